@@ -1,2064 +1,3106 @@
-//================================================================
-//			 Arduino software for Swindon Station Storage Yards
-//================================================================
-// Requires Arduino Mega2560 - on account of needing 3 UARTs
-
-// The layout is controlled by two Arduino Mega2560s - EAST & WEST
-// EAST controls traffic heading towards WEST (down) and storage for traffic from WEST (up)
-// WEST controls traffic heading towards EAST (up) and storage for traffic from EAST (down)
-
-//This version needs TOTI(DCCCHECKTOTI) to be permanently occupied as long as DCC is on
-
-//Put in jumper link J1 on the shield used for West
-//Ground D41 if you want to protect EEPROM from being written with train details
-
-const String swVersion = "3.2.16 01Mar2020";
-
-
-const bool DEBUG = false;
-//Set this true to output everything that goes to the display to the serial port as well
-//Note that in this case, the program will NOT keep time! 
-
-#include <LiquidCrystal.h>
-#include <EEPROM.h>
-#include "WillsIO.h"
-
-
-int testMode = 0;
-int rfidCount = 1;
-
-//State machines
-const int UNOWNED = 0;	//No state machine owns this area
-const int MERGE = 1;
-const int ENTER = 2;
-const int EXIT = 3;
-const int INTERLOPER = 4;	//an interloper has appeared in the protected area
-const int PROTAREATOTI = 12;   //changed from 20
-const int SCISSORSAREATOTI = 14;
-
-const int DCCCHECKTOTI = 24;	//TOTI always occupied to tell whether DCC is on
-const bool DCCCHECKDISABLED = false;	 //true if TOTI24 is not wired 
-
-//assign classes
-IO io(false);			 //input/output space
-Display display;		//LCD display
-Buttons buttons;		//user input
-Beeper beeper;
-State smMerge(MERGE);
-State smEnter(ENTER);
-State smExit(EXIT);
-//We can support up to ten timers
-Timer timer1(1);
-Timer timer2(2);
-Timer timer3(3);
-
-RFID rfid1(1);	//ENTER RFID
-RFID rfid2(2);	//EXIT RFID
-RFID rfid3(3);	//Railcar RFID (not used)
-//EEPROM array for remembering trains
-const unsigned int StoredTrain = 0x020;   //base address for StoredTrain[8] in EEPROM;  xx20...xx27
-
-
-
-const int ledPin = 13;	 // heartbeat
-const int eastPin = 7;	 //Set East or West
-const int writeEnable =	41;	//enable writing to EEPROM
-
-bool lastWriteEnable;
-bool timerFlag;	 //this flag is set by the interrupt routine every 20mS
-int oneSecondCount = 50;
-int STAYINSTATE = 20;	 //seconds allowed in state before deemed as stuck
-bool overRun;		//this flag is set if loop() takes more than 20mS to exectute
-const unsigned int timer1_counter = 64286;	 // preload timer 65536-16MHz/256/50Hz
-
-int testIOAddress = 1;
-bool firstFlag = true;
-unsigned long newTotiValues, oldTotiValues;
-
-int protArea = UNOWNED;		//The protected area of points 19,20,23 may be owned by MERGE or EXIT
-int scissorsArea = UNOWNED;		//The crossover between sidings 1,2 may be owned by ENTER or EXIT
-int lastPA = UNOWNED;		//previous ownership of protArea
-int lastXA = UNOWNED;		//previous ownership of Xover Area
-
-bool despatchMode;	 //if selecting a train to exit
-bool throughMode;	//true if we want an ENTER train to go through
-bool dccOn;				//true if DCC is on
-bool lastDccCheck;	//Previous DCC on/off value
-byte exitTrainId = 0xFF;   //RFID value of train exiting
-
-byte myEnterSiding;
-int exitSiding = -1;	 //current candidate siding for exit queue 0...8
-//this is the value used in the user Destination selection interface
-
-
-byte myExit;	 //what we are actually doing in the Exit state machine
-//EXIT destinations
-//Siding n to MAIN = 0x1n
-//Siding n to GOODS = 0x2n
-//Siding n to BRANCH = 0x4n
-//THROUGH to MAIN = 0x90
-//THROUGH to GOODS = 0xA0
-//THROUGH to BRANCH = 0xC0
-
-byte myExitSiding;	//the siding we're going to get the train from
-byte myExitSiding1; //fixed Siding0 (through) = 15
-byte myDestination;	//where it's going (use EXIT modes coding)
-byte preferredSiding = 0xFF; //where an RFID says this train should go
-byte thisTrainRfid;	//the RFID of the train seen entering the sidings
-
-
-//EXIT destinations
-const byte MAIN = 0x10;
-const byte GOODS = 0x20;
-const byte BRANCH = 0x40;
-const byte THROUGH = 0x80;	//this isn't strictly a destination
-//These values are added to the siding number, to store an exit request in the queue
-
-
-void setup()
-{
-
-	display.init(DEBUG);
-	display.out("Spirit ofSwindon");
-	delay(1000);
-
-//Explicitly initialise variables
-  testMode = 0;
-  rfidCount = 1;
-  oneSecondCount = 50;
-  STAYINSTATE = 20;   //seconds allowed in state before deemed as stuck
-  testIOAddress = 1;
-  firstFlag = true;
-  protArea = UNOWNED;    //The protected area of points 19,20,23 may be owned by MERGE or EXIT
-  scissorsArea = UNOWNED;    //The crossover between sidings 1,2 may be owned by ENTER or EXIT
-  lastPA = UNOWNED;   //previous ownership of protArea
-  lastXA = UNOWNED;   //previous ownership of Xover Area
-  exitSiding = -1;   //current candidate siding for exit queue 0...8
-
-	/*
-	Hardware Timer1 Interrupt
-	Flash LED every second
-	Code from: http://www.hobbytronics.co.uk/arduino-timer-interrupts
-	*/
-
-	pinMode(ledPin, OUTPUT);
-	pinMode(eastPin, INPUT);
-	pinMode(writeEnable, INPUT);
-
-	// initialize timer1 
-	noInterrupts();					 // disable all interrupts
-	TCCR1A = 0;
-	TCCR1B = 0;
-
-	// Set timer1_counter to the correct value for our interrupt interval
-	//timer1_counter = 64886;	 // preload timer 65536-16MHz/256/100Hz
-	//const unsigned int timer1_counter = 64286;	 // preload timer 65536-16MHz/256/50Hz
-	//timer1_counter = 34286;	 // preload timer 65536-16MHz/256/2Hz
-
-	TCNT1 = timer1_counter;	 // preload timer
-	TCCR1B |= (1 << CS12);		// 256 prescaler 
-	TIMSK1 |= (1 << TOIE1);	 // enable timer overflow interrupt
-	timerFlag = false;
-	overRun = false;
-
-	if (DEBUG) {	//time out faster if debugging
-		STAYINSTATE = 10;
-	}
-	else {
-		STAYINSTATE = 30;
-	}
-
-	lastWriteEnable = digitalRead(writeEnable);
-
-	timer1.init(STAYINSTATE);	 //set timer1 to 10secs
-	timer2.init(0);		//disable timer2
-	timer3.init(0);		//disable timer2
-	oneSecondCount = 50;
-	
-	interrupts();						 // enable all interrupts
-
-	rfid1.init();	 //initialise RFIDs
-	rfid2.init();
-	rfid3.init();
-
-
-	//initialise points
-	io.init(false);
-	buttons.init();
-	//initialise state machines
-	smMerge.init(false);
-	smEnter.init(false);
-	smExit.init(false);
-
-	display.out(swVersion);	//this shows that initialisation is complete
-	delay(1000);
-	if (digitalRead(eastPin)) {
-		display.out("East Box");
-	}
-	else {
-		display.out("West Box");
-	}
-	beeper.out(1000);
-	delay(2000);	//wait for beeper to finish, and another second
-
-
-	io.addToQueue(0);		//purge the exit queue 
-	exitSiding = -1;
-
-	dccOn = true;
-	lastDccCheck = true;
-
-	enterRunMode();
-
-}
-
-ISR(TIMER1_OVF_vect)				// interrupt service routine 
-{
-	TCNT1 = timer1_counter;	 // preload timer
-	if (timerFlag == true) {	// loop has taken more than 20mS to execute
-		overRun = true;
-	}
-	timerFlag = true;
-}
-
-void(* resetFunc)(void) = 0;  //declare reset function at address 0
-//from https://www.instructables.com/id/two-ways-to-reset-arduino-in-software/
-
-
-void loop()
-{
-	// come here every 20mS
-	io.updater();
-
-	dccOn = io.testToti(DCCCHECKTOTI);	 //determine whether DCC is on
-
-	overRun = false;
-
-	if (timerFlag){
-		timerFlag = false;
-		if (--oneSecondCount == 0){
-			//come here every second
-			oneSecondCount = 50;	//50Hz
-			digitalWrite(ledPin, digitalRead(ledPin) ^ 1);	 //flash the pulse led
-			//decrement second timers
-			if ((dccOn) || DCCCHECKDISABLED) {	// suspend timers if DCC is off
-				timer1.tick();
-				timer2.tick();
-				timer3.tick();
-			}
-		}
-
-
-		//================================================================
-		//							Here is where all the logic of the program goes
-		//================================================================
-		//We will come here every 20mS
-
-		String myButtons = buttons.poll();
-
-		if (myButtons == "Cancel 1") {
-			byte xExit = io.getFromQueue();	 //remove one from top of queue, whichever mode we're in
-			protArea = UNOWNED;	 //release Protected Area
-			scissorsArea = UNOWNED;	 // release ownership of Siding1/2 crossover
-
-			io.setExitModeDisplay(myExit);	//Exit still active
-			String report = "";
-			if (xExit == 0){
-				display.out("Queue empty!");
-			}
-			else {
-				if ((xExit & MAIN) != 0) report += "M";
-				if ((xExit & GOODS) != 0) report += "G";
-				if ((xExit & BRANCH) != 0) report += "B";
-				report += (String)(xExit & 0x0F);
-				display.out("Cancel exit " + report);
-				smExit.moveToState(0);
-			}
-			enterRunMode();
-		}
-
-
-		if (testMode == 0){	 //Run mode or Despatch mode
-
-			//this is where all the main logic goes
-
-			///////////////////////////////////////////////////////////////
-
-			if (dccOn || DCCCHECKDISABLED) {	 //only update states if DCC is on (otherwise TOTIs will all show CLEAR)
-
-				if (!lastDccCheck) {
-					display.out("DCC restored");
-					beeper.out(500);
-          delay(500);  //give time for TOTIs to register
-					lastDccCheck = true;
-				}
-
-				if (DEBUG){
-					//Show change of ownership of contested areas
-					if ((scissorsArea != lastXA) || (protArea != lastPA)) {
-						display.out("PA=" + (String)protArea + ", XA=" + (String)scissorsArea);
-						lastXA = scissorsArea;
-						lastPA = protArea;
-					}
-				}
-
-				updateMerge(); // Merge State Machine
-				//The Merge State Machine owns the following points:	20,21.
-				//It -may- have the right to control points 19,23 - if it owns the protected area (protArea == MERGE)
-				//It controls Stop Relays 25,26,27.
-				//It considers the TOTI values of 11,20,21,22,23.
-
-				updateEnter(); // Enter State Machine
-				//The Enter State Machine owns the following points:	1,3,4,5,6,7,8.
-				//It -may- have the right to control point 2 - if it owns the crossover (scissorsArea == ENTER)
-				//It controls Stop Relay 28.
-				//It considers the TOTI values of 1,2,3,4,5,6,7,8,9,11A.
-
-				updateExit(); // Exit State Machine
-				// The user interface buttons only have any effect in Exit, 
-				// to select which train should exit the storage yards.
-
-				//The Exit State Machine owns the following points:	9,10,11,12,13,14,15,16,17,18,19.
-				//It -may- have the right to control point 2 - if it owns the crossover (scissorsArea == ENTER)
-				//It controls Stop Relay 28.
-				//It considers the TOTI values of 1,2,3,4,5,6,7,8,9,11A.
-
-				//Check if we've seen an RFID
-				String exitRfid;
-				if ((exitRfid = rfid2.poll()) != "") {
-					//If we see an Exit RFID, save the lsb of the train ID in EEPROM for the siding we've just exited
-					exitTrainId = hexStrToByte(exitRfid);
-					if ((myExitSiding > 0) && (myExitSiding < 9)) {
-						//write the last two characters of the string
-						if (digitalRead(writeEnable)) {   //this has become the Write-protect switch
-							EEPROM.write(StoredTrain + myExitSiding - 1, exitTrainId);
-						}
-					}
-					if (!despatchMode) {
-					  reportStates(!digitalRead(writeEnable));
-					}
-				}
-				String enterRfid;
-				if ((enterRfid = rfid1.poll()) != "") {
-					//If we see an Enter RFID, look up the EEPROM array to see if we know a siding for it
-					byte searchForTrain;
-					thisTrainRfid = hexStrToByte(enterRfid);
-					preferredSiding = 0xfe;  //If we don't recognise the train, =0xfe (0xff is used for nothing heard)
-					for (searchForTrain = 0; searchForTrain < 8; searchForTrain++) {
-						if (EEPROM.read(StoredTrain + searchForTrain) == thisTrainRfid){
-							preferredSiding = searchForTrain + 1;
-						}
-					}
-				}
-
-			}
-			else {
-				if (!dccOn	&& !DCCCHECKDISABLED && lastDccCheck) {	//DCC just failed
-					display.out("No DCC!");
-					lastDccCheck = false;
-				}
-			}
-
-			if (myButtons != ""){
-
-				if (myButtons == "Test 1"){
-					testMode = 3;
-					display.init(DEBUG);  //just in case display has got screwed
-					display.out("Test mode");
-					io.addToQueue(0);		//purge the exit queue when entering Test
-					exitSiding = -1;
-					beeper.out(500);
-				}
-
-				//Despatch mode
-				if (despatchMode) {	 //we are already in despatch mode
-
-					if (myButtons == "Through 0") {
-						//Cancel Despatch mode
-						io.setExitModeDisplay(myExit);	//just update from queue
-						enterRunMode();
-
-					}
-
-					if (exitSiding != -1) { //there is something to queue
-						if (myButtons == "Down 0") {
-
-							exitSiding = findNextSiding(exitSiding, false);
-						}
-						if (myButtons == "Up 0") {
-							exitSiding = findNextSiding(exitSiding, true);
-						}
-						if (myButtons == "Main 0"){
-							byte myMain = (MAIN | exitSiding);
-							if (exitSiding == 0) {
-								myMain = myMain | THROUGH;
-							}
-							if (io.addToQueue(myMain)) {
-								io.setExitModeDisplay(myExit);	//just update from queue
-								display.out(sidingString(exitSiding) + "->Main");
-							}
-							else {
-								display.out("Queue full!");
-							}
-							enterRunMode();
-						}
-						if (myButtons == "Goods 0"){
-							byte myGoods = (GOODS | exitSiding);
-							if (exitSiding == 0) {
-								myGoods = myGoods | THROUGH;
-							}
-							if (io.addToQueue(myGoods)) {
-								io.setExitModeDisplay(myExit);	//just update from queue
-								display.out(sidingString(exitSiding) + "->Goods");
-							}
-							else {
-								display.out("Queue full!");
-							}
-							enterRunMode();
-						}
-						if ((myButtons == "Branch 0") && !digitalRead(eastPin)){
-							byte myBranch = (BRANCH | exitSiding);
-							if (exitSiding == 0) {
-								myBranch = myBranch | THROUGH;
-							}
-							if (io.addToQueue(myBranch)) {
-								io.setExitModeDisplay(myExit);	//just update from queue
-								display.out(sidingString(exitSiding) + "->Branch");
-							}
-							else {
-								display.out("Queue full!");
-							}
-							enterRunMode();
-						}
-
-					}	//else ignore button, because there is no train to queue
-				}
-
-				//Run mode
-				else { //we are in Run mode, not Despatch
-
-					if (myButtons == "Through 0") {	 //select despatch mode
-						despatchMode = true;
-						display.out("Select exit");
-						exitSiding = 8;  //to roll round to zero
-						exitSiding = findNextSiding(exitSiding, true);
-						if (exitSiding == -1){
-							display.out("No train!");
-						}
-					}
-
-					if (myButtons == "Cancel 1") {  //abandon all despatches
-						display.out("Cancel exit");
-						exitSiding = -1;
-						smExit.init(true);
-					}
-
-
-					// do other run mode button actions here...
-
-				}
-			}
-		}	 //end Run or Despatch
-
-		else {			// we are in a test mode
-
-			//whichever test mode we're in, simultaneous up and down will get us out
-			if (myButtons == "Test 1"){
-				enterRunMode();
-			}
-			else {
-
-				String rfidString;	//for some reason, these can't be declared within the case
-				String testString;
-
-				switch (testMode) {
-
-					/*			case 1:		// we are waiting to select a test mode
-								  if (myButtons == "Main 1"){
-								  testMode = 3;
-								  display.out("Test I/O");
-								  }
-								  break;
-								  */
-
-				case 3:		//test I/O
-
-					//Do user-driven points
-					if (myButtons == "Up 1") {
-						if (testIOAddress++ == 35) testIOAddress = 1;
-					}
-					if (myButtons == "Down 1") {
-						if (testIOAddress-- == 1) testIOAddress = 35;
-					}
-
-					if (myButtons == "Through 1") {	 // toggle the point
-						if (testIOAddress <= 29) {
-							if (io.getPoint(testIOAddress)) {
-								io.setPoint(testIOAddress, false);
-								display.out("Point " + (String)(testIOAddress)+" clear");
-							}
-							else {
-								io.setPoint(testIOAddress, true);
-								display.out("Point " + (String)(testIOAddress)+" set");
-							}
-						}
-						else {
-							if (testIOAddress >= 32) {	//32..35	translate to D26..D29
-								digitalWrite(testIOAddress - 6, !digitalRead(testIOAddress - 6));
-							}
-						}
-					}
-
-					if ((myButtons == "Up 1") || (myButtons == "Down 1") || (myButtons == "Through 1")) {
-						testString = (String)(testIOAddress);
-						if (testString.length() == 1) {	 //format = ##
-							testString = "0" + testString;
-						}
-						testString = "Point/Toti" + testString;
-						if (testIOAddress <= 29) {	//29 is the last point in use
-							if (io.getPoint(testIOAddress)) {
-								testString += "P1";
-							}
-							else {
-								testString += "P0";
-							}
-						}
-						else if (testIOAddress < 32) {
-							testString += "--";
-						}
-						else {	//LEDs
-							if (digitalRead(testIOAddress - 6)) {
-								testString += "L1";
-							}
-							else {
-								testString += "L0";
-							}
-						}
-						// now add TOTI state
-						if (testIOAddress <= 24){	//last TOTI in use is 24
-
-							if (io.testToti(testIOAddress)) {
-								testString += "T1";
-							}
-							else {
-								testString += "T0";
-							}
-						}
-						else {
-							testString += "--";
-						}
-
-						display.out(testString);
-					}
-
-
-					if (myButtons == "Goods 1"){
-						testMode = 5;
-						display.out("Clear States");
-					}
-
-					//Report any changes to TOTIs
-					for (byte totiCount = 0; totiCount < 32; totiCount++) {			//for each TOTI
-						bool thisToti = io.testToti(totiCount + 1);
-						bitWrite(newTotiValues, totiCount, thisToti);		//build new TOTI value
-						if (firstFlag) {		//if this is the first time, make old the same
-							bitWrite(oldTotiValues, totiCount, thisToti);
-						}
-						if (thisToti && !bitRead(oldTotiValues, totiCount)) {
-							bitWrite(oldTotiValues, totiCount, thisToti);
-							display.out("TOTI[" + (String)(totiCount + 1) + "] in use");
-							beeper.out(500);
-						}
-						if (!thisToti && bitRead(oldTotiValues, totiCount)) {
-							bitWrite(oldTotiValues, totiCount, thisToti);
-							display.out("TOTI[" + (String)(totiCount + 1) + "] clear");
-							beeper.out(500);
-						}
-					}
-					firstFlag = false;
-
-					if (lastWriteEnable != digitalRead(writeEnable)) {
-						if (digitalRead(writeEnable)) {
-							display.out("Read/Write");
-						}
-						else {
-							display.out("Write-Protect");
-						}
-						lastWriteEnable = digitalRead(writeEnable);
-					}
-
-					//Report any inputs on RFID readers
-					switch (rfidCount) {
-					case 1:
-						rfidString = rfid1.poll();
-						break;
-					case 2:
-						rfidString = rfid2.poll();
-						break;
-					case 3:
-						rfidString = rfid3.poll();
-						break;
-					default:
-						break;
-					}
-
-					if (rfidString != ""){
-						display.out("[" + (String)(rfidCount)+"]=" + rfidString);
-						beeper.out(500);
-					}
-					if (rfidCount++ == 3) rfidCount = 1;
-
-					break;
-
-				case 5:	 //clear state machines, but do not forget train/siding assignments
-					beeper.out(500);
-					smMerge.init(true);
-					smEnter.init(true);
-					smExit.init(true);
-					protArea = UNOWNED;  //release Protected Area
-					scissorsArea = UNOWNED;   // release ownership of Siding1/2 crossover
-//			          io.addToQueue(0);		//already done on entry to Test Mode
-					display.init(DEBUG);
-					display.out("States cleared");
-					delay(1000);
-					beeper.out(500);
-					testMode = 3;
-					break;
-
-				default:
-					beeper.out(2);
-					break;
-				}
-
-			}
-			//================================================================
-			//							End the logic of the program
-			//================================================================
-
-		}
-
-		if (overRun == true){
-			overRun = false;
-			//		beeper.out(2);	 //click if we've taken too long and missed a 20mS tick
-		}
-
-	}
-
-}		//end of the loop
-
-
-
-//================================================================
-//							Update the MERGE State Machine
-//================================================================
-
-// The MERGE State Machine is controlled by TOTIs 11, 18-22.
-// It drives points 20,21,22,23 and controls the entry of trains into the MERGE
-// section using Stop Sections 25,26,27
-// If merging from Branch, it takes ownership of the Protected Area, and in doing this, it may
-//	 cause the EXIT State Machine to have to wait to despatch a train.
-
-
-void updateMerge() {
-
-	String interloper;
-
-	byte state = smMerge.fetch();
-
-	bool entryFlag = false;
-	byte stripState = state & 0x7F;
-
-	if (state <128) { //first time in this state
-		entryFlag = true;
-		smMerge.moveToState(state);	 //set the msb
-		if (despatchMode == false) {   //suppress reporting if we're despatching
-      reportStates(false);
-		}
-	}
-
-	switch (stripState) {
-
-	case 0 :	//IDLE
-
-		if (entryFlag) {	//entering state for the first time
-			io.setPoint(21, false);	 // clear point
-			io.setPoint(23, false);	 // clear point
-			io.setPoint(25, false);	 // Stop Goods
-			io.setPoint(26, false);	 // Stop Main
-			io.setPoint(27, false);	 // Stop Branch
-			if (protArea == MERGE) {
-				protArea = UNOWNED;
-			}
-		}
-
-		if (io.testToti(11) || (io.testToti(12) && (protArea != EXIT)) || io.testToti(20)) {	//something has appeared unexpectedly
-			interloper = "T";
-			if (io.testToti(11)) {
-				interloper += "11";
-			}
-			if (io.testToti(12)) {
-				interloper += "12";
-			}
-			if (io.testToti(20)) {
-				interloper += "20";
-			}
-			display.out(interloper + " Interloper!");
-			smMerge.moveToState(10);    //Exception
-
-		} else {
-
-			if (io.testToti(21))  {
-				//A train has appeared on the Main arriving TOTI
-				smMerge.moveToState(1);		 //Main waiting
-				break;
-			}
-			if (io.testToti(22))  {
-				//A train has appeared on the Goods arriving TOTI
-				smMerge.moveToState(11);		 //Goods waiting 
-				break;
-			}
-			if ((io.testToti(23)) && (protArea == UNOWNED)) {
-				//A train has appeared on the Branch arriving TOTI
-				smMerge.moveToState(21);		 //Branch waiting 
-				break;
-			}
-		}
-		break;
-
-    //****************** EXCEPTION STATE *************************
-    
-  case 10:  //Something has appeared unexpectededly
-
-    if (!io.testToti(11) && !io.testToti(12) && !io.testToti(20)){ //the problem has gone
-		smMerge.moveToState(0);
-    }
-    break;
-
-		//****************** MAIN STATES *************************
-
-	case 1:	 //Main waiting
-		if (entryFlag){
-			timer1.init(STAYINSTATE);
-		}
-
-		if (!io.testToti(20) && !io.testToti(11)) {	 
-			//The way is clear
-//		io.setPoint(20, false);	// No crossover (doesn't exist any more_
-			io.setPoint(21, false);	// Set Goods/Main point to Main
-			io.setPoint(23, false);	// Set Branch/Main to Main
-			io.setPoint(25, false);	 // Stop Goods (Stop25)
-			io.setPoint(27, false);	 // Stop Branch (Stop27)
-			io.setPoint(26, true);	 // Allow Main to go (Stop26)
-			smMerge.moveToState(2);		//Main can go
-			break;
-		}
-
-		if (io.testToti(11) || io.testToti(20)){	//Leave Interloper to be handled by main loop
-			smMerge.moveToState(0);
-			break;
-		}
-
-
-	case 2:	//We have committed to allow Main to go, TOTI21 moving into TOTI20 (TOTI11 if EAST)
-		//Give MAIN 20s to move - otherwise if someone else is waiting, it loses its turn
-	 
-		if (entryFlag){
-			timer1.init(STAYINSTATE);
-		}
-	 
-		if (io.testToti(20) == true) {	
-			//watch for train moving into T20
-			smMerge.moveToState(4);	//Main going
-			break;
-		}
-
-		if (io.testToti(11)){ //Leave Interloper to be handled by main loop
-			smMerge.moveToState(0);
-			break;
-		}
-    
-		if (io.testToti(21) == false) {	//Main disappeared without moving into T11/T20
-			display.out("Main vanished!");
-			io.setPoint(26, false);	 // Clear the signal (Stop26)
-			smMerge.moveToState(0);
-			break;
-		}
-
-		if (timer1.expired() == true) {
-			display.out("Main stuck T21!");
-			if (io.testToti(22) == true){	//Goods is waiting
-				io.setPoint(26, false);	//Main can no longer go
-				smMerge.moveToState(11);	//go to Goods waiting
-				break;
-			}
-			if (io.testToti(23) == true){	//Branch is waiting
-				io.setPoint(26, false);	//Main can no longer go
-				smMerge.moveToState(21);	//go to Branch waiting
-				break;
-			}
-     
-			timer1.init(STAYINSTATE); //no-one else waiting, so go round again
-		}
-
-		break;
-
-	case 4:	//Train moving, now front is in TOTI20 - only in WEST
-		if (entryFlag){	
-			timer1.init(STAYINSTATE);
-		}
-		if (io.testToti(11) == true){
-			smMerge.moveToState(5);	//Merge from protected
-			break;
-		}
-		if (io.testToti(20) == false){	
-			//if T20 clear without going into T11, we must be backing out...
-			smMerge.moveToState(0);
-			break;
-		}
-		if (timer1.expired() == true) {
-			display.out("Merge stuck T20!");
-			timer1.init(STAYINSTATE);
-		}
-		break;
-
-	case 5:	//Merge from protected, now front is in TOTI11
-		//May be held here by other end's ENTER State Machine at STOP28
-		// Stay here until TOTI11 are clear
-		//Exceptional cases (eg TOTI20 not clear) will be handled in main loop
-		if (entryFlag){
-			io.setPoint(26, false);  // Clear the signal (Stop26)
-		}
-
-		if (!io.testToti(20)) { //no need to wait for T11 to be clear to allow exiting trains
-			if (protArea == MERGE) {
-				protArea = UNOWNED;
-			}
-		}
-   
-		if (io.testToti(11) == false)	{
-			smMerge.moveToState(0);	//All done
-		}
-		break;
-
-
-		//****************** GOODS STATES *************************
-
-	
-	case 11:	 //Goods waiting
-		if (entryFlag){
-			timer1.init(STAYINSTATE);
-		}
-
-		if (!io.testToti(20) && !io.testToti(11)) {    //The way is clear
-			io.setPoint(21, true);	// Set Goods/Main point to Goods
-			io.setPoint(23, false);	// Set Branch/Main to Main
-			io.setPoint(26, false);	 // Stop Main (Stop26)
-			io.setPoint(27, false);	 // Stop Branch (Stop27)
-			io.setPoint(25, true);	 // Allow Goods to go (Stop25)
-			smMerge.moveToState(12);		//Goods can go
-			break;
-		}
-
-		if (io.testToti(11) == true){	//Leave Interloper to be handled by main loop
-			smMerge.moveToState(0);
-			break;
-		}
-
-		if (io.testToti(22) == false){
-			display.out("Goods vanished!");
-			smMerge.moveToState(0);
-			break;
-		}
-		if (timer1.expired() == true) {
-			display.out("Goods held! M11");
-			timer1.init(STAYINSTATE);
-		}
-		break;
-
-	case 12:	//We have committed to allow Goods to go, TOTI22 moving into TOTI20 (TOTI11 if EAST)
-		//Give GOODS 20s to move - otherwise if someone else is waiting, it loses its turn
-
-		if (entryFlag){
-			timer1.init(STAYINSTATE);
-		}
-
-    if (io.testToti(11)){ //Leave Interloper to be handled by main loop
-      smMerge.moveToState(0);
-      break;
-    }
- 
- 		if (io.testToti(20) == true) {	
-			//watch for train moving into T20
-			smMerge.moveToState(14);	//Goods going
-			break;
-		}
-
-		if (io.testToti(22) == false) {	//Goods disappeared without moving into T11/T20
-			display.out("Goods vanished!");
-			io.setPoint(25, false);	 // Clear the signal (Stop25)
-			smMerge.moveToState(0);
-			break;
-		}
-		if (timer1.expired() == true) {
-			display.out("Goods stuck T22!");
-			if (io.testToti(21) == true){	//Main is waiting
-				io.setPoint(25, false);	//Goods can no longer go
-				smMerge.moveToState(1);	//go to Main waiting
-				break;
-			}
-			if (io.testToti(21) == true){	//Main is waiting
-				io.setPoint(25, false);	//Goods can no longer go
-				smMerge.moveToState(1);	//go to Main waiting
-				break;
-			}
-			if (io.testToti(23) == true){	//Branch is waiting
-				io.setPoint(25, false);	//Goods can no longer go
-				smMerge.moveToState(21);	//go to Branch waiting
-				break;
-			}
-			if (protArea == MERGE) {
-				protArea = UNOWNED;  //Give EXIT a chance
-			}
-			timer1.init(STAYINSTATE); //no-one else waiting, so go round again
-		}
-		break;
-
-	case 14:	//Train moving, now front is in TOTI20 - only in WEST
-		if (entryFlag){	
-			timer1.init(STAYINSTATE);
-		}
-		if (io.testToti(11) == true){
-			smMerge.moveToState(15);	//Merge from protected
-			break;
-		}
-		if (io.testToti(20) == false){	
-			//if T20 clear without going into T11, we must be backing out...
-			smMerge.moveToState(0);
-			break;
-		}
-		if (timer1.expired() == true) {
-			display.out("Merge stuck T20!");
-			timer1.init(STAYINSTATE);
-		}
-		break;
-
-	case 15:	//Merge from protected, now front is in TOTI11
-		//May be held here by other end's ENTER State Machine at STOP28
-		// Stay here until TOTI11 are clear
-		if (entryFlag){
-      io.setPoint(25, false);  // Clear the signal (Stop25)
-		}
-   
- 		if (io.testToti(11) == false)	{
-			smMerge.moveToState(0);	//All done
-		}
-		break;
-
-
-		//****************** BRANCH STATES *************************
-
-		//Although there is no BRANCH for the EAST controller, all the logic is here,
-		//	so that the code remains identical to MAIN and GOODS
-
-	case 21:	 //Branch waiting
-		if (entryFlag){
-			timer1.init(STAYINSTATE);
-		}
-
-		if (!io.testToti(PROTAREATOTI) && (protArea != EXIT) && !io.testToti(20) && !io.testToti(11)) {	 
-			//The way is clear
-			if (!digitalRead(eastPin)) {
-				protArea = MERGE;	 //no need to take ownership if EAST
-			}
-//		io.setPoint(20, false);	// No crossover
-			io.setPoint(21, false);	// Set Goods/Main point to Main
-			io.setPoint(23, true);	// Set Branch/Main to Branch
-			io.setPoint(25, false);	 // Stop Goods (Stop25)
-			io.setPoint(26, false);	 // Stop Main (Stop26)
-			io.setPoint(27, true);	 // Allow Branch to go (Stop27)
-			smMerge.moveToState(22);		//Branch can go
-			break;
-		}
-
-		if (io.testToti(23) == false){
-			display.out("Branch vanished!");
-			smMerge.moveToState(0);
-			break;
-		}
-		if (timer1.expired() == true) {
-			display.out("Branch held! M21");
-			timer1.init(STAYINSTATE);
-		}
-		break;
-
-	case 22:	//We have committed to allow Branch to go, TOTI23 moving into xover and TOTI20
-		//Give BRANCH 20s to move - otherwise if someone else is waiting, it loses its turn
-	 
-		if (entryFlag){
-			timer1.init(STAYINSTATE);
-		}
-	 
-    if (io.testToti(PROTAREATOTI) ) { 
-			//watch for train moving into crossover
-			smMerge.moveToState(24);	//Branch going
-			break;
-		}
-
-		if (io.testToti(23) == false) {	//Branch disappeared without moving into T11/T12/T20
-			display.out("Branch vanished!");
-			io.setPoint(27, false);	 // Clear the signal (Stop27)
-			smMerge.moveToState(0);
-			break;
-		}
-		if (timer1.expired() == true) {
-			display.out("Branch stuck T23!");
-			if (io.testToti(21) == true){	//Main is waiting
-				io.setPoint(27, false);	//Branch can no longer go
-				protArea = UNOWNED;  //Give EXIT a chance
-				smMerge.moveToState(1);	//go to Main waiting
-				break;
-			}
-			if (io.testToti(22) == true){	//Goods is waiting
-				io.setPoint(27, false);	//Branch can no longer go
-				protArea = UNOWNED;  //Give EXIT a chance
-				smMerge.moveToState(11);	//go to Goods waiting
-				break;
-			}
-     
-			timer1.init(STAYINSTATE); //no-one else waiting, so go round again
-		}
-
-		break;
-
-	case 24:	//Train moving, now front is in TOTI12 xover - only in WEST
-		if (entryFlag){	
-			timer1.init(STAYINSTATE);
-		}
-		if (io.testToti(20) == true){
-			smMerge.moveToState(25);	//Merge from protected
-			break;
-		}
-		if (!io.testToti(PROTAREATOTI)){	
-			//if xover clear without going into T20, we must be backing out...
-			smMerge.moveToState(0);
-			break;
-		}
-		if (timer1.expired() == true) {
-			display.out("Merge stuck T20!");
-			timer1.init(STAYINSTATE);
-		}
-		break;
-
-	case 25:	//Merge from protected, now front is in TOTI20
-		if (entryFlag){
-      io.setPoint(27, false);  // Clear the signal (Stop27)
-		}
-		if (!io.testToti(20) && !io.testToti(PROTAREATOTI))	{
-			smMerge.moveToState(0);	//All done
-		}
-    if (io.testToti(11)) {
-      smMerge.moveToState(26); //Front moving into T11
-    }
-		break;
-
-  case 26:  //Merge from protected, now front is in TOTI11
-    //May be held here indefinitely by other end's ENTER State Machine at STOP28
-    // Stay here until TOTI12, TOTI20 and TOTI11 are clear
-    if (entryFlag){
-    }
-    if (!io.testToti(12) && !io.testToti(20)) {
-      if (protArea == MERGE) {    //allow exiting trains as soon as T12, T20 clear
-        protArea = UNOWNED;
-		io.setPoint(23, false);	//Clear crossover
-	  }
-      if (!io.testToti(11)) {
-        smMerge.moveToState(0); //All done
-      }
-    }
-    break;
-    
-  default:
-    display.out("M-state" + (String)(stripState)+"?!");
-    smMerge.moveToState(0); //Illegal state!
-    break;
-  }
-    
-}
-
-
-
-//================================================================
-//							Update the ENTER State Machine
-//================================================================
-
-
-//The ENTER State Machine is controlled by TOTI13, TOTI9 and the TOTIs for each of the
-// eight sidings.	The outputs are the siding point settings and STOP Section 28.
-//	The ENTER State Machine may also need to take over the Scissor Point scissorsArea
-//		in order to put a train into Siding 2.
-
-/*If the EXIT state machine sees T9 occupied and myEnterSiding ==0
-then it knows there's a through train that wants out */
-
-void updateEnter() {
-
-	byte state = smEnter.fetch();
-
-	byte stripState = state & 0x7F;
-	bool entryFlag = false;
-
-	if (state <128) { //first time in this state
-		entryFlag = true;
-		smEnter.moveToState(state);	 //set the msb
-		if (despatchMode == false) {	//suppress state reporting if we're despatching
-			reportStates(false);
-		}
-	}
-
-
-	switch (stripState) {
-
-	case 0:	//IDLE
-		if (entryFlag) {	//entering state for the first time
-			io.setPoint(28, false);	//stop ENTER train until there is a plan
-			if ((io.testToti(9) == false) && (io.testToti(13) == false)) {	// T9 and T13 clear, so reset siding points
-				io.setPoint(0, true);	//clear siding points
-				if (scissorsArea == ENTER) {
-					scissorsArea = UNOWNED;
-				}
-			}
-		}
-
-		//We move off IDLE if we see anything in T9 or T13
-		if (io.testToti(9)) {	
-			smEnter.moveToState(10);	//Entry congested - abnormal, so we need to hold train at Stop 28
-			//Only legitimate entry is via occupied T13
-			break;
-		}
-		if (io.testToti(13)) {	//A train has arrived
-			smEnter.moveToState(1);	 //train waiting
-		}
-		break;
-
-
-	case 1:	//Train in T13, T9 free
-    //wait for RFID to be heard - if no RFID, stop at Stop 28
-		if (entryFlag){
-			timer2.init(STAYINSTATE);
-		}
-
-		if (preferredSiding != 0xFF) {    //we've heard an RFID
-			myEnterSiding = 0;    //default to THROUGH
-			if (preferredSiding == 0xfe) {	//but the RFID wasn't recognised
-				display.out("New RFID->THRU!");
-			}
-			else {	//we have a valid preferred siding
-				if (myExitSiding == 0) {	//THROUGH is the ACTIVE despatch, so ignore preferred
-					display.out("Queued THROUGH");
-				}
-				else {
-					if (io.testToti(preferredSiding) ) {   //already occupied
-						display.out("S" + (String)(preferredSiding) + " is full!");
-					} else {	//everyting checks out OK
-						myEnterSiding = preferredSiding;
-						display.out(trainIdToString(thisTrainRfid) + " to S" + (String)(myEnterSiding));
-					}
-				}
-			}
-			preferredSiding = 0xFF;  //only use once
-			smEnter.moveToState(11);  //now we know which siding (myEnterSiding)
-			break;
-		}
-
-		if (!io.testToti(13)) {	//we never heard from the RFID
-			io.setPoint(28, false);	//clear everything
-			display.out("E vanished(E1)!");
-			smEnter.moveToState(0);  //Entering train disappeared!
-			break;
-		}
-
-		if (timer2.expired() == true) {	//we've waited at Stop 28, but no RFID has been heard, so send through
-			display.out("No RFID heard");
-			display.out("so go THROUGH!");
-			myEnterSiding = 0;    //default to THROUGH
-			smEnter.moveToState(11);  //now we know which train it is
-		}
-		break;
-
-	case 11: //Train in T13, T9 free, train known
-		//we may have to wait for train exiting from Siding 1
-		//...but if not, we'll go straight to state 12
-		if (entryFlag){
-			timer2.init(STAYINSTATE);
-		}
-
-		if ((scissorsArea != EXIT) || (myEnterSiding != 0 && myEnterSiding != 2)) {
-			//then we can go into the siding
-			if (myEnterSiding == 0 || myEnterSiding == 2){
-				scissorsArea = ENTER; //claim scissors area if necessary
-			}
-			io.setPoint(28, true);   //let the train go
-			setEnterSiding(myEnterSiding);  //set the points
-			smEnter.moveToState(12);  //train can go to siding
-			break;
-		}
-
-		if (!io.testToti(13)) {
-			io.setPoint(28, false);	//clear everything
-			display.out("E vanished(E11)!");
-			smEnter.moveToState(0);  //Entering train disappeared!
-			break;
-		}
-
-		if (timer2.expired() == true) {
-			display.out("Access blocked!");	//We have spent too long in TOTI13
-			timer2.init(STAYINSTATE);
-		}
-
-		break;
-
-  case 12:  //Train can go into siding, so expecting T9 (or myEnterSiding == 8 && T8)
-  
-    if (entryFlag){
-      timer2.init(STAYINSTATE);
-    }
-
-    if (io.testToti(9) || ((myEnterSiding == 8) && io.testToti(8))) {  
-      //allow entry to Siding 8 without going into T9 first
-      smEnter.moveToState(2);  //train moving to selected siding or THROUGH
-      break;
-    }
-    
-    if (!io.testToti(13)) {
-      io.setPoint(28, false); //clear everything
-      display.out("E vanished(E12)!");
-      smEnter.moveToState(0);  //Entering train disappeared!
-      break;
-    }
-
-    if (timer2.expired() == true) {
-      display.out("Stuck to S" + (String)(myEnterSiding) + "E12!"); //We have spent too long in TOTI13
-      timer2.init(STAYINSTATE);
-      break;
-   }
-
-   break;
-
-	case 2: //Train going into siding, or going THROUGH, T9+T13 occupied
-		if (entryFlag) {
-			timer2.init(STAYINSTATE);
-			io.setPoint(28, false);	//stop subsequent trains
-		}
-		if (io.testToti(myEnterSiding) || (io.testToti(SCISSORSAREATOTI) && (scissorsArea == ENTER))){
-			smEnter.moveToState(3);	//front is in siding
-			break;
-		}
-
-		if (timer2.expired() == true) {
-			if (!io.testToti(9) && !io.testToti(SCISSORSAREATOTI)) {
-				display.out("E vanished(E2)!");
-				smEnter.moveToState(0);  //Entering train disappeared!
-				break;
-			}
-			else {
-				display.out("E Stuck(T9+13)!");	//We have spent too long in TOTI9+TOTI13, 
-				timer2.init(STAYINSTATE);			// but keep trying
-			}
-		}
-		break;
-
-	case 3: //Train going into siding, T9 occupied
-		if (entryFlag) {
-			timer2.init(STAYINSTATE);
-		}
-		if (!io.testToti(9) && (!io.testToti(SCISSORSAREATOTI) || (scissorsArea == EXIT))){  //train cleared TOTI9, or if entering Siding 2,T14 clear too
-      //may need to wait for train to complete entering Siding 2
-			smEnter.moveToState(0);		//All done
-			break;
-		}
-		if (timer2.expired() == true) {
-			io.setPoint(28, false);	//stop subsequent trains
-			if ((myEnterSiding == 0) && !io.getPoint(29)) {
-				//suppress message if THROUGH is good to go, as it's then an EXIT problem
-				display.out("Through waiting!");	//We have spent too long in TOTI9 
-			}
-			else {
-				display.out("E Stuck(T9)!");	//We have spent too long in TOTI9 
-			}
-			timer2.init(STAYINSTATE);			// but keep trying
-		}
-		break;
-
-		//Exception states
-
-	case 10:	//Something is sitting at the entrance to the sidings (T9)
-		if (entryFlag){
-			display.out("E10T9interloper!");
-			io.setPoint(28, false);	 //Hold train indefinitely
-			break;
-		}
-		if (io.testToti(9) == false){	//the problem has gone
-			smEnter.moveToState(0);
-		}
-		break;
-
-
-	default:
-		display.out("E-state" + (String)(stripState)+"?!");
-		smEnter.moveToState(0);  
-		break;			//unrecognised state
-	}
-
-}
-
-
-
-//================================================================
-//							Update the EXIT State Machine
-//================================================================
-
-//This pulls a despatch request from the queue and implements it, provided the exit is free
-//It needs TOTI10 free if Siding 2...8
-//It needs TOTI14 free, and scissorsArea != ENTER if Siding 1
-//It needs TOTI12 (Protected Area, WEST only) free if the destination is Main or Goods
-//It needs the destination free (MAIN=T19, GODDS=T18, BRANCH=T17)
-
-bool exitAvailable = true;
-
-
-void updateExit() {
-
-	byte state = smExit.fetch();
-
-	bool entryFlag = false;
-	byte stripState = state & 0x7F;
-
-	if (state < 128) { //first time in this state
-		entryFlag = true;
-		smExit.moveToState(state);	 //set the msb
-		if (despatchMode == false) {  //suppress reporting if we're despatching
-			reportStates(false);
-		}
-	}
-
-
-	switch (stripState) {
-
-	case 0:	//IDLE
-		if (entryFlag) {	//entering state for the first time
-
-			if (io.testToti(10) || ((io.testToti(PROTAREATOTI)) && protArea == EXIT)) {
-				//don't clear points if there's a train on them
-				smExit.moveToState(10);  //Exit congested
-				break;
-			}
-			else {
-				io.clearActiveExit();	//forget what we were just doing
-				exitSidingPoints(0);	//clear all exit points
-				io.setExitModeDisplay(0);	//stop current flashing indication
-				io.setPoint(22, false);	//default to MAIN
-				io.setPoint(24, false);	//default to Goods/Main
-				myExitSiding = 0xff;	//nothing active from the queue
-
-				if (protArea == EXIT) {
-					protArea = UNOWNED;
-				}
-
-				if (scissorsArea == EXIT) {
-					scissorsArea = UNOWNED;
-				}
-			}
- 		}
-
-
-
-		if (io.queueNotEmpty()) {	//we have something to do
-			myExit = io.getFromQueue();	//this is what we're going to do next
-			myExitSiding = myExit & 0x0F;		 //lsn
-			exitTrainId = EEPROM.read(StoredTrain + myExitSiding - 1);	//just for info message
-			myDestination = myExit & 0x70;		//msn, strip THROUGH flag
-			myExitSiding1 = myExitSiding;
-			if (myExitSiding1 == 0 ){
-				myExitSiding1 = 15;  //we don't want to reset everything for a through train      
-			}
-			//If it's not a Through train, and the siding is now empty, we've lost the train somehow
-			if (myExitSiding != 0) {
-				if (!io.testToti(myExitSiding))  {
-					display.out("No S" + (String)(myExitSiding)+" to send!");
-					smExit.moveToState(10);
-					break; //we've lost our train!
-				}
-			}
-			switch (myDestination) {	
-			case MAIN:
-				smExit.moveToState(2);
-				break;
-			case GOODS:
-				smExit.moveToState(12);
-				break;
-			case BRANCH:
-				smExit.moveToState(22);
-				break;
-			default:
-				display.out("Unknown Exit!");
-				break;
-			}
-		}
-		else {	//nothing in the queue
-			myExit = 0;
-			exitTrainId = 0;
-			}
-			break;
-		
-	case 10:	//exit congested, or other exceptional state
-		if (entryFlag) {
-			timer3.init(STAYINSTATE);
-			io.setExitModeDisplay(0);	//stop flashing
-		}
-
-		if (!io.testToti(10) && !io.testToti(PROTAREATOTI)  
-		    && (!io.testToti(14) || (scissorsArea != EXIT))) {	//train cleared
-			//we are all clear, so back to IDLE
-			myExit = myExitSiding = myExitSiding1 = myDestination = 0;
-			smExit.moveToState(0);
-			break;
-		}
-
-		if (timer3.expired() == true) {
-			String xMsg = "X10 block@T";   //send a message that shows the cause of the blockage
-			if (io.testToti(SCISSORSAREATOTI) && (myExitSiding < 2)) xMsg = xMsg + "14;";
-			if (io.testToti(10)) xMsg = xMsg + "10;";
-			if (io.testToti(PROTAREATOTI)) xMsg = xMsg + "12";
-			display.out(xMsg + "!");
-			timer3.init(STAYINSTATE);
-		}
-
-		break;
-
-//	******	States EXITing to MAIN ******	
-
-	case 2:	//hoping to exit to MAIN
-		//here we want to test whether the MAIN onto the display layout is free
-		if (entryFlag) {
-			timer3.init(STAYINSTATE);	 //wait for route to display layout to become free
-		}
-
-		if ((myExitSiding != 0) && (io.testToti(myExitSiding) == false)) {
-			display.out("No S" + (String)(myExitSiding)+" to send!");
-			smExit.moveToState(10);
-		}
-
-		exitAvailable = true;
-		if (io.testToti(19)) exitAvailable = false;	//MAIN exit occupied
-		if (protArea == MERGE) exitAvailable = false;	//crossover in use for MERGE
-		if (io.testToti(PROTAREATOTI)) exitAvailable = false;	//something hogging the crossover
-		if (io.testToti(10) && (myExitSiding > 1)) exitAvailable = false;	//something hogging the exit
-		if ((myExitSiding == 1)  && ((scissorsArea == ENTER) || io.testToti(14))) exitAvailable = false;	//Siding 1 exit blocked
-
-		if (exitAvailable) {
-			if (myExitSiding == 1) {
-			   scissorsArea = EXIT;
-			}
-			//we're good to go
-			exitSidingPoints(myExitSiding1);	//set siding exit points
-			io.setPoint(22, false);  //Goods/Main to Main
-			if (!digitalRead(eastPin)) {   //for WEST only....
-				protArea = EXIT;
-				io.setPoint(23, false);  //no crossover
-				io.setPoint(24, false);  //Branch/Main/Goods to Main/Goods
-			}
-			io.setExitModeDisplay(myExit);	//committing to exit to MAIN, so set flashing
-			smExit.moveToState(3);
-			break;
-		}
-		if (timer3.expired() == true) {
-			display.out("Main X busy! X2");
-			timer3.init(STAYINSTATE);	 //wait for route to display layout to become free
-		}
-
-		break;
-
-
-	case 3:	//we are allowed to exit to MAIN
-		//we are moving when we see train in T10
-		if (entryFlag) {
-			if (myExitSiding == 0) {
-				timer3.init(120);	//allow a full 2 minutes for a THROUGH train
-			}
-			else {
-				timer3.init(STAYINSTATE);
-			}
-		}
-
-		if (io.testToti(10)) {	//exiting train always goes to TOTI10
-			//train moving, so we are now committed
-			smExit.moveToState(4);
-			break;
-		}
-
-
-		//exceptional actions
-		if ((myExitSiding != 0) && !io.testToti(myExitSiding)) {   //if the train in the siding disappears but not via T10
-			if ((myExitSiding != 1) || ((myExitSiding == 1) && !io.testToti(14))) {  //Siding 1 may move into T14 before T10
-				display.out("No S" + (String)(myExitSiding)+" to send!");
-				smExit.moveToState(10);
-				break;
-			}
-		}
-		if (timer3.expired() == true) {
-			if (myExit & 0x80) { 
-				//we can wait for a THROUGH train
-				display.out("Wait Through->M");
-				timer3.init(STAYINSTATE);
-			} else {
-				//we never saw the train in T10, so it hadn't moved, even though allowed to
-				display.out("Abort send S" + (String)(myExitSiding));
-				smExit.moveToState(10);
-			}
-		}
-		break;
-
-
-	case 4:	//train moving to MAIN, as weve seen it in TOTI10
-		//If WEST, look for move into protected area
-		//As train is moving, we can no longer timeout and abort
-		if (entryFlag) {
-			timer3.init(STAYINSTATE);
-		}
-
-		if (io.testToti(PROTAREATOTI)) {	//front of train now in protected area (which we own) (WEST only)
-			smExit.moveToState(5);
-			break;
-		}
-   
-		if (io.testToti(19) == true) {	//train moving into MAIN (this will happen on EAST)
-			smExit.moveToState(6);
-			break;
-		}
-
-		if (!io.testToti(10))	{	//no train exiting
-			display.out("S"+(String)(myExitSiding) + " backing? X4");
-			smExit.moveToState(10);
-			break;
-		}
-
- 		if (timer3.expired() == true) {
-			display.out("M stuck X4T10!");		//on track, so we have to keep waiting...
-			timer3.init(STAYINSTATE);
-			break;
-		}
-		break;
-
-
-	case 5:	//exiting to MAIN, as weve seen it in ProtArea (WEST only) 
-		if (entryFlag) {
-			timer3.init(STAYINSTATE);
-		}
-
-		if (io.testToti(19) == true) {	//train moving into MAIN
-			smExit.moveToState(6);
-			break;
-		}
-		if (!io.testToti(PROTAREATOTI)) {  
-			if (io.testToti(10)) {
-				display.out("Backing?! X5");
-				smExit.moveToState(4);
-			} else {
-				display.out("Vanished! X5");
-				smExit.moveToState(10);
-			}
-			break;
-		}
-
-		if (timer3.expired() == true) {
-			display.out("M X stuck X5T20!");		//on track, so we have to keep waiting...
-			timer3.init(STAYINSTATE);
-		}
-		break;
-
-
-	case 6:	//now actually in MAIN, as we've seen in TOTI19, but still hogging protArea
-		// We could be held in this state for some time, waiting for a routing through the display layout
-		if (entryFlag) {
-		}
-
-		if ((scissorsArea == EXIT) && !io.testToti(SCISSORSAREATOTI)) {		//release scissors area
-			scissorsArea = UNOWNED;
-		}
-		
-
-		if ((!io.testToti(PROTAREATOTI) && !digitalRead(eastPin)) || (!io.testToti(10) && digitalRead(eastPin)) ) {
-			//we are out of the protected area, tail moving into MAIN exit
-			//we are clear of the shared exit route, but may still be waiting for the display layout
-			exitSidingPoints(0); //disable the siding exit
-			if (protArea == EXIT) {
-				protArea = UNOWNED;
-			}
-			smExit.moveToState(10);
-		}
-		break;
-
-		
-	//	******	States EXITing to GOODS ******	
-
-
-	case 12:	//hoping to exit to GOODS
-		//here we want to test whether the GOODS onto the display layout is free
-		if (entryFlag) {
-			timer3.init(STAYINSTATE);	 //wait for route to display layout to become free
-		}
-
-		if ((myExitSiding != 0) && (io.testToti(myExitSiding) == false)) {
-			display.out("No S" + (String)(myExitSiding)+" to send!");
-			smExit.moveToState(10);
-		}
-
-		exitAvailable = true;
-		if (io.testToti(18)) exitAvailable = false;	//GOODS exit occupied
-		if (protArea == MERGE) exitAvailable = false;	//crossover in use for MERGE
-		if (io.testToti(PROTAREATOTI)) exitAvailable = false;	//something hogging the crossover
-		if (io.testToti(10) && (myExitSiding > 1)) exitAvailable = false;	//something hogging the exit
-		if ((myExitSiding == 1)  && ((scissorsArea == ENTER) || io.testToti(14))) exitAvailable = false;	//Siding 1 exit blocked
-		if (exitAvailable) {
-			if (myExitSiding == 1) {
-				scissorsArea = EXIT;
-			}
-			//we're good to go
-			exitSidingPoints(myExitSiding1);  //set siding exit points
-			io.setPoint(22, true);  //Goods/Main to Main
-			if (!digitalRead(eastPin)) {   //for WEST only....
-				protArea = EXIT;
-				io.setPoint(23, false);  //no crossover
-				io.setPoint(24, false);  //Branch/Main/Goods to Main/Goods
-			}
-			io.setExitModeDisplay(myExit);	//set flashing
-			smExit.moveToState(13);
-			break;
-		}
-
-		if (timer3.expired() == true) {
-			display.out("GoodsX busy!X12");
-			timer3.init(STAYINSTATE);	 //wait for route to display layout to become free
-		}
-
-		break;
-
-
-	case 13:	//we are allowed to exit to GOODS
-		//we are moving when we see train in T10
-		if (entryFlag) {
-			if (myExitSiding == 0) {
-				timer3.init(120);	//allow a full 2 minutes for a THROUGH train
-			}
-			else {
-				timer3.init(STAYINSTATE);
-			}
-		}
-
-		if (io.testToti(10))  { //exiting train always goes to TOTI10
-			//train moving, so we are now committed
-			smExit.moveToState(14);
-			break;
-		}
-
-		//exceptional actions
-		if ((myExitSiding != 0) && !io.testToti(myExitSiding)) {   //if the train in the siding disappears but not via T10
-			if ((myExitSiding != 1) || ((myExitSiding == 1) && !io.testToti(14))) {  //Siding 1 may move into T14 before T10
-				display.out("No S" + (String)(myExitSiding)+" to send!");
-				smExit.moveToState(10);
-				break;
-			}
-		}
-		if (timer3.expired() == true) {
-		  if (myDestination & 0x80) { 
-			//we can wait for a THROUGH train
-			display.out("Wait Through->G");
-			timer3.init(STAYINSTATE);
-		  } else {
-			display.out("Abort send S" + (String)(myExitSiding));
-			smExit.moveToState(10);
-		  }
-		}
-		break;
-
-
-
-	case 14:	//train moving to GOODS, as weve seen it in TOTI10
-		//If WEST, look for move into TOTI20
-		if (entryFlag) {
-		  timer3.init(STAYINSTATE);
-		}
-
-		if (io.testToti(PROTAREATOTI)) {  //front of train now in protected area (which we own) (WEST only)
-		  smExit.moveToState(15);
-		  break;
-		}
-   
-		if (io.testToti(18) == true) {  //train moving into GOODS (this will happen on EAST)
-		  smExit.moveToState(16);
-		  break;
-		}
-    
-		if (!io.testToti(10))	{	//no train exiting
-			display.out("S"+(String)(myExitSiding) + " backing?X14");
-			smExit.moveToState(10);
-			break;
-		}
-
-		if (timer3.expired() == true) {
-			display.out("G stuck X14T10!");		//on track, so we have to keep waiting...
-			timer3.init(STAYINSTATE);
-			break;
-		}
-		break;
-
-
-	case 15:	//exiting to GOODS, as weve seen it in ProtArea (WEST only)
-		if (entryFlag) {
-			timer3.init(STAYINSTATE);
-		}
-
-		if (io.testToti(18) == true) {	//train moving into GOODS
-			smExit.moveToState(16);
-			break;
-		}
-		if (!io.testToti(PROTAREATOTI)) {  
-			if (io.testToti(10)) {
-				display.out("Backing?!X15");
-				smExit.moveToState(14);
-			} else {
-				display.out("Vanished!X15");
-				smExit.moveToState(10);
-			}
-			break;
-		}
-
-		if (timer3.expired() == true) {
-			display.out("G X stuckX15T20!");		//on track, so we have to keep waiting...
-			timer3.init(STAYINSTATE);
-		}
-		break;
-
-
-	case 16:	//now actually in GOODS, as we've seen in TOTI18, but still hogging protArea
-		// We could be held in this state for some time, waiting for a routing through the display layout
-		if (entryFlag) {
-		}
-
-		if ((scissorsArea == EXIT) && !io.testToti(SCISSORSAREATOTI)) {		//release scissors area
-			scissorsArea = UNOWNED;
-		}
-
-		if ((!io.testToti(PROTAREATOTI) && !digitalRead(eastPin)) || (!io.testToti(10) && digitalRead(eastPin))) {	//we are out of the protected area, tail moving into GOODS exit
-			exitSidingPoints(0); //disable the siding exit
-			if (protArea == EXIT) {
-				protArea = UNOWNED;
-			}
-			smExit.moveToState(10);
-		}
-		break;
-
-//	******	States EXITing to BRANCH ******	
-
-
-	case 22:	//hoping to exit to BRANCH
-		//here we want to test whether the BRANCH onto the display layout is free
-		if (entryFlag) {
-			timer3.init(STAYINSTATE);	 //wait for route to display layout to become free
-		}
-
-		if ((myExitSiding != 0) && (io.testToti(myExitSiding) == false)) {
-			display.out("No S" + (String)(myExitSiding)+" to send!");
-			smExit.moveToState(10);
-		}
-
-		exitAvailable = true;
-		if (io.testToti(17)) exitAvailable = false;	//BRANCH exit occupied
-		if (io.testToti(10) && (myExitSiding > 1)) exitAvailable = false;	//something hogging the exit
-		if ((myExitSiding == 1)  && ((scissorsArea == ENTER) || io.testToti(14))) exitAvailable = false;	//Siding 1 exit blocked
-		if (exitAvailable) {
-			if (myExitSiding == 1) {
-				scissorsArea = EXIT;
-			}
-			//we're good to go
-			exitSidingPoints(myExitSiding1);  //set siding exit points
-			io.setPoint(24, true);   //Branch/Main/Goods to Branch
-			io.setExitModeDisplay(myExit);	//committing exit to BRANCH, so set flashing
-			smExit.moveToState(23);
-			break;
-		}
-
-		if (timer3.expired() == true) {
-			display.out("BranchX busy!X22");
-			timer3.init(STAYINSTATE);	 //wait for route to display layout to become free
-		}
-
-		break;
-
-
-	case 23:	//we are allowed to exit to BRANCH
-		//we are moving when we see train in T10
-		if (entryFlag) {
-			if (myExitSiding == 0) {
-				timer3.init(120);	//allow a full 2 minutes for a THROUGH train
-			}
-			else {
-				timer3.init(STAYINSTATE);
-			}
-		}
-
-    if (io.testToti(10))  { //exiting train always goes to TOTI10
-			//train moving, so we are now committed
-			smExit.moveToState(24);
-			break;
-		}
-
-		//exceptional actions
-		if ((myExitSiding != 0) && !io.testToti(myExitSiding)) {   //if the train in the siding disappears but not via T10
-			if ((myExitSiding != 1) || ((myExitSiding == 1) && !io.testToti(14))) {  //Siding 1 may move into T14 before T10
-				display.out("No S" + (String)(myExitSiding)+" to send!");
-				smExit.moveToState(10);
-				break;
-			}
-		}
-		if (timer3.expired() == true) {
-		  if (myDestination & 0x80) { 
-			//we can wait for a THROUGH train
-			display.out("Wait Through->B");
-			timer3.init(STAYINSTATE);
-		  } else {
-			  //we never saw the train in T10, so it hadn't moved, even though allowed to
-			  display.out("Abort send S" + (String)(myExitSiding));
-			smExit.moveToState(10);
-		  }
-		}
-		break;
-
-
-	case 24:	//train moving to BRANCH, as weve seen it in TOTI10
-    //If WEST, BRANCH exit does NOT go into ProtArea!
-    if (entryFlag) {
-      timer3.init(STAYINSTATE);
-    }
-
-    if (io.testToti(17) == true) {  //train moving
-      smExit.moveToState(26);
-      break;
-    }
- 
- 		if (!io.testToti(10))	{	//no train exiting
-			display.out("S"+(String)(myExitSiding) + " backing?X24");
-			smExit.moveToState(10);
-			break;
-		}
-
-		if (timer3.expired() == true) {
-			display.out("B stuck X24T10!");		//on track, so we have to keep waiting...
-			timer3.init(STAYINSTATE);
-			break;
-		}
-		break;
-
-	case 26:	//now actually in BRANCH, as we've seen in TOTI17
-		// We could be held in this state for some time, waiting for a routing through the display layout
-		if (entryFlag) {
-		}
-
-		if ((scissorsArea == EXIT) && !io.testToti(SCISSORSAREATOTI)) {		//release scissors area
-			scissorsArea = UNOWNED;
-		}
-
-		if (!io.testToti(10)) {	//we are clear of the shared exit route, but may still be waiting for the display layout
-			exitSidingPoints(0); //disable the siding exit
-			smExit.moveToState(10);
-		}
-		break;
-
-	default:
-		display.out("X-state" + (String)(stripState)+"?!");
-		smExit.moveToState(0);  
-		break;      //unrecognised state
-    
-	}
-}
-
-		//================================================================
-		//							Code clusters
-		//================================================================
-
-
-void reportStates(bool roFlag) {
-	//show all three state engine states "Mnn Enn Xnn (rf)"
-	//if RFID is going to be ignored, show "Mnn Enn Xnn -rf-"
-
-  String allStates = "$";
-	allStates += "M" + byteToString(smMerge.fetch());
-	allStates += " E" + byteToString(smEnter.fetch());
-  byte exitState = smExit.fetch();
-	allStates += " X" + byteToString(exitState);
-  switch(exitState & 0x7F) {
-    case 0:
-      break;  //idle, so no train
-    case 10:
-      allStates += "(**)";  //anomalous, so no idea which train!
-      break;
-    default: 
-     allStates += trainIdToString(exitTrainId);
-	 if (roFlag) {	//show RFID as -xx- if not going to be saved
-		 allStates.replace("(", "-");
-		 allStates.replace(")", "-");
-	 }
-     break;
-  } 
-
-	display.out(allStates);
-
-}
-
-String trainIdToString (byte t) {
-  //Display train ID as (hex)
-    if (t == 0xFF) {
-      return("(?\?)");  //avoid the trigraph (who uses those anyway?)
-    } else {
-      return("(" + byteToHexString(t) + ")");
-    }
-}
-
-String byteToHexString(int s) {
-	//return a byte (7bits) as a string of two digits
-	String myString = String(s,HEX);	//remove first time flag
-	if (myString.length() == 1) {
-		myString = "0" + myString;
-	}
-	return(myString);
-}
-
-String byteToString(int s) {
-  //return a byte (7bits) as a string of two digits
-  String myString = String(s & 0x7F); //remove first time flag
-  if (myString.length() == 1) {
-    myString = "0" + myString;
-  }
-  return(myString);
-}
-
-void enterRunMode(){
-	//do this whenever we enter Run mode from wherever
-	
-	beeper.out(100);
-	delay(100);	//I'm not sure why we need this!
-	testMode = 0;
-	despatchMode = false;
- 
-  display.init(DEBUG);  //just in case the display has got screwed
-
-	display.out("Run Mode");
-	reportStates(false);
-}
-
-
-void setEnterSiding(byte siding) {
-  if (siding != 0xFF) {
-    for (int setSiding = 8; setSiding > 0; setSiding--) { //now set just the point for the siding we want
-      if (siding == setSiding) {
-        io.setPoint(setSiding, true);
-      }
-      else {
-        io.setPoint(setSiding, false);   //and clear all the others
-      }
-    }
-  }
-}
-
-
-void exitSidingPoints(byte siding){
-	//select the exit siding points for whichever siding is specified, and allow train to go
-	// Clear all the others
-	// Through = siding 15 
-	// To clear all exit points and hold the THROUGH signal, exitSidingPoints(0)
-	byte siding1 = siding & 0x0F;	 //strip destination
-
-	if (siding1 == 1) {	//this is a special case, as it relies on the scissor points
-		io.setPoint(2, false);	//clear entry crossover
-	}
-
-	//clear all exit points 9...16 except the one required
-	for (int setExitPoints = 9; setExitPoints < 17; setExitPoints++){
-		if (siding1 == setExitPoints - 8) {
-			io.setPoint(setExitPoints, true);
-		}
-		else {
-			io.setPoint(setExitPoints, false);
-		}
-	}
- 
-	if ((siding1 > 1) && (siding1 < 9)) {	//set exit point, unless siding 1 or THROUGH
-		io.setPoint(17, true);	 //allow sidings 2...8 to exit
-		io.setPoint(29, false);	//stop THROUGH train if any
-	}
- 	else {	 //sidings 0 (reset),1,15 (through)
-		 io.setPoint(17, false);	//clear point for THROUGH/siding 1
-		if (siding1 == 0 ) {  //reset
-			io.setPoint(29, false);	 //reset THROUGH/siding1 exit too
-		}
-		else {
-			io.setPoint(29, true);	//allow THROUGH and siding 1 to pass Stop29
-		}
-	}
-
-}
-
-int findNextSiding(int siding, bool up){
-	//find the next available siding that is occupied and not yet queued, display and return the result
-	//if no alternatives, return with what we started with
-  //if nothing to queue, display error message and return -1
-	//The range for siding is 0...8 (0=Through)
-
-  //check 8 sidings and Through, starting with 'siding' and wrapping round if necessary
-  int newSiding = -1;
-  int checkSiding;
-  checkSiding = siding & 0x0F;
-  for (int scrollLoop = 0;scrollLoop < 10;scrollLoop++) {
-    if (up) {
-      if (++checkSiding == 9) checkSiding = 0;
-    }else {
-      if (--checkSiding == -1) checkSiding = 8;
-    }
-    if (io.testToti(checkSiding) || (checkSiding == 0)) { //there is a train, or it's THROUGH
-      if (io.isThisSidingQueued(checkSiding) == false) { //it has not already been queued
-        newSiding = checkSiding;
-        break;
-      }
-    }
-  }
-	if (newSiding == -1){
-		display.out("Nothing to queue");
-	} else {
-    display.out(sidingString(newSiding));
-  }
-	return newSiding;
-}
-
-String sidingString(byte siding){
-	//return the name of the siding and the RFID of whatever lives there
-	if (siding == 0) {
-		return("Through");
-	}
-	else {
-    return("Siding " + (String)siding + trainIdToString(EEPROM.read(StoredTrain + siding - 1)));
-	}
-}
-
-byte hexStrToByte(String toConvert) {
-  //convert a hexadecimal number as the last 2 chars of string into a byte
-  // NB Invalid hex digits will not be trapped!
-  char msn = toConvert.charAt(toConvert.length()-2);
-  char lsn = toConvert.charAt(toConvert.length()-1);
-  return(charToNib(msn) * 16 + charToNib(lsn)); 
-}
-
-byte charToNib(char toConvert) {
-	if (toConvert >= 'a') return (toConvert - 'a' + 10);
-	if (toConvert >= 'A') return (toConvert - 'A' + 10);
-	return (toConvert - '0');
-}
+//================================================================
+//			 Arduino software for Swindon Station Storage Yards
+//================================================================
+// Requires Arduino Mega2560 - on account of needing 3 UARTs
+
+// The layout is controlled by two Arduino Mega2560s - EAST & WEST
+// EAST controls traffic heading towards WEST (down) and storage for traffic from WEST (up)
+// WEST controls traffic heading towards EAST (up) and storage for traffic from EAST (down)
+
+//This version needs TOTI(DCCCHECKTOTI) to be permanently occupied as long as DCC is on
+
+//Put in jumper link J1 on the shield used for West
+//Ground D41 if you want to protect EEPROM from being written with train details
+
+const String swVersion = "3.2.16 01Mar2020";
+
+
+const bool DEBUG = false;
+//Set this true to output everything that goes to the display to the serial port as well
+//Note that in this case, the program will NOT keep time! 
+
+#include <LiquidCrystal.h>
+#include <EEPROM.h>
+#include "WillsIO.h"
+
+const byte TRACEMODE = TRACEOFF;
+//Set this to TRACERECORD to record every input from power-up, to find intermittent faults,
+// and then to TRACEREPLAY (with the layout disconnected) to play the recording back exactly
+// - or read the EEPROM and play it back on a PC with host/replay (make -C host replay ARGS=file)
+// - going into Test mode ends the recording, so do that before the power goes off
+const bool TRACESERIAL = false;
+//Set this true to send the recording to the USB serial port instead of EEPROM (not with DEBUG)
+// - replay then expects the recording to be sent back the same way, no faster than it reads it
+const bool CONSOLE = true;
+//Set this true to take commands on the USB serial port at 9600 baud (not with DEBUG or TRACESERIAL)
+// - send H for a list of them
+
+
+int testMode = 0;
+int rfidCount = 1;
+
+//State machines
+const int UNOWNED = 0;	//No state machine owns this area
+const int MERGE = 1;
+const int ENTER = 2;
+const int EXIT = 3;
+const int INTERLOPER = 4;	//an interloper has appeared in the protected area
+const int PROTAREATOTI = 12;   //changed from 20
+const int SCISSORSAREATOTI = 14;
+
+const int DCCCHECKTOTI = 24;	//TOTI always occupied to tell whether DCC is on
+const bool DCCCHECKDISABLED = false;	 //true if TOTI24 is not wired 
+
+//assign classes
+IO io(false);			 //input/output space
+Display display;		//LCD display
+Buttons buttons;		//user input
+Beeper beeper;
+State smMerge(MERGE);
+State smEnter(ENTER);
+State smExit(EXIT);
+Stats stats;			//how well the yard is working
+Trace trace;			//recording of all inputs
+Scheduler tasks;		//when each part of loop() runs
+Transit transit;		//how long each move usually takes
+Arbiter arbiter;		//which approach MERGE lets go next
+Tracker tracker;		//which train is where
+Console console;		//commands on the USB serial port
+//We can support up to ten timers
+Timer timer1(1);
+Timer timer2(2);
+Timer timer3(3);
+
+RFID rfid1(1);	//ENTER RFID
+RFID rfid2(2);	//EXIT RFID
+RFID rfid3(3);	//Railcar RFID (not used)
+//EEPROM array for remembering trains
+const unsigned int StoredTrain = 0x020;   //base address for StoredTrain[8] in EEPROM;  xx20...xx27
+
+
+
+const int ledPin = 13;	 // heartbeat
+const int eastPin = 7;	 //Set East or West
+const int writeEnable =	41;	//enable writing to EEPROM
+
+bool lastWriteEnable;
+bool writeEnabled;	//writeEnable as read at the start of this tick (or from the trace)
+unsigned int buttonPins;	//button pins as read at the start of this tick (or from the trace)
+bool eastBox;		//eastPin as read at power-up (or from the trace)
+unsigned int tickMs = 20;	//milliseconds since the last logic tick (or from the trace)
+const unsigned int TICKSLACK = 3;	//milliseconds a tick can be off 20 and still count as 20
+int oneSecondCount = 1000;	//milliseconds to the next second
+int STAYINSTATE = 20;	 //seconds allowed in state before deemed as stuck
+const byte TIMEOUTPERCENTILE = 99;	//once learnt, a move is stuck if it takes longer than this % of moves like it
+//How MERGE chooses between Main, Goods and Branch trains waiting at the same time
+const byte MERGEPOLICY = ARBROUNDROBIN;	//or ARBSHORTEST
+const byte mergeShare[APPROACHES] = { 2, 1, 1 };	//round robin weights for Main, Goods, Branch
+const unsigned int MERGEEXPECTED = 200;	//tenths of a second a merge takes, until we've learnt it
+const byte mergeToti[APPROACHES] = { 21, 22, 23 };	//where Main, Goods and Branch trains wait
+const byte mergeStop[APPROACHES] = { 26, 25, 27 };	//...and the stop that holds them
+//The TOTIs a train passes through between T13 and leaving by MAIN, GOODS or BRANCH
+const byte TRACKEDTOTIS = 16;
+const byte trackedToti[TRACKEDTOTIS] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 12, 13, 14, 17, 18, 19 };
+byte enterTrain = NOTRAIN;	//the train ENTER has routed into the sidings
+byte exitTrain = NOTRAIN;	//...and the one EXIT has routed out
+bool trainsPlaced = false;	//trains already in the sidings at power-up have been named from StoredTrain
+//Serial commands
+const bool consoleOn = CONSOLE && !DEBUG && !(TRACESERIAL && (TRACEMODE != TRACEOFF));
+const byte CONSOLEBATCH = 16;	//despatches the console can hold until there's room in the exit queue
+byte consoleBatch[CONSOLEBATCH];
+byte batchCount = 0;
+const byte DUMPLINES = 6;	//points, TOTIs, states, queue, trains, OK
+byte dumpLine = DUMPLINES;	//next line of a status dump to send, DUMPLINES when there isn't one
+
+int testIOAddress = 1;
+const int TESTLEDS = MAXPOINTS + 1;	//test addresses for the Exit Mode LEDs on D26..D29 follow the points
+bool firstFlag = true;
+byte newTotiValues[TOTIBYTES], oldTotiValues[TOTIBYTES];
+
+int protArea = UNOWNED;		//The protected area of points 19,20,23 may be owned by MERGE or EXIT
+int scissorsArea = UNOWNED;		//The crossover between sidings 1,2 may be owned by ENTER or EXIT
+int lastPA = UNOWNED;		//previous ownership of protArea
+int lastXA = UNOWNED;		//previous ownership of Xover Area
+
+bool despatchMode;	 //if selecting a train to exit
+bool throughMode;	//true if we want an ENTER train to go through
+bool dccOn;				//true if DCC is on
+bool lastDccCheck;	//Previous DCC on/off value
+byte exitTrainId = 0xFF;   //RFID value of train exiting
+
+byte myEnterSiding;
+int exitSiding = -1;	 //current candidate siding for exit queue 0...8
+//this is the value used in the user Destination selection interface
+
+
+byte myExit;	 //what we are actually doing in the Exit state machine
+//EXIT destinations
+//Siding n to MAIN = 0x1n
+//Siding n to GOODS = 0x2n
+//Siding n to BRANCH = 0x4n
+//THROUGH to MAIN = 0x90
+//THROUGH to GOODS = 0xA0
+//THROUGH to BRANCH = 0xC0
+
+byte myExitSiding;	//the siding we're going to get the train from
+byte myExitSiding1; //fixed Siding0 (through) = 15
+byte myDestination;	//where it's going (use EXIT modes coding)
+byte preferredSiding = 0xFF; //where an RFID says this train should go
+byte thisTrainRfid;	//the RFID of the train seen entering the sidings
+byte enterRfid = 0xFF;	//the RFID of the train ENTER has chosen a siding for, so a repeat read can be ignored
+
+//Setting the ENTER points as soon as the Enter RFID is read, before the train reaches T13
+// Compare the S28 waits (Stats) with PRESETENTER false to see what it saves
+const bool PRESETENTER = true;
+const unsigned int PRESETSECONDS = 60;	//undo the points if the train hasn't reached T13 by then
+bool enterPreset = false;	//myEnterSiding has been chosen, and its points set, before the train reached T13
+bool enterNewHome = false;	//myEnterSiding is a new home for enterRfid, remembered once the train arrives
+byte presetPreferred;	//preferredSiding before the preset used it, so an undo can give it back
+unsigned long presetAt;	//stats.upTime() when the points were preset
+unsigned int presetHits = 0;	//trains that found their points already set
+unsigned int presetUndone = 0;	//presets undone - the train never came, or the siding was wanted
+
+//How to choose a siding for a train that is new, or whose own siding is full
+const byte ALLOCNONE = 0;	//don't - send it THROUGH, as before there was a choice
+const byte ALLOCNEAREST = 1;	//free siding nearest its own siding (or nearest Siding 8 if new)
+const byte ALLOCLRU = 2;	//free siding that has gone longest without a train in or out
+const byte ALLOCLENGTH = 3;	//shortest free siding of at least the length class of its own siding
+const byte ALLOCPOLICY = ALLOCNEAREST;
+const byte sidingLength[8] = { 1, 1, 1, 1, 1, 1, 1, 1 };	//length class of Sidings 1...8 (1=short) - set to suit the yard
+unsigned long sidingLastUsed[8];	//upSeconds when a train last went into or out of each siding
+unsigned long upSeconds = 0;	//seconds since power-up
+unsigned int enterThroughCount = 0;	//trains sent THROUGH by ENTER
+unsigned int enterAllocCount = 0;	//trains given a new siding by ENTER
+byte statsPage = 0;	//which page of statistics to show next in Test mode
+const unsigned int STATSCHECKPOINT = 15;	//minutes between saving the statistics to EEPROM
+byte taskPage = 0;	//which task's timings to show next in Test mode
+
+
+//EXIT destinations
+const byte MAIN = 0x10;
+const byte GOODS = 0x20;
+const byte BRANCH = 0x40;
+const byte THROUGH = 0x80;	//this isn't strictly a destination
+//These values are added to the siding number, to store an exit request in the queue
+
+//Routes - the points and stops that are set and cleared together, with one io.setPoints()
+struct Route {
+	unsigned long setMask;	//POINTBIT(n) for point n
+	unsigned long clearMask;
+};
+const unsigned long ENTERPOINTS = 0x000000FF;	//points 1...8
+const unsigned long EXITPOINTS = 0x0000FF00;	//points 9...16
+#define ENTERROUTE(s) { POINTBIT(28) | POINTBIT(s), ENTERPOINTS & ~POINTBIT(s) }
+#define EXITROUTE(s) { POINTBIT(8 + (s)) | POINTBIT(17), (EXITPOINTS & ~POINTBIT(8 + (s))) | POINTBIT(29) }
+
+const Route enterRoute[9] = {	//release Stop28 into Siding 0 (THROUGH)...8
+	{ POINTBIT(28), ENTERPOINTS },
+	ENTERROUTE(1), ENTERROUTE(2), ENTERROUTE(3), ENTERROUTE(4),
+	ENTERROUTE(5), ENTERROUTE(6), ENTERROUTE(7), ENTERROUTE(8)
+};
+
+const Route exitRoute[10] = {	//let a train out of Siding 0 (nothing)...8, then THROUGH
+	{ 0, EXITPOINTS | POINTBIT(17) | POINTBIT(29) },	//hold everything
+	{ POINTBIT(9) | POINTBIT(29), (EXITPOINTS & ~POINTBIT(9)) | POINTBIT(2) | POINTBIT(17) },	//Siding 1 goes over the scissors
+	EXITROUTE(2), EXITROUTE(3), EXITROUTE(4), EXITROUTE(5),
+	EXITROUTE(6), EXITROUTE(7), EXITROUTE(8),
+	{ POINTBIT(29), EXITPOINTS | POINTBIT(17) }	//THROUGH
+};
+
+const Route destRoute[3] = {	//MAIN, GOODS, BRANCH
+	{ 0, POINTBIT(22) | POINTBIT(23) | POINTBIT(24) },	//Goods/Main to Main, no crossover
+	{ POINTBIT(22), POINTBIT(23) | POINTBIT(24) },
+	{ POINTBIT(24), 0 }	//Branch/Main/Goods to Branch
+};
+const unsigned long WESTPOINTS = POINTBIT(23) | POINTBIT(24);	//only the WEST box clears these to exit
+
+
+void setup()
+{
+
+	display.init(DEBUG);
+	display.out("Spirit ofSwindon");
+	delay(1000);
+
+//Explicitly initialise variables
+  testMode = 0;
+  rfidCount = 1;
+  oneSecondCount = 1000;
+  STAYINSTATE = 20;   //seconds allowed in state before deemed as stuck
+  testIOAddress = 1;
+  firstFlag = true;
+  protArea = UNOWNED;    //The protected area of points 19,20,23 may be owned by MERGE or EXIT
+  scissorsArea = UNOWNED;    //The crossover between sidings 1,2 may be owned by ENTER or EXIT
+  lastPA = UNOWNED;   //previous ownership of protArea
+  lastXA = UNOWNED;   //previous ownership of Xover Area
+  exitSiding = -1;   //current candidate siding for exit queue 0...8
+
+	pinMode(ledPin, OUTPUT);
+	pinMode(eastPin, INPUT);
+	pinMode(writeEnable, INPUT);
+
+	if (DEBUG) {	//time out faster if debugging
+		STAYINSTATE = 10;
+	}
+	else {
+		STAYINSTATE = 30;
+	}
+
+	lastWriteEnable = digitalRead(writeEnable);
+	writeEnabled = lastWriteEnable;
+	eastBox = digitalRead(eastPin);
+
+	timer1.init(STAYINSTATE);	 //set timer1 to 10secs
+	timer2.init(0);		//disable timer2
+	timer3.init(0);		//disable timer2
+	oneSecondCount = 1000;
+
+	rfid1.init();	 //initialise RFIDs
+	rfid2.init();
+	rfid3.init();
+
+
+	//initialise points
+	io.init(false);
+
+	// initialize timer1 to step the exchange with the DPR boards
+	noInterrupts();					 // disable all interrupts
+	TCCR1A = 0;
+	TCCR1B = (1 << WGM12) | (1 << CS11);		// clear on compare, 8 prescaler = 0.5uS per count
+	OCR1A = SCANSTEP * 2 - 1;
+	TIMSK1 |= (1 << OCIE1A);	 // enable timer compare interrupt
+	interrupts();						 // enable all interrupts
+	buttons.init();
+	//initialise state machines
+	smMerge.init(false);
+	smEnter.init(false);
+	smExit.init(false);
+	stats.init();
+	stats.load();	//carry on counting from the last checkpoint
+	transit.init(TIMEOUTPERCENTILE, false);
+	arbiter.init(MERGEPOLICY);
+	tracker.init();
+	for (byte toti = 0; toti < TRACKEDTOTIS; toti++) {
+		tracker.track(trackedToti[toti], true);
+	}
+	for (byte approach = 0; approach < APPROACHES; approach++) {
+		arbiter.weight(approach, mergeShare[approach]);
+	}
+
+	trace.init(TRACEMODE, TRACESERIAL);
+	if (trace.recording()) {
+		startRecording();
+	}
+	if (trace.replaying()) {
+		startReplay();
+	}
+
+	display.out(swVersion);	//this shows that initialisation is complete
+	delay(1000);
+	if (eastBox) {
+		display.out("East Box");
+	}
+	else {
+		display.out("West Box");
+	}
+	beeper.out(1000);
+	delay(2000);	//wait for beeper to finish, and another second
+
+
+	io.addToQueue(0);		//purge the exit queue 
+	batchCount = 0;			//...and anything the console was still to feed into it
+	exitSiding = -1;
+
+	dccOn = true;
+	lastDccCheck = true;
+
+	enterRunMode();
+
+	//Task periods and deadlines in mS, in priority order
+	tasks.init(SCANTASK, 1, 5);	//points to the scan interrupt and TOTIs from it - the stop relays depend on this
+	tasks.init(RFIDTASK, 2, 20);	//the UARTs hold 64 chars, about 60mS at 9600 baud
+	tasks.init(LOGICTASK, 20, 20);	//buttons, RFIDs and state machines
+	tasks.init(BLINKTASK, 500, 100);	//Exit Mode LEDs
+	tasks.init(DISPLAYTASK, 1000, 1000);	//LCD
+	tasks.init(CONSOLETASK, 20, 100);	//serial commands
+	if (consoleOn) {
+		console.init();
+	}
+
+}
+
+ISR(TIMER1_COMPA_vect)				// interrupt service routine 
+{
+	io.scanStep();	 // refresh the points and TOTIs, whatever loop() is doing
+}
+
+void(* resetFunc)(void) = 0;  //declare reset function at address 0
+//from https://www.instructables.com/id/two-ways-to-reset-arduino-in-software/
+
+
+void loop()
+{
+	//Run the most urgent task that is due, then come round again
+	// A TOTI change brings the state machines forward, and a point change brings the scan forward,
+	//  so a train reaching a stop section gets its relay within two exchanges with the DPR boards
+
+	if (tasks.due(SCANTASK)) {
+		if (io.updater() && !trace.replaying()) {
+			tasks.trigger(LOGICTASK);	//a TOTI has changed
+		}
+		return;
+	}
+
+	if (tasks.due(RFIDTASK)) {
+		rfid1.drain();
+		rfid2.drain();
+		rfid3.drain();
+		return;
+	}
+
+	bool logicDue;
+	if (trace.replaying()) {
+		logicDue = replayTick();	//replay as fast as we can, one tick per loop
+		tickMs = trace.tickMs;
+	}
+	else {
+		logicDue = tasks.due(LOGICTASK);
+		if (logicDue) {
+			tickMs = tasks.elapsed(LOGICTASK, 20, TICKSLACK);	//a normal tick is 20, so the trace needn't record it
+			if (tickMs > 255) tickMs = 255;	//we've been blocked - lose the time, as the trace would
+		}
+	}
+
+	if (logicDue){
+		dccOn = io.testToti(DCCCHECKTOTI);	 //determine whether DCC is on
+
+		oneSecondCount -= tickMs;
+		if (oneSecondCount <= 0){
+			//come here every second
+			oneSecondCount += 1000;
+			upSeconds++;
+			if ((upSeconds % (STATSCHECKPOINT * 60UL)) == 0) {
+				stats.checkpoint();
+			}
+			digitalWrite(ledPin, digitalRead(ledPin) ^ 1);	 //flash the pulse led
+			//decrement second timers
+			if ((dccOn) || DCCCHECKDISABLED) {	// suspend timers if DCC is off
+				timer1.tick();
+				timer2.tick();
+				timer3.tick();
+			}
+		}
+
+
+		//================================================================
+		//							Here is where all the logic of the program goes
+		//================================================================
+		//We will come here every 20mS, or sooner if a TOTI changes
+
+		if (!trace.replaying()) {
+			buttonPins = buttons.readPins();
+			writeEnabled = digitalRead(writeEnable);
+		}
+		String myButtons = buttons.poll(buttonPins, tickMs);
+
+		if (myButtons == "Cancel 1") {
+			byte xExit = io.getFromQueue();	 //remove one from top of queue, whichever mode we're in
+			protArea = UNOWNED;	 //release Protected Area
+			scissorsArea = UNOWNED;	 // release ownership of Siding1/2 crossover
+
+			io.setExitModeDisplay(myExit);	//Exit still active
+			String report = "";
+			if (xExit == 0){
+				display.out("Queue empty!");
+			}
+			else {
+				if ((xExit & MAIN) != 0) report += "M";
+				if ((xExit & GOODS) != 0) report += "G";
+				if ((xExit & BRANCH) != 0) report += "B";
+				report += (String)(xExit & 0x0F);
+				display.out("Cancel exit " + report);
+				smExit.moveToState(0);
+			}
+			enterRunMode();
+		}
+
+
+		if (testMode == 0){	 //Run mode or Despatch mode
+
+			//this is where all the main logic goes
+
+			///////////////////////////////////////////////////////////////
+
+			if (dccOn || DCCCHECKDISABLED) {	 //only update states if DCC is on (otherwise TOTIs will all show CLEAR)
+
+				if (!lastDccCheck) {
+					display.out("DCC restored");
+					beeper.out(500);
+          delay(500);  //give time for TOTIs to register
+					lastDccCheck = true;
+				}
+
+				if (DEBUG){
+					//Show change of ownership of contested areas
+					if ((scissorsArea != lastXA) || (protArea != lastPA)) {
+						display.out("PA=" + (String)protArea + ", XA=" + (String)scissorsArea);
+						lastXA = scissorsArea;
+						lastPA = protArea;
+					}
+				}
+
+				arbiter.tick(tickMs, mergeHeld());
+				updateMerge(); // Merge State Machine
+				//The Merge State Machine owns the following points:	20,21.
+				//It -may- have the right to control points 19,23 - if it owns the protected area (protArea == MERGE)
+				//It controls Stop Relays 25,26,27.
+				//It considers the TOTI values of 11,20,21,22,23.
+
+				updateEnter(); // Enter State Machine
+				//The Enter State Machine owns the following points:	1,3,4,5,6,7,8.
+				//It -may- have the right to control point 2 - if it owns the crossover (scissorsArea == ENTER)
+				//It controls Stop Relay 28.
+				//It considers the TOTI values of 1,2,3,4,5,6,7,8,9,11A.
+
+				updateExit(); // Exit State Machine
+				// The user interface buttons only have any effect in Exit, 
+				// to select which train should exit the storage yards.
+
+				//The Exit State Machine owns the following points:	9,10,11,12,13,14,15,16,17,18,19.
+				//It -may- have the right to control point 2 - if it owns the crossover (scissorsArea == ENTER)
+				//It controls Stop Relay 28.
+				//It considers the TOTI values of 1,2,3,4,5,6,7,8,9,11A.
+
+				//Measure how long trains wait at each stop section, and how long we spend stuck
+				stats.tick(tickMs);
+				stats.watchStop(0, io.testToti(22), io.testPoint(25));	//Goods
+				stats.watchStop(1, io.testToti(21), io.testPoint(26));	//Main
+				stats.watchStop(2, io.testToti(23), io.testPoint(27));	//Branch
+				stats.watchStop(3, io.testToti(13), io.testPoint(28));	//Enter
+				if ((smMerge.fetch() & 0x7F) == 10) stats.exceptionTime(MERGE, tickMs);
+				if ((smEnter.fetch() & 0x7F) == 10) stats.exceptionTime(ENTER, tickMs);
+				if ((smExit.fetch() & 0x7F) == 10) stats.exceptionTime(EXIT, tickMs);
+				for (byte totiIndex = 0; totiIndex < TOTIBYTES; totiIndex++) {
+					stats.watchTotis(totiIndex, io.totiByte(totiIndex));
+					tracker.watch(totiIndex, io.totiByte(totiIndex));
+				}
+				if (!trainsPlaced) {
+					placeTrains();
+				}
+				byte mergeState = smMerge.fetch() & 0x7F;
+				byte exitState = smExit.fetch() & 0x7F;
+				stats.watchContention(((protArea == MERGE) && ((exitState == 2) || (exitState == 12)))
+					|| ((protArea == EXIT) && (mergeState == 21)));	//who waits for the protected area
+
+				//Check if we've seen an RFID
+				String exitRfid;
+				if ((exitRfid = pollRfid(2)) != "") {
+					//If we see an Exit RFID, save the lsb of the train ID in EEPROM for the siding we've just exited
+					exitTrainId = hexStrToByte(exitRfid);
+					tracker.name(exitTrain, exitTrainId);
+					if ((myExitSiding > 0) && (myExitSiding < 9)) {
+						//write the last two characters of the string
+						if (writeEnabled) {   //this has become the Write-protect switch
+							nvUpdate(StoredTrain + myExitSiding - 1, exitTrainId);
+						}
+					}
+					if (!despatchMode) {
+					  reportStates(!writeEnabled);
+					}
+				}
+				String heardRfid;
+				if (((heardRfid = pollRfid(1)) != "") && !repeatRfid(hexStrToByte(heardRfid))) {
+					//If we see an Enter RFID, look up the EEPROM array to see if we know a siding for it
+					byte searchForTrain;
+					thisTrainRfid = hexStrToByte(heardRfid);
+					tracker.heard(13, thisTrainRfid);	//the train in T13, or the next one there
+					preferredSiding = 0xfe;  //If we don't recognise the train, =0xfe (0xff is used for nothing heard)
+					for (searchForTrain = 0; searchForTrain < 8; searchForTrain++) {
+						if (EEPROM.read(StoredTrain + searchForTrain) == thisTrainRfid){
+							preferredSiding = searchForTrain + 1;
+						}
+					}
+					presetEnter();
+				}
+
+			}
+			else {
+				if (!dccOn	&& !DCCCHECKDISABLED && lastDccCheck) {	//DCC just failed
+					display.out("No DCC!");
+					lastDccCheck = false;
+				}
+			}
+
+			if (myButtons != ""){
+
+				if (myButtons == "Test 1"){
+					testMode = 3;
+					display.init(DEBUG);  //just in case display has got screwed
+					display.out("Test mode");
+					io.addToQueue(0);		//purge the exit queue when entering Test
+					batchCount = 0;			//...and the console's despatches waiting to join it
+					exitSiding = -1;
+					beeper.out(500);
+				}
+
+				//Despatch mode
+				if (despatchMode) {	 //we are already in despatch mode
+
+					if (myButtons == "Through 0") {
+						//Cancel Despatch mode
+						io.setExitModeDisplay(myExit);	//just update from queue
+						enterRunMode();
+
+					}
+
+					if (exitSiding != -1) { //there is something to queue
+						if (myButtons == "Down 0") {
+
+							exitSiding = findNextSiding(exitSiding, false);
+						}
+						if (myButtons == "Up 0") {
+							exitSiding = findNextSiding(exitSiding, true);
+						}
+						if (myButtons == "Main 0"){
+							byte myMain = (MAIN | exitSiding);
+							if (exitSiding == 0) {
+								myMain = myMain | THROUGH;
+							}
+							if (io.addToQueue(myMain)) {
+								io.setExitModeDisplay(myExit);	//just update from queue
+								display.out(sidingString(exitSiding) + "->Main");
+							}
+							else {
+								display.out("Queue full!");
+							}
+							enterRunMode();
+						}
+						if (myButtons == "Goods 0"){
+							byte myGoods = (GOODS | exitSiding);
+							if (exitSiding == 0) {
+								myGoods = myGoods | THROUGH;
+							}
+							if (io.addToQueue(myGoods)) {
+								io.setExitModeDisplay(myExit);	//just update from queue
+								display.out(sidingString(exitSiding) + "->Goods");
+							}
+							else {
+								display.out("Queue full!");
+							}
+							enterRunMode();
+						}
+						if ((myButtons == "Branch 0") && !eastBox){
+							byte myBranch = (BRANCH | exitSiding);
+							if (exitSiding == 0) {
+								myBranch = myBranch | THROUGH;
+							}
+							if (io.addToQueue(myBranch)) {
+								io.setExitModeDisplay(myExit);	//just update from queue
+								display.out(sidingString(exitSiding) + "->Branch");
+							}
+							else {
+								display.out("Queue full!");
+							}
+							enterRunMode();
+						}
+
+					}	//else ignore button, because there is no train to queue
+				}
+
+				//Run mode
+				else { //we are in Run mode, not Despatch
+
+					if (myButtons == "Through 0") {	 //select despatch mode
+						despatchMode = true;
+						display.out("Select exit");
+						exitSiding = 8;  //to roll round to zero
+						exitSiding = findNextSiding(exitSiding, true);
+						if (exitSiding == -1){
+							display.out("No train!");
+						}
+					}
+
+					if (myButtons == "Cancel 1") {  //abandon all despatches
+						display.out("Cancel exit");
+						exitSiding = -1;
+						smExit.init(true);
+					}
+
+
+					// do other run mode button actions here...
+
+				}
+			}
+		}	 //end Run or Despatch
+
+		else {			// we are in a test mode
+
+			//whichever test mode we're in, simultaneous up and down will get us out
+			if (myButtons == "Test 1"){
+				enterRunMode();
+			}
+			else {
+
+				String rfidString;	//for some reason, these can't be declared within the case
+				String testString;
+
+				switch (testMode) {
+
+					/*			case 1:		// we are waiting to select a test mode
+								  if (myButtons == "Main 1"){
+								  testMode = 3;
+								  display.out("Test I/O");
+								  }
+								  break;
+								  */
+
+				case 3:		//test I/O
+
+					//Do user-driven points
+					if (myButtons == "Up 1") {
+						if (testIOAddress++ == TESTLEDS + 3) testIOAddress = 1;
+					}
+					if (myButtons == "Down 1") {
+						if (testIOAddress-- == 1) testIOAddress = TESTLEDS + 3;
+					}
+
+					if (myButtons == "Through 1") {	 // toggle the point
+						if (io.pointExists(testIOAddress)) {
+							if (io.getPoint(testIOAddress)) {
+								io.setPoint(testIOAddress, false);
+								display.out("Point " + (String)(testIOAddress)+" clear");
+							}
+							else {
+								io.setPoint(testIOAddress, true);
+								display.out("Point " + (String)(testIOAddress)+" set");
+							}
+						}
+						else {
+							if (testIOAddress >= TESTLEDS) {	//translate to D26..D29
+								digitalWrite(testIOAddress - TESTLEDS + 26, !digitalRead(testIOAddress - TESTLEDS + 26));
+							}
+						}
+					}
+
+					if ((myButtons == "Up 1") || (myButtons == "Down 1") || (myButtons == "Through 1")) {
+						testString = (String)(testIOAddress);
+						if (testString.length() == 1) {	 //format = ##
+							testString = "0" + testString;
+						}
+						testString = "Point/Toti" + testString;
+						if (io.pointExists(testIOAddress)) {
+							if (io.getPoint(testIOAddress)) {
+								testString += "P1";
+							}
+							else {
+								testString += "P0";
+							}
+						}
+						else if (testIOAddress < TESTLEDS) {
+							testString += "--";
+						}
+						else {	//LEDs
+							if (digitalRead(testIOAddress - TESTLEDS + 26)) {
+								testString += "L1";
+							}
+							else {
+								testString += "L0";
+							}
+						}
+						// now add TOTI state
+						if (testIOAddress <= MAXTOTIS){	//one TOTI per DPR board relay
+
+							if (io.testToti(testIOAddress)) {
+								testString += "T1";
+							}
+							else {
+								testString += "T0";
+							}
+						}
+						else {
+							testString += "--";
+						}
+
+						display.out(testString);
+					}
+
+
+					if (myButtons == "Main 1"){	//show what the DPR chain is costing us, then how late each task has been
+						display.out(taskString(taskPage));
+						if (++taskPage == TASKS + 1) taskPage = 0;
+					}
+
+					if (myButtons == "Branch 1"){	//show the next page of statistics
+						display.out(statsString(statsPage));
+						if (++statsPage == 17) statsPage = 0;
+					}
+
+					if (myButtons == "Bench 1"){	//time the busy routines, and compare with the baseline
+						runBench(false);
+					}
+					if (myButtons == "Baseline 1"){	//time the busy routines, and keep the results as the baseline
+						runBench(true);
+					}
+					if (myButtons == "Export 1"){	//send all the statistics to the USB serial port, for capacity planning
+						stats.send();
+						display.out("Stats sent");
+					}
+					if (myButtons == "Reset 1"){	//start counting again
+						stats.reset();	//not init(), as moves and the preset are being timed from upTime()
+						stats.checkpoint();
+						display.out("Stats reset");
+					}
+
+					if (myButtons == "Goods 1"){
+						testMode = 5;
+						display.out("Clear States");
+					}
+
+					//Report any changes to TOTIs
+					for (byte totiCount = 0; totiCount < MAXTOTIS; totiCount++) {			//for each TOTI
+						bool thisToti = io.testToti(totiCount + 1);
+						byte totiByte = totiCount / 8;
+						byte totiBit = totiCount % 8;
+						bitWrite(newTotiValues[totiByte], totiBit, thisToti);		//build new TOTI value
+						if (firstFlag) {		//if this is the first time, make old the same
+							bitWrite(oldTotiValues[totiByte], totiBit, thisToti);
+						}
+						if (thisToti && !bitRead(oldTotiValues[totiByte], totiBit)) {
+							bitWrite(oldTotiValues[totiByte], totiBit, thisToti);
+							display.out("TOTI[" + (String)(totiCount + 1) + "] in use");
+							beeper.out(500);
+						}
+						if (!thisToti && bitRead(oldTotiValues[totiByte], totiBit)) {
+							bitWrite(oldTotiValues[totiByte], totiBit, thisToti);
+							display.out("TOTI[" + (String)(totiCount + 1) + "] clear");
+							beeper.out(500);
+						}
+					}
+					firstFlag = false;
+
+					if (lastWriteEnable != writeEnabled) {
+						if (writeEnabled) {
+							display.out("Read/Write");
+						}
+						else {
+							display.out("Write-Protect");
+						}
+						lastWriteEnable = writeEnabled;
+					}
+
+					//Report any inputs on RFID readers
+					rfidString = pollRfid(rfidCount);
+
+					if (rfidString != ""){
+						display.out("[" + (String)(rfidCount)+"]=" + rfidString);
+						beeper.out(500);
+					}
+					if (rfidCount++ == 3) rfidCount = 1;
+
+					break;
+
+				case 5:	 //clear state machines, but do not forget train/siding assignments
+					beeper.out(500);
+					smMerge.init(true);
+					smEnter.init(true);
+					smExit.init(true);
+					protArea = UNOWNED;  //release Protected Area
+					scissorsArea = UNOWNED;   // release ownership of Siding1/2 crossover
+//			          io.addToQueue(0);		//already done on entry to Test Mode
+					display.init(DEBUG);
+					display.out("States cleared");
+					delay(1000);
+					beeper.out(500);
+					testMode = 3;
+					break;
+
+				default:
+					beeper.out(2);
+					break;
+				}
+
+			}
+			//================================================================
+			//							End the logic of the program
+			//================================================================
+
+		}
+
+		if (trace.recording()) {	//add this tick's inputs to the recording
+			for (byte totiIndex = 0; totiIndex < TOTIBYTES; totiIndex++) {
+				trace.totis[totiIndex] = io.totiByte(totiIndex);
+			}
+			trace.buttonPins = buttonPins;
+			trace.writeEnabled = writeEnabled;
+			trace.tickMs = tickMs;
+			trace.record();
+		}
+		//one EEPROM write a tick at most - the trace first, as it can't wait
+		if (!trace.drain() && writeEnabled) {
+			if (!transit.drain()) {	//save what we've learnt about moves
+				stats.drain();	//...or else the statistics
+			}
+		}
+		if (trace.overflowed()) {
+			trace.stop();	//just the end mark
+			display.out("Trace full!");
+			trace.init(TRACEOFF, false);
+		}
+		else if (trace.recording() && (testMode != 0)) {
+			trace.stop();	//Test mode ends the session - it is all in the recording now
+			display.out("Trace saved");
+		}
+
+		if (io.pointsPending()) {
+			tasks.trigger(SCANTASK);	//get any stop relay changes out now
+		}
+		return;
+	}
+
+	if (tasks.due(BLINKTASK)) {
+		io.blink();
+		return;
+	}
+
+	if (tasks.due(DISPLAYTASK)) {
+		display.tick();
+		return;
+	}
+
+	if (consoleOn && tasks.due(CONSOLETASK)) {
+		serveConsole();
+	}
+
+}		//end of the loop
+
+
+
+//================================================================
+//							Update the MERGE State Machine
+//================================================================
+
+// The MERGE State Machine is controlled by TOTIs 11, 18-22.
+// It drives points 20,21,22,23 and controls the entry of trains into the MERGE
+// section using Stop Sections 25,26,27
+// If merging from Branch, it takes ownership of the Protected Area, and in doing this, it may
+//	 cause the EXIT State Machine to have to wait to despatch a train.
+
+
+void updateMerge() {
+
+	String interloper;
+
+	byte state = smMerge.fetch();
+
+	bool entryFlag = false;
+	byte stripState = state & 0x7F;
+
+	if (state <128) { //first time in this state
+		entryFlag = true;
+		smMerge.moveToState(state);	 //set the msb
+		timeMove(MERGE, state, 0);
+		if (despatchMode == false) {   //suppress reporting if we're despatching
+      reportStates(false);
+		}
+	}
+
+	switch (stripState) {
+
+	case 0 :	//IDLE
+
+		if (entryFlag) {	//entering state for the first time
+			io.setPoint(21, false);	 // clear point
+			io.setPoint(23, false);	 // clear point
+			io.setPoint(25, false);	 // Stop Goods
+			io.setPoint(26, false);	 // Stop Main
+			io.setPoint(27, false);	 // Stop Branch
+			if (protArea == MERGE) {
+				protArea = UNOWNED;
+			}
+		}
+
+		if (io.testToti(11) || (io.testToti(12) && (protArea != EXIT)) || io.testToti(20)) {	//something has appeared unexpectedly
+			interloper = "T";
+			if (io.testToti(11)) {
+				interloper += "11";
+			}
+			if (io.testToti(12)) {
+				interloper += "12";
+			}
+			if (io.testToti(20)) {
+				interloper += "20";
+			}
+			display.out(interloper + " Interloper!");
+			smMerge.moveToState(10);    //Exception
+
+		} else {
+			//Trains waiting on the Main, Goods or Branch arriving TOTIs - the arbiter says who goes first
+			byte next = mergeNext(0xFF);
+			if (next != 0) {
+				smMerge.moveToState(next);		 //Main, Goods or Branch waiting
+			}
+		}
+		break;
+
+    //****************** EXCEPTION STATE *************************
+    
+  case 10:  //Something has appeared unexpectededly
+
+    if (!io.testToti(11) && !io.testToti(12) && !io.testToti(20)){ //the problem has gone
+		smMerge.moveToState(0);
+    }
+    break;
+
+		//****************** MAIN STATES *************************
+
+	case 1:	 //Main waiting
+		if (entryFlag){
+			timer1.init(STAYINSTATE);
+		}
+
+		if (!io.testToti(20) && !io.testToti(11)) {	 
+			//The way is clear
+//		io.setPoint(20, false);	// No crossover (doesn't exist any more_
+			io.setPoint(21, false);	// Set Goods/Main point to Main
+			io.setPoint(23, false);	// Set Branch/Main to Main
+			io.setPoint(25, false);	 // Stop Goods (Stop25)
+			io.setPoint(27, false);	 // Stop Branch (Stop27)
+			io.setPoint(26, true);	 // Allow Main to go (Stop26)
+			arbiter.served(0);
+			smMerge.moveToState(2);		//Main can go
+			break;
+		}
+
+		if (io.testToti(11) || io.testToti(20)){	//Leave Interloper to be handled by main loop
+			smMerge.moveToState(0);
+			break;
+		}
+		break;	//not reached - the way is either clear or it isn't
+
+
+	case 2:	//We have committed to allow Main to go, TOTI21 moving into TOTI20 (TOTI11 if EAST)
+		//Give MAIN 20s to move - otherwise if someone else is waiting, it loses its turn
+	 
+		if (entryFlag){
+			timer1.init(transit.timeout(MERGE, 2, 0, STAYINSTATE));
+		}
+	 
+		if (io.testToti(20) == true) {	
+			//watch for train moving into T20
+			smMerge.moveToState(4);	//Main going
+			break;
+		}
+
+		if (io.testToti(11)){ //Leave Interloper to be handled by main loop
+			smMerge.moveToState(0);
+			break;
+		}
+    
+		if (io.testToti(21) == false) {	//Main disappeared without moving into T11/T20
+			display.out("Main vanished!");
+			io.setPoint(26, false);	 // Clear the signal (Stop26)
+			smMerge.moveToState(0);
+			break;
+		}
+
+		if (timer1.expired() == true) {
+			display.out("Main stuck T21!");
+			byte next = mergeNext(0);
+			if (next != 0){	//Goods or Branch is waiting
+				io.setPoint(26, false);	//Main can no longer go
+				smMerge.moveToState(next);
+				break;
+			}
+     
+			timer1.init(STAYINSTATE); //no-one else waiting, so go round again
+		}
+
+		break;
+
+	case 4:	//Train moving, now front is in TOTI20 - only in WEST
+		if (entryFlag){	
+			timer1.init(transit.timeout(MERGE, 4, 0, STAYINSTATE));
+		}
+		if (io.testToti(11) == true){
+			smMerge.moveToState(5);	//Merge from protected
+			break;
+		}
+		if (io.testToti(20) == false){	
+			//if T20 clear without going into T11, we must be backing out...
+			smMerge.moveToState(0);
+			break;
+		}
+		if (timer1.expired() == true) {
+			display.out("Merge stuck T20!");
+			timer1.init(STAYINSTATE);
+		}
+		break;
+
+	case 5:	//Merge from protected, now front is in TOTI11
+		//May be held here by other end's ENTER State Machine at STOP28
+		// Stay here until TOTI11 are clear
+		//Exceptional cases (eg TOTI20 not clear) will be handled in main loop
+		if (entryFlag){
+			io.setPoint(26, false);  // Clear the signal (Stop26)
+		}
+
+		if (!io.testToti(20)) { //no need to wait for T11 to be clear to allow exiting trains
+			if (protArea == MERGE) {
+				protArea = UNOWNED;
+			}
+		}
+   
+		if (io.testToti(11) == false)	{
+			stats.trainDone(MERGE);
+			smMerge.moveToState(0);	//All done
+		}
+		break;
+
+
+		//****************** GOODS STATES *************************
+
+	
+	case 11:	 //Goods waiting
+		if (entryFlag){
+			timer1.init(STAYINSTATE);
+		}
+
+		if (!io.testToti(20) && !io.testToti(11)) {    //The way is clear
+			io.setPoint(21, true);	// Set Goods/Main point to Goods
+			io.setPoint(23, false);	// Set Branch/Main to Main
+			io.setPoint(26, false);	 // Stop Main (Stop26)
+			io.setPoint(27, false);	 // Stop Branch (Stop27)
+			io.setPoint(25, true);	 // Allow Goods to go (Stop25)
+			arbiter.served(1);
+			smMerge.moveToState(12);		//Goods can go
+			break;
+		}
+
+		if (io.testToti(11) == true){	//Leave Interloper to be handled by main loop
+			smMerge.moveToState(0);
+			break;
+		}
+
+		if (io.testToti(22) == false){
+			display.out("Goods vanished!");
+			smMerge.moveToState(0);
+			break;
+		}
+		if (timer1.expired() == true) {
+			display.out("Goods held! M11");
+			timer1.init(STAYINSTATE);
+		}
+		break;
+
+	case 12:	//We have committed to allow Goods to go, TOTI22 moving into TOTI20 (TOTI11 if EAST)
+		//Give GOODS 20s to move - otherwise if someone else is waiting, it loses its turn
+
+		if (entryFlag){
+			timer1.init(transit.timeout(MERGE, 12, 0, STAYINSTATE));
+		}
+
+    if (io.testToti(11)){ //Leave Interloper to be handled by main loop
+      smMerge.moveToState(0);
+      break;
+    }
+ 
+ 		if (io.testToti(20) == true) {	
+			//watch for train moving into T20
+			smMerge.moveToState(14);	//Goods going
+			break;
+		}
+
+		if (io.testToti(22) == false) {	//Goods disappeared without moving into T11/T20
+			display.out("Goods vanished!");
+			io.setPoint(25, false);	 // Clear the signal (Stop25)
+			smMerge.moveToState(0);
+			break;
+		}
+		if (timer1.expired() == true) {
+			display.out("Goods stuck T22!");
+			byte next = mergeNext(1);
+			if (next != 0){	//Main or Branch is waiting
+				io.setPoint(25, false);	//Goods can no longer go
+				smMerge.moveToState(next);
+				break;
+			}
+			if (protArea == MERGE) {
+				protArea = UNOWNED;  //Give EXIT a chance
+			}
+			timer1.init(STAYINSTATE); //no-one else waiting, so go round again
+		}
+		break;
+
+	case 14:	//Train moving, now front is in TOTI20 - only in WEST
+		if (entryFlag){	
+			timer1.init(transit.timeout(MERGE, 14, 0, STAYINSTATE));
+		}
+		if (io.testToti(11) == true){
+			smMerge.moveToState(15);	//Merge from protected
+			break;
+		}
+		if (io.testToti(20) == false){	
+			//if T20 clear without going into T11, we must be backing out...
+			smMerge.moveToState(0);
+			break;
+		}
+		if (timer1.expired() == true) {
+			display.out("Merge stuck T20!");
+			timer1.init(STAYINSTATE);
+		}
+		break;
+
+	case 15:	//Merge from protected, now front is in TOTI11
+		//May be held here by other end's ENTER State Machine at STOP28
+		// Stay here until TOTI11 are clear
+		if (entryFlag){
+      io.setPoint(25, false);  // Clear the signal (Stop25)
+		}
+   
+ 		if (io.testToti(11) == false)	{
+			stats.trainDone(MERGE);
+			smMerge.moveToState(0);	//All done
+		}
+		break;
+
+
+		//****************** BRANCH STATES *************************
+
+		//Although there is no BRANCH for the EAST controller, all the logic is here,
+		//	so that the code remains identical to MAIN and GOODS
+
+	case 21:	 //Branch waiting
+		if (entryFlag){
+			timer1.init(STAYINSTATE);
+		}
+
+		if (!io.testToti(PROTAREATOTI) && (protArea != EXIT) && !io.testToti(20) && !io.testToti(11)) {	 
+			//The way is clear
+			if (!eastBox) {
+				protArea = MERGE;	 //no need to take ownership if EAST
+			}
+//		io.setPoint(20, false);	// No crossover
+			io.setPoint(21, false);	// Set Goods/Main point to Main
+			io.setPoint(23, true);	// Set Branch/Main to Branch
+			io.setPoint(25, false);	 // Stop Goods (Stop25)
+			io.setPoint(26, false);	 // Stop Main (Stop26)
+			io.setPoint(27, true);	 // Allow Branch to go (Stop27)
+			arbiter.served(2);
+			smMerge.moveToState(22);		//Branch can go
+			break;
+		}
+
+		if (io.testToti(PROTAREATOTI) || (protArea == EXIT)) {	//Branch has to wait for the protected area
+			byte next = mergeNext(2);
+			if (next != 0) {	//so let Main or Goods by meanwhile - Branch keeps ageing
+				smMerge.moveToState(next);
+				break;
+			}
+		}
+
+		if (io.testToti(23) == false){
+			display.out("Branch vanished!");
+			smMerge.moveToState(0);
+			break;
+		}
+		if (timer1.expired() == true) {
+			display.out("Branch held! M21");
+			timer1.init(STAYINSTATE);
+		}
+		break;
+
+	case 22:	//We have committed to allow Branch to go, TOTI23 moving into xover and TOTI20
+		//Give BRANCH 20s to move - otherwise if someone else is waiting, it loses its turn
+	 
+		if (entryFlag){
+			timer1.init(transit.timeout(MERGE, 22, 0, STAYINSTATE));
+		}
+	 
+    if (io.testToti(PROTAREATOTI) ) { 
+			//watch for train moving into crossover
+			smMerge.moveToState(24);	//Branch going
+			break;
+		}
+
+		if (io.testToti(23) == false) {	//Branch disappeared without moving into T11/T12/T20
+			display.out("Branch vanished!");
+			io.setPoint(27, false);	 // Clear the signal (Stop27)
+			smMerge.moveToState(0);
+			break;
+		}
+		if (timer1.expired() == true) {
+			display.out("Branch stuck T23!");
+			byte next = mergeNext(2);
+			if (next != 0){	//Main or Goods is waiting
+				io.setPoint(27, false);	//Branch can no longer go
+				protArea = UNOWNED;  //Give EXIT a chance
+				smMerge.moveToState(next);
+				break;
+			}
+     
+			timer1.init(STAYINSTATE); //no-one else waiting, so go round again
+		}
+
+		break;
+
+	case 24:	//Train moving, now front is in TOTI12 xover - only in WEST
+		if (entryFlag){	
+			timer1.init(transit.timeout(MERGE, 24, 0, STAYINSTATE));
+		}
+		if (io.testToti(20) == true){
+			smMerge.moveToState(25);	//Merge from protected
+			break;
+		}
+		if (!io.testToti(PROTAREATOTI)){	
+			//if xover clear without going into T20, we must be backing out...
+			smMerge.moveToState(0);
+			break;
+		}
+		if (timer1.expired() == true) {
+			display.out("Merge stuck T20!");
+			timer1.init(STAYINSTATE);
+		}
+		break;
+
+	case 25:	//Merge from protected, now front is in TOTI20
+		if (entryFlag){
+      io.setPoint(27, false);  // Clear the signal (Stop27)
+		}
+		if (!io.testToti(20) && !io.testToti(PROTAREATOTI))	{
+			stats.trainDone(MERGE);
+			smMerge.moveToState(0);	//All done
+		}
+    if (io.testToti(11)) {
+      smMerge.moveToState(26); //Front moving into T11
+    }
+		break;
+
+  case 26:  //Merge from protected, now front is in TOTI11
+    //May be held here indefinitely by other end's ENTER State Machine at STOP28
+    // Stay here until TOTI12, TOTI20 and TOTI11 are clear
+    if (entryFlag){
+    }
+    if (!io.testToti(12) && !io.testToti(20)) {
+      if (protArea == MERGE) {    //allow exiting trains as soon as T12, T20 clear
+        protArea = UNOWNED;
+		io.setPoint(23, false);	//Clear crossover
+	  }
+      if (!io.testToti(11)) {
+        stats.trainDone(MERGE);
+        smMerge.moveToState(0); //All done
+      }
+    }
+    break;
+    
+  default:
+    display.out("M-state" + (String)(stripState)+"?!");
+    smMerge.moveToState(0); //Illegal state!
+    break;
+  }
+    
+}
+
+
+
+//================================================================
+//							Update the ENTER State Machine
+//================================================================
+
+
+//The ENTER State Machine is controlled by TOTI13, TOTI9 and the TOTIs for each of the
+// eight sidings.	The outputs are the siding point settings and STOP Section 28.
+//	The ENTER State Machine may also need to take over the Scissor Point scissorsArea
+//		in order to put a train into Siding 2.
+
+/*If the EXIT state machine sees T9 occupied and myEnterSiding ==0
+then it knows there's a through train that wants out */
+
+void updateEnter() {
+
+	byte state = smEnter.fetch();
+
+	byte stripState = state & 0x7F;
+	bool entryFlag = false;
+
+	if (state <128) { //first time in this state
+		entryFlag = true;
+		smEnter.moveToState(state);	 //set the msb
+		timeMove(ENTER, state, myEnterSiding);
+		if (despatchMode == false) {	//suppress state reporting if we're despatching
+			reportStates(false);
+		}
+	}
+
+
+	switch (stripState) {
+
+	case 0:	//IDLE
+		if (entryFlag) {	//entering state for the first time
+			io.setPoint(28, false);	//stop ENTER train until there is a plan
+			tracker.cancel(enterTrain);	//nothing more to expect of it
+			enterTrain = NOTRAIN;
+			if ((io.testToti(9) == false) && (io.testToti(13) == false)) {	// T9 and T13 clear, so reset siding points
+				io.setPoint(0, true);	//clear siding points
+				if (scissorsArea == ENTER) {
+					scissorsArea = UNOWNED;
+				}
+			}
+		}
+
+		//We move off IDLE if we see anything in T9 or T13
+		if (io.testToti(9)) {	
+			if (enterPreset) {
+				undoPreset();
+			}
+			smEnter.moveToState(10);	//Entry congested - abnormal, so we need to hold train at Stop 28
+			//Only legitimate entry is via occupied T13
+			break;
+		}
+		if (enterPreset) {	//points set for a train we've heard but not yet seen
+			if (io.testToti(13)) {	//it's arrived, and we already know where it's going
+				presetHits++;
+				commitEnterSiding();
+				if ((myEnterSiding != 0 && myEnterSiding != 2) || (scissorsArea == ENTER)) {
+					//its points are already set, so let it go now rather than a tick later from state 11
+					if (myEnterSiding == 0) {
+						enterThroughCount++;
+					}
+					io.setPoint(28, true);
+					trackEnter();
+					smEnter.moveToState(12);
+					break;
+				}
+				smEnter.moveToState(11);	//it needs the scissors, and EXIT has them
+				break;
+			}
+			if (stats.upTime() - presetAt > PRESETSECONDS * 1000UL) {
+				display.out("Preset timed out");
+				undoPreset();
+			}
+			else if ((myEnterSiding != 0) && io.testToti(myEnterSiding)) {
+				display.out("S" + (String)(myEnterSiding) + " taken!");
+				undoPreset();
+			}
+			else if ((scissorsArea == ENTER) && (myExitSiding == 1) && ((smExit.fetch() & 0x7F) % 10 == 2)) {
+				undoPreset();	//EXIT is waiting for the scissors, and the train isn't here yet
+			}
+		}
+		if (io.testToti(13)) {	//A train has arrived
+			smEnter.moveToState(1);	 //train waiting
+		}
+		break;
+
+
+	case 1:	//Train in T13, T9 free
+    //wait for RFID to be heard - if no RFID, stop at Stop 28
+		if (entryFlag){
+			timer2.init(STAYINSTATE);
+		}
+
+		if (preferredSiding != 0xFF) {    //we've heard an RFID
+			myEnterSiding = chooseEnterSiding(preferredSiding);
+			enterRfid = thisTrainRfid;
+			commitEnterSiding();
+			preferredSiding = 0xFF;  //only use once
+			smEnter.moveToState(11);  //now we know which siding (myEnterSiding)
+			break;
+		}
+
+		if (!io.testToti(13)) {	//we never heard from the RFID
+			io.setPoint(28, false);	//clear everything
+			display.out("E vanished(E1)!");
+			smEnter.moveToState(0);  //Entering train disappeared!
+			break;
+		}
+
+		if (timer2.expired() == true) {	//we've waited at Stop 28, but no RFID has been heard, so find it a siding
+			display.out("No RFID heard");
+			myEnterSiding = allocateSiding(0xfe, 0xFF);	//we can't remember it, but it needn't go round again
+			if (myEnterSiding == 0) {
+				display.out("so go THROUGH!");
+			}
+			else {
+				display.out("so go to S" + (String)(myEnterSiding));
+			}
+			smEnter.moveToState(11);  //now we know which train it is
+		}
+		break;
+
+	case 11: //Train in T13, T9 free, train known
+		//we may have to wait for train exiting from Siding 1
+		//...but if not, we'll go straight to state 12
+		if (entryFlag){
+			timer2.init(STAYINSTATE);
+			if (myEnterSiding == 0) {
+				enterThroughCount++;
+			}
+		}
+
+		if ((scissorsArea != EXIT) || (myEnterSiding != 0 && myEnterSiding != 2)) {
+			//then we can go into the siding
+			if (myEnterSiding == 0 || myEnterSiding == 2){
+				scissorsArea = ENTER; //claim scissors area if necessary
+			}
+			setEnterSiding(myEnterSiding);  //set the points and let the train go
+			trackEnter();
+			smEnter.moveToState(12);  //train can go to siding
+			break;
+		}
+
+		if (!io.testToti(13)) {
+			io.setPoint(28, false);	//clear everything
+			display.out("E vanished(E11)!");
+			smEnter.moveToState(0);  //Entering train disappeared!
+			break;
+		}
+
+		if (timer2.expired() == true) {
+			display.out("Access blocked!");	//We have spent too long in TOTI13
+			timer2.init(STAYINSTATE);
+		}
+
+		break;
+
+  case 12:  //Train can go into siding, so expecting T9 (or myEnterSiding == 8 && T8)
+  
+    if (entryFlag){
+      timer2.init(transit.timeout(ENTER, 12, myEnterSiding, STAYINSTATE));
+    }
+
+    if (io.testToti(9) || ((myEnterSiding == 8) && io.testToti(8))) {  
+      //allow entry to Siding 8 without going into T9 first
+      smEnter.moveToState(2);  //train moving to selected siding or THROUGH
+      break;
+    }
+    
+    if (!io.testToti(13)) {
+      io.setPoint(28, false); //clear everything
+      display.out("E vanished(E12)!");
+      smEnter.moveToState(0);  //Entering train disappeared!
+      break;
+    }
+
+    if (timer2.expired() == true) {
+      display.out("Stuck to S" + (String)(myEnterSiding) + "E12!"); //We have spent too long in TOTI13
+      timer2.init(STAYINSTATE);
+      break;
+   }
+
+   break;
+
+	case 2: //Train going into siding, or going THROUGH, T9+T13 occupied
+		if (entryFlag) {
+			timer2.init(transit.timeout(ENTER, 2, myEnterSiding, STAYINSTATE));
+			io.setPoint(28, false);	//stop subsequent trains
+		}
+		if (io.testToti(myEnterSiding) || (io.testToti(SCISSORSAREATOTI) && (scissorsArea == ENTER))){
+			sidingUsed(myEnterSiding);
+			stats.sidingIn(myEnterSiding);
+			smEnter.moveToState(3);	//front is in siding
+			break;
+		}
+
+		if (timer2.expired() == true) {
+			if (!io.testToti(9) && !io.testToti(SCISSORSAREATOTI)) {
+				display.out("E vanished(E2)!");
+				smEnter.moveToState(0);  //Entering train disappeared!
+				break;
+			}
+			else {
+				display.out("E Stuck(T9+13)!");	//We have spent too long in TOTI9+TOTI13, 
+				timer2.init(STAYINSTATE);			// but keep trying
+			}
+		}
+		break;
+
+	case 3: //Train going into siding, T9 occupied
+		if (entryFlag) {
+			timer2.init(transit.timeout(ENTER, 3, myEnterSiding, STAYINSTATE));
+		}
+		if (!io.testToti(9) && (!io.testToti(SCISSORSAREATOTI) || (scissorsArea == EXIT))){  //train cleared TOTI9, or if entering Siding 2,T14 clear too
+      //may need to wait for train to complete entering Siding 2
+			stats.trainDone(ENTER);
+			smEnter.moveToState(0);		//All done
+			break;
+		}
+		if (timer2.expired() == true) {
+			io.setPoint(28, false);	//stop subsequent trains
+			if ((myEnterSiding == 0) && !io.getPoint(29)) {
+				//suppress message if THROUGH is good to go, as it's then an EXIT problem
+				display.out("Through waiting!");	//We have spent too long in TOTI9 
+			}
+			else {
+				display.out("E Stuck(T9)!");	//We have spent too long in TOTI9 
+			}
+			timer2.init(STAYINSTATE);			// but keep trying
+		}
+		break;
+
+		//Exception states
+
+	case 10:	//Something is sitting at the entrance to the sidings (T9)
+		if (entryFlag){
+			display.out("E10T9interloper!");
+			io.setPoint(28, false);	 //Hold train indefinitely
+			break;
+		}
+		if (io.testToti(9) == false){	//the problem has gone
+			smEnter.moveToState(0);
+		}
+		break;
+
+
+	default:
+		display.out("E-state" + (String)(stripState)+"?!");
+		smEnter.moveToState(0);  
+		break;			//unrecognised state
+	}
+
+}
+
+
+
+//================================================================
+//							Update the EXIT State Machine
+//================================================================
+
+//This pulls a despatch request from the queue and implements it, provided the exit is free
+//It needs TOTI10 free if Siding 2...8
+//It needs TOTI14 free, and scissorsArea != ENTER if Siding 1
+//It needs TOTI12 (Protected Area, WEST only) free if the destination is Main or Goods
+//It needs the destination free (MAIN=T19, GODDS=T18, BRANCH=T17)
+
+bool exitAvailable = true;
+
+
+void updateExit() {
+
+	byte state = smExit.fetch();
+
+	bool entryFlag = false;
+	byte stripState = state & 0x7F;
+
+	if (state < 128) { //first time in this state
+		entryFlag = true;
+		smExit.moveToState(state);	 //set the msb
+		timeMove(EXIT, state, myExit);
+		if (despatchMode == false) {  //suppress reporting if we're despatching
+			reportStates(false);
+		}
+	}
+
+
+	switch (stripState) {
+
+	case 0:	//IDLE
+		if (entryFlag) {	//entering state for the first time
+
+			if (io.testToti(10) || ((io.testToti(PROTAREATOTI)) && protArea == EXIT)) {
+				//don't clear points if there's a train on them
+				smExit.moveToState(10);  //Exit congested
+				break;
+			}
+			else {
+				io.clearActiveExit();	//forget what we were just doing
+				tracker.cancel(exitTrain);
+				exitTrain = NOTRAIN;
+				exitSidingPoints(0, 0);	//clear all exit points
+				io.setExitModeDisplay(0);	//stop current flashing indication
+				io.setPoint(22, false);	//default to MAIN
+				io.setPoint(24, false);	//default to Goods/Main
+				myExitSiding = 0xff;	//nothing active from the queue
+
+				if (protArea == EXIT) {
+					protArea = UNOWNED;
+				}
+
+				if (scissorsArea == EXIT) {
+					scissorsArea = UNOWNED;
+				}
+			}
+ 		}
+
+
+
+		if (io.queueNotEmpty()) {	//we have something to do
+			myExit = io.getFromQueue();	//this is what we're going to do next
+			myExitSiding = myExit & 0x0F;		 //lsn
+			exitTrainId = sidingTrainId(myExitSiding);	//just for info message
+			myDestination = myExit & 0x70;		//msn, strip THROUGH flag
+			myExitSiding1 = myExitSiding;
+			if (myExitSiding1 == 0 ){
+				myExitSiding1 = 15;  //we don't want to reset everything for a through train      
+			}
+			//If it's not a Through train, and the siding is now empty, we've lost the train somehow
+			if (myExitSiding != 0) {
+				if (!io.testToti(myExitSiding))  {
+					display.out("No S" + (String)(myExitSiding)+" to send!");
+					smExit.moveToState(10);
+					break; //we've lost our train!
+				}
+			}
+			switch (myDestination) {	
+			case MAIN:
+				smExit.moveToState(2);
+				break;
+			case GOODS:
+				smExit.moveToState(12);
+				break;
+			case BRANCH:
+				smExit.moveToState(22);
+				break;
+			default:
+				display.out("Unknown Exit!");
+				break;
+			}
+		}
+		else {	//nothing in the queue
+			myExit = 0;
+			exitTrainId = 0;
+			}
+			break;
+		
+	case 10:	//exit congested, or other exceptional state
+		if (entryFlag) {
+			timer3.init(STAYINSTATE);
+			io.setExitModeDisplay(0);	//stop flashing
+		}
+
+		if (!io.testToti(10) && !io.testToti(PROTAREATOTI)  
+		    && (!io.testToti(14) || (scissorsArea != EXIT))) {	//train cleared
+			//we are all clear, so back to IDLE
+			myExit = myExitSiding = myExitSiding1 = myDestination = 0;
+			smExit.moveToState(0);
+			break;
+		}
+
+		if (timer3.expired() == true) {
+			String xMsg = "X10 block@T";   //send a message that shows the cause of the blockage
+			if (io.testToti(SCISSORSAREATOTI) && (myExitSiding < 2)) xMsg = xMsg + "14;";
+			if (io.testToti(10)) xMsg = xMsg + "10;";
+			if (io.testToti(PROTAREATOTI)) xMsg = xMsg + "12";
+			display.out(xMsg + "!");
+			timer3.init(STAYINSTATE);
+		}
+
+		break;
+
+//	******	States EXITing to MAIN ******	
+
+	case 2:	//hoping to exit to MAIN
+		//here we want to test whether the MAIN onto the display layout is free
+		if (entryFlag) {
+			timer3.init(STAYINSTATE);	 //wait for route to display layout to become free
+		}
+
+		if ((myExitSiding != 0) && (io.testToti(myExitSiding) == false)) {
+			display.out("No S" + (String)(myExitSiding)+" to send!");
+			smExit.moveToState(10);
+		}
+
+		exitAvailable = true;
+		if (io.testToti(19)) exitAvailable = false;	//MAIN exit occupied
+		if (protArea == MERGE) exitAvailable = false;	//crossover in use for MERGE
+		if (io.testToti(PROTAREATOTI)) exitAvailable = false;	//something hogging the crossover
+		if (io.testToti(10) && (myExitSiding > 1)) exitAvailable = false;	//something hogging the exit
+		if ((myExitSiding == 1)  && ((scissorsArea == ENTER) || io.testToti(14))) exitAvailable = false;	//Siding 1 exit blocked
+
+		if (exitAvailable) {
+			if (myExitSiding == 1) {
+			   scissorsArea = EXIT;
+			}
+			//we're good to go
+			exitSidingPoints(myExitSiding1, MAIN);	//set siding exit points, and Goods/Main to Main
+			trackExit(19);
+			if (!eastBox) {   //for WEST only....
+				protArea = EXIT;
+			}
+			io.setExitModeDisplay(myExit);	//committing to exit to MAIN, so set flashing
+			smExit.moveToState(3);
+			break;
+		}
+		if (timer3.expired() == true) {
+			display.out("Main X busy! X2");
+			timer3.init(STAYINSTATE);	 //wait for route to display layout to become free
+		}
+
+		break;
+
+
+	case 3:	//we are allowed to exit to MAIN
+		//we are moving when we see train in T10
+		if (entryFlag) {
+			if (myExitSiding == 0) {
+				timer3.init(transit.timeout(EXIT, 3, myExit, 120));	//allow a full 2 minutes for a THROUGH train, until we know better
+			}
+			else {
+				timer3.init(transit.timeout(EXIT, 3, myExit, STAYINSTATE));
+			}
+		}
+
+		if (io.testToti(10)) {	//exiting train always goes to TOTI10
+			//train moving, so we are now committed
+			sidingUsed(myExitSiding);
+			stats.sidingOut(myExitSiding, 0);	//MAIN
+			smExit.moveToState(4);
+			break;
+		}
+
+
+		//exceptional actions
+		if ((myExitSiding != 0) && !io.testToti(myExitSiding)) {   //if the train in the siding disappears but not via T10
+			if ((myExitSiding != 1) || ((myExitSiding == 1) && !io.testToti(14))) {  //Siding 1 may move into T14 before T10
+				display.out("No S" + (String)(myExitSiding)+" to send!");
+				smExit.moveToState(10);
+				break;
+			}
+		}
+		if (timer3.expired() == true) {
+			if (myExit & 0x80) { 
+				//we can wait for a THROUGH train
+				display.out("Wait Through->M");
+				timer3.init(STAYINSTATE);
+			} else {
+				//we never saw the train in T10, so it hadn't moved, even though allowed to
+				display.out("Abort send S" + (String)(myExitSiding));
+				smExit.moveToState(10);
+			}
+		}
+		break;
+
+
+	case 4:	//train moving to MAIN, as weve seen it in TOTI10
+		//If WEST, look for move into protected area
+		//As train is moving, we can no longer timeout and abort
+		if (entryFlag) {
+			timer3.init(transit.timeout(EXIT, 4, myExit, STAYINSTATE));
+		}
+
+		if (io.testToti(PROTAREATOTI)) {	//front of train now in protected area (which we own) (WEST only)
+			smExit.moveToState(5);
+			break;
+		}
+   
+		if (io.testToti(19) == true) {	//train moving into MAIN (this will happen on EAST)
+			smExit.moveToState(6);
+			break;
+		}
+
+		if (!io.testToti(10))	{	//no train exiting
+			display.out("S"+(String)(myExitSiding) + " backing? X4");
+			smExit.moveToState(10);
+			break;
+		}
+
+ 		if (timer3.expired() == true) {
+			display.out("M stuck X4T10!");		//on track, so we have to keep waiting...
+			timer3.init(STAYINSTATE);
+			break;
+		}
+		break;
+
+
+	case 5:	//exiting to MAIN, as weve seen it in ProtArea (WEST only) 
+		if (entryFlag) {
+			timer3.init(transit.timeout(EXIT, 5, myExit, STAYINSTATE));
+		}
+
+		if (io.testToti(19) == true) {	//train moving into MAIN
+			smExit.moveToState(6);
+			break;
+		}
+		if (!io.testToti(PROTAREATOTI)) {  
+			if (io.testToti(10)) {
+				display.out("Backing?! X5");
+				smExit.moveToState(4);
+			} else {
+				display.out("Vanished! X5");
+				smExit.moveToState(10);
+			}
+			break;
+		}
+
+		if (timer3.expired() == true) {
+			display.out("M X stuck X5T20!");		//on track, so we have to keep waiting...
+			timer3.init(STAYINSTATE);
+		}
+		break;
+
+
+	case 6:	//now actually in MAIN, as we've seen in TOTI19, but still hogging protArea
+		// We could be held in this state for some time, waiting for a routing through the display layout
+		if (entryFlag) {
+		}
+
+		if ((scissorsArea == EXIT) && !io.testToti(SCISSORSAREATOTI)) {		//release scissors area
+			scissorsArea = UNOWNED;
+		}
+		
+
+		if ((!io.testToti(PROTAREATOTI) && !eastBox) || (!io.testToti(10) && eastBox) ) {
+			//we are out of the protected area, tail moving into MAIN exit
+			//we are clear of the shared exit route, but may still be waiting for the display layout
+			exitSidingPoints(0, 0); //disable the siding exit
+			if (protArea == EXIT) {
+				protArea = UNOWNED;
+			}
+			stats.trainDone(EXIT);
+			smExit.moveToState(10);
+		}
+		break;
+
+		
+	//	******	States EXITing to GOODS ******	
+
+
+	case 12:	//hoping to exit to GOODS
+		//here we want to test whether the GOODS onto the display layout is free
+		if (entryFlag) {
+			timer3.init(STAYINSTATE);	 //wait for route to display layout to become free
+		}
+
+		if ((myExitSiding != 0) && (io.testToti(myExitSiding) == false)) {
+			display.out("No S" + (String)(myExitSiding)+" to send!");
+			smExit.moveToState(10);
+		}
+
+		exitAvailable = true;
+		if (io.testToti(18)) exitAvailable = false;	//GOODS exit occupied
+		if (protArea == MERGE) exitAvailable = false;	//crossover in use for MERGE
+		if (io.testToti(PROTAREATOTI)) exitAvailable = false;	//something hogging the crossover
+		if (io.testToti(10) && (myExitSiding > 1)) exitAvailable = false;	//something hogging the exit
+		if ((myExitSiding == 1)  && ((scissorsArea == ENTER) || io.testToti(14))) exitAvailable = false;	//Siding 1 exit blocked
+		if (exitAvailable) {
+			if (myExitSiding == 1) {
+				scissorsArea = EXIT;
+			}
+			//we're good to go
+			exitSidingPoints(myExitSiding1, GOODS);  //set siding exit points, and Goods/Main to Goods
+			trackExit(18);
+			if (!eastBox) {   //for WEST only....
+				protArea = EXIT;
+			}
+			io.setExitModeDisplay(myExit);	//set flashing
+			smExit.moveToState(13);
+			break;
+		}
+
+		if (timer3.expired() == true) {
+			display.out("GoodsX busy!X12");
+			timer3.init(STAYINSTATE);	 //wait for route to display layout to become free
+		}
+
+		break;
+
+
+	case 13:	//we are allowed to exit to GOODS
+		//we are moving when we see train in T10
+		if (entryFlag) {
+			if (myExitSiding == 0) {
+				timer3.init(transit.timeout(EXIT, 13, myExit, 120));	//allow a full 2 minutes for a THROUGH train, until we know better
+			}
+			else {
+				timer3.init(transit.timeout(EXIT, 13, myExit, STAYINSTATE));
+			}
+		}
+
+		if (io.testToti(10))  { //exiting train always goes to TOTI10
+			//train moving, so we are now committed
+			sidingUsed(myExitSiding);
+			stats.sidingOut(myExitSiding, 1);	//GOODS
+			smExit.moveToState(14);
+			break;
+		}
+
+		//exceptional actions
+		if ((myExitSiding != 0) && !io.testToti(myExitSiding)) {   //if the train in the siding disappears but not via T10
+			if ((myExitSiding != 1) || ((myExitSiding == 1) && !io.testToti(14))) {  //Siding 1 may move into T14 before T10
+				display.out("No S" + (String)(myExitSiding)+" to send!");
+				smExit.moveToState(10);
+				break;
+			}
+		}
+		if (timer3.expired() == true) {
+		  if (myDestination & 0x80) { 
+			//we can wait for a THROUGH train
+			display.out("Wait Through->G");
+			timer3.init(STAYINSTATE);
+		  } else {
+			display.out("Abort send S" + (String)(myExitSiding));
+			smExit.moveToState(10);
+		  }
+		}
+		break;
+
+
+
+	case 14:	//train moving to GOODS, as weve seen it in TOTI10
+		//If WEST, look for move into TOTI20
+		if (entryFlag) {
+		  timer3.init(transit.timeout(EXIT, 14, myExit, STAYINSTATE));
+		}
+
+		if (io.testToti(PROTAREATOTI)) {  //front of train now in protected area (which we own) (WEST only)
+		  smExit.moveToState(15);
+		  break;
+		}
+   
+		if (io.testToti(18) == true) {  //train moving into GOODS (this will happen on EAST)
+		  smExit.moveToState(16);
+		  break;
+		}
+    
+		if (!io.testToti(10))	{	//no train exiting
+			display.out("S"+(String)(myExitSiding) + " backing?X14");
+			smExit.moveToState(10);
+			break;
+		}
+
+		if (timer3.expired() == true) {
+			display.out("G stuck X14T10!");		//on track, so we have to keep waiting...
+			timer3.init(STAYINSTATE);
+			break;
+		}
+		break;
+
+
+	case 15:	//exiting to GOODS, as weve seen it in ProtArea (WEST only)
+		if (entryFlag) {
+			timer3.init(transit.timeout(EXIT, 15, myExit, STAYINSTATE));
+		}
+
+		if (io.testToti(18) == true) {	//train moving into GOODS
+			smExit.moveToState(16);
+			break;
+		}
+		if (!io.testToti(PROTAREATOTI)) {  
+			if (io.testToti(10)) {
+				display.out("Backing?!X15");
+				smExit.moveToState(14);
+			} else {
+				display.out("Vanished!X15");
+				smExit.moveToState(10);
+			}
+			break;
+		}
+
+		if (timer3.expired() == true) {
+			display.out("G X stuckX15T20!");		//on track, so we have to keep waiting...
+			timer3.init(STAYINSTATE);
+		}
+		break;
+
+
+	case 16:	//now actually in GOODS, as we've seen in TOTI18, but still hogging protArea
+		// We could be held in this state for some time, waiting for a routing through the display layout
+		if (entryFlag) {
+		}
+
+		if ((scissorsArea == EXIT) && !io.testToti(SCISSORSAREATOTI)) {		//release scissors area
+			scissorsArea = UNOWNED;
+		}
+
+		if ((!io.testToti(PROTAREATOTI) && !eastBox) || (!io.testToti(10) && eastBox)) {	//we are out of the protected area, tail moving into GOODS exit
+			exitSidingPoints(0, 0); //disable the siding exit
+			if (protArea == EXIT) {
+				protArea = UNOWNED;
+			}
+			stats.trainDone(EXIT);
+			smExit.moveToState(10);
+		}
+		break;
+
+//	******	States EXITing to BRANCH ******	
+
+
+	case 22:	//hoping to exit to BRANCH
+		//here we want to test whether the BRANCH onto the display layout is free
+		if (entryFlag) {
+			timer3.init(STAYINSTATE);	 //wait for route to display layout to become free
+		}
+
+		if ((myExitSiding != 0) && (io.testToti(myExitSiding) == false)) {
+			display.out("No S" + (String)(myExitSiding)+" to send!");
+			smExit.moveToState(10);
+		}
+
+		exitAvailable = true;
+		if (io.testToti(17)) exitAvailable = false;	//BRANCH exit occupied
+		if (io.testToti(10) && (myExitSiding > 1)) exitAvailable = false;	//something hogging the exit
+		if ((myExitSiding == 1)  && ((scissorsArea == ENTER) || io.testToti(14))) exitAvailable = false;	//Siding 1 exit blocked
+		if (exitAvailable) {
+			if (myExitSiding == 1) {
+				scissorsArea = EXIT;
+			}
+			//we're good to go
+			exitSidingPoints(myExitSiding1, BRANCH);  //set siding exit points, and Branch/Main/Goods to Branch
+			trackExit(17);
+			io.setExitModeDisplay(myExit);	//committing exit to BRANCH, so set flashing
+			smExit.moveToState(23);
+			break;
+		}
+
+		if (timer3.expired() == true) {
+			display.out("BranchX busy!X22");
+			timer3.init(STAYINSTATE);	 //wait for route to display layout to become free
+		}
+
+		break;
+
+
+	case 23:	//we are allowed to exit to BRANCH
+		//we are moving when we see train in T10
+		if (entryFlag) {
+			if (myExitSiding == 0) {
+				timer3.init(transit.timeout(EXIT, 23, myExit, 120));	//allow a full 2 minutes for a THROUGH train, until we know better
+			}
+			else {
+				timer3.init(transit.timeout(EXIT, 23, myExit, STAYINSTATE));
+			}
+		}
+
+    if (io.testToti(10))  { //exiting train always goes to TOTI10
+			//train moving, so we are now committed
+			sidingUsed(myExitSiding);
+			stats.sidingOut(myExitSiding, 2);	//BRANCH
+			smExit.moveToState(24);
+			break;
+		}
+
+		//exceptional actions
+		if ((myExitSiding != 0) && !io.testToti(myExitSiding)) {   //if the train in the siding disappears but not via T10
+			if ((myExitSiding != 1) || ((myExitSiding == 1) && !io.testToti(14))) {  //Siding 1 may move into T14 before T10
+				display.out("No S" + (String)(myExitSiding)+" to send!");
+				smExit.moveToState(10);
+				break;
+			}
+		}
+		if (timer3.expired() == true) {
+		  if (myDestination & 0x80) { 
+			//we can wait for a THROUGH train
+			display.out("Wait Through->B");
+			timer3.init(STAYINSTATE);
+		  } else {
+			  //we never saw the train in T10, so it hadn't moved, even though allowed to
+			  display.out("Abort send S" + (String)(myExitSiding));
+			smExit.moveToState(10);
+		  }
+		}
+		break;
+
+
+	case 24:	//train moving to BRANCH, as weve seen it in TOTI10
+    //If WEST, BRANCH exit does NOT go into ProtArea!
+    if (entryFlag) {
+      timer3.init(transit.timeout(EXIT, 24, myExit, STAYINSTATE));
+    }
+
+    if (io.testToti(17) == true) {  //train moving
+      smExit.moveToState(26);
+      break;
+    }
+ 
+ 		if (!io.testToti(10))	{	//no train exiting
+			display.out("S"+(String)(myExitSiding) + " backing?X24");
+			smExit.moveToState(10);
+			break;
+		}
+
+		if (timer3.expired() == true) {
+			display.out("B stuck X24T10!");		//on track, so we have to keep waiting...
+			timer3.init(STAYINSTATE);
+			break;
+		}
+		break;
+
+	case 26:	//now actually in BRANCH, as we've seen in TOTI17
+		// We could be held in this state for some time, waiting for a routing through the display layout
+		if (entryFlag) {
+		}
+
+		if ((scissorsArea == EXIT) && !io.testToti(SCISSORSAREATOTI)) {		//release scissors area
+			scissorsArea = UNOWNED;
+		}
+
+		if (!io.testToti(10)) {	//we are clear of the shared exit route, but may still be waiting for the display layout
+			exitSidingPoints(0, 0); //disable the siding exit
+			stats.trainDone(EXIT);
+			smExit.moveToState(10);
+		}
+		break;
+
+	default:
+		display.out("X-state" + (String)(stripState)+"?!");
+		smExit.moveToState(0);  
+		break;      //unrecognised state
+    
+	}
+}
+
+		//================================================================
+		//							Code clusters
+		//================================================================
+
+
+void reportStates(bool roFlag) {
+	//show all three state engine states "Mnn Enn Xnn (rf)"
+	//if RFID is going to be ignored, show "Mnn Enn Xnn -rf-"
+
+  String allStates = "$";
+	allStates += "M" + byteToString(smMerge.fetch());
+	allStates += " E" + byteToString(smEnter.fetch());
+  byte exitState = smExit.fetch();
+	allStates += " X" + byteToString(exitState);
+  switch(exitState & 0x7F) {
+    case 0:
+      break;  //idle, so no train
+    case 10:
+      allStates += "(**)";  //anomalous, so no idea which train!
+      break;
+    default: 
+     allStates += trainIdToString(exitTrainId);
+	 if (roFlag) {	//show RFID as -xx- if not going to be saved
+		 allStates.replace("(", "-");
+		 allStates.replace(")", "-");
+	 }
+     break;
+  } 
+
+	display.out(allStates);
+
+}
+
+String statsString(byte page) {
+	//one line of statistics for the LCD - waits are in seconds
+	switch (page) {
+	case 0:
+		return("Up " + (String)(stats.counted() / 60000UL) + "min");
+	case 1:
+		return("Trains/h M" + (String)(stats.perHour(stats.trains(MERGE))) + "E" + (String)(stats.perHour(stats.trains(ENTER)))
+			+ "X" + (String)(stats.perHour(stats.trains(EXIT))));
+	case 2:
+	case 3:
+	case 4:
+	case 5:
+		return("S" + (String)(page + 23) + " " + msToString(stats.meanWait(page - 2)) + " 95%" + msToString(stats.p95Wait(page - 2)));
+	case 6:
+		return("Exc M" + (String)(stats.exceptions(MERGE) / 1000) + "E" + (String)(stats.exceptions(ENTER) / 1000)
+			+ "X" + (String)(stats.exceptions(EXIT) / 1000));
+	case 8:
+		return("Moves learnt " + (String)(transit.learnt()) + "/" + (String)(MOVES));
+	case 9:
+		return("Desp/h M" + (String)(stats.perHour(stats.despatched(0))) + "G" + (String)(stats.perHour(stats.despatched(1)))
+			+ "B" + (String)(stats.perHour(stats.despatched(2))));
+	case 10:
+		return("PA wait " + (String)(stats.contended()) + "x " + (String)(stats.contendedTime() / 1000) + "s");
+	case 11:
+		return("Busiest S" + (String)(busiestSiding()) + " " + (String)(stats.sidingMoves(busiestSiding())) + " in/out");
+	case 12:	//how much of the time a train stands at the entry waiting for its RFID or a siding
+		return("T13 in use " + (String)(stats.counted() < 100 ? 0 : stats.occupied(13) / (stats.counted() / 100)) + "%");
+	case 13:	//trains whose points were set from the RFID before they reached T13
+		return("Preset " + (String)(presetHits) + " undo " + (String)(presetUndone));
+	case 14:	//longest any Main, Goods or Branch train has been held by MERGE, in seconds
+		return("Held M" + (String)(arbiter.longest(0) / 1000) + "G" + (String)(arbiter.longest(1) / 1000)
+			+ "B" + (String)(arbiter.longest(2) / 1000));
+	case 15:
+		return("Let go M" + (String)(arbiter.servedCount(0)) + "G" + (String)(arbiter.servedCount(1))
+			+ "B" + (String)(arbiter.servedCount(2)));
+	case 16:
+		return("Following " + (String)(tracker.trains()) + " trains");
+	default:
+		return("EEwr/h " + (String)(stats.perHour(nvWrites())) + " T" + (String)(enterThroughCount) + "A" + (String)(enterAllocCount));
+	}
+}
+
+const char* const taskName[TASKS] = { "Scan", "RFID", "Logic", "Blink", "LCD", "Cmd" };
+
+String taskString(byte page) {
+	//page 0 is the IO scan time, then one page per task
+	if (page == 0) {
+		return("IO scan " + (String)(io.scanTime()) + "uS");
+	}
+	return((String)(taskName[page - 1]) + " miss" + (String)(tasks.misses(page - 1))
+		+ " " + (String)(tasks.worstLate(page - 1) / 1000) + "mS");
+}
+
+byte busiestSiding() {
+	//the siding with the most trains in and out
+	byte busiest = 1;
+	for (byte siding = 2; siding < 9; siding++) {
+		if (stats.sidingMoves(siding) > stats.sidingMoves(busiest)) {
+			busiest = siding;
+		}
+	}
+	return(busiest);
+}
+
+String msToString(unsigned long ms) {
+	//show milliseconds as seconds to one decimal place, or '>' if off the scale
+	if (ms == 0xFFFFFFFF) {
+		return(">60");
+	}
+	return((String)(ms / 1000) + "." + (String)((ms % 1000) / 100));
+}
+
+String pollRfid(byte port) {
+	//poll an RFID reader, or get what it said in this tick from the trace being replayed
+	String heard = "";
+	if (trace.replaying()) {
+		heard = trace.rfid[port];
+		trace.rfid[port] = "";   //only once
+		return(heard);
+	}
+	switch (port) {
+	case 1:
+		heard = rfid1.poll();
+		break;
+	case 2:
+		heard = rfid2.poll();
+		break;
+	case 3:
+		heard = rfid3.poll();
+		break;
+	default:
+		break;
+	}
+	if (trace.recording()) {
+		trace.rfid[port] += heard;
+	}
+	return(heard);
+}
+
+void startRecording() {
+	//the recording starts with everything from EEPROM that the state machines depend on
+	trace.putWaiting('S');
+	trace.putWaiting('T');
+	trace.putWaiting(TRACEFORMAT);
+	trace.putWaiting(TOTIBYTES);
+	trace.putWaiting(MAXPOINTS);
+	trace.putWaiting(eastBox);
+	trace.putWaiting(smMerge.fetch() & 0x7F);
+	trace.putWaiting(smEnter.fetch() & 0x7F);
+	trace.putWaiting(smExit.fetch() & 0x7F);
+	for (byte siding = 0; siding < 8; siding++) {
+		trace.putWaiting(EEPROM.read(StoredTrain + siding));
+	}
+	for (byte pointByte = 0; pointByte < POINTBYTES; pointByte++) {
+		byte pointBits = 0;
+		for (byte pointBit = 0; pointBit < 8; pointBit++) {
+			bitWrite(pointBits, pointBit, io.testPoint(pointByte * 8 + pointBit + 1));
+		}
+		trace.putWaiting(pointBits);
+	}
+	//...and the move timings, as timeouts come from them - only the entries in use, without the spare byte
+	//  (the statistics only feed the display and the export, so a replay keeps its own)
+	byte inUse = 0;
+	for (byte entry = 0; entry < MOVES; entry++) {
+		if (transit.snapshot(entry * 10) != 0xFF) inUse++;
+	}
+	trace.putWaiting(inUse);
+	for (byte entry = 0; entry < MOVES; entry++) {
+		if (transit.snapshot(entry * 10) == 0xFF) continue;
+		trace.putWaiting(entry);
+		for (byte index = 0; index < 9; index++) {
+			trace.putWaiting(transit.snapshot(entry * 10 + index));
+		}
+	}
+	display.out("Recording");
+}
+
+void startReplay() {
+	//put everything back as it was when the recording started
+	if ((trace.getByte() != 'S') || (trace.getByte() != 'T')) {
+		display.out("No trace!");
+		trace.init(TRACEOFF, false);
+		return;
+	}
+	if ((trace.getByte() != TRACEFORMAT) || (trace.getByte() != TOTIBYTES) || (trace.getByte() != MAXPOINTS)) {
+		display.out("Old trace!");	//recorded by a different version
+		trace.init(TRACEOFF, false);
+		return;
+	}
+	eastBox = trace.getByte();
+	smMerge.restore(trace.getByte());
+	smEnter.restore(trace.getByte());
+	smExit.restore(trace.getByte());
+	for (byte siding = 0; siding < 8; siding++) {
+		nvUpdate(StoredTrain + siding, trace.getByte());
+	}
+	for (byte pointByte = 0; pointByte < POINTBYTES; pointByte++) {
+		byte pointBits = trace.getByte();
+		for (byte pointBit = 0; pointBit < 8; pointBit++) {
+			io.setPoint(pointByte * 8 + pointBit + 1, bitRead(pointBits, pointBit));
+		}
+	}
+	for (byte entry = 0; entry < MOVES; entry++) {
+		transit.restore(entry * 10, 0xFF);	//forget what this board has learnt...
+	}
+	byte inUse = trace.getByte();
+	for (byte x = 0; (x < inUse) && (x < MOVES); x++) {
+		byte entry = trace.getByte();	//...and learn what the recording's board had
+		for (byte index = 0; index < 9; index++) {
+			transit.restore((entry % MOVES) * 10 + index, trace.getByte());
+		}
+	}
+	display.out("Replaying");
+}
+
+bool replayTick() {
+	//load the inputs for the next tick from the trace - false when there are no more
+	static bool replayDone = false;
+	if (replayDone) {
+		return(false);
+	}
+	if (!trace.next()) {
+		display.out("Replay done");
+		replayDone = true;
+		return(false);
+	}
+	for (byte totiIndex = 0; totiIndex < TOTIBYTES; totiIndex++) {
+		io.setTotiByte(totiIndex, trace.totis[totiIndex]);
+	}
+	buttonPins = trace.buttonPins;
+	writeEnabled = trace.writeEnabled;
+	return(true);
+}
+
+String trainIdToString (byte t) {
+  //Display train ID as (hex)
+    if (t == 0xFF) {
+      return("(?\?)");  //avoid the trigraph (who uses those anyway?)
+    } else {
+      return("(" + byteToHexString(t) + ")");
+    }
+}
+
+String byteToHexString(int s) {
+	//return a byte (7bits) as a string of two digits
+	String myString = String(s,HEX);	//remove first time flag
+	if (myString.length() == 1) {
+		myString = "0" + myString;
+	}
+	return(myString);
+}
+
+String byteToString(int s) {
+  //return a byte (7bits) as a string of two digits
+  String myString = String(s & 0x7F); //remove first time flag
+  if (myString.length() == 1) {
+    myString = "0" + myString;
+  }
+  return(myString);
+}
+
+void enterRunMode(){
+	//do this whenever we enter Run mode from wherever
+	
+	beeper.out(100);
+	delay(100);	//I'm not sure why we need this!
+	testMode = 0;
+	despatchMode = false;
+ 
+  display.init(DEBUG);  //just in case the display has got screwed
+
+	display.out("Run Mode");
+	reportStates(false);
+}
+
+
+//Moves that we learn the timing of - the machine, the state a train starts the move in,
+// and the state that shows the move has finished
+const byte MOVETYPES = 19;
+const byte moveTable[MOVETYPES][3] = {
+	{ MERGE, 2, 4 }, { MERGE, 4, 5 }, { MERGE, 12, 14 }, { MERGE, 14, 15 }, { MERGE, 22, 24 }, { MERGE, 24, 25 },
+	{ ENTER, 12, 2 }, { ENTER, 2, 3 }, { ENTER, 3, 0 },
+	{ EXIT, 3, 4 }, { EXIT, 4, 5 }, { EXIT, 4, 6 }, { EXIT, 5, 6 },
+	{ EXIT, 13, 14 }, { EXIT, 14, 15 }, { EXIT, 14, 16 }, { EXIT, 15, 16 },
+	{ EXIT, 23, 24 }, { EXIT, 24, 26 }
+};
+
+void placeTrains() {
+	//the trains standing in the sidings at power-up are the ones that live there
+	for (byte siding = 1; siding < 9; siding++) {
+		byte train = tracker.at(siding);
+		if ((train != NOTRAIN) && (tracker.id(train) == 0xFF)) {
+			tracker.name(train, EEPROM.read(StoredTrain + siding - 1));
+		}
+	}
+	trainsPlaced = true;
+}
+
+void trackEnter() {
+	//ENTER has let the train in T13 go - it will come through T9 (and T14 for Siding 2) into its siding
+	enterTrain = tracker.at(13);
+	tracker.expect(enterTrain, 9);	//THROUGH trains wait there
+	if (myEnterSiding == 2) {
+		tracker.expect(enterTrain, SCISSORSAREATOTI);
+	}
+	if ((myEnterSiding > 0) && (myEnterSiding < 9)) {
+		tracker.expect(enterTrain, myEnterSiding);
+	}
+}
+
+void trackExit(byte destinationToti) {
+	//EXIT has let the train in myExitSiding go - through T14 (Siding 1), T10 and the protected area
+	// (WEST, MAIN and GOODS) to the destination, and it's gone when that clears
+	exitTrain = tracker.at((myExitSiding == 0) ? 9 : myExitSiding);
+	if (myExitSiding == 1) {
+		tracker.expect(exitTrain, SCISSORSAREATOTI);
+	}
+	tracker.expect(exitTrain, 10);
+	if (!eastBox && (destinationToti != 17)) {
+		tracker.expect(exitTrain, PROTAREATOTI);
+	}
+	tracker.expect(exitTrain, destinationToti);
+}
+
+byte sidingTrainId(byte siding) {
+	//the train in a siding (0 = THROUGH) - the one we followed there if we know it, otherwise the one that lives there
+	byte id = tracker.id(tracker.at((siding == 0) ? 9 : siding));
+	if ((id == 0xFF) && (siding > 0) && (siding < 9)) {
+		id = EEPROM.read(StoredTrain + siding - 1);
+	}
+	return(id);
+}
+
+		//================================================================
+		//							Serial commands
+		//================================================================
+
+//One line per command, words separated by spaces or commas, any case:
+// H						list the commands
+// S (or ?)					status - points, TOTIs, states, exit queue, and which train is where
+// D siding dest ...		despatch from each siding (0 = THROUGH) to M(ain), G(oods) or B(ranch)
+// X						forget despatches that haven't reached the exit queue yet
+// P point 0|1				clear or set a point, in Test mode only
+//Every command is answered with OK or ERR, the status after its last line
+
+void serveConsole() {
+	//one step of the serial commands - never waits for the port, and takes a line only when the last is answered
+	feedBatch();
+	if (dumpLine < DUMPLINES) {
+		while ((dumpLine < DUMPLINES) && console.print(dumpString(dumpLine))) {
+			dumpLine++;
+		}
+	}
+	else if (console.poll()) {
+		doCommand();
+		console.done();
+	}
+	console.drain();
+}
+
+void doCommand() {
+	if (console.words() == 0) {
+		return;
+	}
+	if (console.tooLong()) {
+		console.print("ERR too long");
+	}
+	else if (console.is(0, "H")) {
+		console.print("S|D s M|G|B ...|X|P n 0|1");
+		console.print("OK");
+	}
+	else if (console.is(0, "S") || console.is(0, "?")) {
+		dumpLine = 0;
+	}
+	else if (console.is(0, "D")) {
+		despatchCommand();
+	}
+	else if (console.is(0, "X")) {
+		batchCount = 0;
+		console.print("OK");
+	}
+	else if (console.is(0, "P")) {
+		pointCommand();
+	}
+	else {
+		console.print("ERR ?");
+	}
+}
+
+void despatchCommand() {
+	//queue every siding and destination pair, or none of them
+	if ((testMode != 0) || trace.recording() || trace.replaying()) {
+		console.print("ERR not now");	//a trace can't replay what came from here
+		return;
+	}
+	if ((console.words() < 3) || ((console.words() % 2) == 0)) {
+		console.print("ERR D s M|G|B ...");
+		return;
+	}
+	byte requests[CONSOLEWORDS / 2];
+	byte count = 0;
+	for (byte word = 1; word < console.words(); word += 2) {
+		int siding = console.number(word);
+		byte destination = 0;
+		if (console.is(word + 1, "M")) destination = MAIN;
+		if (console.is(word + 1, "G")) destination = GOODS;
+		if (console.is(word + 1, "B") && !eastBox) destination = BRANCH;
+		if ((siding < 0) || (siding > 8) || (destination == 0)) {
+			console.print("ERR word " + (String)(word));
+			return;
+		}
+		if (!despatchable(siding, requests, count)) {
+			console.print("ERR S" + (String)(siding));	//empty, or already going
+			return;
+		}
+		requests[count++] = destination | siding | ((siding == 0) ? THROUGH : 0);
+	}
+	if (batchCount + count > CONSOLEBATCH) {
+		console.print("ERR batch full");
+		return;
+	}
+	for (byte request = 0; request < count; request++) {
+		consoleBatch[batchCount++] = requests[request];
+	}
+	feedBatch();
+	console.print("OK " + (String)(count));
+}
+
+bool despatchable(byte siding, const byte* requests, byte count) {
+	//there's a train there (or it's THROUGH), and it isn't queued already - by the buttons or by us
+	if ((siding != 0) && !io.testToti(siding)) {
+		return(false);
+	}
+	if (io.isThisSidingQueued(siding)) {
+		return(false);
+	}
+	for (byte request = 0; request < batchCount; request++) {
+		if ((consoleBatch[request] & 0x0F) == siding) return(false);
+	}
+	for (byte request = 0; request < count; request++) {
+		if ((requests[request] & 0x0F) == siding) return(false);
+	}
+	return(true);
+}
+
+void feedBatch() {
+	//move despatches into the exit queue as EXIT makes room
+	if ((batchCount == 0) || (testMode != 0)) {
+		return;
+	}
+	byte moved = 0;
+	while ((moved < batchCount) && io.addToQueue(consoleBatch[moved])) {
+		moved++;
+	}
+	if (moved == 0) {
+		return;
+	}
+	for (byte request = moved; request < batchCount; request++) {
+		consoleBatch[request - moved] = consoleBatch[request];
+	}
+	batchCount -= moved;
+	if (!despatchMode) {
+		io.setExitModeDisplay(myExit);	//just update from queue
+	}
+}
+
+void pointCommand() {
+	int pointNo = console.number(1);
+	int value = console.number(2);
+	if (testMode == 0) {
+		console.print("ERR Test mode");
+		return;
+	}
+	if ((console.words() != 3) || (pointNo < 1) || (pointNo > MAXPOINTS) || (value < 0) || (value > 1)) {
+		console.print("ERR P n 0|1");
+		return;
+	}
+	io.setPoint(pointNo, value == 1);
+	console.print("OK P" + (String)(pointNo) + "=" + (String)(value));
+}
+
+String dumpString(byte line) {
+	//one line of the status dump - bytes in hex, with point or TOTI 1 in bit 0 of the first byte
+	String dump = "";
+	switch (line) {
+	case 0:
+		dump = "P";
+		for (byte index = 0; index < POINTBYTES; index++) {
+			byte points = 0;
+			for (byte bit = 0; bit < 8; bit++) {
+				if (io.testPoint((index * 8) + bit + 1)) bitSet(points, bit);
+			}
+			dump += " " + byteToHexString(points);
+		}
+		return(dump);
+	case 1:
+		dump = "T";
+		for (byte index = 0; index < TOTIBYTES; index++) {
+			dump += " " + byteToHexString(io.totiByte(index));
+		}
+		return(dump);
+	case 2:
+		dump = "S M" + byteToString(smMerge.fetch()) + " E" + byteToString(smEnter.fetch()) + " X" + byteToString(smExit.fetch())
+			+ " PA" + (String)(protArea) + " XA" + (String)(scissorsArea);
+		if (testMode != 0) return(dump + " Test");
+		if (despatchMode) return(dump + " Desp");
+		return(dump + " Run");
+	case 3:	//the exit queue, then despatches still waiting to join it
+		dump = "Q";
+		for (byte index = 0; index < EXITQUEUELENGTH; index++) {
+			dump += " " + byteToHexString(io.queueEntry(index));
+		}
+		dump += " +";
+		for (byte request = 0; request < batchCount; request++) {
+			dump += " " + byteToHexString(consoleBatch[request]);
+		}
+		return(dump);
+	case 4:	//RFID@TOTI for each train we're following
+		dump = "R";
+		for (byte train = 0; train < TRAINS; train++) {
+			if (tracker.where(train) != 0) {
+				dump += " " + byteToHexString(tracker.id(train)) + "@" + (String)(tracker.where(train));
+			}
+		}
+		return(dump);
+	default:
+		return("OK");
+	}
+}
+
+byte mergeHeld() {
+	//approaches with a train standing at a stop that is still on, for the arbiter to age
+	byte held = 0;
+	for (byte approach = 0; approach < APPROACHES; approach++) {
+		if (io.testToti(mergeToti[approach]) && !io.testPoint(mergeStop[approach])) {
+			bitSet(held, approach);
+		}
+	}
+	return(held);
+}
+
+byte mergeNext(byte notThis) {
+	//the MERGE waiting state (1, 11 or 21) of whichever approach should go next, or 0 if none can
+	// notThis is the approach that has just lost its turn (0xFF if none)
+	byte eligible = 0;
+	unsigned int expected[APPROACHES];
+	for (byte approach = 0; approach < APPROACHES; approach++) {
+		if ((approach != notThis) && io.testToti(mergeToti[approach])) {
+			bitSet(eligible, approach);
+		}
+		//the merge is busy from the stop being released until the train is into T11
+		expected[approach] = transit.mean(MERGE, (approach * 10) + 2, 0) + transit.mean(MERGE, (approach * 10) + 4, 0);
+		if (expected[approach] == 0) {
+			expected[approach] = MERGEEXPECTED;
+		}
+	}
+	if ((protArea != UNOWNED) && (protArea != MERGE)) {
+		bitClear(eligible, 2);	//Branch needs the protected area
+	}
+	byte approach = arbiter.choose(eligible, expected);
+	if (approach == 0xFF) {
+		return(0);
+	}
+	return((approach * 10) + 1);
+}
+
+void timeMove(byte machine, byte newState, byte route) {
+	//a state machine has just changed state - learn from the move it has finished, and time the one it is starting
+	unsigned long now = stats.upTime();
+	bool starting = false;
+	for (byte move = 0; move < MOVETYPES; move++) {
+		if (moveTable[move][0] == machine) {
+			if (moveTable[move][2] == newState) {
+				transit.done(machine, moveTable[move][1], now);	//only if that's the move being timed
+			}
+			if (moveTable[move][1] == newState) {
+				starting = true;
+			}
+		}
+	}
+	if (starting) {
+		transit.start(machine, newState, route, now);
+	}
+	else {
+		transit.cancel(machine);	//anything else means the move went wrong
+	}
+}
+
+byte chooseEnterSiding(byte preferred) {
+	//which siding the train we've heard should go to - preferred is its own siding, or 0xfe if we don't know it
+	// A new home isn't written to EEPROM here, only flagged (enterNewHome) for commitEnterSiding()
+	byte siding = 0;    //default to THROUGH
+	enterNewHome = false;
+	if (preferred == 0xfe) {	//the RFID wasn't recognised
+		siding = allocateSiding(preferred, thisTrainRfid);
+		if (siding == 0) {	//nowhere to put it
+			display.out("New RFID->THRU!");
+		}
+		else {
+			enterNewHome = homeless(siding, thisTrainRfid);	//otherwise it's only visiting
+			display.out("New" + trainIdToString(thisTrainRfid) + "->S" + (String)(siding));
+		}
+	}
+	else {	//we have a valid preferred siding
+		if (myExitSiding == 0) {	//THROUGH is the ACTIVE despatch, so ignore preferred
+			display.out("Queued THROUGH");
+		}
+		else {
+			if (io.testToti(preferred) ) {   //already occupied
+				display.out("S" + (String)(preferred) + " is full!");
+				siding = allocateSiding(preferred, thisTrainRfid);
+				if (siding == 0) {	//nowhere else either
+					display.out("so go THROUGH!");
+				}
+				else {
+					enterNewHome = homeless(siding, thisTrainRfid);
+					display.out(trainIdToString(thisTrainRfid) + " now S" + (String)(siding));
+				}
+			} else {	//everyting checks out OK
+				siding = preferred;
+				display.out(trainIdToString(thisTrainRfid) + " to S" + (String)(siding));
+			}
+		}
+	}
+	return siding;
+}
+
+bool repeatRfid(byte trainId) {
+	//the reader often sees a tag more than once - once ENTER has chosen the train's siding,
+	// hearing it again mustn't count as the next train
+	return((trainId == enterRfid) && (enterPreset || ((smEnter.fetch() & 0x7F) != 0)));
+}
+
+void commitEnterSiding() {
+	//the train is in T13 and going to myEnterSiding - remember it there if that's its new home
+	if (enterNewHome) {
+		newHome(enterRfid, myEnterSiding);
+	}
+	enterNewHome = false;
+	enterPreset = false;
+}
+
+void presetEnter() {
+	//the Enter RFID has been read before the train reached T13 - choose its siding now and set the points,
+	// with Stop28 still on, so ENTER can release the train as soon as it arrives
+	if (!PRESETENTER || enterPreset) return;
+	if ((smEnter.fetch() != 0x80) || io.testToti(9) || io.testToti(13)) return;	//not idle, so state 1 will deal with it
+	presetPreferred = preferredSiding;
+	myEnterSiding = chooseEnterSiding(preferredSiding);
+	enterRfid = thisTrainRfid;	//another train may be heard before this one arrives
+	preferredSiding = 0xFF;
+	enterPreset = true;
+	presetAt = stats.upTime();
+	if (myEnterSiding == 0 || myEnterSiding == 2) {	//needs the scissors
+		if (scissorsArea != UNOWNED) return;	//chosen, but state 11 will wait for the scissors as usual
+		scissorsArea = ENTER;
+	}
+	io.setPoints(enterRoute[myEnterSiding].setMask & ENTERPOINTS, enterRoute[myEnterSiding].clearMask);
+}
+
+void undoPreset() {
+	//put the siding points back, and give the RFID back to state 1 in case the train turns up later
+	// - unless another train has been heard since, which is now the one to expect
+	io.setPoints(0, ENTERPOINTS);
+	if (scissorsArea == ENTER) {
+		scissorsArea = UNOWNED;
+	}
+	enterPreset = false;
+	enterNewHome = false;
+	if (preferredSiding == 0xFF) {
+		preferredSiding = presetPreferred;
+		thisTrainRfid = enterRfid;
+	}
+	presetUndone++;
+}
+
+void setEnterSiding(byte siding) {
+  //set the points for the siding, and release Stop28, in one go
+  if (siding > 8) {   //we don't know where it's going yet
+    io.setPoint(28, true);
+    return;
+  }
+  io.setPoints(enterRoute[siding].setMask, enterRoute[siding].clearMask);
+}
+
+
+void exitSidingPoints(byte siding, byte destination){
+	//select the exit siding points for whichever siding is specified, and allow train to go
+	// Clear all the others, and set the route to MAIN, GOODS or BRANCH (or 0 to leave it alone)
+	// Through = siding 15 
+	// To clear all exit points and hold the THROUGH signal, exitSidingPoints(0, 0)
+	byte siding1 = siding & 0x0F;	 //strip destination
+	if (siding1 > 8) {
+		siding1 = 9;	//THROUGH
+	}
+	unsigned long setMask = exitRoute[siding1].setMask;
+	unsigned long clearMask = exitRoute[siding1].clearMask;
+
+	byte dest = 3;
+	if (destination == MAIN) dest = 0;
+	if (destination == GOODS) dest = 1;
+	if (destination == BRANCH) dest = 2;
+	if (dest < 3) {
+		setMask |= destRoute[dest].setMask;
+		clearMask |= destRoute[dest].clearMask;
+		if (eastBox) {
+			clearMask &= ~WESTPOINTS;
+		}
+	}
+	io.setPoints(setMask, clearMask);
+}
+
+int findNextSiding(int siding, bool up){
+	//find the next available siding that is occupied and not yet queued, display and return the result
+	//if no alternatives, return with what we started with
+  //if nothing to queue, display error message and return -1
+	//The range for siding is 0...8 (0=Through)
+
+  //check 8 sidings and Through, starting with 'siding' and wrapping round if necessary
+  int newSiding = -1;
+  int checkSiding;
+  checkSiding = siding & 0x0F;
+  for (int scrollLoop = 0;scrollLoop < 10;scrollLoop++) {
+    if (up) {
+      if (++checkSiding == 9) checkSiding = 0;
+    }else {
+      if (--checkSiding == -1) checkSiding = 8;
+    }
+    if (io.testToti(checkSiding) || (checkSiding == 0)) { //there is a train, or it's THROUGH
+      if (io.isThisSidingQueued(checkSiding) == false) { //it has not already been queued
+        newSiding = checkSiding;
+        break;
+      }
+    }
+  }
+	if (newSiding == -1){
+		display.out("Nothing to queue");
+	} else {
+    display.out(sidingString(newSiding));
+  }
+	return newSiding;
+}
+
+byte freeSidings() {
+	//bit n-1 is set if Siding n is empty, and no train is queued or leaving from it
+	byte freeMask = 0;
+	for (byte siding = 1; siding < 9; siding++) {
+		if (!io.testToti(siding) && !io.isThisSidingQueued(siding)) {
+			bitSet(freeMask, siding - 1);
+		}
+	}
+	return freeMask;
+}
+
+bool homeless(byte siding, byte trainId) {
+	//true if no other train has Siding n as its home - one that does may be out on the layout, and will come back to it
+	byte owner = EEPROM.read(StoredTrain + siding - 1);
+	return((owner == 0xFF) || (owner == trainId));
+}
+
+byte allocateSiding(byte preferred, byte trainId) {
+	//choose a free siding for a train that can't go to its preferred siding (0xfe if not known)
+	//Sidings that are another train's home are only lent out if there's nowhere else
+	//Return 0 (THROUGH) only if every siding is in use, or ALLOCPOLICY is ALLOCNONE
+	if (ALLOCPOLICY == ALLOCNONE) {
+		return 0;
+	}
+	byte freeMask = freeSidings();
+	byte homelessMask = 0;
+	for (byte siding = 1; siding < 9; siding++) {
+		if (bitRead(freeMask, siding - 1) && homeless(siding, trainId)) {
+			bitSet(homelessMask, siding - 1);
+		}
+	}
+	if (homelessMask != 0) {
+		freeMask = homelessMask;
+	}
+	byte bestSiding = 0;
+	unsigned long bestScore = 0xFFFFFFFF;
+	byte ownSiding = 8;	//a new train is best kept near the entrance
+	byte needLength = 0;	//...and can go anywhere that's long enough
+	if ((preferred > 0) && (preferred < 9)) {
+		ownSiding = preferred;
+		needLength = sidingLength[preferred - 1];
+	}
+
+	for (byte siding = 1; siding < 9; siding++) {
+		if (!bitRead(freeMask, siding - 1)) {
+			continue;
+		}
+		unsigned long score;
+		switch (ALLOCPOLICY) {
+		case ALLOCLRU:
+			score = sidingLastUsed[siding - 1];
+			break;
+		case ALLOCLENGTH:
+			if (sidingLength[siding - 1] < needLength) {
+				continue;	//too short
+			}
+			score = sidingLength[siding - 1];
+			break;
+		default:	//ALLOCNEAREST
+			score = (siding > ownSiding) ? (siding - ownSiding) : (ownSiding - siding);
+			break;
+		}
+		if (score < bestScore) {
+			bestScore = score;
+			bestSiding = siding;
+		}
+	}
+	if (bestSiding != 0) {
+		enterAllocCount++;
+	}
+	return bestSiding;
+}
+
+void newHome(byte trainId, byte siding) {
+	//remember that this train now lives in this siding, so it comes back here next time
+	//Never take a siding from the train that lives there
+	if (writeEnabled && homeless(siding, trainId)) {   //writeEnabled has become the Write-protect switch
+		for (byte oldSiding = 0; oldSiding < 8; oldSiding++) {
+			if (EEPROM.read(StoredTrain + oldSiding) == trainId) {
+				nvUpdate(StoredTrain + oldSiding, 0xFF);	//it doesn't live there any more
+			}
+		}
+		nvUpdate(StoredTrain + siding - 1, trainId);
+	}
+}
+
+void sidingUsed(byte siding) {
+	//note when a train went into or out of a siding, for ALLOCLRU
+	if ((siding > 0) && (siding < 9)) {
+		sidingLastUsed[siding - 1] = upSeconds;
+	}
+}
+
+String sidingString(byte siding){
+	//return the name of the siding and the RFID of whatever lives there
+	if (siding == 0) {
+		return("Through");
+	}
+	else {
+    return("Siding " + (String)siding + trainIdToString(sidingTrainId(siding)));
+	}
+}
+
+byte hexStrToByte(String toConvert) {
+  //convert a hexadecimal number as the last 2 chars of string into a byte
+  // NB Invalid hex digits will not be trapped!
+  char msn = toConvert.charAt(toConvert.length()-2);
+  char lsn = toConvert.charAt(toConvert.length()-1);
+  return(charToNib(msn) * 16 + charToNib(lsn)); 
+}
+
+byte charToNib(char toConvert) {
+	if (toConvert >= 'a') return (toConvert - 'a' + 10);
+	if (toConvert >= 'A') return (toConvert - 'A' + 10);
+	return (toConvert - '0');
+}
+
+
+		//================================================================
+		//							Benchmarks
+		//================================================================
+
+//Run the busy routines a number of times each, and report per call:
+// time taken, EEPROM writes, and time spent blocked in delays
+//Only from Test mode, as the routines really do move points and change states
+//Heap allocations aren't counted here - a String is freed before the routine returns, so the
+// heap top can't see it.  host/bench counts every malloc, and runs these same calls
+
+const byte BENCHITEMS = 7;
+const char* const benchName[BENCHITEMS] = { "RFID", "Butn", "IOup", "Pnt", "Stat", "LCD", "Rte3" };
+const byte benchRuns[BENCHITEMS] = { 100, 100, 20, 10, 10, 4, 10 };
+const byte BENCHPOINT = PINSLOT * 8 + PINPOINTS + 1;	//a point that isn't wired to anything
+const unsigned long BENCHROUTE = POINTBIT(BENCHPOINT) | POINTBIT(BENCHPOINT + 1) | POINTBIT(BENCHPOINT + 2);	//nor are these
+const unsigned int EEbench = 0x380;	//baseline: 'B', then for each item time, blocked (uS), writes per 10 calls
+
+void benchCall(byte item, byte run) {
+	//call the routine being timed once
+	static byte benchState;
+	switch (item) {
+	case 0:
+		rfid3.poll();	//the railcar reader isn't used
+		break;
+	case 1:
+		buttons.poll();
+		break;
+	case 2:
+		io.updater();
+		break;
+	case 3:
+		io.setPoint(BENCHPOINT, (run & 1) == 0);
+		break;
+	case 4:	//flip the EXIT state machine away and back again
+		if (run == 0) {
+			benchState = smExit.fetch();	//with its msb, so EXIT doesn't repeat the state's entry actions
+		}
+		if (run & 1) {
+			smExit.moveToState(benchState & 0x7F);
+			if (benchState & 0x80) {
+				smExit.moveToState(benchState & 0x7F);	//the same state again only sets the msb - no write
+			}
+		}
+		else {
+			smExit.moveToState(((benchState & 0x7F) == 10) ? 0 : 10);
+		}
+		break;
+	case 5:
+		display.out("Bench");
+		break;
+	default:	//three points as one route - compare with three times Pnt
+		if (run & 1) {
+			io.setPoints(0, BENCHROUTE);
+		}
+		else {
+			io.setPoints(BENCHROUTE, 0);
+		}
+		break;
+	}
+}
+
+void runBench(bool saveBaseline) {
+	if (saveBaseline) {
+		nvUpdate(EEbench, 'B');
+	}
+	bool haveBaseline = (EEPROM.read(EEbench) == 'B');
+	for (byte item = 0; item < BENCHITEMS; item++) {
+		unsigned long writesBefore = nvWrites();
+		unsigned long blockedBefore = blockedMicros();
+		unsigned long startTime = micros();
+		for (byte run = 0; run < benchRuns[item]; run++) {
+			benchCall(item, run);
+		}
+		unsigned long took = (micros() - startTime) / benchRuns[item];
+		unsigned long blocked = (blockedMicros() - blockedBefore) / benchRuns[item];
+		unsigned int writes = ((nvWrites() - writesBefore) * 10) / benchRuns[item];
+
+		//compare with the baseline, allowing 10% (+20uS) for jitter
+		unsigned int baseAddress = EEbench + 1 + (item * 10);
+		String regressed = "";
+		if (saveBaseline) {
+			nvPutLong(baseAddress, took);
+			nvPutLong(baseAddress + 4, blocked);
+			nvUpdate(baseAddress + 8, writes & 0xFF);
+			nvUpdate(baseAddress + 9, writes >> 8);
+		}
+		else if (haveBaseline) {
+			unsigned int baseWrites = EEPROM.read(baseAddress + 8) + (EEPROM.read(baseAddress + 9) * 256);
+			if ((took > (nvGetLong(baseAddress) * 11 / 10) + 20)
+				|| (blocked > (nvGetLong(baseAddress + 4) * 11 / 10) + 20)
+				|| (writes > baseWrites)) {
+				regressed = "!";	//beeps too
+			}
+		}
+		display.out((String)(benchName[item]) + " " + (String)(took) + "uS|w" + (String)(writes / 10) + "." + (String)(writes % 10)
+			+ " blk" + (String)(blocked) + regressed);
+		blockFor(1000);	//time to read it
+	}
+}
+
+void nvPutLong(unsigned int address, unsigned long value) {
+	for (byte x = 0; x < 4; x++) {
+		nvUpdate(address + x, (value >> (8 * x)) & 0xFF);
+	}
+}
+
+unsigned long nvGetLong(unsigned int address) {
+	unsigned long value = 0;
+	for (byte x = 0; x < 4; x++) {
+		value += (unsigned long)(EEPROM.read(address + x)) << (8 * x);
+	}
+	return(value);
+}
@@ -1,757 +1,2234 @@
-/*
-Hardware input/output routines for Will's Train Layout
-Author: Chris Moller, chris.moller@evonet.com, Aug2015
-
-v.3.0.18 02Mar2018
-Changed if to while in line 66 - 07Nov2019
-*/
-
-#include "Arduino.h"
-#include "EEPROM.h"
-#include "WillsIO.h"
-#include <LiquidCrystal.h>
-
-#define BEEPPIN 6
-
-//The Arduino seems to need this for stable operation
-#define EEPROMupdateTime 7
-
-
-//================================================================
-//                      RFID routines - source
-//================================================================
-
-
-// Note that you should not use RFID chips with the lsb = 0x00,0xFF as these have special meanings
-// Also, only use one RFID chip with each lsb value - this is the only byte that is significant
-
-
-RFID::RFID(byte port)  //constructor
-{
-	_port = port;
-}
-
-
-void RFID::init()  //initialise the I/O
-{
-	switch (_port) {
-	case 0:
-		Serial.begin(9600);
-		break;
-	case 1:
-		Serial1.begin(9600);
-		break;
-	case 2:
-		Serial2.begin(9600);
-		break;
-	case 3:
-		Serial3.begin(9600);
-		break;
-	default:  //take no action unless port is 0...3
-		break;
-	}
-	//there will be four copies of these private variables:
-	charsRead[_port] = 0xFF;
-	buildString[_port] = "";
-}
-
-
-String RFID::poll() {
-
-	//Check the serial port, and if there is a char, build the RFID string.  
-	// If we get to 12 chars, take action
-	// This routine could also be used for the USB serial port
-
-	// This routine is called every 20mS
-
-	byte val = 0;  //the character read
-	
-	//Find out if the UART has a character available
-	while (rfidAvailable() > 0) {
-		val = rfidRead();		//get the char
-
-
-		if (charsRead[_port] == 0xFF) {   //we have not yet started
-			if (val == 0x02) {                  // header starts 
-				charsRead[_port] = 0;
-				buildString[_port] = "";
-			}		//any other char before start - throw away
-		}
-		else {    //we have already started
-			buildString[_port] += char(val);
-			charsRead[_port]++;
-
-			if ((charsRead[_port] == 12) || (val < '0')) {
-				if (charsRead[_port] < 12) {
-					buildString[_port] += String("**Error");
-				}
-
-				charsRead[_port] = 0xFF;  //start over
-				String result = buildString[_port];
-				buildString[_port] = "";
-
-				return (result);
-			}
-		}
-	}  // nothing available
-
-	return("");
-}
-
-
-byte RFID::rfidAvailable() {
-	//Find out if the UART has a character available
-	// whichRfid can be 1 (=Pin19=RFIDIn), 2(=Pin17=RFIDOut), 3 (=Pin15=RFIDIn2 for railcar detect)
-	switch (_port) {
-	case 0:
-		return Serial.available();
-	case 1:
-		return Serial1.available();
-	case 2:
-		return Serial2.available();
-	case 3:
-		return Serial3.available();
-	default:
-		return(-1);
-	}
-}
-
-byte RFID::rfidRead() {
-	//Read a byte from the correct RFID
-	switch (_port) {
-	case 0:
-		return Serial.read();
-	case 1:
-		return Serial1.read();
-	case 2:
-		return Serial2.read();
-	case 3:
-		return Serial3.read();
-	default:
-		return(-1);
-	}
-}
-
-
-
-//================================================================
-//                      Shift Register I/O routines - source
-//================================================================
-
-
-//tested - see IOtest.ino
-
-
-//EXIT modes - these refer to sidingMode
-#define THROUGH 0x80
-#define MAIN 0x10
-#define GOODS 0x20
-#define BRANCH 0x40
-
-
-IO::IO(bool dummy)  //constructor
-{
-	//	_dummy = dummy;
-}
-
-// RFC Pin assignments
-const int STROBE = 3;
-const int CLOCK = 2;
-const int DATAOUT = 4;
-const int DATAIN = 5;
-const int shiftLength = 24;   //this is the number of outputs we have to set using DPR boards
-
-//EEPROM memory map
-const unsigned int EEpoint = 0x000;   //base address for EEpoint[32];  xx00...xx1F
-//const unsigned int StoredTrain = 0x020;   //base address for StoredTrain[8];  xx20...xx27
-
-void IO::init(bool clearVars)  //initialise the I/O
-{
-	//initilalise the hardware
-	pinMode(STROBE, OUTPUT);
-	pinMode(CLOCK, OUTPUT);
-	pinMode(DATAOUT, OUTPUT);
-	pinMode(DATAIN, INPUT);
-	pinMode(8, OUTPUT);   //STOP17 = point 29
-	pinMode(9, OUTPUT);   //Stop25
-	pinMode(10, OUTPUT);  //Stop26
-	pinMode(11, OUTPUT);  //Stop27
-	pinMode(12, OUTPUT);  //Stop28
-	pinMode(26, OUTPUT);  //pin 26 = MAIN LED indicator
-	pinMode(27, OUTPUT);  //pin 27 = GOODS
-	pinMode(28, OUTPUT);  //pin 28 = BRANCH
-	pinMode(29, OUTPUT);  //pin 29 = THROUGH
-   
-	if (clearVars) {	//zero pointValues and set EEPROM to 0xFFh
-		pointValues = 0UL;
-		for (int x = 0; x < 40; x++){
-			EEPROM.update(EEpoint + x, 0xFF);  //0xFF is what EEPROM contains if never written
-			delay(EEPROMupdateTime);
-		}
-	}
-
-	addToQueue(0);		//initialise the queue
-
-	//copy EEPROM values into pointValues
-	for (int y = 0; y < 32; y++){
-		if (getPoint(y+1)){
-			bitWrite(pointValues, y, 1);
-		}
-		else {
-			bitWrite(pointValues, y, 0);
-		}
-	}
-
-
-}
-
-
-void IO::updater() {
-	//Send point values from pointValues out to points
-	// and get current TOTI values into totiValues
-	const int pulseWidth = 25;  //set pulse widths
-	//This routine will take approx 100 * pulseWidth microseconds to execute
-
-  static bool blinker = false;
-	//The following array is to fix the strange order in which DPR boards have their relays
-	const byte mapDPR[] = { 6, 4, 2, 0, 7, 5, 3, 1, 14, 12, 10, 8, 15, 13, 11, 9, 22, 20, 18, 16, 23, 21, 19, 17 };
-
-	//reset the DPR board shift registers
-	digitalWrite(STROBE, HIGH);
-	delayMicroseconds(pulseWidth);
-	digitalWrite(STROBE, LOW);
-	delayMicroseconds(pulseWidth);
-	for (int shiftIndex = 0; shiftIndex < shiftLength; shiftIndex++) {  //for all the shift registers
-
-		//clock out all the point values to the DPR boards 
-		if (bitRead(pointValues,mapDPR[shiftIndex])) {
-			digitalWrite(DATAOUT, HIGH);
-		}
-		else {
-			digitalWrite(DATAOUT, LOW);
-		}
-
-		delayMicroseconds(pulseWidth);
-		//load in all the Toti values
-		// change the next line if the sense of TOTI o/p is wrong
-		bitWrite(totiValues, shiftLength - 1 - shiftIndex, 1 - digitalRead(DATAIN));
-		delayMicroseconds(pulseWidth);
-		digitalWrite(CLOCK, HIGH);
-		delayMicroseconds(pulseWidth);
-		digitalWrite(CLOCK, LOW);
-		delayMicroseconds(pulseWidth);
-	}
-	digitalWrite(STROBE, HIGH);
-	delayMicroseconds(pulseWidth);
-	digitalWrite(STROBE, LOW);
-	delayMicroseconds(pulseWidth);
-
-	//Now do the top five points/stop sections (25-29)
-	//Assumes D9..D12, D8 are the Arduino pins for these
-	for (int shiftIndex1 = shiftLength; shiftIndex1 < shiftLength + 5; shiftIndex1++) {
-		int ioBit = shiftIndex1 - 15;
-		if (ioBit == 13) {
-			ioBit = 8;  //STOP17 = Point 29 is out of order on pin 8
-		}
-		if (bitRead(pointValues,shiftIndex1)) {
-			digitalWrite(ioBit, HIGH);
-		}
-		else {
-			digitalWrite(ioBit, LOW);
-		}
-	}
-
-	if (--halfSecond == 0){
-		//come here every half second
-		halfSecond = 25;
-		blinker = !blinker;
-
-		//now update the Exit Mode display
-		//bits are THROUGH | BRANCH | GOODS | MAIN | THROUGH FLASH | BRANCH FLASH | GOODS FLASH | MAIN FLASH
-		//           pin29 | pin28  | pin27 | pin26
-		bool pinVal;
-		for (int modeIndex = 0; modeIndex < 4; modeIndex++) {  //for each destination
-			if (bitRead(exitModeDisplay, modeIndex + 4)) {   //get the bit
-				if (bitRead(exitModeDisplay, modeIndex)) {
-					pinVal = blinker;
-				} else { 
-					pinVal = true;
-				}
-			}
-			else {
-				pinVal = false;
-			}
-			digitalWrite(26 + modeIndex, pinVal);
-			//pin 26 = MAIN
-			//pin 27 = GOODS
-			//pin 28 = BRANCH
-			//pin 29 = THROUGH
-		}
-
-	}
-
-}
-
-
-bool IO::testToti(byte totiNo) {
-	//return whether a TOTI section is occupied
-	byte totiNo1 = (totiNo - 1) & 0x1F;
-	return(bitRead(totiValues, totiNo1));
-}
-
-void IO::setP1(byte pointNo, bool set) {
-//set a point 1...32 to the value of SET
-  
-  byte pointNo1 = (pointNo -1) & 0x1F;
-  bitWrite(pointValues, pointNo1, set);   //will take effect on next update()
-  if (set){
-    EEPROM.update(EEpoint + pointNo1, 0xFE);  //make a non-volatile copy
-  }
-  else {
-    EEPROM.update(EEpoint + pointNo1, 0xFF);  //make a non-volatile copy
-  }
-  //This delay needed to be increased from 4, 2020-01-22, as Arduino was continually resetting
-  delay(EEPROMupdateTime);
-}
-
-void IO::setPoint(byte pointNo, bool set){
-  //set or unset the specified point
-  //If point 0 is specified, clear all siding entry points
-  if (pointNo == 0 ) {
-    for (int spCount = 8; spCount >0; spCount--){
-      setP1(spCount,false);
-    }
-  }
-  else {
-    setP1(pointNo,set);
-  }
-}
-
-bool IO :: getPoint(byte pointNo) {   
-//return whether a point is set or clear
-	// - relies on lsb of value in EEPROM being correctly set
-	// pointNo = 1...32
-	byte pointVal = EEPROM.read(EEpoint + ((pointNo -1) & 0x1F));
-	delay(1);
-	if (bitRead(pointVal,0)) {
-		return(false);
-	}
-	else {
-		return(true);
-	}
-}
-
-
-void IO::setExitModeDisplay(byte myExit){
-	//Set the LEDs on the control panel from the queue
-	//Set flashing the LED from myExit, which is the value just retrieved from the queue
-	//Values for activeMode are:
-	//Siding n to MAIN = 0x1n
-	//Siding n to GOODS = 0x2n
-	//Siding n to BRANCH = 0x4n
-	//THROUGH to MAIN = 0x90
-	//THROUGH to GOODS = 0xA0
-	//THROUGH to BRANCH = 0xC0
-	//Nothing yet active = 0x00
-
-	// MSN of mode = destination, LSN = source
-	// exit mode bits are mostly set from the queue, but also set from the activeMode parameter
-	// if a bit is set from activeMode, it will also be set to flash
-	// MSN uses ExitMode values (eg MAIN = 0X10)
-	//if activeMode Siding (lsn) = 0, set THROUGH flashing as well
-
-	exitModeDisplay = 0;
-	//set exitModeDisplay MSN based on destinations stored in the queue
-	for (int queueIndex = 0; queueIndex < EXITQUEUELENGTH; queueIndex++){
-		exitModeDisplay = exitModeDisplay | (exitQueue[queueIndex] & 0xF0);  //set if there's something queued to this exit, strip siding
-	}
-	//Now determine which if any is flashing
-	exitModeDisplay = exitModeDisplay | (myExit & 0xF0);  //Add currently active destination
-	exitModeDisplay = exitModeDisplay | ((myExit & 0xF0) >> 4);  //Set currently active destination to flash
-
-	halfSecond = 1;  //update soon
-}
-
-
-bool IO::addToQueue(byte queue) {
-/*The queue consists of bytes with the MSN specifying the exit mode,
-  the LSN the siding to despatch from.  exitQueue[0] is the next active entry */
-
-//add an exit request onto the tail of the queue
-	//If there's no space left, nothing will be registered, return(false)
-	//to purge, write 0
-	int writeQueue;
-	if (queue == 0){  //purge queue
-		for (writeQueue = 0; writeQueue < EXITQUEUELENGTH; writeQueue++){
-			exitQueue[writeQueue] = 0;
-		}
-		activeExit = 0;
-		setExitModeDisplay(0);	//stop any flashing indication
-		return(true);
-	} else {
-		for (writeQueue = 0; writeQueue < EXITQUEUELENGTH; writeQueue++){
-			if (exitQueue[writeQueue] == 0){  //empty queue position
-				exitQueue[writeQueue] = queue;
-				return(true);
-			}
-		}
-	}
-	return(false);
-}
-
-byte IO::getFromQueue(){
-	//fetch the next exit request from the queue
-	byte valToPop = exitQueue[0];
-	//move all the others nearer the front
-	for (int popIndex = 0; popIndex < EXITQUEUELENGTH - 1; popIndex++){
-		exitQueue[popIndex] = exitQueue[popIndex + 1];
-	}
-	exitQueue[EXITQUEUELENGTH-1] = 0;
-	activeExit = valToPop;  //only used by isThisSidingQueued
-	return valToPop;
-}
-
-bool IO::isThisSidingQueued(byte siding){
-	//find out if this siding is already in the queue or active
-	for (int isqIndex = 0; isqIndex < EXITQUEUELENGTH; isqIndex++){
-		byte isqVal = exitQueue[isqIndex];
-		if ((isqVal != 0) && ((isqVal & 0x0F) == siding)) {
-			return(true);  //this siding is queued
-		}
-		if ((activeExit != 0) && ((activeExit & 0x0F) == siding)) {
-			return(true);  //this siding is active
-		}
-
-	}
-	return false;
-}
-
-bool IO::queueNotEmpty() {
-	//return true if there's something there
-	return (exitQueue[0] != 0);
-}
-
-void IO::clearActiveExit(){
-	//forget what we are doing in Exit state machine
-	activeExit = 0;
-}
-
-
-
-//================================================================
-//                      User buttons - source
-//================================================================
-
-
-//Digital control line assignments
-const int buttonBase = 20;   //buttons must be in sequence
-const int upButton = 20;       //D20 =1
-const int downButton = 21;     //D21 =2
-const int mainButton = 22;     //D22 =4
-const int goodsButton = 23;    //D23 =8
-const int branchButton = 24;   //D24 =16
-const int throughButton = 25;  //D25 =32 
-
-
-Buttons::Buttons()  //constructor
-{
-
-}
-
-
-
-
-void Buttons::init()  //initialise the counters
-{
-	buttonPins = previousPins = bounceCount = lastAnnouncedValue = 0;
-}
-
-/////////////  This bit isn't done yet! ///////////////
-
-String Buttons::poll() {
-	// Act just once on each button-press, returning the strings indicated below to say what's happened
-
-	struct key {    //See K&R p.124
-		String keyWord;
-		unsigned int keyVal;
-	} keytab[] = {
-		"Up 1", 0x0001,
-		"Down 1", 0x0002,
-		"Main 1", 0x0004,
-		"Goods 1", 0x0008,
-		"Branch 1", 0x0010,
-		"Through 1", 0x0020,
-		"Up 0", 0x0100,
-		"Down 0", 0x0200,
-		"Main 0", 0x0400,
-		"Goods 0", 0x0800,
-		"Branch 0", 0x1000,
-		"Through 0", 0x2000,
-		"Test 1", 0x0003,  //Up and Down together
-		"Test 1", 0x0103,  //necessary because Up may get pressed first
-		"Test 1", 0x0203,  // or Down
-		"Cancel 1", 0x0028,  //Thru and Goods together
-		"Cancel 1", 0x0228,   //needed in case Thru pressed first
-		"Cancel 1", 0x0828,   //needed in case Goods pressed first 
-
-		//you can add more key functions here if you need
-		"X", 0xFFFF
-	};
-
-	buttonPins = (1 - digitalRead(upButton));  //Up = bit 0
-	buttonPins += (1 - digitalRead(downButton)) * 2;   //Down = bit 1
-	buttonPins += (1 - digitalRead(mainButton)) * 4;   //Main = bit 2
-	buttonPins += (1 - digitalRead(goodsButton)) * 8;   //Goods = bit 3
-	buttonPins += (1 - digitalRead(branchButton)) * 16;   //Branch = bit 4
-	buttonPins += (1 - digitalRead(throughButton)) * 32;   //Through = bit 5
-
-	if (buttonPins == previousPins) {
-		bounceCount++;
-	}
-	else {
-		bounceCount = 0;    //not stable
-		previousPins = buttonPins;
-	}
-	if (bounceCount == 3){   //it's been this way for at least 80mS
-		if (buttonPins != lastAnnouncedValue) {   //this is news
-			unsigned int newAndOld = buttonPins + (lastAnnouncedValue *256);   //show previous state in msb
-			lastAnnouncedValue = buttonPins;
-			bounceCount = 0;
-			for (int z = 0; keytab[z].keyWord != "X"; z++){
-				if (keytab[z].keyVal == newAndOld) {
-					return(keytab[z].keyWord);
-				}
-			}
-//			return("Error");   //only do this if you need to flag illegal key combinations
-			return("");
-
-/*			String result = "";  //only do this to diagnose hardware issues
-			for (int z = 0; z < 16; z++){
-				result = (String)bitRead(newAndOld, z) + result;
-			}
-			return(result);  
-*/		}
-	}
-	return("");
-
-}
-
-
-//================================================================
-//                      State machines - source
-//================================================================
-
-
-State::State(int machine)  //constructor
-{
-	_machine = machine;
-}
-
-/* A copy of myState[] is held in EEPROM, using 3*256 bytes, to minimise
-  wear on the EEPROM.  Only the LSB is significant (==0 for this state 
-  being current).  The EEPROM is only read on power-up. 
-  
-  The MSB of myState is set if we are not entering this state for the first
-  time (so only 127 states are possible for each State Machine).
-  */
-
-const int nvStates = 0x100;  //where we store the non-volatile states
-//MERGE = 0x100...0x17f
-//ENTER = 0x180...0x1ff
-//EXIT  = 0x200...0x27f
-
-void State::init(bool clearVars)  //initialise the state machines
-{
-	if (clearVars){
-		for (int x = 0; x < 0x80; x++){
-			EEPROM.update(nvStates + (0x080 * (_machine - 1)) + x, 0xFF);
-			delay(EEPROMupdateTime);
-		}
-	}
-	//fetch current state from nv memory, set RAM state to agree
-	myState[_machine] = 0;   //initial state = 0
-	int y;
-	for (y = 0; y < 0x80; y++){
-		if (bitRead(EEPROM.read(nvStates + (0x080 * (_machine - 1)) + y), 0) == false){
-			delay(1);
-			myState[_machine] = y;
-			break;
-		}
-	}
-}
-
-void State::moveToState(byte newState) {
-
-	//if newState is the same as the existing state, then set MSB
-	byte oldState = myState[_machine];
-	//remove existing nv state
-	EEPROM.update(nvStates + (0x100 * (_machine - 1)) + oldState, 0xFF);
-	delay(EEPROMupdateTime);
-	if ((oldState & 0x7F) == newState) {
-		myState[_machine] = (newState + 128);   //change the state in RAM, show not 1st time
-
-	} else {
-		myState[_machine] = newState ;   //change the state in RAM
-	}
-	//save it to nv memory too - but without the msb set - so always first time on power up
-	EEPROM.update(nvStates + (0x080 * (_machine - 1)) + (myState[_machine] & 0x7F), 0xFE);
-	delay(EEPROMupdateTime);
-}
-
-
-byte State::fetch() {  //fetch the current value of the state
-
-	return myState[_machine];
-}
-
-
-
-//================================================================
-//                      Timers - source
-//================================================================
-
-
-Timer::Timer(int myTime)  //constructor
-{
-	_myTime = myTime;
-}
-
-void Timer::init(unsigned int seconds)  //initialise the timer
-{
-	counter[_myTime] = seconds;
-	expiredFlag[_myTime] = false;
-}
-
-
-void Timer::tick() {  //come here every second
-	if (counter[_myTime] > 0) {    //if timer is running
-		if (--counter[_myTime] == 0) {
-			expiredFlag[_myTime] = true;   //only if 1->0
-		}
-	}
-}
-
-bool Timer::expired() {     //this will only indicated expiry ONCE per timer initialisation
-	if (expiredFlag[_myTime] == true) {
-		expiredFlag[_myTime] = false;
-		return(true);
-	}
-	return(false);
-}
-
-
-//================================================================
-//                      Beeper - source
-//================================================================
-
-Beeper::Beeper()  //constructor
-{
-}
-
-
-void Beeper::out(unsigned int milliseconds)  
-{
-  //Note that this does not hold the program up!!
-  //...but it does need interrupts enabled!
-	tone(BEEPPIN, 1000, (unsigned long)milliseconds);    //1kHz
-}
-
-
-
-//================================================================
-//                      LCD routines - source
-//================================================================
-
-// LCD code from http://www.arduino.cc/en/Tutorial/LiquidCrystal
-
-// include the library code:
-#include <LiquidCrystal.h>
-// construct the lcd with the numbers of the interface pins
-LiquidCrystal lcd(30, 32, 31, 37, 38, 39, 40);
-
-
-Display::Display()  //constructor
-{
-
-}
-
-
-
-
-void Display::init(bool testMode)  //initialise the display
-{
-	if (testMode) {
-		Serial.begin(9600);
-		delay(1000);  // see http://www.arduino.cc/cgi-bin/yabb2/YaBB.pl?num=1289878242 
-	}
-	// set up the LCD's number of columns and rows: 
-	lcd.begin(16, 2);    //set size of display
-	_bottomLine = "          ";
-	_testMode = testMode;
-}
-
-
-void Display::out(String text) {
-	//print to the LCD display and perhaps the serial port
-
-	/*Special characters are:
-	'!' at the end of a line (causes a beep)
-	'$' at the start of the line suppresses LF, but only if 
-	    '$' also at the start of the current bottom line
-	'|' in the text causes a CRLF.
-	A string should not contain both '$' and '|'.
-	*/
-
-	int nlPos = -1;
-	String temp = text;
-	if (temp.endsWith("!")) {    //indicates an error
-		tone(BEEPPIN, 1000, 250);    //500Hz, 300mS
-	}
-
-	bool noLF = ((temp.startsWith("$")) && (_bottomLine.startsWith("$")));
-
-	while (temp.length() > 0) {  //while there is some text
-
-		if (noLF == false) {   //unless we're going to overwrite
-			//move bottom line to top
-			lcd.setCursor(0, 0);
-			lcd.print((_bottomLine + "                 ").substring(0, 16));
-		}
-
-		//now do bottom line
-		nlPos = temp.indexOf ('|');
-		if (nlPos > -1) {   // if there is a newline,
-			if (nlPos > 0) {
-				_bottomLine = temp.substring(0, nlPos);   //split it there
-			}
-			else {
-				_bottomLine = "";   //if \n is first char
-			}
-			if ((int)temp.length() > nlPos) {
-				temp = temp.substring(nlPos + 1);
-			}
-			else {
-				temp = "";
-			}
-		}
-		else {
-			_bottomLine = temp;  //otherwise, display the whole string
-			temp = "";
-		}
-		lcd.setCursor(0, 1);
-		lcd.print((_bottomLine + "                 ").substring(0, 16));
-
-		if (_testMode) {
-			Serial.println(_bottomLine);
-			delay(1000);   //give time for buffer to empty so as not to upset debug
-			//but note that this will make all timings wrong, so strictly for debugging!
-		}
-	}
-}
-
-
-
-void Display::tick()  //update the display every second if necessary
-{
-
-}
+/*
+Hardware input/output routines for Will's Train Layout
+Author: Chris Moller, chris.moller@evonet.com, Aug2015
+
+v.3.0.18 02Mar2018
+Changed if to while in line 66 - 07Nov2019
+*/
+
+#include "Arduino.h"
+#include "EEPROM.h"
+#include "WillsIO.h"
+#include <LiquidCrystal.h>
+
+#define BEEPPIN 6
+
+//The Arduino seems to need this for stable operation
+#define EEPROMupdateTime 7
+
+static unsigned long nvWriteCount = 0;
+static unsigned long blockedCount = 0;
+
+void blockFor(unsigned int milliseconds) {
+	//delay(), but keep count of how long we've spent doing nothing
+	delay(milliseconds);
+	blockedCount += milliseconds * 1000UL;
+}
+
+void blockForMicros(unsigned int microseconds) {
+	delayMicroseconds(microseconds);
+	blockedCount += microseconds;
+}
+
+unsigned long blockedMicros() {
+	return(blockedCount);
+}
+
+void nvUpdate(unsigned int address, byte value) {
+	//write a byte to EEPROM only if it has changed, and count it if it has
+	//No need to wait for stability if nothing was written
+	if (EEPROM.read(address) != value) {
+		EEPROM.write(address, value);
+		nvWriteCount++;
+		blockFor(EEPROMupdateTime);
+	}
+}
+
+bool nvDrain(unsigned int address, byte value) {
+	//Stats, Transit and Trace save in the background, a byte at a time, and stop for this tick
+	// as soon as one has really been written - a write takes 3.3mS, so one is all a tick can spare
+	if (EEPROM.read(address) == value) {
+		return(false);
+	}
+	nvUpdate(address, value);
+	return(true);
+}
+
+unsigned long nvWrites() {
+	return(nvWriteCount);
+}
+
+
+//================================================================
+//                      RFID routines - source
+//================================================================
+
+
+// Note that you should not use RFID chips with the lsb = 0x00,0xFF as these have special meanings
+// Also, only use one RFID chip with each lsb value - this is the only byte that is significant
+
+
+RFID::RFID(byte port)  //constructor
+{
+	_port = port;
+}
+
+
+void RFID::init()  //initialise the I/O
+{
+	switch (_port) {
+	case 0:
+		Serial.begin(9600);
+		break;
+	case 1:
+		Serial1.begin(9600);
+		break;
+	case 2:
+		Serial2.begin(9600);
+		break;
+	case 3:
+		Serial3.begin(9600);
+		break;
+	default:  //take no action unless port is 0...3
+		break;
+	}
+	//there will be four copies of these private variables:
+	charsRead[_port] = 0xFF;
+	buildString[_port] = "";
+	heard[_port] = "";
+}
+
+
+String RFID::poll() {
+	//return a complete RFID string if one has arrived, otherwise ""
+	// This routine is called every logic tick
+
+	drain();   //in case the RFID task has not run since the last character
+	String result = heard[_port];
+	heard[_port] = "";
+	return(result);
+}
+
+
+void RFID::drain() {
+
+	//Check the serial port, and if there is a char, build the RFID string.  
+	// If we get to 12 chars, keep it for poll()
+	// This routine could also be used for the USB serial port
+
+	// This routine is called every 2mS, so that the UART never overflows
+	//  however long the logic takes
+
+	byte val = 0;  //the character read
+	
+	//Find out if the UART has a character available
+	// - but leave it there if the last string has not been collected yet
+	while ((heard[_port] == "") && (rfidAvailable() > 0)) {
+		val = rfidRead();		//get the char
+
+
+		if (charsRead[_port] == 0xFF) {   //we have not yet started
+			if (val == 0x02) {                  // header starts 
+				charsRead[_port] = 0;
+				buildString[_port] = "";
+			}		//any other char before start - throw away
+		}
+		else {    //we have already started
+			buildString[_port] += char(val);
+			charsRead[_port]++;
+
+			if ((charsRead[_port] == 12) || (val < '0')) {
+				if (charsRead[_port] < 12) {
+					buildString[_port] += String("**Error");
+				}
+
+				charsRead[_port] = 0xFF;  //start over
+				heard[_port] = buildString[_port];
+				buildString[_port] = "";
+			}
+		}
+	}  // nothing available
+}
+
+
+byte RFID::rfidAvailable() {
+	//Find out if the UART has a character available
+	// whichRfid can be 1 (=Pin19=RFIDIn), 2(=Pin17=RFIDOut), 3 (=Pin15=RFIDIn2 for railcar detect)
+	switch (_port) {
+	case 0:
+		return Serial.available();
+	case 1:
+		return Serial1.available();
+	case 2:
+		return Serial2.available();
+	case 3:
+		return Serial3.available();
+	default:
+		return(-1);
+	}
+}
+
+byte RFID::rfidRead() {
+	//Read a byte from the correct RFID
+	switch (_port) {
+	case 0:
+		return Serial.read();
+	case 1:
+		return Serial1.read();
+	case 2:
+		return Serial2.read();
+	case 3:
+		return Serial3.read();
+	default:
+		return(-1);
+	}
+}
+
+
+
+//================================================================
+//                      Shift Register I/O routines - source
+//================================================================
+
+
+//tested - see IOtest.ino
+
+
+//EXIT modes - these refer to sidingMode
+#define THROUGH 0x80
+#define MAIN 0x10
+#define GOODS 0x20
+#define BRANCH 0x40
+
+
+IO::IO(bool dummy)  //constructor
+{
+	//	_dummy = dummy;
+}
+
+// RFC Pin assignments
+const int STROBE = 3;
+const int CLOCK = 2;
+const int DATAOUT = 4;
+const int DATAIN = 5;
+const byte pinPoints[PINPOINTS] = { 9, 10, 11, 12, 8 };   //Stop25...Stop28, then STOP17 = point 29
+
+//EEPROM memory map
+const unsigned int EEpoint = 0x000;   //base address for EEpoint[32];  xx00...xx1F
+//const unsigned int StoredTrain = 0x020;   //base address for StoredTrain[8];  xx20...xx27
+const unsigned int EEpointExt = 0x300;   //points 33 upwards;  x300...x37F
+
+static unsigned int pointAddress(byte pointNo) {
+	//where the non-volatile copy of a point 1...MAXPOINTS lives
+	if (pointNo <= 32) {
+		return(EEpoint + pointNo - 1);
+	}
+	return(EEpointExt + pointNo - 33);
+}
+
+void IO::init(bool clearVars)  //initialise the I/O
+{
+	//initilalise the hardware
+	pinMode(STROBE, OUTPUT);
+	pinMode(CLOCK, OUTPUT);
+	pinMode(DATAOUT, OUTPUT);
+	pinMode(DATAIN, INPUT);
+	for (int pinIndex = 0; pinIndex < PINPOINTS; pinIndex++) {
+		pinMode(pinPoints[pinIndex], OUTPUT);   //Stop25...Stop28, STOP17
+	}
+	pinMode(26, OUTPUT);  //pin 26 = MAIN LED indicator
+	pinMode(27, OUTPUT);  //pin 27 = GOODS
+	pinMode(28, OUTPUT);  //pin 28 = BRANCH
+	pinMode(29, OUTPUT);  //pin 29 = THROUGH
+
+	//The DPR boards all have their relays in the same strange order,
+	// so build the order for the whole chain from the order for one board
+	const byte mapDPR[] = { 6, 4, 2, 0, 7, 5, 3, 1 };
+	for (int shiftIndex = 0; shiftIndex < SHIFTLENGTH; shiftIndex++) {
+		byte board = shiftIndex / 8;
+		if (board >= PINSLOT) {
+			board++;   //skip the points on the Arduino pins
+		}
+		shiftMap[shiftIndex] = (board * 8) + mapDPR[shiftIndex % 8];
+	}
+	blinker = false;
+   
+	if (clearVars) {	//zero pointValues and set EEPROM to 0xFFh
+		for (int x = 0; x < POINTBYTES; x++) {
+			pointValues[x] = 0;
+		}
+		for (int x = 0; x < 40; x++){
+			nvUpdate(EEpoint + x, 0xFF);  //0xFF is what EEPROM contains if never written
+		}
+		for (int x = 33; x <= MAXPOINTS; x++){
+			nvUpdate(pointAddress(x), 0xFF);
+		}
+	}
+
+	addToQueue(0);		//initialise the queue
+
+	//copy EEPROM values into pointValues
+	for (int y = 0; y < MAXPOINTS; y++){
+		if (getPoint(y+1)){
+			bitWrite(pointValues[y / 8], y % 8, 1);
+		}
+		else {
+			bitWrite(pointValues[y / 8], y % 8, 0);
+		}
+	}
+
+	//nothing goes out to the points until the scan interrupt has been given them
+	stepNo = 0;
+	totiSeq = 0;
+	shadowIndex = 0;
+	publishPoints();
+
+
+}
+
+
+bool IO::updater() {
+	//Hand the point values to the scan interrupt,
+	// and take the TOTI values from the last exchange it finished
+	publishPoints();
+
+	byte seq;
+	byte snapshot[TOTIBYTES];
+	do {   //if an exchange finishes while we copy, copy again
+		seq = totiSeq;
+		for (int x = 0; x < TOTIBYTES; x++) {
+			snapshot[x] = publishedTotis[x];
+		}
+	} while (seq != totiSeq);
+
+	//compare what was read, not the count of exchanges - the count wraps every 256, about 1.3S
+	bool changed = false;
+	for (int x = 0; x < TOTIBYTES; x++) {
+		if (totiValues[x] != snapshot[x]) {
+			totiValues[x] = snapshot[x];
+			changed = true;
+		}
+	}
+	return(changed);
+}
+
+void IO::publishPoints() {
+	//fill the buffer the interrupt isn't using, then swap - one byte, so the swap is atomic
+	// Points set together in one tick therefore go out together
+	byte next = 1 - shadowIndex;
+	for (int x = 0; x < POINTBYTES; x++) {
+		shadowPoints[next][x] = pointValues[x];
+	}
+	shadowIndex = next;
+	pointsChanged = false;
+}
+
+void IO::scanStep() {
+	//Send point values out to points and get current TOTI values in, one step at a time,
+	// so that the relays are refreshed every 5mS however long loop() takes
+	// Steps 0,1 reset the DPR board shift registers, each relay takes 4 steps, then 2 to latch
+	const unsigned int lastStep = 4 * SHIFTLENGTH + 3;
+
+	if (stepNo == 0) {
+		//start an exchange with the last set of points we were given
+		byte index = shadowIndex;
+		for (int x = 0; x < POINTBYTES; x++) {
+			scanPoints[x] = shadowPoints[index][x];
+		}
+		scanStart = micros();
+
+		//the points/stop sections on the Arduino pins (25-29) can go straight out
+		for (int pinIndex = 0; pinIndex < PINPOINTS; pinIndex++) {
+			if (bitRead(scanPoints[PINSLOT], pinIndex)) {
+				digitalWrite(pinPoints[pinIndex], HIGH);
+			}
+			else {
+				digitalWrite(pinPoints[pinIndex], LOW);
+			}
+		}
+		digitalWrite(STROBE, HIGH);
+	}
+	else if (stepNo == 1) {
+		digitalWrite(STROBE, LOW);
+	}
+	else if (stepNo < lastStep - 1) {
+		byte shiftIndex = (stepNo - 2) / 4;
+		switch ((stepNo - 2) % 4) {
+		case 0: {   //clock out the point value to the DPR boards
+			byte pointBit = shiftMap[shiftIndex];
+			if (bitRead(scanPoints[pointBit / 8], pointBit % 8)) {
+				digitalWrite(DATAOUT, HIGH);
+			}
+			else {
+				digitalWrite(DATAOUT, LOW);
+			}
+			break;
+		}
+		case 1: {   //load in the Toti value
+			// change the next line if the sense of TOTI o/p is wrong
+			byte totiBit = SHIFTLENGTH - 1 - shiftIndex;
+			bitWrite(scanTotis[totiBit / 8], totiBit % 8, 1 - digitalRead(DATAIN));
+			break;
+		}
+		case 2:
+			digitalWrite(CLOCK, HIGH);
+			break;
+		default:
+			digitalWrite(CLOCK, LOW);
+			break;
+		}
+	}
+	else if (stepNo == lastStep - 1) {
+		digitalWrite(STROBE, HIGH);
+	}
+	else {
+		digitalWrite(STROBE, LOW);
+		for (int x = 0; x < TOTIBYTES; x++) {
+			publishedTotis[x] = scanTotis[x];
+		}
+		totiSeq++;
+		scanMicros = micros() - scanStart;
+		stepNo = 0;
+		return;
+	}
+	stepNo++;
+}
+
+bool IO::pointsPending() {
+	return(pointsChanged);
+}
+
+void IO::blink() {
+	//come here every half second
+	blinker = !blinker;
+	showExitMode();
+}
+
+void IO::showExitMode() {
+	//update the Exit Mode display
+	//bits are THROUGH | BRANCH | GOODS | MAIN | THROUGH FLASH | BRANCH FLASH | GOODS FLASH | MAIN FLASH
+	//           pin29 | pin28  | pin27 | pin26
+	bool pinVal;
+	for (int modeIndex = 0; modeIndex < 4; modeIndex++) {  //for each destination
+		if (bitRead(exitModeDisplay, modeIndex + 4)) {   //get the bit
+			if (bitRead(exitModeDisplay, modeIndex)) {
+				pinVal = blinker;
+			} else { 
+				pinVal = true;
+			}
+		}
+		else {
+			pinVal = false;
+		}
+		digitalWrite(26 + modeIndex, pinVal);
+		//pin 26 = MAIN
+		//pin 27 = GOODS
+		//pin 28 = BRANCH
+		//pin 29 = THROUGH
+	}
+}
+
+
+bool IO::testToti(byte totiNo) {
+	//return whether a TOTI section is occupied
+	if ((totiNo == 0) || (totiNo > MAXTOTIS)) {
+		return(false);   //no such TOTI
+	}
+	byte totiNo1 = totiNo - 1;
+	return(bitRead(totiValues[totiNo1 / 8], totiNo1 % 8));
+}
+
+void IO::setP1(byte pointNo, bool set) {
+//set a point 1...MAXPOINTS to the value of SET
+  
+  if ((pointNo == 0) || (pointNo > MAXPOINTS)) {
+    return;   //no such point
+  }
+  byte pointNo1 = pointNo - 1;
+  if (bitRead(pointValues[pointNo1 / 8], pointNo1 % 8) != set) {
+    pointsChanged = true;   //so that the scan can be brought forward
+  }
+  bitWrite(pointValues[pointNo1 / 8], pointNo1 % 8, set);   //will take effect on next update()
+  //nvUpdate's delay needed to be increased from 4, 2020-01-22, as Arduino was continually resetting
+  if (set){
+    nvUpdate(pointAddress(pointNo), 0xFE);  //make a non-volatile copy
+  }
+  else {
+    nvUpdate(pointAddress(pointNo), 0xFF);  //make a non-volatile copy
+  }
+}
+
+void IO::setPoint(byte pointNo, bool set){
+  //set or unset the specified point
+  //If point 0 is specified, clear all siding entry points
+  if (pointNo == 0 ) {
+    for (int spCount = 8; spCount >0; spCount--){
+      setP1(spCount,false);
+    }
+  }
+  else {
+    setP1(pointNo,set);
+  }
+}
+
+void IO::setPoints(unsigned long setMask, unsigned long clearMask) {
+  //set and clear points 1...32 together - bit 0 is point 1, and set wins if a point is in both masks
+  //pointValues changes in one go, so the scan sends all of them or none,
+  // and only points that actually change are written to EEPROM
+  unsigned long was = 0;
+  for (int x = 0; x < 4 && x < POINTBYTES; x++) {
+    was |= (unsigned long)pointValues[x] << (8 * x);
+  }
+  unsigned long now = (was & ~clearMask) | setMask;
+  unsigned long changed = was ^ now;
+  if (changed == 0) {
+    return;   //the route is already set
+  }
+  for (int x = 0; x < 4 && x < POINTBYTES; x++) {
+    pointValues[x] = (now >> (8 * x)) & 0xFF;
+  }
+  pointsChanged = true;
+
+  for (byte pointNo = 1; pointNo <= 32 && pointNo <= MAXPOINTS; pointNo++) {
+    if (bitRead(changed, pointNo - 1)) {
+      if (bitRead(now, pointNo - 1)) {
+        nvUpdate(pointAddress(pointNo), 0xFE);  //make a non-volatile copy
+      }
+      else {
+        nvUpdate(pointAddress(pointNo), 0xFF);  //make a non-volatile copy
+      }
+    }
+  }
+}
+
+bool IO :: getPoint(byte pointNo) {   
+//return whether a point is set or clear
+	// - relies on lsb of value in EEPROM being correctly set
+	// pointNo = 1...MAXPOINTS
+	if ((pointNo == 0) || (pointNo > MAXPOINTS)) {
+		return(false);   //no such point
+	}
+	byte pointVal = EEPROM.read(pointAddress(pointNo));
+	blockFor(1);
+	if (bitRead(pointVal,0)) {
+		return(false);
+	}
+	else {
+		return(true);
+	}
+}
+
+bool IO::pointExists(byte pointNo) {
+	//points 1...24 and 33 upwards are on DPR boards, but only some of 25...32 are wired
+	if ((pointNo == 0) || (pointNo > MAXPOINTS)) {
+		return(false);
+	}
+	if ((pointNo > PINSLOT * 8 + PINPOINTS) && (pointNo <= (PINSLOT + 1) * 8)) {
+		return(false);
+	}
+	return(true);
+}
+
+bool IO::testPoint(byte pointNo) {
+	//return whether a point is set, without the EEPROM read of getPoint()
+	if ((pointNo == 0) || (pointNo > MAXPOINTS)) {
+		return(false);   //no such point
+	}
+	byte pointNo1 = pointNo - 1;
+	return(bitRead(pointValues[pointNo1 / 8], pointNo1 % 8));
+}
+
+byte IO::totiByte(byte index) {
+	return(totiValues[index]);
+}
+
+void IO::setTotiByte(byte index, byte value) {
+	//when replaying a trace, what was recorded replaces what updater() has just read
+	totiValues[index] = value;
+}
+
+unsigned int IO::scanTime() {
+	//how long the last exchange took, to see what adding DPR boards costs
+	byte oldSREG = SREG;
+	cli();   //the interrupt mustn't change it between the two bytes
+	unsigned int took = scanMicros;
+	SREG = oldSREG;
+	return(took);
+}
+
+
+void IO::setExitModeDisplay(byte myExit){
+	//Set the LEDs on the control panel from the queue
+	//Set flashing the LED from myExit, which is the value just retrieved from the queue
+	//Values for activeMode are:
+	//Siding n to MAIN = 0x1n
+	//Siding n to GOODS = 0x2n
+	//Siding n to BRANCH = 0x4n
+	//THROUGH to MAIN = 0x90
+	//THROUGH to GOODS = 0xA0
+	//THROUGH to BRANCH = 0xC0
+	//Nothing yet active = 0x00
+
+	// MSN of mode = destination, LSN = source
+	// exit mode bits are mostly set from the queue, but also set from the activeMode parameter
+	// if a bit is set from activeMode, it will also be set to flash
+	// MSN uses ExitMode values (eg MAIN = 0X10)
+	//if activeMode Siding (lsn) = 0, set THROUGH flashing as well
+
+	exitModeDisplay = 0;
+	//set exitModeDisplay MSN based on destinations stored in the queue
+	for (int queueIndex = 0; queueIndex < EXITQUEUELENGTH; queueIndex++){
+		exitModeDisplay = exitModeDisplay | (exitQueue[queueIndex] & 0xF0);  //set if there's something queued to this exit, strip siding
+	}
+	//Now determine which if any is flashing
+	exitModeDisplay = exitModeDisplay | (myExit & 0xF0);  //Add currently active destination
+	exitModeDisplay = exitModeDisplay | ((myExit & 0xF0) >> 4);  //Set currently active destination to flash
+
+	showExitMode();  //update now, and flash from the next blink()
+}
+
+
+bool IO::addToQueue(byte queue) {
+/*The queue consists of bytes with the MSN specifying the exit mode,
+  the LSN the siding to despatch from.  exitQueue[0] is the next active entry */
+
+//add an exit request onto the tail of the queue
+	//If there's no space left, nothing will be registered, return(false)
+	//to purge, write 0
+	int writeQueue;
+	if (queue == 0){  //purge queue
+		for (writeQueue = 0; writeQueue < EXITQUEUELENGTH; writeQueue++){
+			exitQueue[writeQueue] = 0;
+		}
+		activeExit = 0;
+		setExitModeDisplay(0);	//stop any flashing indication
+		return(true);
+	} else {
+		for (writeQueue = 0; writeQueue < EXITQUEUELENGTH; writeQueue++){
+			if (exitQueue[writeQueue] == 0){  //empty queue position
+				exitQueue[writeQueue] = queue;
+				return(true);
+			}
+		}
+	}
+	return(false);
+}
+
+byte IO::getFromQueue(){
+	//fetch the next exit request from the queue
+	byte valToPop = exitQueue[0];
+	//move all the others nearer the front
+	for (int popIndex = 0; popIndex < EXITQUEUELENGTH - 1; popIndex++){
+		exitQueue[popIndex] = exitQueue[popIndex + 1];
+	}
+	exitQueue[EXITQUEUELENGTH-1] = 0;
+	activeExit = valToPop;  //only used by isThisSidingQueued
+	return valToPop;
+}
+
+bool IO::isThisSidingQueued(byte siding){
+	//find out if this siding is already in the queue or active
+	for (int isqIndex = 0; isqIndex < EXITQUEUELENGTH; isqIndex++){
+		byte isqVal = exitQueue[isqIndex];
+		if ((isqVal != 0) && ((isqVal & 0x0F) == siding)) {
+			return(true);  //this siding is queued
+		}
+		if ((activeExit != 0) && ((activeExit & 0x0F) == siding)) {
+			return(true);  //this siding is active
+		}
+
+	}
+	return false;
+}
+
+byte IO::queueEntry(byte index) {
+	if (index >= EXITQUEUELENGTH) {
+		return(0);
+	}
+	return(exitQueue[index]);
+}
+
+bool IO::queueNotEmpty() {
+	//return true if there's something there
+	return (exitQueue[0] != 0);
+}
+
+void IO::clearActiveExit(){
+	//forget what we are doing in Exit state machine
+	activeExit = 0;
+}
+
+
+
+//================================================================
+//                      User buttons - source
+//================================================================
+
+
+//Digital control line assignments
+const int buttonBase = 20;   //buttons must be in sequence
+const int upButton = 20;       //D20 =1
+const int downButton = 21;     //D21 =2
+const int mainButton = 22;     //D22 =4
+const int goodsButton = 23;    //D23 =8
+const int branchButton = 24;   //D24 =16
+const int throughButton = 25;  //D25 =32 
+
+
+Buttons::Buttons()  //constructor
+{
+
+}
+
+
+
+
+void Buttons::init()  //initialise the counters
+{
+	buttonPins = previousPins = stableMs = lastAnnouncedValue = 0;
+	lastPoll = millis();
+}
+
+/////////////  This bit isn't done yet! ///////////////
+
+unsigned int Buttons::readPins() {
+	unsigned int pins;
+	pins = (1 - digitalRead(upButton));  //Up = bit 0
+	pins += (1 - digitalRead(downButton)) * 2;   //Down = bit 1
+	pins += (1 - digitalRead(mainButton)) * 4;   //Main = bit 2
+	pins += (1 - digitalRead(goodsButton)) * 8;   //Goods = bit 3
+	pins += (1 - digitalRead(branchButton)) * 16;   //Branch = bit 4
+	pins += (1 - digitalRead(throughButton)) * 32;   //Through = bit 5
+	return(pins);
+}
+
+String Buttons::poll() {
+	unsigned long now = millis();
+	unsigned long ms = now - lastPoll;
+	lastPoll = now;
+	return(poll(readPins(), (ms > BOUNCEMS) ? BOUNCEMS : ms));
+}
+
+String Buttons::poll(unsigned int pins, unsigned int ms) {
+	// Act just once on each button-press, returning the strings indicated below to say what's happened
+
+	static const struct key {    //See K&R p.124 - built once, and a String only made for a match
+		const char* keyWord;
+		unsigned int keyVal;
+	} keytab[] = {
+		"Up 1", 0x0001,
+		"Down 1", 0x0002,
+		"Main 1", 0x0004,
+		"Goods 1", 0x0008,
+		"Branch 1", 0x0010,
+		"Through 1", 0x0020,
+		"Up 0", 0x0100,
+		"Down 0", 0x0200,
+		"Main 0", 0x0400,
+		"Goods 0", 0x0800,
+		"Branch 0", 0x1000,
+		"Through 0", 0x2000,
+		"Test 1", 0x0003,  //Up and Down together
+		"Test 1", 0x0103,  //necessary because Up may get pressed first
+		"Test 1", 0x0203,  // or Down
+		"Cancel 1", 0x0028,  //Thru and Goods together
+		"Cancel 1", 0x0228,   //needed in case Thru pressed first
+		"Cancel 1", 0x0828,   //needed in case Goods pressed first 
+		//In Test mode, Up, Down, Main and Branch on their own only change the display, so whichever of
+		// a pair built from them is pressed first, nothing happens until the pair is complete
+		"Bench 1", 0x0014,  //Main and Branch together
+		"Bench 1", 0x0414,
+		"Bench 1", 0x1014,
+		"Baseline 1", 0x0006,  //Down and Main together
+		"Baseline 1", 0x0206,
+		"Baseline 1", 0x0406,
+		"Export 1", 0x0005,  //Up and Main together
+		"Export 1", 0x0105,
+		"Export 1", 0x0405,
+		"Reset 1", 0x0012,  //Down and Branch together
+		"Reset 1", 0x0212,
+		"Reset 1", 0x1012,
+
+		//you can add more key functions here if you need
+		"X", 0xFFFF
+	};
+
+	buttonPins = pins;
+
+	//debounce on time, not on polls - a TOTI change brings the poll forward, so polls aren't always 20mS apart
+	if (buttonPins == previousPins) {
+		if (stableMs < BOUNCEMS) stableMs += ms;
+	}
+	else {
+		stableMs = 0;    //not stable
+		previousPins = buttonPins;
+	}
+	if (stableMs >= BOUNCEMS){   //it's been this way for at least BOUNCEMS
+		if (buttonPins != lastAnnouncedValue) {   //this is news
+			unsigned int newAndOld = buttonPins + (lastAnnouncedValue *256);   //show previous state in msb
+			lastAnnouncedValue = buttonPins;
+			for (int z = 0; keytab[z].keyVal != 0xFFFF; z++){
+				if (keytab[z].keyVal == newAndOld) {
+					return((String)keytab[z].keyWord);
+				}
+			}
+//			return("Error");   //only do this if you need to flag illegal key combinations
+			return("");
+
+/*			String result = "";  //only do this to diagnose hardware issues
+			for (int z = 0; z < 16; z++){
+				result = (String)bitRead(newAndOld, z) + result;
+			}
+			return(result);  
+*/		}
+	}
+	return("");
+
+}
+
+
+//================================================================
+//                      State machines - source
+//================================================================
+
+
+State::State(int machine)  //constructor
+{
+	_machine = machine;
+}
+
+/* A copy of myState[] is held in EEPROM, using 3*256 bytes, to minimise
+  wear on the EEPROM.  Only the LSB is significant (==0 for this state 
+  being current).  The EEPROM is only read on power-up. 
+  
+  The MSB of myState is set if we are not entering this state for the first
+  time (so only 127 states are possible for each State Machine).
+  */
+
+const int nvStates = 0x100;  //where we store the non-volatile states
+//MERGE = 0x100...0x17f
+//ENTER = 0x180...0x1ff
+//EXIT  = 0x200...0x27f
+
+void State::init(bool clearVars)  //initialise the state machines
+{
+	if (clearVars){
+		for (int x = 0; x < 0x80; x++){
+			nvUpdate(nvStates + (0x080 * (_machine - 1)) + x, 0xFF);
+		}
+	}
+	//fetch current state from nv memory, set RAM state to agree
+	myState[_machine] = 0;   //initial state = 0
+	int y;
+	for (y = 0; y < 0x80; y++){
+		if (bitRead(EEPROM.read(nvStates + (0x080 * (_machine - 1)) + y), 0) == false){
+			blockFor(1);
+			myState[_machine] = y;
+			break;
+		}
+	}
+	//earlier versions cleared the old state in the wrong place, so tidy up any others
+	for (y = y + 1; y < 0x80; y++){
+		if (bitRead(EEPROM.read(nvStates + (0x080 * (_machine - 1)) + y), 0) == false){
+			nvUpdate(nvStates + (0x080 * (_machine - 1)) + y, 0xFF);
+		}
+	}
+}
+
+void State::moveToState(byte newState) {
+
+	//if newState is the same as the existing state, then set MSB
+	byte oldState = myState[_machine];
+	if ((oldState & 0x7F) == newState) {
+		myState[_machine] = (newState + 128);   //change the state in RAM, show not 1st time
+		return;   //nv memory doesn't have the msb, so it already has this state
+	}
+	myState[_machine] = newState ;   //change the state in RAM
+	//remove existing nv state
+	nvUpdate(nvStates + (0x080 * (_machine - 1)) + (oldState & 0x7F), 0xFF);
+	//save it to nv memory too - but without the msb set - so always first time on power up
+	nvUpdate(nvStates + (0x080 * (_machine - 1)) + newState, 0xFE);
+}
+
+
+void State::restore(byte newState) {
+	//set the state in RAM and EEPROM, with the msb clear as it would be after power-up
+	for (int x = 0; x < 0x80; x++){
+		nvUpdate(nvStates + (0x080 * (_machine - 1)) + x, ((x == (newState & 0x7F)) ? 0xFE : 0xFF));
+	}
+	myState[_machine] = newState & 0x7F;
+}
+
+
+byte State::fetch() {  //fetch the current value of the state
+
+	return myState[_machine];
+}
+
+
+
+//================================================================
+//                      Timers - source
+//================================================================
+
+
+Timer::Timer(int myTime)  //constructor
+{
+	_myTime = myTime;
+}
+
+void Timer::init(unsigned int seconds)  //initialise the timer
+{
+	counter[_myTime] = seconds;
+	expiredFlag[_myTime] = false;
+}
+
+
+void Timer::tick() {  //come here every second
+	if (counter[_myTime] > 0) {    //if timer is running
+		if (--counter[_myTime] == 0) {
+			expiredFlag[_myTime] = true;   //only if 1->0
+		}
+	}
+}
+
+bool Timer::expired() {     //this will only indicated expiry ONCE per timer initialisation
+	if (expiredFlag[_myTime] == true) {
+		expiredFlag[_myTime] = false;
+		return(true);
+	}
+	return(false);
+}
+
+
+//================================================================
+//                      Task scheduler - source
+//================================================================
+
+//Tasks are run in the order loop() asks about them, one per pass, so a long task delays the others
+// by at most its own length.  A task that falls a whole period behind skips the missed runs.
+
+Scheduler::Scheduler()  //constructor
+{
+
+}
+
+void Scheduler::init(byte task, unsigned int period, unsigned int deadline) {
+	periodUs[task] = period * 1000UL;
+	deadlineUs[task] = deadline * 1000UL;
+	nextRun[task] = micros();
+	lastRun[task] = nextRun[task] - periodUs[task];
+	triggered[task] = false;
+	carryUs[task] = 0;
+	missCount[task] = 0;
+	worst[task] = 0;
+}
+
+bool Scheduler::due(byte task) {
+	unsigned long now = micros();
+	if (!triggered[task] && ((long)(now - nextRun[task]) < 0)) {
+		return(false);   //not yet
+	}
+	if (!triggered[task]) {   //only count lateness against the timetable
+		unsigned long late = now - nextRun[task];
+		if (late > worst[task]) worst[task] = late;
+		if (late > deadlineUs[task]) missCount[task]++;
+	}
+	triggered[task] = false;
+	carryUs[task] += now - lastRun[task];
+	lastRun[task] = now;
+	nextRun[task] += periodUs[task];
+	if ((long)(now - nextRun[task]) >= 0) {   //a whole period behind - don't try to catch up
+		nextRun[task] = now + periodUs[task];
+	}
+	return(true);
+}
+
+void Scheduler::trigger(byte task) {
+	triggered[task] = true;
+}
+
+unsigned int Scheduler::elapsed(byte task, unsigned int nominal, unsigned int slack) {
+	//whole milliseconds only, so without the carry the clocks built on this would lose the fractions
+	long ms = nominal;
+	if (labs(carryUs[task] - (nominal * 1000L)) > (slack * 1000L)) {
+		ms = (carryUs[task] < 0) ? 0 : carryUs[task] / 1000;
+	}
+	carryUs[task] -= ms * 1000L;
+	if (ms > 0xFFFF) ms = 0xFFFF;
+	return(ms);
+}
+
+unsigned int Scheduler::misses(byte task) {
+	return(missCount[task]);
+}
+
+unsigned long Scheduler::worstLate(byte task) {
+	return(worst[task]);
+}
+
+void Scheduler::clear() {
+	for (int task = 0; task < TASKS; task++) {
+		missCount[task] = 0;
+		worst[task] = 0;
+	}
+}
+
+
+//================================================================
+//                      Statistics - source
+//================================================================
+
+//upper limits of the wait time histogram bins, in milliseconds
+const unsigned long waitBinLimit[WAITBINS] = { 500, 1000, 2000, 5000, 10000, 30000, 60000, 0xFFFFFFFF };
+
+Stats::Stats()  //constructor
+{
+}
+
+const unsigned int EEstats = 0x500;   //'A', size (2 bytes), StatsData
+static_assert(sizeof(StatsData) <= 0x200 - 3, "The statistics checkpoint must fit in 0x500...0x6FF");
+
+void Stats::init()  //zero everything
+{
+	clockMs = 0;
+	reset();
+	for (int stop = 0; stop < STATSTOPS; stop++) {
+		waitState[stop] = 0;
+		waitStart[stop] = 0;
+	}
+	for (int x = 0; x < TOTIBYTES; x++) {
+		lastTotis[x] = 0;
+	}
+	lastContended = false;
+	saveIndex = sizeof(saved) + 4;   //nothing to save
+}
+
+void Stats::reset()
+{
+	//anything being timed carries on from now, as the other machines are timing from the same clock
+	byte* bytes = (byte*)&data;
+	for (unsigned int x = 0; x < sizeof(data); x++) {
+		bytes[x] = 0;
+	}
+	for (byte toti = 0; toti < MAXTOTIS; toti++) {
+		occupiedSince[toti] = clockMs;
+	}
+	contendedSince = clockMs;
+}
+
+bool Stats::load() {
+	if ((EEPROM.read(EEstats) != 'A') || (EEPROM.read(EEstats + 1) != (sizeof(data) & 0xFF))
+		|| (EEPROM.read(EEstats + 2) != (sizeof(data) >> 8))) {
+		return(false);   //never saved, or saved by a different version
+	}
+	byte* bytes = (byte*)&data;
+	for (unsigned int x = 0; x < sizeof(data); x++) {
+		bytes[x] = EEPROM.read(EEstats + 3 + x);
+	}
+	return(true);
+}
+
+void Stats::tick(unsigned int milliseconds) {
+	//keep our own time, so we only count the time the yard is running
+	data.now += milliseconds;
+	clockMs += milliseconds;
+}
+
+void Stats::watchStop(byte stop, bool waiting, bool released) {
+	//time how long a train waits at a stop section before the stop relay lets it go
+	if (!waiting) {
+		waitState[stop] = 0;   //train gone (or never let go)
+		return;
+	}
+	if (waitState[stop] == 0) {   //train has just arrived
+		waitState[stop] = 1;
+		waitStart[stop] = clockMs;
+	}
+	if ((waitState[stop] == 1) && released) {   //train has just been let go
+		waitState[stop] = 2;   //only count it once
+		unsigned long waited = clockMs - waitStart[stop];
+		data.waitTotal[stop] += waited;
+		int bin = 0;
+		while (waited > waitBinLimit[bin]) {
+			bin++;
+		}
+		data.waitBins[stop][bin]++;
+	}
+}
+
+void Stats::trainDone(byte machine) {
+	data.trainCount[machine & 0x03]++;
+}
+
+void Stats::exceptionTime(byte machine, unsigned int milliseconds) {
+	data.exceptionMs[machine & 0x03] += milliseconds;
+}
+
+void Stats::watchTotis(byte index, byte totis) {
+	//only the TOTIs that have changed cost anything
+	byte changed = totis ^ lastTotis[index];
+	lastTotis[index] = totis;
+	for (int bit = 0; changed != 0; bit++, changed >>= 1) {
+		if (changed & 0x01) {
+			byte toti = (index * 8) + bit;
+			if (bitRead(totis, bit)) {
+				occupiedSince[toti] = clockMs;
+			}
+			else {
+				data.totiMs[toti] += clockMs - occupiedSince[toti];
+			}
+		}
+	}
+}
+
+void Stats::sidingIn(byte siding) {
+	if (siding < 9) data.sidingIn[siding]++;
+}
+
+void Stats::sidingOut(byte siding, byte route) {
+	if (siding < 9) data.sidingOut[siding]++;
+	if (route < 3) data.despatches[route]++;
+}
+
+void Stats::watchContention(bool waiting) {
+	if (waiting && !lastContended) {
+		data.contentions++;
+		contendedSince = clockMs;
+	}
+	if (!waiting && lastContended) {
+		data.contendedMs += clockMs - contendedSince;
+	}
+	lastContended = waiting;
+}
+
+void Stats::checkpoint() {
+	saved = data;
+	saveIndex = 0;
+}
+
+bool Stats::drain() {
+	//The 'A' is spoilt before the data is touched, and put back after the size, so that a checkpoint
+	// cut short by a power cut is never loaded
+	byte* bytes = (byte*)&saved;
+	while (saveIndex < sizeof(saved) + 4) {
+		unsigned int address;
+		byte value;
+		if (saveIndex == 0) {
+			address = EEstats;
+			value = 0;
+		}
+		else if (saveIndex <= sizeof(saved)) {
+			address = EEstats + 2 + saveIndex;
+			value = bytes[saveIndex - 1];
+		}
+		else if (saveIndex == sizeof(saved) + 1) {
+			address = EEstats + 1;
+			value = sizeof(saved) & 0xFF;
+		}
+		else if (saveIndex == sizeof(saved) + 2) {
+			address = EEstats + 2;
+			value = sizeof(saved) >> 8;
+		}
+		else {
+			address = EEstats;
+			value = 'A';
+		}
+		saveIndex++;
+		if (nvDrain(address, value)) {
+			return(true);
+		}
+	}
+	return(false);
+}
+
+void Stats::send() {
+	//this waits for the serial port, so only do it in Test mode
+	Serial.begin(9600);
+	byte* bytes = (byte*)&data;
+	byte sum = 0;
+	Serial.write('A');
+	Serial.write(sizeof(data) & 0xFF);
+	Serial.write(sizeof(data) >> 8);
+	for (unsigned int x = 0; x < sizeof(data); x++) {
+		Serial.write(bytes[x]);
+		sum += bytes[x];
+	}
+	Serial.write(sum);
+}
+
+unsigned long Stats::upTime() {
+	return(clockMs);
+}
+
+unsigned long Stats::counted() {
+	return(data.now);
+}
+
+unsigned int Stats::perHour(unsigned long count) {
+	if (data.now < 60000UL) {
+		return(0);   //not enough time to say yet
+	}
+	return((count * 60UL) / (data.now / 60000UL));
+}
+
+unsigned int Stats::trains(byte machine) {
+	return(data.trainCount[machine & 0x03]);
+}
+
+unsigned long Stats::meanWait(byte stop) {
+	unsigned long waits = 0;
+	for (int bin = 0; bin < WAITBINS; bin++) {
+		waits += data.waitBins[stop][bin];
+	}
+	if (waits == 0) {
+		return(0);
+	}
+	return(data.waitTotal[stop] / waits);
+}
+
+unsigned long Stats::p95Wait(byte stop) {
+	//find the bin in which the 95th percentile falls, and return its upper limit
+	unsigned long waits = 0;
+	for (int bin = 0; bin < WAITBINS; bin++) {
+		waits += data.waitBins[stop][bin];
+	}
+	if (waits == 0) {
+		return(0);
+	}
+	unsigned long sofar = 0;
+	for (int bin = 0; bin < WAITBINS; bin++) {
+		sofar += data.waitBins[stop][bin];
+		if ((sofar * 100) >= (waits * 95)) {
+			return(waitBinLimit[bin]);
+		}
+	}
+	return(0);
+}
+
+unsigned long Stats::exceptions(byte machine) {
+	return(data.exceptionMs[machine & 0x03]);
+}
+
+unsigned long Stats::occupied(byte totiNo) {
+	if ((totiNo == 0) || (totiNo > MAXTOTIS)) {
+		return(0);   //no such TOTI
+	}
+	byte toti = totiNo - 1;
+	unsigned long total = data.totiMs[toti];
+	if (bitRead(lastTotis[toti / 8], toti % 8)) {
+		total += clockMs - occupiedSince[toti];   //still occupied
+	}
+	return(total);
+}
+
+unsigned int Stats::sidingMoves(byte siding) {
+	if (siding > 8) {
+		return(0);
+	}
+	return(data.sidingIn[siding] + data.sidingOut[siding]);
+}
+
+unsigned int Stats::despatched(byte route) {
+	if (route > 2) {
+		return(0);
+	}
+	return(data.despatches[route]);
+}
+
+unsigned int Stats::contended() {
+	return(data.contentions);
+}
+
+unsigned long Stats::contendedTime() {
+	unsigned long total = data.contendedMs;
+	if (lastContended) {
+		total += clockMs - contendedSince;
+	}
+	return(total);
+}
+
+
+//================================================================
+//                      Move timings - source
+//================================================================
+
+//Each move keeps an exponentially weighted mean and variance of how long it takes (1/8 weight to the
+// newest move), and times out when it has taken longer than that percentage of moves usually do
+
+const unsigned int EEmoves = 0x400;   //'R', then MOVES entries of 10 bytes
+const byte zTable[5][2] = { { 80, 8 }, { 90, 13 }, { 95, 16 }, { 98, 21 }, { 99, 23 } };   //percentile, z in tenths
+
+Transit::Transit()  //constructor
+{
+
+}
+
+void Transit::init(byte percentile, bool clearAll) {
+	z = zTable[4][1];
+	for (int x = 4; x >= 0; x--) {
+		if (percentile <= zTable[x][0]) {
+			z = zTable[x][1];
+		}
+	}
+	for (int machine = 0; machine < 4; machine++) {
+		pendingKey[machine] = 0xFF;
+	}
+	dirty = 0;
+	saveEntry = 0;
+	saveIndex = 0;
+
+	if (clearAll || (EEPROM.read(EEmoves) != 'R')) {
+		for (int entry = 0; entry < MOVES; entry++) {
+			moveKey[entry] = 0xFF;
+			moveCount[entry] = 0;
+			bitSet(dirty, entry);
+		}
+		nvUpdate(EEmoves, 'R');
+		return;
+	}
+	for (int entry = 0; entry < MOVES; entry++) {
+		unsigned int address = EEmoves + 1 + (entry * 10);
+		moveKey[entry] = EEPROM.read(address);
+		moveRoute[entry] = EEPROM.read(address + 1);
+		moveCount[entry] = EEPROM.read(address + 2);
+		moveMean[entry] = EEPROM.read(address + 3) | ((unsigned int)EEPROM.read(address + 4) << 8);
+		moveVar[entry] = 0;
+		for (int x = 3; x >= 0; x--) {
+			moveVar[entry] = (moveVar[entry] << 8) | EEPROM.read(address + 5 + x);
+		}
+	}
+}
+
+int Transit::find(byte key, byte route) {
+	for (int entry = 0; entry < MOVES; entry++) {
+		if ((moveKey[entry] == key) && (moveRoute[entry] == route)) {
+			return(entry);
+		}
+	}
+	return(-1);
+}
+
+void Transit::start(byte machine, byte state, byte route, unsigned long now) {
+	machine &= 0x03;
+	pendingKey[machine] = (machine << 5) | (state & 0x1F);
+	pendingRoute[machine] = route;
+	pendingStart[machine] = now;
+}
+
+void Transit::cancel(byte machine) {
+	pendingKey[machine & 0x03] = 0xFF;
+}
+
+void Transit::done(byte machine, byte state, unsigned long now) {
+	machine &= 0x03;
+	byte key = (machine << 5) | (state & 0x1F);
+	if (pendingKey[machine] != key) {
+		return;   //we weren't timing this move
+	}
+	pendingKey[machine] = 0xFF;
+	byte route = pendingRoute[machine];
+	long took = (now - pendingStart[machine]) / 100;   //tenths of a second
+	if (took > 20000) took = 20000;
+
+	int entry = find(key, route);
+	if (entry < 0) {   //a new move - use an empty entry, or else the one we know least about
+		entry = 0;
+		for (int x = 1; x < MOVES; x++) {
+			if ((moveKey[entry] != 0xFF) && ((moveKey[x] == 0xFF) || (moveCount[x] < moveCount[entry]))) {
+				entry = x;
+			}
+		}
+		moveKey[entry] = key;
+		moveRoute[entry] = route;
+		moveCount[entry] = 0;
+	}
+
+	if (moveCount[entry] == 0) {
+		moveMean[entry] = took;
+		moveVar[entry] = 0;
+	}
+	else {
+		long diff = took - (long)moveMean[entry];
+		moveMean[entry] = moveMean[entry] + (diff / 8);
+		moveVar[entry] = (7 * (moveVar[entry] + ((unsigned long)(diff * diff) / 8))) / 8;
+	}
+	if (moveCount[entry] < 255) moveCount[entry]++;
+	bitSet(dirty, entry);
+	if (entry == saveEntry) {
+		saveIndex = 0;   //half saved, so start it again
+	}
+}
+
+static unsigned long squareRoot(unsigned long value) {
+	//integer square root, a bit of the answer at a time - 16 steps at most, whatever the value
+	unsigned long root = 0;
+	unsigned long bit = 1UL << 30;   //the highest power of 4 in 32 bits
+	while (bit > value) {
+		bit >>= 2;
+	}
+	while (bit != 0) {
+		if (value >= root + bit) {
+			value -= root + bit;
+			root = (root >> 1) + bit;
+		}
+		else {
+			root >>= 1;
+		}
+		bit >>= 2;
+	}
+	return(root);
+}
+
+unsigned int Transit::timeout(byte machine, byte state, byte route, unsigned int fallback) {
+	int entry = find(((machine & 0x03) << 5) | (state & 0x1F), route);
+	if ((entry < 0) || (moveCount[entry] < MINMOVES)) {
+		return(fallback);   //not learnt yet
+	}
+	unsigned long sd = squareRoot(moveVar[entry]);   //tenths of a second
+	unsigned long allow = moveMean[entry] + ((sd * z) / 10);   //tenths of a second
+	unsigned int seconds = (allow + 9) / 10;
+	if (seconds < 5) seconds = 5;   //TOTIs and drivers aren't that precise
+	return(seconds);
+}
+
+unsigned int Transit::mean(byte machine, byte state, byte route) {
+	int entry = find(((machine & 0x03) << 5) | (state & 0x1F), route);
+	if (entry < 0) {
+		return(0);
+	}
+	return(moveMean[entry]);
+}
+
+byte Transit::learnt() {
+	byte trusted = 0;
+	for (int entry = 0; entry < MOVES; entry++) {
+		if ((moveKey[entry] != 0xFF) && (moveCount[entry] >= MINMOVES)) {
+			trusted++;
+		}
+	}
+	return(trusted);
+}
+
+byte Transit::snapshot(unsigned int x) {
+	return(entryByte(x / 10, x % 10));
+}
+
+void Transit::restore(unsigned int x, byte value) {
+	//the reverse of entryByte()
+	byte entry = x / 10;
+	byte index = x % 10;
+	switch (index) {
+	case 0:   //an entry's bytes come in order, so start it afresh
+		moveKey[entry] = value;
+		moveMean[entry] = 0;
+		moveVar[entry] = 0;
+		break;
+	case 1:
+		moveRoute[entry] = value;
+		break;
+	case 2:
+		moveCount[entry] = value;
+		break;
+	case 3:
+	case 4:
+		moveMean[entry] = (moveMean[entry] & ~(0xFFU << (8 * (index - 3)))) | ((unsigned int)value << (8 * (index - 3)));
+		break;
+	case 9:
+		break;   //spare
+	default:
+		moveVar[entry] = (moveVar[entry] & ~(0xFFUL << (8 * (index - 5)))) | ((unsigned long)value << (8 * (index - 5)));
+		break;
+	}
+	bitSet(dirty, entry);   //EEPROM goes back as it was too
+}
+
+byte Transit::entryByte(byte entry, byte index) {
+	switch (index) {
+	case 0:
+		return(moveKey[entry]);
+	case 1:
+		return(moveRoute[entry]);
+	case 2:
+		return(moveCount[entry]);
+	case 3:
+	case 4:
+		return((moveMean[entry] >> (8 * (index - 3))) & 0xFF);
+	case 9:
+		return(0xFF);   //spare
+	default:
+		return((moveVar[entry] >> (8 * (index - 5))) & 0xFF);
+	}
+}
+
+bool Transit::drain() {
+	if (dirty == 0) {
+		return(false);
+	}
+	while (!bitRead(dirty, saveEntry)) {   //find the next entry to save
+		saveIndex = 0;
+		if (++saveEntry == MOVES) saveEntry = 0;
+	}
+	while (saveIndex < 10) {
+		unsigned int address = EEmoves + 1 + (saveEntry * 10) + saveIndex;
+		byte value = entryByte(saveEntry, saveIndex++);
+		if (nvDrain(address, value)) {
+			return(true);
+		}
+	}
+	saveIndex = 0;
+	bitClear(dirty, saveEntry);
+	return(false);
+}
+
+
+//================================================================
+//                      Merge arbitration - source
+//================================================================
+
+//Each approach ages while its train is held, so whichever policy is used, a train that has waited
+// long enough always wins. Ties go to the approach after the one served last.
+
+Arbiter::Arbiter()  //constructor
+{
+
+}
+
+void Arbiter::init(byte newPolicy) {
+	policy = newPolicy;
+	last = APPROACHES - 1;   //so that ties start with Main
+	for (int approach = 0; approach < APPROACHES; approach++) {
+		share[approach] = 1;
+		waitMs[approach] = 0;
+		longestMs[approach] = 0;
+		servedTimes[approach] = 0;
+	}
+}
+
+void Arbiter::weight(byte approach, byte newShare) {
+	if (approach < APPROACHES) {
+		share[approach] = (newShare == 0) ? 1 : newShare;
+	}
+}
+
+void Arbiter::tick(unsigned int milliseconds, byte held) {
+	for (int approach = 0; approach < APPROACHES; approach++) {
+		if (bitRead(held, approach)) {
+			waitMs[approach] += milliseconds;
+			if (waitMs[approach] > longestMs[approach]) {
+				longestMs[approach] = waitMs[approach];
+			}
+		}
+		else {
+			waitMs[approach] = 0;
+		}
+	}
+}
+
+byte Arbiter::choose(byte eligible, const unsigned int expected[APPROACHES]) {
+	byte best = 0xFF;
+	long bestScore = 0;
+	for (int x = 1; x <= APPROACHES; x++) {
+		byte approach = (last + x) % APPROACHES;
+		if (!bitRead(eligible, approach)) continue;
+		long score;
+		if (policy == ARBSHORTEST) {
+			score = (long)waitMs[approach] - ((long)expected[approach] * 100L);
+		}
+		else {
+			score = (long)(waitMs[approach] * share[approach]);
+		}
+		if ((best == 0xFF) || (score > bestScore)) {
+			best = approach;
+			bestScore = score;
+		}
+	}
+	return(best);
+}
+
+void Arbiter::served(byte approach) {
+	if (approach < APPROACHES) {
+		last = approach;
+		servedTimes[approach]++;
+	}
+}
+
+unsigned long Arbiter::waiting(byte approach) {
+	return(waitMs[approach]);
+}
+
+unsigned long Arbiter::longest(byte approach) {
+	return(longestMs[approach]);
+}
+
+unsigned int Arbiter::servedCount(byte approach) {
+	return(servedTimes[approach]);
+}
+
+
+//================================================================
+//                      Train tracking - source
+//================================================================
+
+//A train is moved when the TOTI it has been routed to becomes occupied, and forgotten when the TOTI
+// its front is in clears with nowhere left to go. A train nobody expected is followed from where it appears.
+
+Tracker::Tracker()  //constructor
+{
+
+}
+
+void Tracker::init() {
+	for (int train = 0; train < TRAINS; train++) {
+		trainId[train] = 0xFF;
+		trainAt[train] = 0;
+		expects[train] = 0;
+	}
+	for (int totiNo = 0; totiNo <= MAXTOTIS; totiNo++) {
+		inToti[totiNo] = NOTRAIN;
+		comingTo[totiNo] = NOTRAIN;
+	}
+	for (int index = 0; index < TOTIBYTES; index++) {
+		lastTotis[index] = 0;
+		tracked[index] = 0;
+	}
+	heardToti = 0;
+}
+
+void Tracker::track(byte totiNo, bool follow) {
+	if ((totiNo > 0) && (totiNo <= MAXTOTIS)) {
+		bitWrite(tracked[(totiNo - 1) / 8], (totiNo - 1) % 8, follow);
+	}
+}
+
+void Tracker::watch(byte index, byte totis) {
+	//only the TOTIs that have changed cost anything - arrivals first, so that a train moving
+	// from one TOTI to the next is moved before the one it is leaving clears
+	byte changed = (totis ^ lastTotis[index]) & tracked[index];
+	lastTotis[index] = totis;
+	for (int bit = 0; bit < 8; bit++) {
+		if (bitRead(changed, bit) && bitRead(totis, bit)) {
+			arrive((index * 8) + bit + 1);
+		}
+	}
+	for (int bit = 0; bit < 8; bit++) {
+		if (bitRead(changed, bit) && !bitRead(totis, bit)) {
+			leave((index * 8) + bit + 1);
+		}
+	}
+}
+
+void Tracker::arrive(byte totiNo) {
+	byte train = comingTo[totiNo];
+	if (train != NOTRAIN) {   //the train we routed here
+		comingTo[totiNo] = NOTRAIN;
+		expects[train]--;
+		if (inToti[trainAt[train]] == train) {
+			inToti[trainAt[train]] = NOTRAIN;
+		}
+		trainAt[train] = totiNo;
+		inToti[totiNo] = train;
+		return;
+	}
+	if (inToti[totiNo] != NOTRAIN) {
+		return;
+	}
+	for (train = 0; train < TRAINS; train++) {   //one we didn't expect, so start following it
+		if (trainAt[train] == 0) {
+			trainAt[train] = totiNo;
+			trainId[train] = 0xFF;
+			if (heardToti == totiNo) {
+				trainId[train] = heardId;
+				heardToti = 0;
+			}
+			inToti[totiNo] = train;
+			return;
+		}
+	}
+}
+
+void Tracker::leave(byte totiNo) {
+	byte train = inToti[totiNo];
+	if ((train != NOTRAIN) && (expects[train] == 0)) {   //gone, and not to anywhere we sent it
+		inToti[totiNo] = NOTRAIN;
+		trainAt[train] = 0;
+		trainId[train] = 0xFF;
+	}
+}
+
+void Tracker::expect(byte train, byte totiNo) {
+	if ((train >= TRAINS) || (totiNo == 0) || (totiNo > MAXTOTIS) || (comingTo[totiNo] == train)) {
+		return;
+	}
+	if (comingTo[totiNo] != NOTRAIN) {
+		expects[comingTo[totiNo]]--;   //it can't be both of them
+	}
+	comingTo[totiNo] = train;
+	expects[train]++;
+}
+
+void Tracker::cancel(byte train) {
+	if ((train >= TRAINS) || (expects[train] == 0)) {
+		return;
+	}
+	for (int totiNo = 1; totiNo <= MAXTOTIS; totiNo++) {
+		if (comingTo[totiNo] == train) {
+			comingTo[totiNo] = NOTRAIN;
+		}
+	}
+	expects[train] = 0;
+	byte totiNo = trainAt[train];
+	if ((totiNo != 0) && !bitRead(lastTotis[(totiNo - 1) / 8], (totiNo - 1) % 8)) {
+		leave(totiNo);   //it had already left where it was
+	}
+}
+
+void Tracker::heard(byte totiNo, byte id) {
+	//a train we already know can't be renamed by a tag heard for the one behind it
+	byte train = inToti[totiNo];
+	if ((train != NOTRAIN) && ((trainId[train] == 0xFF) || (trainId[train] == id))) {
+		trainId[train] = id;
+		return;
+	}
+	heardToti = totiNo;
+	heardId = id;
+}
+
+void Tracker::name(byte train, byte id) {
+	if (train < TRAINS) {
+		trainId[train] = id;
+	}
+}
+
+byte Tracker::at(byte totiNo) {
+	if (totiNo > MAXTOTIS) {
+		return(NOTRAIN);
+	}
+	return(inToti[totiNo]);
+}
+
+byte Tracker::id(byte train) {
+	if (train >= TRAINS) {
+		return(0xFF);
+	}
+	return(trainId[train]);
+}
+
+byte Tracker::where(byte train) {
+	if (train >= TRAINS) {
+		return(0);
+	}
+	return(trainAt[train]);
+}
+
+byte Tracker::trains() {
+	byte count = 0;
+	for (int train = 0; train < TRAINS; train++) {
+		if (trainAt[train] != 0) count++;
+	}
+	return(count);
+}
+
+
+//================================================================
+//                      Input trace - source
+//================================================================
+
+//EEPROM memory map
+const unsigned int EEtrace = 0x800;   //trace recording;  x800...xFFF
+const unsigned int EEtraceEnd = 0x1000;
+
+Trace::Trace()  //constructor
+{
+}
+
+void Trace::init(byte mode, bool useSerial)
+{
+	_mode = mode;
+	_useSerial = useSerial;
+	_overflow = false;
+	_address = EEtrace;
+	fifoIn = fifoOut = 0;
+	idleTicks = 0;
+	for (int x = 0; x < TOTIBYTES; x++) {
+		totis[x] = lastTotis[x] = 0;
+	}
+	buttonPins = lastButtons = 0;
+	writeEnabled = lastWriteEnabled = false;
+	tickMs = 20;
+	for (int port = 0; port < 4; port++) {
+		rfid[port] = "";
+	}
+	if ((mode != TRACEOFF) && useSerial) {
+		Serial.begin(9600);   //binary, so not with DEBUG
+	}
+}
+
+bool Trace::recording() {
+	return(_mode == TRACERECORD);
+}
+
+bool Trace::replaying() {
+	return(_mode == TRACEREPLAY);
+}
+
+bool Trace::overflowed() {
+	return(_overflow);
+}
+
+void Trace::putByte(byte value) {
+	//queue a byte for drain() to send out
+	byte newIn = (fifoIn + 1) % TRACEBUFFER;
+	if (newIn == fifoOut) {   //no room - a partial recording is no use for replay, so stop
+		_overflow = true;
+		_mode = TRACEOFF;
+		return;
+	}
+	fifo[fifoIn] = value;
+	fifoIn = newIn;
+}
+
+void Trace::putWaiting(byte value) {
+	//the recording starts with more than the buffer holds, so send some out first
+	while ((((fifoIn + 1) % TRACEBUFFER) == fifoOut) && (_mode == TRACERECORD)) {
+		drain();
+	}
+	putByte(value);
+}
+
+byte Trace::getByte() {
+	if (_useSerial) {
+		unsigned long waitStart = millis();
+		while (Serial.available() == 0) {   //replaying, so there's no hurry
+			if (millis() - waitStart > 1000) {
+				return(0xFF);   //take it that the recording has finished
+			}
+		}
+		return(Serial.read());
+	}
+	if (_address >= EEtraceEnd) {
+		return(0xFF);
+	}
+	return(EEPROM.read(_address++));
+}
+
+void Trace::flushIdle() {
+	if (idleTicks > 63) {
+		putByte(0xC0 + (idleTicks >> 8));
+		putByte(idleTicks & 0xFF);
+	}
+	else if (idleTicks > 0) {
+		putByte(0x80 + idleTicks);
+	}
+	idleTicks = 0;
+}
+
+void Trace::record() {
+	//put this tick's inputs into the recording, as only what has changed
+	byte header = 0;
+	byte changedTotis = 0;
+	for (int x = 0; x < TOTIBYTES; x++) {
+		if (totis[x] != lastTotis[x]) {
+			bitSet(changedTotis, x);
+		}
+	}
+	if (changedTotis != 0) header |= 0x01;
+	if (buttonPins != lastButtons) header |= 0x02;
+	if (writeEnabled) header |= 0x04;
+	for (int port = 1; port < 4; port++) {
+		if (rfid[port].length() > 0) header |= (0x04 << port);
+	}
+	if (tickMs != 20) header |= 0x40;
+
+	if (((header & 0x7B) == 0) && (writeEnabled == lastWriteEnabled)) {   //nothing new
+		if (++idleTicks == TRACEIDLEMAX) {
+			flushIdle();
+		}
+		return;
+	}
+
+	flushIdle();
+	putByte(header);
+	if (changedTotis != 0) {
+		putByte(changedTotis);
+		for (int x = 0; x < TOTIBYTES; x++) {
+			if (bitRead(changedTotis, x)) {
+				putByte(totis[x]);
+				lastTotis[x] = totis[x];
+			}
+		}
+	}
+	if (header & 0x02) {
+		putByte(buttonPins);
+		lastButtons = buttonPins;
+	}
+	lastWriteEnabled = writeEnabled;
+	if (header & 0x40) {
+		putByte(tickMs);
+	}
+	for (int port = 1; port < 4; port++) {
+		if (rfid[port].length() > 0) {
+			putByte(rfid[port].length());
+			for (unsigned int x = 0; x < rfid[port].length(); x++) {
+				putByte(rfid[port].charAt(x));
+			}
+			rfid[port] = "";
+		}
+	}
+}
+
+bool Trace::next() {
+	//fetch the inputs for the next tick from the recording
+	for (int port = 1; port < 4; port++) {
+		rfid[port] = "";
+	}
+	tickMs = 20;
+	if (idleTicks > 0) {   //still in a run of ticks when nothing changed
+		idleTicks--;
+		return(true);
+	}
+	byte header = getByte();
+	if (header == 0xFF) {
+		return(false);   //end of the recording
+	}
+	if (header & 0x80) {
+		idleTicks = header & 0x3F;
+		if (header & 0x40) {
+			idleTicks = (idleTicks << 8) + getByte();
+		}
+		idleTicks--;   //this is the first of them
+		return(true);
+	}
+	if (header & 0x01) {
+		byte changedTotis = getByte();
+		for (int x = 0; x < TOTIBYTES; x++) {
+			if (bitRead(changedTotis, x)) {
+				totis[x] = getByte();
+			}
+		}
+	}
+	if (header & 0x02) {
+		buttonPins = getByte();
+	}
+	writeEnabled = ((header & 0x04) != 0);
+	if (header & 0x40) {
+		tickMs = getByte();
+	}
+	for (int port = 1; port < 4; port++) {
+		if (header & (0x04 << port)) {
+			byte length = getByte();
+			for (int x = 0; x < length; x++) {
+				rfid[port] += char(getByte());
+			}
+		}
+	}
+	return(true);
+}
+
+bool Trace::drain() {
+	//Serial goes as fast as the UART buffer allows, without waiting
+	if (_mode != TRACERECORD) {
+		return(false);
+	}
+	if (_useSerial) {
+		while ((fifoOut != fifoIn) && (Serial.availableForWrite() > 0)) {
+			Serial.write(fifo[fifoOut]);
+			fifoOut = (fifoOut + 1) % TRACEBUFFER;
+		}
+		return(false);
+	}
+	if (fifoOut == fifoIn) {
+		return(false);
+	}
+	if (_address >= EEtraceEnd) {   //EEPROM full
+		_overflow = true;
+		_mode = TRACEOFF;
+		return(false);
+	}
+	bool wrote = nvDrain(_address++, fifo[fifoOut]);
+	fifoOut = (fifoOut + 1) % TRACEBUFFER;
+	return(wrote);
+}
+
+void Trace::stop() {
+	//send everything still waiting, then the end mark - stopping can take a few hundred mS
+	//If the buffer overflowed, what is in it may end in half a record, so only the end mark goes
+	if ((_mode != TRACERECORD) && !_overflow) {
+		return;
+	}
+	if (_mode == TRACERECORD) {
+		flushIdle();
+	}
+	while ((fifoOut != fifoIn) && (_mode == TRACERECORD)) {
+		if (_useSerial) {
+			Serial.write(fifo[fifoOut]);   //waits for room
+			fifoOut = (fifoOut + 1) % TRACEBUFFER;
+		}
+		else {
+			drain();
+		}
+	}
+	if (_useSerial) {
+		Serial.write(0xFF);
+	}
+	else if (_address < EEtraceEnd) {
+		nvUpdate(_address, 0xFF);
+	}
+	_mode = TRACEOFF;
+}
+
+
+//================================================================
+//                      Beeper - source
+//================================================================
+
+Beeper::Beeper()  //constructor
+{
+}
+
+
+void Beeper::out(unsigned int milliseconds)  
+{
+  //Note that this does not hold the program up!!
+  //...but it does need interrupts enabled!
+	tone(BEEPPIN, 1000, (unsigned long)milliseconds);    //1kHz
+}
+
+
+
+//================================================================
+//                      LCD routines - source
+//================================================================
+
+// LCD code from http://www.arduino.cc/en/Tutorial/LiquidCrystal
+
+// include the library code:
+#include <LiquidCrystal.h>
+// construct the lcd with the numbers of the interface pins
+LiquidCrystal lcd(30, 32, 31, 37, 38, 39, 40);
+
+
+Display::Display()  //constructor
+{
+
+}
+
+
+
+
+void Display::init(bool testMode)  //initialise the display
+{
+	if (testMode) {
+		Serial.begin(9600);
+		blockFor(1000);  // see http://www.arduino.cc/cgi-bin/yabb2/YaBB.pl?num=1289878242 
+	}
+	// set up the LCD's number of columns and rows: 
+	lcd.begin(16, 2);    //set size of display
+	_bottomLine = "          ";
+	_testMode = testMode;
+}
+
+
+void Display::out(String text) {
+	//print to the LCD display and perhaps the serial port
+
+	/*Special characters are:
+	'!' at the end of a line (causes a beep)
+	'$' at the start of the line suppresses LF, but only if 
+	    '$' also at the start of the current bottom line
+	'|' in the text causes a CRLF.
+	A string should not contain both '$' and '|'.
+	*/
+
+	int nlPos = -1;
+	String temp = text;
+	if (temp.endsWith("!")) {    //indicates an error
+		tone(BEEPPIN, 1000, 250);    //500Hz, 300mS
+	}
+
+	bool noLF = ((temp.startsWith("$")) && (_bottomLine.startsWith("$")));
+
+	while (temp.length() > 0) {  //while there is some text
+
+		if (noLF == false) {   //unless we're going to overwrite
+			//move bottom line to top
+			lcd.setCursor(0, 0);
+			lcd.print((_bottomLine + "                 ").substring(0, 16));
+		}
+
+		//now do bottom line
+		nlPos = temp.indexOf ('|');
+		if (nlPos > -1) {   // if there is a newline,
+			if (nlPos > 0) {
+				_bottomLine = temp.substring(0, nlPos);   //split it there
+			}
+			else {
+				_bottomLine = "";   //if \n is first char
+			}
+			if ((int)temp.length() > nlPos) {
+				temp = temp.substring(nlPos + 1);
+			}
+			else {
+				temp = "";
+			}
+		}
+		else {
+			_bottomLine = temp;  //otherwise, display the whole string
+			temp = "";
+		}
+		lcd.setCursor(0, 1);
+		lcd.print((_bottomLine + "                 ").substring(0, 16));
+
+		if (_testMode) {
+			Serial.println(_bottomLine);
+			blockFor(1000);   //give time for buffer to empty so as not to upset debug
+			//but note that this will make all timings wrong, so strictly for debugging!
+		}
+	}
+}
+
+
+
+void Display::tick()  //update the display every second if necessary
+{
+
+}
+
+
+//================================================================
+//                      Serial commands - source
+//================================================================
+
+//Input is kept until the whole line is there, so a command costs nothing until it is complete.
+// Output goes into a FIFO that drain() empties as fast as the UART buffer allows.
+
+Console::Console()  //constructor
+{
+
+}
+
+void Console::init() {
+	Serial.begin(9600);
+	lineLength = 0;
+	lineReady = false;
+	overflow = false;
+	wordCount = 0;
+	fifoIn = 0;
+	fifoOut = 0;
+}
+
+bool Console::poll() {
+	if (lineReady) {
+		return(true);
+	}
+	while (Serial.available() > 0) {   //never more than the UART buffer holds
+		char c = Serial.read();
+		if ((c == '\n') || (c == '\r')) {
+			if ((lineLength == 0) && !overflow) {
+				continue;   //blank line, or the other half of CR LF
+			}
+			line[lineLength] = 0;
+			split();
+			lineReady = true;
+			return(true);
+		}
+		if (lineLength < CONSOLELINE) {
+			line[lineLength++] = toupper(c);
+		}
+		else {
+			overflow = true;
+		}
+	}
+	return(false);
+}
+
+void Console::split() {
+	//break the line into words in place
+	wordCount = 0;
+	bool inWord = false;
+	for (byte x = 0; x < lineLength; x++) {
+		if ((line[x] == ' ') || (line[x] == ',') || (line[x] == '\t')) {
+			line[x] = 0;
+			inWord = false;
+		}
+		else if (!inWord) {
+			if (wordCount == CONSOLEWORDS) {
+				overflow = true;   //more words than we can keep
+				return;
+			}
+			wordStart[wordCount++] = x;
+			inWord = true;
+		}
+	}
+}
+
+bool Console::tooLong() {
+	return(overflow);
+}
+
+byte Console::words() {
+	return(wordCount);
+}
+
+bool Console::is(byte index, const char* text) {
+	if (index >= wordCount) {
+		return(false);
+	}
+	return(strcmp(&line[wordStart[index]], text) == 0);
+}
+
+int Console::number(byte index) {
+	if (index >= wordCount) {
+		return(-1);
+	}
+	int value = 0;
+	for (const char* c = &line[wordStart[index]]; *c != 0; c++) {
+		if ((*c < '0') || (*c > '9') || (value > 999)) {
+			return(-1);
+		}
+		value = (value * 10) + (*c - '0');
+	}
+	return(value);
+}
+
+char Console::letter(byte index) {
+	if (index >= wordCount) {
+		return(0);
+	}
+	return(line[wordStart[index]]);
+}
+
+void Console::done() {
+	lineLength = 0;
+	lineReady = false;
+	overflow = false;
+	wordCount = 0;
+}
+
+bool Console::print(const char* text) {
+	unsigned int length = strlen(text) + 2;   //and CR LF
+	unsigned int room = (fifoOut + CONSOLEOUT - fifoIn - 1) % CONSOLEOUT;
+	if (length > room) {
+		return(false);
+	}
+	for (const char* c = text; *c != 0; c++) {
+		fifo[fifoIn] = *c;
+		fifoIn = (fifoIn + 1) % CONSOLEOUT;
+	}
+	fifo[fifoIn] = '\r';
+	fifoIn = (fifoIn + 1) % CONSOLEOUT;
+	fifo[fifoIn] = '\n';
+	fifoIn = (fifoIn + 1) % CONSOLEOUT;
+	return(true);
+}
+
+bool Console::print(String text) {
+	return(print(text.c_str()));
+}
+
+void Console::drain() {
+	while ((fifoOut != fifoIn) && (Serial.availableForWrite() > 0)) {
+		Serial.write(fifo[fifoOut]);
+		fifoOut = (fifoOut + 1) % CONSOLEOUT;
+	}
+}
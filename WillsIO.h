@@ -1,213 +1,615 @@
-/*
-Hardware input/output routines for Will's Train Layout
-Author: Chris Moller, chris.moller@evonet.com, Aug2015
-
-v.3.0.18 02Mar2018
-*/
-
-#ifndef WillsIO_h
-#define WillsIO_h
-
-#include "Arduino.h"
-
-
-//================================================================
-//                      RFID routines - headers
-//================================================================
-
-
-// Port can be 1 (=Pin19=RFIDIn), 2(=Pin17=RFIDOut), 3 (=Pin15=RFIDIn2 for railcar detect)
-
-class RFID   //handle all input from the RFID readers on the serial ports
-{
-public:
-	RFID(byte port);
-	void init();   //initialise the I/O
-	String poll();   //poll an RFID, build the internal string, and if complete, return a byte
-		// otherwise, return 0x00h
-
-private:
-	byte _port;
-	byte rfidAvailable();   //retrurn the number of chars in the serial buffer
-	byte rfidRead();    //the next char from the buffer
-	byte charsRead[4];   // char count for each serial port  - 0xFF = not started
-	String buildString[4];		// where the strings for each serial port are built
-};
-
-
-
-//================================================================
-//                      Shift Register I/O routines - headers
-//================================================================
-
-
-class IO   //handle points and TOTIs
-{
-public:
-	IO(bool dummy);
-	void init(bool clearVars);   //initialise the I/O - if clearVars set, empty EEPROM
-		//load point values from EEPROM into RAM
-	void updater();	//ensure hardware and software agree
-
-	bool testToti(byte totiNo);	//return whether a TOTI is occupied
-	void setPoint(byte pointNo, bool set);   //set or clear a point
-	bool getPoint(byte pointNo);  //return whether a point is set
-	bool addToQueue(byte queue);  //push an exit onto the queue (return false if full)
-	byte getFromQueue();   //fetch an exit from the queue 0x00 if nothing
-	bool queueNotEmpty();  //test if there is anything in the queue
-	void setExitModeDisplay(byte myExit);  //set flashing in the Exit Mode Display
-	bool isThisSidingQueued(byte siding); //find out if this siding is already in the queue
-	void clearActiveExit();  //forget what we've just be doing with EXIT
-
-private:
-	unsigned long pointValues;   //bit 0 is point 1, etc.  Off-normal if bit is set
-	unsigned long totiValues;	//bit 0 is toti 1 etc.  Bit set if section occupied
-  void setP1(byte pointNo, bool set);   //set or clear a point
-
-	static bool blinker;
-	int halfSecond = 25;
-#define EXITQUEUELENGTH 4
-	byte exitQueue[EXITQUEUELENGTH];  //lsn=siding#, msn=mode, lowest index goes next
-	byte activeExit;  //last value popped from queue
-
-	//EXIT destinations
-const byte MAIN = 0x10;
-const byte GOODS = 0x20;
-const byte BRANCH = 0x40;
-
-	byte exitModeDisplay = 0;  //MSN bit set as above (from queue), LSN also set if active
-	//bits are THROUGH | BRANCH | GOODS | MAIN | THROUGH FLASH | BRANCH FLASH | GOODS FLASH | MAIN FLASH
-
-	//in EEPROM:
-	//byte EEpoint[32];
-  //byte StoredTrain[8];
-  // at 0x100...0x27F nvStates  
-
-
-
-};
-
-
-
-//================================================================
-//                      User buttons - headers
-//================================================================
-
-
-class Buttons   //handle user buttons
-{
-public:
-	Buttons();
-	void init();   //initialise the counters
-	String poll();	//check statuses
-	/*returned value is a string containing the name of the significant button/function
-	followed by a space and '1' to indicate that the button has just been pressed, 
-	or '0' to indicate its release.  
-	
-	An exmpty string indicates nothing significant has happened.
-
-	The strings are:
-	  Up 
-	  Down
-	  Main
-	  Goods
-	  Branch
-	  Through
-	  Test
-	  */
-
-private:
-	unsigned int buttonPins;    //same bit assignments as output
-	unsigned int bounceCount;
-	unsigned int previousPins;
-	unsigned int lastAnnouncedValue;	  //last non-null output sent
-
-
-};
-
-
-//================================================================
-//                      State machine operation - headers
-//================================================================
-
-
-class State   //handle State Machines
-{
-public:
-	State(int machine);   //1=MERGE, 2=ENTER, 3=EXIT
-	void init(bool clearVars);   //zero timers, fetch states from EEPROM.  If clearVars set, zero EEPROM
-	void moveToState(byte newState);  //move to a new state value
-	byte fetch();  //fetch the current state of this machine
-
-private:
-	int _machine;   //1=MERGE, 2=ENTER, 3=EXIT 
-	byte myState[5];  //if msb clear, then we are just entering the state for the first time
-};
-
-
-//================================================================
-//                      Timers - headers
-//================================================================
-
-
-class Timer   //handle timeouts
-{
-public:
-	Timer(int myTime);
-	void init(unsigned int seconds);   //start timer - set to zero to disable
-	void tick();  //come here once a second, decrement timer, set expired flag TRUE if 1->0 
-	bool expired();  //test expired flag
-
-private:
-	int _myTime;
-	unsigned int counter[10];   //10 timers allowed
-	bool expiredFlag[10];    //if we expired
-
-};
-
-
-//================================================================
-//                      Beeper - headers
-//================================================================
-
-
-class Beeper   //make a noise
-{
-public:
-	Beeper();
-	void out(unsigned int milliseconds);   //sound 1kHz for specified duration
-
-private:
-
-};
-
-
-
-
-
-//================================================================
-//                      LCD routines - headers
-//================================================================
-
-//Tested - see Display.ino
-
-class Display   //output all information messages to the LCD and perhaps the serial port
-{
-public:
-	Display();
-	void init(bool testMode);   //initialise the I/O
-	//You MUST have Test Mode turned off during Visual Studio debugging, or breakpoints won't work!
-
-	void out(String text);  //send the string to the LCD and perhaps the serial port too
-	/*if a single line, then bottom line scrolls up to top line.
-	Linefeeds are indicated by a vertical bar '|', since '\n' causes issues
-	If string contains '|' then both lines are written.  Multiple '|' will only make sense to serial. */
-	void tick();  //Come here every second to update the display if necessary
-private:
-	bool _testMode;  //remember internally whether we're going to output to serial
-	String _bottomLine;  //what we last sent to the bottom line
-	String fifo[4][32];  //text queued up to be displayed by tick()
-//	bool _dummy;
-};
-
-#endif
+/*
+Hardware input/output routines for Will's Train Layout
+Author: Chris Moller, chris.moller@evonet.com, Aug2015
+
+v.3.0.18 02Mar2018
+*/
+
+#ifndef WillsIO_h
+#define WillsIO_h
+
+#include "Arduino.h"
+
+//EEPROM writes - only writes if the value changes, and counts the writes
+void nvUpdate(unsigned int address, byte value);
+bool nvDrain(unsigned int address, byte value);   //one byte of a background save - true if it had to be written
+unsigned long nvWrites();   //how many EEPROM writes since power-up
+
+//Delays - as delay() and delayMicroseconds(), but counting the time spent blocked
+void blockFor(unsigned int milliseconds);
+void blockForMicros(unsigned int microseconds);
+unsigned long blockedMicros();   //how long we've been blocked since power-up
+
+
+//================================================================
+//                      RFID routines - headers
+//================================================================
+
+
+// Port can be 1 (=Pin19=RFIDIn), 2(=Pin17=RFIDOut), 3 (=Pin15=RFIDIn2 for railcar detect)
+
+class RFID   //handle all input from the RFID readers on the serial ports
+{
+public:
+	RFID(byte port);
+	void init();   //initialise the I/O
+	String poll();   //poll an RFID, build the internal string, and if complete, return a byte
+		// otherwise, return 0x00h
+	void drain();   //empty the UART into the internal string, keeping a complete one for poll()
+
+private:
+	byte _port;
+	byte rfidAvailable();   //retrurn the number of chars in the serial buffer
+	byte rfidRead();    //the next char from the buffer
+	byte charsRead[4];   // char count for each serial port  - 0xFF = not started
+	String buildString[4];		// where the strings for each serial port are built
+	String heard[4];   // a complete string waiting for poll()
+};
+
+
+
+//================================================================
+//                      Shift Register I/O routines - headers
+//================================================================
+
+//Number of DPR boards in the shift register chain - each board has 8 relays and 8 TOTIs
+//Board 1 is the furthest from the Arduino.  Add new boards at the Arduino end of the chain,
+// so that the existing point and TOTI numbers stay the same.
+#define DPRBOARDS 3
+#define SHIFTLENGTH (DPRBOARDS * 8)   //bits shifted out and in on each update
+#define PINSLOT 3   //points 25...32 are on Arduino pins, so DPR boards 4 onwards start at point 33
+#define PINPOINTS 5   //points 25...29 are wired, to D9...D12, D8
+#define MAXPOINTS (SHIFTLENGTH + 8)
+#define MAXTOTIS SHIFTLENGTH
+#define POINTBYTES (MAXPOINTS / 8)
+#define TOTIBYTES (MAXTOTIS / 8)
+#define POINTBIT(n) (1UL << ((n) - 1))   //point 1...32 in a mask for setPoints()
+#define SCANSTEP 50   //microseconds between steps of the exchange with the DPR boards
+	//an exchange takes 4 steps per relay and 4 more, so 5mS for 3 boards
+
+#if DPRBOARDS < PINSLOT
+#error "Points 1...24 must be on DPR boards"
+#endif
+#if MAXPOINTS > 32 + 0x80
+#error "Points 33 upwards must fit in EEPROM x300...x37F, so no more than 19 DPR boards"
+#endif
+
+class IO   //handle points and TOTIs
+{
+public:
+	IO(bool dummy);
+	void init(bool clearVars);   //initialise the I/O - if clearVars set, empty EEPROM
+		//load point values from EEPROM into RAM
+	bool updater();	//hand the points to the scan interrupt, and take its TOTIs - true if any TOTI changed
+	void scanStep();   //come here from the timer interrupt every SCANSTEP microseconds
+	bool pointsPending();  //true if a point has changed since the last updater()
+	void blink();   //come here every half second to flash the Exit Mode LEDs
+
+	bool testToti(byte totiNo);	//return whether a TOTI is occupied
+	void setPoint(byte pointNo, bool set);   //set or clear a point
+	void setPoints(unsigned long setMask, unsigned long clearMask);   //set and clear several of points 1...32 at once
+	bool getPoint(byte pointNo);  //return whether a point is set
+	bool pointExists(byte pointNo);  //return whether a point is wired to anything
+	bool testPoint(byte pointNo);  //return whether a point is set, from RAM (fast)
+	byte totiByte(byte index);  //TOTIs 8*index+1...8*index+8, for the trace
+	void setTotiByte(byte index, byte value);  //overwrite what updater() read, when replaying a trace
+	unsigned int scanTime();  //microseconds taken by the last exchange with the DPR boards
+	bool addToQueue(byte queue);  //push an exit onto the queue (return false if full)
+	byte getFromQueue();   //fetch an exit from the queue 0x00 if nothing
+	bool queueNotEmpty();  //test if there is anything in the queue
+	void setExitModeDisplay(byte myExit);  //set flashing in the Exit Mode Display
+	bool isThisSidingQueued(byte siding); //find out if this siding is already in the queue
+	byte queueEntry(byte index);  //the exit request at position index in the queue, 0x00 if nothing
+	void clearActiveExit();  //forget what we've just be doing with EXIT
+
+private:
+	byte pointValues[POINTBYTES];   //bit 0 of [0] is point 1, etc.  Off-normal if bit is set
+	byte totiValues[TOTIBYTES];	//bit 0 of [0] is toti 1 etc.  Bit set if section occupied
+	byte shiftMap[SHIFTLENGTH];   //which point goes out at each position in the DPR chain
+	bool pointsChanged;   //since the last updater()
+
+	//shared with the scan interrupt - each side only ever sees a whole set
+	volatile byte shadowPoints[2][POINTBYTES];   //the interrupt sends shadowPoints[shadowIndex]
+	volatile byte shadowIndex;
+	volatile byte publishedTotis[TOTIBYTES];   //from the last complete exchange
+	volatile byte totiSeq;   //counts complete exchanges - only to spot one finishing during a copy, so it may wrap
+	volatile unsigned int scanMicros;   //two bytes - read with interrupts off
+
+	//only used by the scan interrupt
+	byte scanPoints[POINTBYTES];   //what this exchange is sending
+	byte scanTotis[TOTIBYTES];   //what this exchange has read so far
+	unsigned int stepNo;
+	unsigned long scanStart;
+	void publishPoints();   //hand pointValues to the scan interrupt
+  void setP1(byte pointNo, bool set);   //set or clear a point
+
+	bool blinker;
+	void showExitMode();   //set the Exit Mode LEDs from exitModeDisplay
+#define EXITQUEUELENGTH 4
+	byte exitQueue[EXITQUEUELENGTH];  //lsn=siding#, msn=mode, lowest index goes next
+	byte activeExit;  //last value popped from queue
+
+	//EXIT destinations
+const byte MAIN = 0x10;
+const byte GOODS = 0x20;
+const byte BRANCH = 0x40;
+
+	byte exitModeDisplay = 0;  //MSN bit set as above (from queue), LSN also set if active
+	//bits are THROUGH | BRANCH | GOODS | MAIN | THROUGH FLASH | BRANCH FLASH | GOODS FLASH | MAIN FLASH
+
+	//in EEPROM:
+	//byte EEpoint[32];
+  //byte StoredTrain[8];
+  // at 0x100...0x27F nvStates  
+  // at 0x300...0x37F EEpoint for points 33 upwards
+  // at 0x380...0x3FF benchmark baseline
+  // at 0x400...0x4FF move timings
+  // at 0x500...0x6FF statistics checkpoint
+  // at 0x800...0xFFF recorded trace
+
+
+
+};
+
+
+
+//================================================================
+//                      User buttons - headers
+//================================================================
+
+#define BOUNCEMS 60   //a button change must be steady this long before poll() acts on it
+
+
+class Buttons   //handle user buttons
+{
+public:
+	Buttons();
+	void init();   //initialise the counters
+	String poll();	//check statuses
+	String poll(unsigned int pins, unsigned int ms);  //as poll(), but with pin values from readPins() or a trace, ms since the last poll
+	unsigned int readPins();   //read the button pins - same bit assignments as output
+	/*returned value is a string containing the name of the significant button/function
+	followed by a space and '1' to indicate that the button has just been pressed, 
+	or '0' to indicate its release.  
+	
+	An exmpty string indicates nothing significant has happened.
+
+	The strings are:
+	  Up 
+	  Down
+	  Main
+	  Goods
+	  Branch
+	  Through
+	  Test
+	  Cancel
+	  Bench
+	  Baseline
+	  Export
+	  Reset
+	  */
+
+private:
+	unsigned int buttonPins;    //same bit assignments as output
+	unsigned int stableMs;    //how long the pins have been as they are now
+	unsigned long lastPoll;    //millis() at the last poll(), for a poll without a tick's time
+	unsigned int previousPins;
+	unsigned int lastAnnouncedValue;	  //last non-null output sent
+
+
+};
+
+
+//================================================================
+//                      State machine operation - headers
+//================================================================
+
+
+class State   //handle State Machines
+{
+public:
+	State(int machine);   //1=MERGE, 2=ENTER, 3=EXIT
+	void init(bool clearVars);   //zero timers, fetch states from EEPROM.  If clearVars set, zero EEPROM
+	void moveToState(byte newState);  //move to a new state value
+	void restore(byte newState);  //force a state, as if we had just powered up in it
+	byte fetch();  //fetch the current state of this machine
+
+private:
+	int _machine;   //1=MERGE, 2=ENTER, 3=EXIT 
+	byte myState[5];  //if msb clear, then we are just entering the state for the first time
+};
+
+
+//================================================================
+//                      Timers - headers
+//================================================================
+
+
+class Timer   //handle timeouts
+{
+public:
+	Timer(int myTime);
+	void init(unsigned int seconds);   //start timer - set to zero to disable
+	void tick();  //come here once a second, decrement timer, set expired flag TRUE if 1->0 
+	bool expired();  //test expired flag
+
+private:
+	int _myTime;
+	unsigned int counter[10];   //10 timers allowed
+	bool expiredFlag[10];    //if we expired
+
+};
+
+
+//================================================================
+//                      Task scheduler - headers
+//================================================================
+
+#define TASKS 6
+#define SCANTASK 0   //points out, TOTIs in
+#define RFIDTASK 1   //empty the RFID UARTs
+#define LOGICTASK 2   //buttons and state machines
+#define BLINKTASK 3   //flash the Exit Mode LEDs
+#define DISPLAYTASK 4   //LCD housekeeping
+#define CONSOLETASK 5   //commands on the USB serial port
+
+class Scheduler   //run each task at its own rate, and count the times one starts late
+{
+public:
+	Scheduler();
+	void init(byte task, unsigned int period, unsigned int deadline);   //milliseconds
+	bool due(byte task);   //true if the task should run now - ask in priority order
+	void trigger(byte task);   //run the task as soon as possible, whatever its period
+	unsigned int elapsed(byte task, unsigned int nominal, unsigned int slack);   //milliseconds the task's last run stands for
+		//nominal unless the real time is more than slack away from it - what's left over is carried to the next run
+	unsigned int misses(byte task);   //times the task started more than its deadline late
+	unsigned long worstLate(byte task);   //microseconds
+	void clear();   //forget misses and worst lateness
+
+private:
+	unsigned long nextRun[TASKS];   //micros() when the task is next due
+	unsigned long lastRun[TASKS];
+	long carryUs[TASKS];   //real time not yet accounted for by elapsed()
+	unsigned long periodUs[TASKS];
+	unsigned long deadlineUs[TASKS];
+	bool triggered[TASKS];
+	unsigned int missCount[TASKS];
+	unsigned long worst[TASKS];
+};
+
+
+//================================================================
+//                      Statistics - headers
+//================================================================
+
+#define STATSTOPS 4   //Stop25...Stop28
+#define WAITBINS 8
+
+struct StatsData {   //everything we count - checkpointed to EEPROM, and exported, just as it is in RAM
+	unsigned long now;   //milliseconds the yard has been running since the counts were last reset
+	unsigned long waitTotal[STATSTOPS];
+	unsigned int waitBins[STATSTOPS][WAITBINS];
+	unsigned int trainCount[4];   //1=MERGE, 2=ENTER, 3=EXIT
+	unsigned long exceptionMs[4];
+	unsigned long totiMs[MAXTOTIS];   //time each TOTI section has been occupied
+	unsigned int sidingIn[9];   //trains into Siding 0 (THROUGH)...8
+	unsigned int sidingOut[9];
+	unsigned int despatches[3];   //trains sent to MAIN, GOODS, BRANCH
+	unsigned int contentions;   //times a machine had to wait for the protected area
+	unsigned long contendedMs;
+};
+
+class Stats   //measure how well the yard is working, so that changes come with numbers
+{
+public:
+	Stats();
+	void init();   //zero everything, including the clock
+	void reset();   //zero the counts, but keep the clock running
+	bool load();   //carry on from the last checkpoint in EEPROM, false if there isn't one
+	void tick(unsigned int milliseconds);   //come here every loop with how long it has been
+	void watchStop(byte stop, bool waiting, bool released);  //stop 0...3 = Stop25...28
+		//waiting = train in the TOTI before the stop, released = stop relay set
+	void trainDone(byte machine);   //MERGE, ENTER or EXIT has finished moving a train
+	void exceptionTime(byte machine, unsigned int milliseconds);  //time spent in an exception state
+	void watchTotis(byte index, byte totis);   //TOTIs 8*index+1...8*index+8, every tick
+	void sidingIn(byte siding);   //a train has gone into Siding 1...8 (or 0 for THROUGH)
+	void sidingOut(byte siding, byte route);   //...or out, to route 0...2 = MAIN, GOODS, BRANCH
+	void watchContention(bool waiting);   //true while a machine waits for the protected area
+	void checkpoint();   //start saving everything to EEPROM
+	bool drain();   //come here every tick to save the checkpoint a byte at a time - true if it wrote
+	void send();   //export everything over the USB serial port
+	unsigned long upTime();   //milliseconds since power-up, for timing things - never reset
+	unsigned long counted();   //milliseconds the counts cover
+	unsigned int perHour(unsigned long count);   //turn a count into a rate
+	unsigned int trains(byte machine);
+	unsigned long meanWait(byte stop);   //milliseconds
+	unsigned long p95Wait(byte stop);   //95% of waits were no longer than this, in milliseconds
+	unsigned long exceptions(byte machine);   //milliseconds
+	unsigned long occupied(byte totiNo);   //milliseconds TOTI 1...MAXTOTIS has been occupied
+	unsigned int sidingMoves(byte siding);   //trains in and out of a siding
+	unsigned int despatched(byte route);
+	unsigned int contended();
+	unsigned long contendedTime();   //milliseconds
+
+private:
+	StatsData data;
+	unsigned long clockMs;   //upTime()
+	StatsData saved;   //the checkpoint being written, so that EEPROM gets one consistent copy
+	unsigned int saveIndex;   //next step of saving it, or sizeof(saved) + 4 when done - see drain()
+	unsigned long waitStart[STATSTOPS];
+	byte waitState[STATSTOPS];   //0 = nothing there, 1 = waiting, 2 = released
+	byte lastTotis[TOTIBYTES];
+	unsigned long occupiedSince[MAXTOTIS];
+	bool lastContended;
+	unsigned long contendedSince;
+
+	/*In EEPROM at 0x500...0x6FF, and over serial from send():
+	  'A', then the size of StatsData (2 bytes, lsb first), then StatsData as it is in RAM
+	  - ints are 2 bytes and longs 4, lsb first, with no padding between them
+	  Over serial, a byte follows which is the sum of all the StatsData bytes
+	*/
+};
+
+
+//================================================================
+//                      Move timings - headers
+//================================================================
+
+#define MOVES 24   //different moves we can remember the timing of
+#define MINMOVES 5   //moves seen before we trust what we've learnt
+
+class Transit   //learn how long each move takes, so that stuck trains are noticed sooner, and slow ones aren't
+{
+public:
+	Transit();
+	void init(byte percentile, bool clearAll);   //load what we learnt from EEPROM (or forget it)
+		//timeouts allow for this percentage of moves - 80, 90, 95, 98 or 99
+	void start(byte machine, byte state, byte route, unsigned long now);   //a train has started a move
+	void done(byte machine, byte state, unsigned long now);   //...and finished the move started in state
+	void cancel(byte machine);   //the move was abandoned, so don't learn from it
+	unsigned int timeout(byte machine, byte state, byte route, unsigned int fallback);   //seconds
+	unsigned int mean(byte machine, byte state, byte route);   //tenths of a second, 0 if not learnt
+	byte learnt();   //number of moves we now trust
+	bool drain();   //come here every tick to save what we've learnt to EEPROM, a byte at a time - true if it wrote
+	byte snapshot(unsigned int x);   //byte x of a snapshot - entry x / 10 as it is in EEPROM, for the start of a trace
+	void restore(unsigned int x, byte value);   //...and put it back when the trace is replayed
+
+private:
+	byte z;   //standard deviations to allow, in tenths
+	byte moveKey[MOVES];   //machine << 5 | state, 0xFF = unused
+	byte moveRoute[MOVES];
+	byte moveCount[MOVES];
+	unsigned int moveMean[MOVES];   //tenths of a second
+	unsigned long moveVar[MOVES];   //tenths of a second squared
+	unsigned long dirty;   //bit set for each entry that EEPROM doesn't match yet
+	byte saveEntry;   //entry being saved
+	byte saveIndex;   //next byte of it to save
+	byte pendingKey[4];   //move being timed for MERGE, ENTER, EXIT
+	byte pendingRoute[4];
+	unsigned long pendingStart[4];
+	int find(byte key, byte route);   //-1 if not known
+	byte entryByte(byte entry, byte index);   //an entry as it is kept in EEPROM
+
+	//in EEPROM at 0x400: 'R', then 10 bytes per entry - key, route, count, mean (2), variance (4), spare
+};
+
+
+//================================================================
+//                      Merge arbitration - headers
+//================================================================
+
+#define APPROACHES 3   //0 = Main, 1 = Goods, 2 = Branch
+#define ARBROUNDROBIN 0   //weighted round robin - the longest weighted wait goes first
+#define ARBSHORTEST 1   //shortest expected occupancy first, but a long enough wait beats it
+
+class Arbiter   //choose which waiting approach MERGE lets go next, so that none of them starves
+{
+public:
+	Arbiter();
+	void init(byte policy);   //ARBROUNDROBIN or ARBSHORTEST, all weights 1
+	void weight(byte approach, byte share);   //round robin share of the merge, 1...
+	void tick(unsigned int milliseconds, byte held);   //held = bit set for each approach with a train at its stop
+	byte choose(byte eligible, const unsigned int expected[APPROACHES]);   //approach to let go, or 0xFF if none
+		//eligible = bit set for each approach that could go, expected = tenths of a second each would take
+	void served(byte approach);   //the approach has been let go
+	unsigned long waiting(byte approach);   //milliseconds its train has been held
+	unsigned long longest(byte approach);   //longest hold so far, milliseconds
+	unsigned int servedCount(byte approach);
+
+private:
+	byte policy;
+	byte share[APPROACHES];
+	byte last;   //approach served last, where ties start from
+	unsigned long waitMs[APPROACHES];
+	unsigned long longestMs[APPROACHES];
+	unsigned int servedTimes[APPROACHES];
+};
+
+
+//================================================================
+//                      Train tracking - headers
+//================================================================
+
+#define TRAINS 12   //trains we can follow at once
+#define NOTRAIN 0xFF
+
+class Tracker   //follow each train from TOTI to TOTI, so we know which train is where without asking EEPROM
+{
+public:
+	Tracker();
+	void init();   //forget every train
+	void watch(byte index, byte totis);   //TOTIs 8*index+1...8*index+8, every tick - moves trains on the edges
+	void track(byte totiNo, bool follow);   //only follow trains in the TOTIs we say (none to start with)
+	void expect(byte train, byte totiNo);   //the train has been given a route, so the next thing into totiNo is it
+	void cancel(byte train);   //the route has been abandoned - forget where we expected the train to go
+	void heard(byte totiNo, byte id);   //an RFID names the unknown train in totiNo, or else the next to arrive there
+	void name(byte train, byte id);
+	byte at(byte totiNo);   //the train whose front is in TOTI 1...MAXTOTIS, or NOTRAIN
+	byte id(byte train);   //its RFID, 0xFF if we don't know it
+	byte where(byte train);   //TOTI its front is in, 0 if the train isn't in use
+	byte trains();   //number being followed
+
+private:
+	byte trainId[TRAINS];
+	byte trainAt[TRAINS];   //0 = not in use
+	byte expects[TRAINS];   //TOTIs it is expected in, so that it isn't forgotten between sections
+	byte inToti[MAXTOTIS + 1];   //train whose front is in each TOTI
+	byte comingTo[MAXTOTIS + 1];   //train expected next in each TOTI
+	byte lastTotis[TOTIBYTES];
+	byte tracked[TOTIBYTES];
+	byte heardToti;   //an RFID read before the train arrived
+	byte heardId;
+	void arrive(byte totiNo);
+	void leave(byte totiNo);
+};
+
+
+//================================================================
+//                      Input trace - headers
+//================================================================
+
+#define TRACEOFF 0
+#define TRACERECORD 1
+#define TRACEREPLAY 2
+#define TRACEBUFFER 64   //bytes waiting to go out to EEPROM or serial
+#define TRACEFORMAT 2   //what startRecording() and record() write - a replay refuses any other
+#define TRACEIDLEMAX 0x3EFF   //most ticks one idle record can hold
+
+#if TOTIBYTES > 8
+#error "The trace can only mark 8 bytes of TOTIs as changed"
+#endif
+
+class Trace   //record the inputs of every logic tick, so that a session can be replayed exactly
+{
+public:
+	Trace();
+	void init(byte mode, bool useSerial);   //TRACEOFF, TRACERECORD or TRACEREPLAY - EEPROM unless useSerial
+	bool recording();
+	bool replaying();
+	bool overflowed();   //recording stopped because EEPROM or the buffer was full
+	void putByte(byte value);   //add a byte to the recording
+	void putWaiting(byte value);   //putByte(), waiting for room - only for what the recording starts with
+	byte getByte();   //next byte of the recording being replayed (0xFF at the end)
+	void record();   //add this tick's inputs to the recording
+	bool next();   //fetch the next tick's inputs from the recording, false at the end
+	bool drain();   //come here every tick to send recorded bytes to EEPROM or serial - true if it wrote EEPROM
+	void stop();   //finish the recording - send what is waiting, then the end mark
+
+	//The inputs for one tick
+	byte totis[TOTIBYTES];
+	byte buttonPins;
+	bool writeEnabled;
+	byte tickMs;   //how long this tick was
+	String rfid[4];   //what RFID port 1...3 gave us this tick ("" if nothing)
+
+private:
+	byte _mode;
+	bool _useSerial;
+	bool _overflow;
+	unsigned int _address;   //next EEPROM byte to write or read
+	byte fifo[TRACEBUFFER];
+	byte fifoIn;
+	byte fifoOut;
+	byte lastTotis[TOTIBYTES];
+	byte lastButtons;
+	bool lastWriteEnabled;
+	unsigned int idleTicks;   //ticks when nothing changed, not yet in the recording (or not yet replayed)
+	void flushIdle();
+
+	/*Each tick is one record - a header byte, and then only what has changed:
+	  0x80 + n = n ticks (1...63) when nothing changed
+	  0xC0 + h, then l = (h << 8) + l ticks (64...TRACEIDLEMAX) when nothing changed
+	  otherwise bit 0 = TOTIs changed - a byte marking which TOTI bytes follow, then those bytes
+	            bit 1 = button pins follow
+	            bit 2 = write enable
+	            bit 3...5 = RFID port 1...3 heard something - length, then the characters
+	            bit 6 = the tick was not 20mS - its length follows
+	  0xFF = end of recording - written once, by stop(), so a recording cut short by the power
+	         going off replays on into whatever an older one left after it
+	*/
+};
+
+
+//================================================================
+//                      Beeper - headers
+//================================================================
+
+
+class Beeper   //make a noise
+{
+public:
+	Beeper();
+	void out(unsigned int milliseconds);   //sound 1kHz for specified duration
+
+private:
+
+};
+
+
+
+
+
+//================================================================
+//                      LCD routines - headers
+//================================================================
+
+//Tested - see Display.ino
+
+class Display   //output all information messages to the LCD and perhaps the serial port
+{
+public:
+	Display();
+	void init(bool testMode);   //initialise the I/O
+	//You MUST have Test Mode turned off during Visual Studio debugging, or breakpoints won't work!
+
+	void out(String text);  //send the string to the LCD and perhaps the serial port too
+	/*if a single line, then bottom line scrolls up to top line.
+	Linefeeds are indicated by a vertical bar '|', since '\n' causes issues
+	If string contains '|' then both lines are written.  Multiple '|' will only make sense to serial. */
+	void tick();  //Come here every second to update the display if necessary
+private:
+	bool _testMode;  //remember internally whether we're going to output to serial
+	String _bottomLine;  //what we last sent to the bottom line
+	String fifo[4][32];  //text queued up to be displayed by tick()
+//	bool _dummy;
+};
+
+
+//================================================================
+//                      Serial commands - headers
+//================================================================
+
+#define CONSOLELINE 48   //longest command line
+#define CONSOLEWORDS 19   //most words in one line - D and all 9 sidings (0 = THROUGH) with their destinations
+#define CONSOLEOUT 128   //bytes waiting to go out
+
+class Console   //take commands a line at a time on the USB serial port, and answer them, without ever waiting for it
+{
+public:
+	Console();
+	void init();
+	bool poll();   //take whatever has arrived - true when a whole line is ready, until done()
+	bool tooLong();   //the line, or its words, didn't fit, so only its start is there
+	byte words();   //words in the line - separated by spaces or commas, and upper case
+	bool is(byte index, const char* text);   //word index is text
+	int number(byte index);   //word index as a number, -1 if it isn't one
+	char letter(byte index);   //first character of word index, 0 if there isn't one
+	void done();   //finished with the line, so start on the next
+	bool print(const char* text);   //queue a line to go out - false, and nothing queued, if there isn't room yet
+	bool print(String text);
+	void drain();   //send what the UART will take, without waiting
+
+private:
+	char line[CONSOLELINE + 1];
+	byte lineLength;
+	bool lineReady;
+	bool overflow;
+	byte wordCount;
+	byte wordStart[CONSOLEWORDS];
+	char fifo[CONSOLEOUT];
+	byte fifoIn;
+	byte fifoOut;
+	void split();
+};
+
+#endif
@@ -0,0 +1,238 @@
+/*
+Arduino core, as much of it as SwinStor2 and WillsIO use, for building them on a PC
+The pins, Timer1, the serial ports and the clock are simulated in board.cpp
+
+String follows the Arduino core's WString - one malloc'd buffer per String, grown to the exact length
+ by realloc - so that counting allocations on the host counts what the Mega would do
+int is 32 bits here and 16 on the Mega, and long 64 here and 32 there - keep that in mind
+*/
+
+#ifndef Arduino_h
+#define Arduino_h
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <math.h>
+#include <algorithm>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+#define bitRead(value, bit) (((value) >> (bit)) & 0x01)
+#define bitSet(value, bit) ((value) |= (1UL << (bit)))
+#define bitClear(value, bit) ((value) &= ~(1UL << (bit)))
+#define bitWrite(value, bit, bitvalue) ((bitvalue) ? bitSet(value, bit) : bitClear(value, bit))
+#define bit(b) (1UL << (b))
+#define lowByte(w) ((uint8_t) ((w) & 0xff))
+#define highByte(w) ((uint8_t) ((w) >> 8))
+
+using std::min;
+using std::max;
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void tone(uint8_t pin, unsigned int frequency, unsigned long duration = 0);
+void noTone(uint8_t pin);
+void noInterrupts();
+void interrupts();
+void cli();
+void sei();
+extern volatile uint8_t SREG;   //a sketch that puts back the I bit it saved doesn't run what fell due until time next passes
+
+//Timer1 - board.cpp runs the interrupt routine the sketch sets it up for
+extern volatile uint8_t TCCR1A, TCCR1B, TIMSK1;
+extern volatile uint16_t OCR1A, TCNT1;
+#define CS10 0
+#define CS11 1
+#define CS12 2
+#define WGM12 3
+#define TOIE1 0
+#define OCIE1A 1
+#define ISR(vector) extern "C" void vector(void)
+
+extern char* __brkval;
+extern char __heap_start;
+
+
+//================================================================
+//                      String
+//================================================================
+
+class StringSumHelper;
+
+class String
+{
+public:
+	String(const char* cstr = "");
+	String(const String& str);
+	String(String&& rval);
+	String(StringSumHelper&& rval);
+	explicit String(char c);
+	explicit String(unsigned char value, unsigned char base = 10);
+	explicit String(int value, unsigned char base = 10);
+	explicit String(unsigned int value, unsigned char base = 10);
+	explicit String(long value, unsigned char base = 10);
+	explicit String(unsigned long value, unsigned char base = 10);
+	~String();
+
+	String& operator=(const String& rhs);
+	String& operator=(const char* cstr);
+	String& operator=(String&& rval);
+	String& operator=(StringSumHelper&& rval);
+
+	unsigned char reserve(unsigned int size);
+	unsigned int length() const { return len; }
+
+	unsigned char concat(const String& str);
+	unsigned char concat(const char* cstr);
+	unsigned char concat(const char* cstr, unsigned int length);
+	unsigned char concat(char c);
+	unsigned char concat(unsigned char num);
+	unsigned char concat(int num);
+	unsigned char concat(unsigned int num);
+	unsigned char concat(long num);
+	unsigned char concat(unsigned long num);
+
+	String& operator+=(const String& rhs) { concat(rhs); return(*this); }
+	String& operator+=(const char* cstr) { concat(cstr); return(*this); }
+	String& operator+=(char c) { concat(c); return(*this); }
+	String& operator+=(unsigned char num) { concat(num); return(*this); }
+	String& operator+=(int num) { concat(num); return(*this); }
+	String& operator+=(unsigned int num) { concat(num); return(*this); }
+	String& operator+=(long num) { concat(num); return(*this); }
+	String& operator+=(unsigned long num) { concat(num); return(*this); }
+
+	friend StringSumHelper& operator+(const StringSumHelper& lhs, const String& rhs);
+	friend StringSumHelper& operator+(const StringSumHelper& lhs, const char* cstr);
+	friend StringSumHelper& operator+(const StringSumHelper& lhs, char c);
+	friend StringSumHelper& operator+(const StringSumHelper& lhs, unsigned char num);
+	friend StringSumHelper& operator+(const StringSumHelper& lhs, int num);
+	friend StringSumHelper& operator+(const StringSumHelper& lhs, unsigned int num);
+	friend StringSumHelper& operator+(const StringSumHelper& lhs, long num);
+	friend StringSumHelper& operator+(const StringSumHelper& lhs, unsigned long num);
+
+	int compareTo(const String& s) const;
+	unsigned char equals(const String& s) const;
+	unsigned char equals(const char* cstr) const;
+	unsigned char operator==(const String& rhs) const { return equals(rhs); }
+	unsigned char operator==(const char* cstr) const { return equals(cstr); }
+	unsigned char operator!=(const String& rhs) const { return !equals(rhs); }
+	unsigned char operator!=(const char* cstr) const { return !equals(cstr); }
+	unsigned char startsWith(const String& prefix) const;
+	unsigned char endsWith(const String& suffix) const;
+
+	char charAt(unsigned int index) const;
+	char operator[](unsigned int index) const;
+	const char* c_str() const { return(buffer ? buffer : ""); }
+
+	int indexOf(char ch) const;
+	int indexOf(char ch, unsigned int fromIndex) const;
+	int indexOf(const String& str) const;
+	int indexOf(const String& str, unsigned int fromIndex) const;
+	String substring(unsigned int beginIndex) const { return substring(beginIndex, len); }
+	String substring(unsigned int beginIndex, unsigned int endIndex) const;
+
+	void replace(char find, char replace);
+	void replace(const String& find, const String& replace);
+	void toUpperCase();
+	void toLowerCase();
+	void trim();
+	long toInt() const;
+
+protected:
+	char* buffer;
+	unsigned int capacity;
+	unsigned int len;
+	void init();
+	void invalidate();
+	unsigned char changeBuffer(unsigned int maxStrLen);
+	String& copy(const char* cstr, unsigned int length);
+	void move(String& rhs);
+};
+
+class StringSumHelper : public String
+{
+public:
+	StringSumHelper(const String& s) : String(s) {}
+	StringSumHelper(const char* p) : String(p) {}
+	StringSumHelper(char c) : String(c) {}
+	StringSumHelper(unsigned char num) : String(num) {}
+	StringSumHelper(int num) : String(num) {}
+	StringSumHelper(unsigned int num) : String(num) {}
+	StringSumHelper(long num) : String(num) {}
+	StringSumHelper(unsigned long num) : String(num) {}
+};
+
+
+//================================================================
+//                      Serial ports
+//================================================================
+
+#define SERIAL_TX_BUFFER_SIZE 64
+#define SERIAL_RX_BUFFER_SIZE 64
+
+class HardwareSerial
+{
+public:
+	HardwareSerial(byte port);
+	void begin(unsigned long baud);
+	void end();
+	int available();
+	int peek();
+	int read();
+	int availableForWrite();
+	void flush();
+	size_t write(uint8_t c);
+	size_t write(const uint8_t* buffer, size_t size);
+	size_t write(const char* str) { return write((const uint8_t*)str, strlen(str)); }
+	size_t print(const String& s) { return write((const uint8_t*)s.c_str(), s.length()); }
+	size_t print(const char* str) { return write(str); }
+	size_t print(char c) { return write((uint8_t)c); }
+	size_t print(int n, int base = DEC) { return print(String((long)n, base)); }
+	size_t print(unsigned int n, int base = DEC) { return print(String((unsigned long)n, base)); }
+	size_t print(long n, int base = DEC) { return print(String(n, base)); }
+	size_t print(unsigned long n, int base = DEC) { return print(String(n, base)); }
+	size_t println() { return write("\r\n"); }
+	template <typename T> size_t println(T value) { size_t n = print(value); return(n + println()); }
+	template <typename T> size_t println(T value, int base) { size_t n = print(value, base); return(n + println()); }
+	operator bool() { return(true); }
+
+	//the simulated side of the port - see board.h
+	byte port;
+	bool open;
+	unsigned long baud;
+	int fd;   //a file descriptor (a pty) the port is connected to, or -1
+	uint8_t rxBuffer[SERIAL_RX_BUFFER_SIZE];
+	unsigned int rxHead, rxTail;
+	unsigned long rxDropped;   //characters lost because the receive buffer was full
+	unsigned long txDoneAt;   //simulated micros() when the last character queued will have gone
+	unsigned long txBlocked;   //microseconds write() has spent waiting for room
+	unsigned long txCount;
+	void (*sent)(byte port, uint8_t c);   //sees every character written, if set
+	bool receive(uint8_t c);   //a character has arrived from outside
+	unsigned long charMicros();
+	int txQueued();
+};
+
+extern HardwareSerial Serial, Serial1, Serial2, Serial3;
+
+#endif
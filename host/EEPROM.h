@@ -0,0 +1,35 @@
+/*
+The Mega's 4K of EEPROM for the host build - starts erased (0xFF), like a new chip
+A write takes 3.3mS, and like avr-libc's, the next read or write waits for it to finish
+*/
+
+#ifndef EEPROM_h
+#define EEPROM_h
+
+#include "Arduino.h"
+
+#define EEPROMSIZE 4096
+#define EEPROMWRITEMICROS 3300
+
+class EEPROMClass
+{
+public:
+	EEPROMClass();
+	uint8_t read(int address);
+	void write(int address, uint8_t value);
+	void update(int address, uint8_t value);
+	uint16_t length() { return(EEPROMSIZE); }
+
+	uint8_t cells[EEPROMSIZE];
+	unsigned long writes;   //real writes since power-up, each one wearing a cell
+	unsigned long waited;   //microseconds spent waiting for a write to finish
+	unsigned long busyUntil;   //simulated micros() when the last write finishes
+	void erase();
+
+private:
+	void ready();
+};
+
+extern EEPROMClass EEPROM;
+
+#endif
@@ -0,0 +1,26 @@
+/*
+The 16x2 LCD for the host build - keeps what is on the screen, so a test can read it
+*/
+
+#ifndef LiquidCrystal_h
+#define LiquidCrystal_h
+
+#include "Arduino.h"
+
+class LiquidCrystal
+{
+public:
+	LiquidCrystal(uint8_t rs, uint8_t rw, uint8_t enable, uint8_t d4, uint8_t d5, uint8_t d6, uint8_t d7);
+	void begin(uint8_t cols, uint8_t rows);
+	void clear();
+	void setCursor(uint8_t col, uint8_t row);
+	size_t write(uint8_t c);
+	size_t print(const String& s);
+	size_t print(const char* str);
+
+	char screen[2][17];   //what the display shows, a line each
+	uint8_t col, row;
+	void (*shown)(const char* line);   //sees each line as it's finished, if set
+};
+
+#endif
@@ -0,0 +1,440 @@
+/*
+String for the host build - the Arduino core's WString, cut down to what the sketch uses
+Every buffer comes from malloc/realloc exactly as on the Mega, so the bench can count them
+*/
+
+#include "Arduino.h"
+
+static void toBase(char* buf, unsigned long value, unsigned char base) {
+	//avr-libc's ultoa - digits above 9 are lower case
+	char digits[8 * sizeof(long) + 1];
+	int n = 0;
+	do {
+		byte digit = value % base;
+		digits[n++] = (digit < 10) ? ('0' + digit) : ('a' + digit - 10);
+		value /= base;
+	} while (value != 0);
+	while (n > 0) {
+		*buf++ = digits[--n];
+	}
+	*buf = 0;
+}
+
+static void toSigned(char* buf, long value, unsigned char base, unsigned long mask) {
+	//itoa/ltoa - only base 10 is signed, other bases show the bits of the Mega's int or long
+	if ((base == 10) && (value < 0)) {
+		*buf++ = '-';
+		toBase(buf, -value, 10);
+		return;
+	}
+	toBase(buf, (unsigned long)value & mask, base);
+}
+
+const unsigned long AVRINT = 0xFFFFUL;
+const unsigned long AVRLONG = 0xFFFFFFFFUL;
+
+
+//================================================================
+//                      Constructors
+//================================================================
+
+String::String(const char* cstr) {
+	init();
+	if (cstr) copy(cstr, strlen(cstr));
+}
+
+String::String(const String& value) {
+	init();
+	*this = value;
+}
+
+String::String(String&& rval) {
+	init();
+	move(rval);
+}
+
+String::String(StringSumHelper&& rval) {
+	init();
+	move(rval);
+}
+
+String::String(char c) {
+	init();
+	char buf[2] = { c, 0 };
+	*this = buf;
+}
+
+String::String(unsigned char value, unsigned char base) {
+	init();
+	char buf[1 + 8 * sizeof(unsigned char)];
+	toBase(buf, value, base);
+	*this = buf;
+}
+
+String::String(int value, unsigned char base) {
+	init();
+	char buf[2 + 8 * sizeof(int)];
+	toSigned(buf, value, base, AVRINT);
+	*this = buf;
+}
+
+String::String(unsigned int value, unsigned char base) {
+	init();
+	char buf[1 + 8 * sizeof(unsigned int)];
+	toBase(buf, value & AVRINT, base);
+	*this = buf;
+}
+
+String::String(long value, unsigned char base) {
+	init();
+	char buf[2 + 8 * sizeof(long)];
+	toSigned(buf, value, base, AVRLONG);
+	*this = buf;
+}
+
+String::String(unsigned long value, unsigned char base) {
+	init();
+	char buf[1 + 8 * sizeof(unsigned long)];
+	toBase(buf, value & AVRLONG, base);
+	*this = buf;
+}
+
+String::~String() {
+	free(buffer);
+}
+
+
+//================================================================
+//                      Memory management
+//================================================================
+
+void String::init() {
+	buffer = NULL;
+	capacity = 0;
+	len = 0;
+}
+
+void String::invalidate() {
+	if (buffer) free(buffer);
+	buffer = NULL;
+	capacity = len = 0;
+}
+
+unsigned char String::reserve(unsigned int size) {
+	if (buffer && capacity >= size) return 1;
+	if (changeBuffer(size)) {
+		if (len == 0) buffer[0] = 0;
+		return 1;
+	}
+	return 0;
+}
+
+unsigned char String::changeBuffer(unsigned int maxStrLen) {
+	char* newbuffer = (char*)realloc(buffer, maxStrLen + 1);
+	if (newbuffer) {
+		buffer = newbuffer;
+		capacity = maxStrLen;
+		return 1;
+	}
+	return 0;
+}
+
+String& String::copy(const char* cstr, unsigned int length) {
+	if (!reserve(length)) {
+		invalidate();
+		return(*this);
+	}
+	len = length;
+	strcpy(buffer, cstr);
+	return(*this);
+}
+
+void String::move(String& rhs) {
+	if (buffer) {
+		if (rhs.buffer && capacity >= rhs.len) {
+			strcpy(buffer, rhs.buffer);
+			len = rhs.len;
+			rhs.len = 0;
+			return;
+		}
+		free(buffer);
+	}
+	buffer = rhs.buffer;
+	capacity = rhs.capacity;
+	len = rhs.len;
+	rhs.buffer = NULL;
+	rhs.capacity = 0;
+	rhs.len = 0;
+}
+
+String& String::operator=(const String& rhs) {
+	if (this == &rhs) return(*this);
+	if (rhs.buffer) copy(rhs.buffer, rhs.len);
+	else invalidate();
+	return(*this);
+}
+
+String& String::operator=(String&& rval) {
+	if (this != &rval) move(rval);
+	return(*this);
+}
+
+String& String::operator=(StringSumHelper&& rval) {
+	if (this != &rval) move(rval);
+	return(*this);
+}
+
+String& String::operator=(const char* cstr) {
+	if (cstr) copy(cstr, strlen(cstr));
+	else invalidate();
+	return(*this);
+}
+
+
+//================================================================
+//                      Concatenation
+//================================================================
+
+unsigned char String::concat(const String& s) {
+	return concat(s.buffer, s.len);
+}
+
+unsigned char String::concat(const char* cstr, unsigned int length) {
+	unsigned int newlen = len + length;
+	if (!cstr) return 0;
+	if (length == 0) return 1;
+	if (!reserve(newlen)) return 0;
+	strcpy(buffer + len, cstr);
+	len = newlen;
+	return 1;
+}
+
+unsigned char String::concat(const char* cstr) {
+	if (!cstr) return 0;
+	return concat(cstr, strlen(cstr));
+}
+
+unsigned char String::concat(char c) {
+	char buf[2] = { c, 0 };
+	return concat(buf, 1);
+}
+
+unsigned char String::concat(unsigned char num) {
+	char buf[1 + 3 * sizeof(unsigned char)];
+	toBase(buf, num, 10);
+	return concat(buf, strlen(buf));
+}
+
+unsigned char String::concat(int num) {
+	char buf[2 + 3 * sizeof(int)];
+	toSigned(buf, num, 10, AVRINT);
+	return concat(buf, strlen(buf));
+}
+
+unsigned char String::concat(unsigned int num) {
+	char buf[1 + 3 * sizeof(unsigned int)];
+	toBase(buf, num & AVRINT, 10);
+	return concat(buf, strlen(buf));
+}
+
+unsigned char String::concat(long num) {
+	char buf[2 + 3 * sizeof(long)];
+	toSigned(buf, num, 10, AVRLONG);
+	return concat(buf, strlen(buf));
+}
+
+unsigned char String::concat(unsigned long num) {
+	char buf[1 + 3 * sizeof(unsigned long)];
+	toBase(buf, num & AVRLONG, 10);
+	return concat(buf, strlen(buf));
+}
+
+StringSumHelper& operator+(const StringSumHelper& lhs, const String& rhs) {
+	StringSumHelper& a = const_cast<StringSumHelper&>(lhs);
+	if (!a.concat(rhs.buffer, rhs.len)) a.invalidate();
+	return a;
+}
+
+StringSumHelper& operator+(const StringSumHelper& lhs, const char* cstr) {
+	StringSumHelper& a = const_cast<StringSumHelper&>(lhs);
+	if (!cstr || !a.concat(cstr, strlen(cstr))) a.invalidate();
+	return a;
+}
+
+StringSumHelper& operator+(const StringSumHelper& lhs, char c) {
+	StringSumHelper& a = const_cast<StringSumHelper&>(lhs);
+	if (!a.concat(c)) a.invalidate();
+	return a;
+}
+
+StringSumHelper& operator+(const StringSumHelper& lhs, unsigned char num) {
+	StringSumHelper& a = const_cast<StringSumHelper&>(lhs);
+	if (!a.concat(num)) a.invalidate();
+	return a;
+}
+
+StringSumHelper& operator+(const StringSumHelper& lhs, int num) {
+	StringSumHelper& a = const_cast<StringSumHelper&>(lhs);
+	if (!a.concat(num)) a.invalidate();
+	return a;
+}
+
+StringSumHelper& operator+(const StringSumHelper& lhs, unsigned int num) {
+	StringSumHelper& a = const_cast<StringSumHelper&>(lhs);
+	if (!a.concat(num)) a.invalidate();
+	return a;
+}
+
+StringSumHelper& operator+(const StringSumHelper& lhs, long num) {
+	StringSumHelper& a = const_cast<StringSumHelper&>(lhs);
+	if (!a.concat(num)) a.invalidate();
+	return a;
+}
+
+StringSumHelper& operator+(const StringSumHelper& lhs, unsigned long num) {
+	StringSumHelper& a = const_cast<StringSumHelper&>(lhs);
+	if (!a.concat(num)) a.invalidate();
+	return a;
+}
+
+
+//================================================================
+//                      Comparison and search
+//================================================================
+
+int String::compareTo(const String& s) const {
+	if (!buffer || !s.buffer) {
+		if (s.buffer && s.len > 0) return 0 - *(unsigned char*)s.buffer;
+		if (buffer && len > 0) return *(unsigned char*)buffer;
+		return 0;
+	}
+	return strcmp(buffer, s.buffer);
+}
+
+unsigned char String::equals(const String& s2) const {
+	return (len == s2.len && compareTo(s2) == 0);
+}
+
+unsigned char String::equals(const char* cstr) const {
+	if (len == 0) return (cstr == NULL || *cstr == 0);
+	if (cstr == NULL) return buffer[0] == 0;
+	return strcmp(buffer, cstr) == 0;
+}
+
+unsigned char String::startsWith(const String& s2) const {
+	if (len < s2.len || !buffer || !s2.buffer) return 0;
+	return strncmp(buffer, s2.buffer, s2.len) == 0;
+}
+
+unsigned char String::endsWith(const String& s2) const {
+	if (len < s2.len || !buffer || !s2.buffer) return 0;
+	return strcmp(&buffer[len - s2.len], s2.buffer) == 0;
+}
+
+char String::charAt(unsigned int loc) const {
+	return operator[](loc);
+}
+
+char String::operator[](unsigned int index) const {
+	if (index >= len || !buffer) return 0;
+	return buffer[index];
+}
+
+int String::indexOf(char c) const {
+	return indexOf(c, 0);
+}
+
+int String::indexOf(char ch, unsigned int fromIndex) const {
+	if (fromIndex >= len) return -1;
+	const char* temp = strchr(buffer + fromIndex, ch);
+	if (temp == NULL) return -1;
+	return temp - buffer;
+}
+
+int String::indexOf(const String& s2) const {
+	return indexOf(s2, 0);
+}
+
+int String::indexOf(const String& s2, unsigned int fromIndex) const {
+	if (fromIndex >= len) return -1;
+	const char* found = strstr(buffer + fromIndex, s2.c_str());
+	if (found == NULL) return -1;
+	return found - buffer;
+}
+
+String String::substring(unsigned int left, unsigned int right) const {
+	if (left > right) {
+		unsigned int temp = right;
+		right = left;
+		left = temp;
+	}
+	String out;
+	if (left >= len) return out;
+	if (right > len) right = len;
+	char temp = buffer[right];
+	buffer[right] = '\0';
+	out = buffer + left;
+	buffer[right] = temp;
+	return out;
+}
+
+
+//================================================================
+//                      Modification
+//================================================================
+
+void String::replace(char find, char replace) {
+	if (!buffer) return;
+	for (char* p = buffer; *p; p++) {
+		if (*p == find) *p = replace;
+	}
+}
+
+void String::replace(const String& find, const String& replace) {
+	//not the core's in-place shuffle, but the same result and at most one realloc
+	if (len == 0 || find.len == 0) return;
+	String out;
+	unsigned int from = 0;
+	int at;
+	while ((at = indexOf(find, from)) >= 0) {
+		char keep = buffer[at];
+		buffer[at] = 0;
+		out.concat(buffer + from);
+		buffer[at] = keep;
+		out.concat(replace);
+		from = at + find.len;
+	}
+	if (from == 0) return;
+	out.concat(buffer + from);
+	*this = out;
+}
+
+void String::toUpperCase() {
+	if (!buffer) return;
+	for (char* p = buffer; *p; p++) {
+		*p = toupper(*p);
+	}
+}
+
+void String::toLowerCase() {
+	if (!buffer) return;
+	for (char* p = buffer; *p; p++) {
+		*p = tolower(*p);
+	}
+}
+
+void String::trim() {
+	if (!buffer || len == 0) return;
+	char* begin = buffer;
+	while (isspace(*begin)) begin++;
+	char* end = buffer + len - 1;
+	while (isspace(*end) && end >= begin) end--;
+	len = end + 1 - begin;
+	if (begin > buffer) memmove(buffer, begin, len);
+	buffer[len] = 0;
+}
+
+long String::toInt() const {
+	if (buffer) return atol(buffer);
+	return 0;
+}
@@ -0,0 +1,197 @@
+/*
+Bench - the sketch's own benchmark calls (benchCall() in SwinStor2.ino), run on the PC where every
+ malloc can be counted
+
+For each routine, per call: nanoseconds on this PC, microseconds on the simulated Mega, heap
+ allocations and the bytes they asked for, the most the heap grew during the call, EEPROM writes,
+ and microseconds blocked in delays.  The railcar reader is sent a whole tag before
+ each RFID poll, so that the poll has a string to build.
+
+  bench                     print the figures
+  bench --save FILE         ...and keep them as the baseline
+  bench --compare FILE      ...and flag anything worse than the baseline, exiting 1 if there is
+
+The Timer1 interrupt runs as simulated time passes, as it would on the Mega, so its cost is in the
+ figures too.  Everything but nanoseconds is exact, so any rise in them is a regression;
+ nanoseconds are the best of a few passes, and are allowed 50% (and 200nS) for the PC's own jitter.
+Each routine must also leave EXIT in the state it found it, msb and all.
+*/
+
+#include "board.h"
+#include "WillsIO.h"
+#include <string>
+#include <algorithm>
+#include <time.h>
+
+//what the sketch has that the bench needs
+void setup();
+void benchCall(byte item, byte run);
+extern State smExit;
+
+const byte WESTPIN = 7;   //eastPin - LOW for the West box
+const byte DCCTOTI = 24;   //always occupied while DCC is on
+const int ITEMS = 7;
+const char* const itemName[ITEMS] = { "RFID", "Butn", "IOup", "Pnt", "Stat", "LCD", "Rte3" };   //as benchName[] in the sketch
+const int RUNS = 200;   //calls of each - benchCall() counts them in a byte
+const int PASSES = 5;   //times the calls are made, for the best nanoseconds
+const double NSALLOWED = 1.5;   //nanoseconds can be this much over the baseline
+const double NSSLACK = 200;   //...plus this
+
+enum { NS, MICROS, ALLOCS, BYTES, PEAK, WRITES, BLOCKED, FIGURES };   //MICROS are on the simulated Mega
+const char* const figureName[FIGURES] = { "ns", "uS", "allocs", "bytes", "peak", "writes", "blocked" };
+const double shownTo[FIGURES] = { 1, 0.1, 0.01, 0.1, 0.1, 0.001, 0.1 };   //as print() rounds them, so the baseline is too
+
+struct Figures {
+	double value[FIGURES];
+};
+
+static unsigned long long wallNanos() {
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return((unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec);
+}
+
+static void tagArrives() {
+	//an ID-12 frame on the railcar reader, all of it in the UART by the time poll() looks
+	const char frame[] = "\x02" "0000000000AB\r\n\x03";
+	hostFeed(Serial3, frame, sizeof(frame) - 1);
+	hostAdvance(20000);
+}
+
+static Figures pass(byte item) {
+	Figures sum = { { 0, 0, 0, 0, 0, 0, 0 } };
+	for (int run = 0; run < RUNS; run++) {
+		if (item == 0) {
+			tagArrives();
+		}
+		unsigned long writes = EEPROM.writes;
+		unsigned long blocked = blockedMicros();
+		unsigned long simStart = hostNow();
+		hostHeapReset();
+		unsigned long long start = wallNanos();
+		benchCall(item, run);
+		unsigned long long took = wallNanos() - start;
+		hostHeap.counting = false;
+		sum.value[NS] += took;
+		sum.value[MICROS] += hostNow() - simStart;
+		sum.value[ALLOCS] += hostHeap.allocs;
+		sum.value[BYTES] += hostHeap.bytes;
+		sum.value[PEAK] += hostHeap.peak;
+		sum.value[WRITES] += EEPROM.writes - writes;
+		sum.value[BLOCKED] += blockedMicros() - blocked;
+	}
+	for (int x = 0; x < FIGURES; x++) {
+		sum.value[x] /= RUNS;
+	}
+	return(sum);
+}
+
+static Figures measure(byte item) {
+	Figures best = pass(item);
+	for (int x = 1; x < PASSES; x++) {
+		best.value[NS] = std::min(best.value[NS], pass(item).value[NS]);
+	}
+	return(best);
+}
+
+static bool readBaseline(const char* path, Figures* baseline) {
+	FILE* f = fopen(path, "r");
+	if (!f) {
+		fprintf(stderr, "bench: can't read %s\n", path);
+		return(false);
+	}
+	char line[200];
+	int found = 0;
+	while (fgets(line, sizeof(line), f)) {
+		char name[20];
+		Figures b;
+		if (line[0] == '#') continue;
+		double* v = b.value;
+		if (sscanf(line, "%19s %lf %lf %lf %lf %lf %lf %lf", name, &v[NS], &v[MICROS], &v[ALLOCS], &v[BYTES],
+				&v[PEAK], &v[WRITES], &v[BLOCKED]) != 8) continue;
+		for (int item = 0; item < ITEMS; item++) {
+			if (strcmp(name, itemName[item]) == 0) {
+				baseline[item] = b;
+				found++;
+			}
+		}
+	}
+	fclose(f);
+	if (found != ITEMS) {
+		fprintf(stderr, "bench: %s doesn't have all %d routines\n", path, ITEMS);
+		return(false);
+	}
+	return(true);
+}
+
+static void print(FILE* f, const char* name, const Figures& figures, const char* flags) {
+	const double* v = figures.value;
+	fprintf(f, "%-5s %10.0f %8.1f %7.2f %8.1f %7.1f %7.3f %8.1f%s\n", name, v[NS], v[MICROS], v[ALLOCS],
+		v[BYTES], v[PEAK], v[WRITES], v[BLOCKED], flags);
+}
+
+int main(int argc, char** argv) {
+	const char* save = NULL;
+	const char* compare = NULL;
+	for (int x = 1; x < argc; x++) {
+		std::string option = argv[x];
+		if ((option == "--save") && (x + 1 < argc)) save = argv[++x];
+		else if ((option == "--compare") && (x + 1 < argc)) compare = argv[++x];
+		else {
+			fprintf(stderr, "bench [--save FILE | --compare FILE]\n");
+			return(2);
+		}
+	}
+	Figures baseline[ITEMS];
+	if (compare && !readBaseline(compare, baseline)) {
+		return(2);
+	}
+
+	hostSetInput(WESTPIN, LOW);
+	hostToti(DCCTOTI, true);
+	setup();
+
+	Figures results[ITEMS];
+	bool regressed = false;
+	const char* heading = "#name         ns       uS  allocs    bytes    peak  writes  blocked  (per call)\n";
+	printf("%s", heading);
+	for (byte item = 0; item < ITEMS; item++) {
+		byte exitState = smExit.fetch();
+		results[item] = measure(item);
+		if (smExit.fetch() != exitState) {   //Stat must leave EXIT as it found it, msb and all
+			printf("%s left EXIT in state %02x, was %02x\n", itemName[item], smExit.fetch(), exitState);
+			regressed = true;
+		}
+		std::string flags;
+		if (compare) {
+			for (int x = 0; x < FIGURES; x++) {
+				double now = results[item].value[x];
+				double then = baseline[item].value[x];
+				bool worse = (x == NS) ? (now > then * NSALLOWED + NSSLACK) : (now > then + shownTo[x] / 2 + 1e-9);
+				if (worse) {
+					flags += std::string(" ") + figureName[x] + "!";
+					regressed = true;
+				}
+			}
+		}
+		print(stdout, itemName[item], results[item], flags.c_str());
+	}
+
+	if (save) {
+		FILE* f = fopen(save, "w");
+		if (!f) {
+			fprintf(stderr, "bench: can't write %s\n", save);
+			return(2);
+		}
+		fprintf(f, "%s", heading);
+		for (int item = 0; item < ITEMS; item++) {
+			print(f, itemName[item], results[item], "");
+		}
+		fclose(f);
+	}
+	if (regressed) {
+		printf("worse than %s\n", compare);
+		return(1);
+	}
+	return(0);
+}
@@ -0,0 +1,586 @@
+/*
+The simulated Mega for the host build - clock, Timer1, pins, DPR boards, serial ports, EEPROM, LCD and heap
+See board.h
+*/
+
+#include "board.h"
+#include "WillsIO.h"
+#include <malloc.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <deque>
+#include <utility>
+
+//The Arduino pins the sketch wires the DPR chain and stops to - see WillsIO.cpp
+const byte STROBEPIN = 3;
+const byte CLOCKPIN = 2;
+const byte DATAOUTPIN = 4;
+const byte DATAINPIN = 5;
+const byte stopPins[5] = { 9, 10, 11, 12, 8 };   //points 25...29
+
+#ifdef DPRBOARDS
+const byte DEFAULTBOARDS = DPRBOARDS;
+#else
+const byte DEFAULTBOARDS = 3;   //before the chain length could be changed
+#endif
+
+
+//================================================================
+//                      Time and Timer1
+//================================================================
+
+static unsigned long nowMicros = 0;
+unsigned int hostMicrosCost = 4;
+unsigned int hostPinCost = 4;
+unsigned long hostInterrupts = 0;
+unsigned long hostInterruptsLate = 0;
+
+volatile uint8_t TCCR1A, TCCR1B, TIMSK1;
+volatile uint16_t OCR1A, TCNT1;
+
+extern "C" void TIMER1_COMPA_vect(void) __attribute__((weak));
+extern "C" void TIMER1_OVF_vect(void) __attribute__((weak));
+
+volatile uint8_t SREG = 0x80;   //only the I bit means anything here
+static bool inInterrupt = false;
+static unsigned long timerSetup = 0xFFFFFFFFUL;   //TCCR1B, TIMSK1 and OCR1A when the timer was last started
+static bool timerRunning = false;
+static unsigned long timerDue;   //when the next compare match or overflow happens
+
+static unsigned long timerCounts(unsigned long counts) {
+	//microseconds for Timer1 to count this far at 16MHz with the prescaler selected
+	static const unsigned int prescale[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+	return(counts * prescale[TCCR1B & 7] / 16);
+}
+
+static bool timerCompare() {
+	return((TCCR1B & (1 << WGM12)) && (TIMSK1 & (1 << OCIE1A)) && TIMER1_COMPA_vect);
+}
+
+static bool timerOverflow() {
+	return(!(TCCR1B & (1 << WGM12)) && (TIMSK1 & (1 << TOIE1)) && TIMER1_OVF_vect);
+}
+
+static void timerCheck() {
+	//start the timer from now if the sketch has just set it up (or changed it)
+	unsigned long setup = ((unsigned long)TCCR1B << 24) | ((unsigned long)TIMSK1 << 16) | OCR1A;
+	if (setup == timerSetup) return;
+	timerSetup = setup;
+	timerRunning = ((TCCR1B & 7) != 0) && (timerCompare() || timerOverflow());
+	if (timerCompare()) {
+		timerDue = nowMicros + timerCounts(OCR1A + 1UL);
+	}
+	else if (timerOverflow()) {
+		timerDue = nowMicros + timerCounts(0x10000UL - TCNT1);
+	}
+}
+
+static void timerInterrupt() {
+	//run the interrupt routine, then work out when it's next due
+	inInterrupt = true;
+	hostInterrupts++;
+	if (timerCompare()) {
+		TIMER1_COMPA_vect();
+		unsigned long period = timerCounts(OCR1A + 1UL);
+		timerDue += period;
+		if (timerDue <= nowMicros) {   //the routine took longer than the period - the flag is already set again
+			hostInterruptsLate++;
+			while (timerDue + period <= nowMicros) {
+				timerDue += period;   //only one can be pending
+			}
+		}
+	}
+	else {
+		TIMER1_OVF_vect();
+		timerDue = nowMicros + timerCounts(0x10000UL - TCNT1);   //the routine reloads TCNT1
+	}
+	inInterrupt = false;
+	timerSetup = ((unsigned long)TCCR1B << 24) | ((unsigned long)TIMSK1 << 16) | OCR1A;
+}
+
+unsigned long hostNow() {
+	return(nowMicros);
+}
+
+void hostAdvance(unsigned long microseconds) {
+	unsigned long until = nowMicros + microseconds;
+	if (!inInterrupt) {
+		for (;;) {
+			timerCheck();
+			if (!(SREG & 0x80) || !timerRunning || (timerDue > until)) break;
+			if (timerDue > nowMicros) {
+				nowMicros = timerDue;
+			}
+			timerInterrupt();
+		}
+	}
+	if (nowMicros < until) {
+		nowMicros = until;
+	}
+}
+
+unsigned long micros() {
+	hostAdvance(hostMicrosCost);
+	return(nowMicros);
+}
+
+unsigned long millis() {
+	hostAdvance(hostMicrosCost / 2);
+	return(nowMicros / 1000);
+}
+
+void delay(unsigned long ms) {
+	hostAdvance(ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us) {
+	hostAdvance(us);
+}
+
+void noInterrupts() {
+	cli();
+}
+
+void interrupts() {
+	sei();
+}
+
+void cli() {
+	SREG &= ~0x80;
+}
+
+void sei() {
+	SREG |= 0x80;
+	hostAdvance(0);   //anything that fell due meanwhile runs now
+}
+
+void tone(uint8_t pin, unsigned int frequency, unsigned long duration) {
+}
+
+void noTone(uint8_t pin) {
+}
+
+
+//================================================================
+//                      Pins and the DPR boards
+//================================================================
+
+const byte PINS = 70;
+static byte pinModes[PINS];
+static byte pinOut[PINS];
+static byte pinIn[PINS] = { 0 };
+static bool pinInSet[PINS] = { false };
+
+//the DPR chain - index 0 is the shift register stage nearest the Arduino
+const int MAXCHAIN = 8 * 32;
+static byte boards = DEFAULTBOARDS;
+static byte outShift[MAXCHAIN];   //the relay data being clocked in
+static byte relays[MAXCHAIN];   //what the relays were last latched to
+static byte inShift[MAXCHAIN];   //the TOTIs being clocked out
+static bool totis[MAXCHAIN + 1];   //occupied, by TOTI number
+static byte relayPoint[MAXCHAIN];   //the point each stage's relay switches
+static unsigned long latches = 0;
+static bool boardsWired = false;
+
+static void wireBoards() {
+	//each board's relays are in the same strange order along its shift register,
+	// and points 25...32 are on Arduino pins, so board 4 onwards starts at point 33
+	const byte relayOrder[8] = { 6, 4, 2, 0, 7, 5, 3, 1 };
+	int length = boards * 8;
+	for (int stage = 0; stage < length; stage++) {
+		int fromFar = length - 1 - stage;
+		int board = fromFar / 8;
+		if (board >= 3) {
+			board++;
+		}
+		relayPoint[stage] = (board * 8) + relayOrder[fromFar % 8] + 1;
+	}
+	boardsWired = true;
+}
+
+void hostBoards(byte count) {
+	boards = count;
+	wireBoards();
+}
+
+static void strobe() {
+	//the relays take what has been clocked in, and the TOTIs are loaded ready to clock out (active low)
+	int length = boards * 8;
+	for (int stage = 0; stage < length; stage++) {
+		relays[stage] = outShift[stage];
+		inShift[stage] = totis[length - stage] ? LOW : HIGH;
+	}
+	latches++;
+}
+
+static void clock() {
+	int length = boards * 8;
+	for (int stage = length - 1; stage > 0; stage--) {
+		outShift[stage] = outShift[stage - 1];
+	}
+	outShift[0] = pinOut[DATAOUTPIN];
+	for (int stage = 0; stage < length - 1; stage++) {
+		inShift[stage] = inShift[stage + 1];
+	}
+	inShift[length - 1] = HIGH;
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+	if (pin < PINS) {
+		pinModes[pin] = mode;
+	}
+}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+	hostAdvance(hostPinCost);
+	if (pin >= PINS) return;
+	if (!boardsWired) wireBoards();
+	byte was = pinOut[pin];
+	pinOut[pin] = value ? HIGH : LOW;
+	if ((was == LOW) && (pinOut[pin] == HIGH)) {
+		if (pin == STROBEPIN) strobe();
+		if (pin == CLOCKPIN) clock();
+	}
+}
+
+int digitalRead(uint8_t pin) {
+	hostAdvance(hostPinCost);
+	if (pin >= PINS) return(LOW);
+	if (pin == DATAINPIN) {
+		if (!boardsWired) wireBoards();
+		return(inShift[0]);
+	}
+	if (pinModes[pin] == OUTPUT) {
+		return(pinOut[pin]);
+	}
+	return(pinInSet[pin] ? pinIn[pin] : HIGH);   //pulled up
+}
+
+void hostSetInput(uint8_t pin, int level) {
+	if (pin < PINS) {
+		pinIn[pin] = level ? HIGH : LOW;
+		pinInSet[pin] = true;
+	}
+}
+
+int hostOutput(uint8_t pin) {
+	return((pin < PINS) ? pinOut[pin] : LOW);
+}
+
+bool hostRelay(byte point) {
+	if ((point >= 25) && (point < 30)) {
+		return(pinOut[stopPins[point - 25]] == HIGH);
+	}
+	if (!boardsWired) wireBoards();
+	for (int stage = 0; stage < boards * 8; stage++) {
+		if (relayPoint[stage] == point) {
+			return(relays[stage] == HIGH);
+		}
+	}
+	return(false);   //not wired to anything
+}
+
+void hostToti(byte toti, bool occupied) {
+	if ((toti > 0) && (toti <= MAXCHAIN)) {
+		totis[toti] = occupied;
+	}
+}
+
+bool hostTotiOccupied(byte toti) {
+	return((toti > 0) && (toti <= MAXCHAIN) && totis[toti]);
+}
+
+unsigned long hostLatches() {
+	return(latches);
+}
+
+
+//================================================================
+//                      Serial ports
+//================================================================
+
+HardwareSerial Serial(0), Serial1(1), Serial2(2), Serial3(3);
+static std::deque<std::pair<unsigned long, uint8_t> > arriving[4];   //characters on their way in, and when each arrives
+
+HardwareSerial::HardwareSerial(byte p) {
+	port = p;
+	open = false;
+	baud = 9600;
+	fd = -1;
+	rxHead = rxTail = 0;
+	rxDropped = 0;
+	txDoneAt = 0;
+	txBlocked = 0;
+	txCount = 0;
+	sent = NULL;
+}
+
+void HardwareSerial::begin(unsigned long rate) {
+	baud = rate;
+	open = true;
+}
+
+void HardwareSerial::end() {
+	open = false;
+}
+
+unsigned long HardwareSerial::charMicros() {
+	return(10000000UL / baud);   //start, 8 data, stop
+}
+
+bool HardwareSerial::receive(uint8_t c) {
+	unsigned int next = (rxHead + 1) % SERIAL_RX_BUFFER_SIZE;
+	if (next == rxTail) {
+		rxDropped++;   //the UART overran
+		return(false);
+	}
+	rxBuffer[rxHead] = c;
+	rxHead = next;
+	return(true);
+}
+
+static void collect(HardwareSerial& s) {
+	//whatever has arrived by now goes into the receive buffer
+	std::deque<std::pair<unsigned long, uint8_t> >& queue = arriving[s.port];
+	while (!queue.empty() && (queue.front().first <= nowMicros)) {
+		s.receive(queue.front().second);
+		queue.pop_front();
+	}
+	if (s.fd >= 0) {
+		uint8_t c;
+		while ((((s.rxHead + 1) % SERIAL_RX_BUFFER_SIZE) != s.rxTail) && (::read(s.fd, &c, 1) == 1)) {
+			s.receive(c);
+		}
+	}
+}
+
+int HardwareSerial::available() {
+	collect(*this);
+	return((rxHead + SERIAL_RX_BUFFER_SIZE - rxTail) % SERIAL_RX_BUFFER_SIZE);
+}
+
+int HardwareSerial::peek() {
+	collect(*this);
+	if (rxHead == rxTail) return(-1);
+	return(rxBuffer[rxTail]);
+}
+
+int HardwareSerial::read() {
+	collect(*this);
+	if (rxHead == rxTail) return(-1);
+	uint8_t c = rxBuffer[rxTail];
+	rxTail = (rxTail + 1) % SERIAL_RX_BUFFER_SIZE;
+	return(c);
+}
+
+int HardwareSerial::txQueued() {
+	//characters still in the transmit buffer
+	if (txDoneAt <= nowMicros) return(0);
+	return((txDoneAt - nowMicros + charMicros() - 1) / charMicros());
+}
+
+int HardwareSerial::availableForWrite() {
+	int room = (SERIAL_TX_BUFFER_SIZE - 1) - txQueued();
+	return((room > 0) ? room : 0);
+}
+
+void HardwareSerial::flush() {
+	if (txDoneAt > nowMicros) {
+		hostAdvance(txDoneAt - nowMicros);
+	}
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+	if (txQueued() >= SERIAL_TX_BUFFER_SIZE - 1) {   //the buffer is full, so write() waits for room
+		unsigned long wait = txDoneAt - ((SERIAL_TX_BUFFER_SIZE - 2) * charMicros()) - nowMicros;
+		txBlocked += wait;
+		hostAdvance(wait);
+	}
+	txDoneAt = ((txDoneAt > nowMicros) ? txDoneAt : nowMicros) + charMicros();
+	txCount++;
+	if (fd >= 0) {
+		if (::write(fd, &c, 1) < 0) {
+			fd = -1;
+		}
+	}
+	if (sent) {
+		sent(port, c);
+	}
+	return(1);
+}
+
+size_t HardwareSerial::write(const uint8_t* data, size_t size) {
+	for (size_t x = 0; x < size; x++) {
+		write(data[x]);
+	}
+	return(size);
+}
+
+void hostFeed(HardwareSerial& s, const char* data, size_t length) {
+	std::deque<std::pair<unsigned long, uint8_t> >& queue = arriving[s.port];
+	unsigned long at = queue.empty() ? nowMicros : queue.back().first;
+	for (size_t x = 0; x < length; x++) {
+		at += s.charMicros();
+		queue.push_back(std::make_pair(at, (uint8_t)data[x]));
+	}
+}
+
+void hostAttach(HardwareSerial& s, int fd) {
+	s.fd = fd;
+	if (fd >= 0) {
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	}
+}
+
+
+//================================================================
+//                      EEPROM
+//================================================================
+
+EEPROMClass EEPROM;
+
+EEPROMClass::EEPROMClass() {
+	erase();
+}
+
+void EEPROMClass::erase() {
+	memset(cells, 0xFF, sizeof(cells));
+	writes = waited = busyUntil = 0;
+}
+
+void EEPROMClass::ready() {
+	if (busyUntil > nowMicros) {
+		unsigned long wait = busyUntil - nowMicros;
+		waited += wait;
+		hostAdvance(wait);
+	}
+}
+
+uint8_t EEPROMClass::read(int address) {
+	ready();
+	return(cells[address % EEPROMSIZE]);
+}
+
+void EEPROMClass::write(int address, uint8_t value) {
+	ready();
+	cells[address % EEPROMSIZE] = value;
+	writes++;
+	busyUntil = nowMicros + EEPROMWRITEMICROS;
+}
+
+void EEPROMClass::update(int address, uint8_t value) {
+	if (read(address) != value) {
+		write(address, value);
+	}
+}
+
+
+//================================================================
+//                      LCD
+//================================================================
+
+LiquidCrystal* hostLcd = NULL;
+
+LiquidCrystal::LiquidCrystal(uint8_t rs, uint8_t rw, uint8_t enable, uint8_t d4, uint8_t d5, uint8_t d6, uint8_t d7) {
+	clear();
+	shown = NULL;
+	hostLcd = this;
+}
+
+void LiquidCrystal::begin(uint8_t cols, uint8_t rows) {
+	clear();
+}
+
+void LiquidCrystal::clear() {
+	memset(screen, ' ', sizeof(screen));
+	screen[0][16] = screen[1][16] = 0;
+	col = row = 0;
+}
+
+void LiquidCrystal::setCursor(uint8_t c, uint8_t r) {
+	col = c;
+	row = r & 1;
+}
+
+size_t LiquidCrystal::write(uint8_t c) {
+	if (col < 16) {
+		screen[row][col++] = c;
+	}
+	return(1);
+}
+
+size_t LiquidCrystal::print(const char* str) {
+	size_t n = 0;
+	while (str[n]) {
+		write(str[n++]);
+	}
+	if (shown) {
+		shown(screen[row]);
+	}
+	return(n);
+}
+
+size_t LiquidCrystal::print(const String& s) {
+	return(print(s.c_str()));
+}
+
+
+//================================================================
+//                      Heap
+//================================================================
+
+//Every malloc, realloc and free goes through here, so that the bench can count what a call allocates
+// - on the Mega, the only things that use the heap are Strings
+
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_realloc(void* ptr, size_t size);
+extern "C" void __libc_free(void* ptr);
+
+HostHeap hostHeap = { false, 0, 0, 0, 0, 0 };
+char* __brkval = NULL;
+char __heap_start;
+
+void hostHeapReset() {
+	hostHeap.allocs = hostHeap.frees = hostHeap.bytes = 0;
+	hostHeap.live = hostHeap.peak = 0;
+	hostHeap.counting = true;
+}
+
+static void counted(long change) {
+	hostHeap.live += change;
+	if (hostHeap.live > hostHeap.peak) {
+		hostHeap.peak = hostHeap.live;
+	}
+}
+
+extern "C" void* malloc(size_t size) {
+	void* block = __libc_malloc(size);
+	if (hostHeap.counting && block) {
+		hostHeap.allocs++;
+		hostHeap.bytes += size;
+		counted(malloc_usable_size(block));
+	}
+	return(block);
+}
+
+extern "C" void* realloc(void* ptr, size_t size) {
+	if (!hostHeap.counting) {
+		return(__libc_realloc(ptr, size));
+	}
+	long was = ptr ? malloc_usable_size(ptr) : 0;
+	void* block = __libc_realloc(ptr, size);
+	if (block) {
+		hostHeap.allocs++;
+		hostHeap.bytes += size;
+		counted((long)malloc_usable_size(block) - was);
+	}
+	return(block);
+}
+
+extern "C" void free(void* ptr) {
+	if (hostHeap.counting && ptr) {
+		hostHeap.frees++;
+		counted(-(long)malloc_usable_size(ptr));
+	}
+	__libc_free(ptr);
+}
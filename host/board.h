@@ -0,0 +1,62 @@
+/*
+The simulated Mega and what is wired to it, for building SwinStor2 on a PC
+
+Time only passes when the sketch asks for it (delay(), micros(), a pin or a serial character),
+ or when a test calls hostAdvance() - and the Timer1 interrupt runs whenever it passes
+The DPR boards are modelled from their shift registers up, so the sketch's own code drives them
+*/
+
+#ifndef board_h
+#define board_h
+
+#include "Arduino.h"
+#include "EEPROM.h"
+#include "LiquidCrystal.h"
+
+//================================================================
+//                      Time
+//================================================================
+
+unsigned long hostNow();   //simulated micros(), without the cost of calling it
+void hostAdvance(unsigned long microseconds);   //let time pass, running the Timer1 interrupt as it falls due
+extern unsigned int hostMicrosCost;   //microseconds micros() takes on the Mega
+extern unsigned int hostPinCost;   //...and digitalWrite() or digitalRead()
+extern unsigned long hostInterrupts;   //Timer1 interrupts run so far
+extern unsigned long hostInterruptsLate;   //...and those that found the one before still pending
+
+
+//================================================================
+//                      Pins and the DPR boards
+//================================================================
+
+//Relays and TOTIs are numbered as they are wired - board 1 is the furthest from the Arduino,
+// and its relays are in the order { 6, 4, 2, 0, 7, 5, 3, 1 } along its shift register
+void hostBoards(byte boards);   //how many DPR boards are chained (3 unless told otherwise)
+void hostSetInput(uint8_t pin, int level);   //what an input pin reads - they all read HIGH until set
+int hostOutput(uint8_t pin);   //the level an output pin is driving
+bool hostRelay(byte point);   //whether a point's relay or Arduino pin is set
+void hostToti(byte toti, bool occupied);   //put a train on a TOTI, or take it off
+bool hostTotiOccupied(byte toti);
+unsigned long hostLatches();   //times the DPR boards have latched their relays
+
+
+//================================================================
+//                      Serial ports, LCD and heap
+//================================================================
+
+void hostFeed(HardwareSerial& port, const char* data, size_t length);   //characters arrive from now on, at the port's baud rate
+void hostAttach(HardwareSerial& port, int fd);   //connect a port to a file descriptor (a pty)
+extern LiquidCrystal* hostLcd;
+
+struct HostHeap {   //every malloc, realloc and free, while counting is set
+	bool counting;
+	unsigned long allocs;   //mallocs and reallocs
+	unsigned long frees;
+	unsigned long bytes;   //requested by those allocs
+	long live;   //bytes allocated and not yet freed
+	long peak;   //the most live has been
+};
+extern HostHeap hostHeap;
+void hostHeapReset();   //zero the counts, and start counting
+
+#endif
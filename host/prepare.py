@@ -0,0 +1,98 @@
+#!/usr/bin/env python3
+"""Copy the sketch into a build directory as C++, the way the Arduino IDE would compile it.
+
+    prepare.py [--set NAME=VALUE ...] SOURCEDIR BUILDDIR
+
+SwinStor2.ino becomes sketch.cpp, with Arduino.h included and a prototype for every
+function ahead of the first one, as the IDE adds them.  WillsIO.h and WillsIO.cpp are
+copied as they are.
+
+--set changes a setting in the copies - a top-level 'const TYPE NAME = ...;' or a
+'#define NAME ...' in any of the three files - so that a sweep can build the sketch
+with other values without editing it.  A setting that isn't found is an error.
+"""
+
+import argparse
+import os
+import re
+import sys
+
+SOURCES = ("SwinStor2.ino", "WillsIO.h", "WillsIO.cpp")
+
+FUNCTION = re.compile(r"^([A-Za-z_][\w<>\*&\s]*?[\s\*&])([A-Za-z_]\w*)\s*\(([^;{}]*)\)\s*\{?\s*(//.*)?$")
+NOTFUNCTION = ("return", "else", "struct", "class", "#define", "ISR")
+
+
+def prototypes(lines):
+    """The prototypes the IDE would add, and the line the first function starts on."""
+    found = []
+    first = None
+    for number, line in enumerate(lines):
+        match = FUNCTION.match(line)
+        if not match or line.startswith((" ", "\t")) or line.lstrip().startswith("#"):
+            continue
+        if match.group(1).strip() in NOTFUNCTION:
+            continue
+        opens = "{" in line or (number + 1 < len(lines) and lines[number + 1].strip().startswith("{"))
+        if not opens:
+            continue
+        found.append("%s %s(%s);" % (match.group(1).strip(), match.group(2), match.group(3)))
+        if first is None:
+            first = number
+    return found, first
+
+
+def apply(text, name, value):
+    """Give a const or #define a new value - returns the new text and whether it was found."""
+    const = re.compile(r"^(const\s[^=;\n]*?\b%s\s*(?:\[[^\]]*\])?\s*=\s*)[^;]*;" % re.escape(name), re.M)
+    define = re.compile(r"^(#define\s+%s\s+)\S[^\n/]*?(\s*(?://.*)?)$" % re.escape(name), re.M)
+    text, count = const.subn(lambda m: m.group(1) + value + ";", text)
+    if count == 0:
+        text, count = define.subn(lambda m: m.group(1) + value + m.group(2), text)
+    return text, count > 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--set", action="append", default=[], metavar="NAME=VALUE")
+    parser.add_argument("source")
+    parser.add_argument("build")
+    args = parser.parse_args()
+
+    texts = {}
+    for name in SOURCES:
+        with open(os.path.join(args.source, name), newline="") as f:
+            texts[name] = f.read().replace("\r\n", "\n")
+
+    for setting in args.set:
+        if "=" not in setting:
+            sys.exit("prepare.py: --set %s should be NAME=VALUE" % setting)
+        name, value = setting.split("=", 1)
+        found = False
+        for source in SOURCES:
+            texts[source], here = apply(texts[source], name, value)
+            found = found or here
+        if not found:
+            sys.exit("prepare.py: %s isn't a const or #define in the sketch" % name)
+
+    os.makedirs(args.build, exist_ok=True)
+    lines = texts["SwinStor2.ino"].split("\n")
+    found, first = prototypes(lines)
+    sketch = ["#include <Arduino.h>", '#line 1 "SwinStor2.ino"'] + lines[:first] + found + ['#line %d "SwinStor2.ino"' % (first + 1)] + lines[first:]
+    outputs = {
+        "sketch.cpp": "\n".join(sketch),
+        "WillsIO.h": texts["WillsIO.h"],
+        "WillsIO.cpp": texts["WillsIO.cpp"],
+    }
+    for name, text in outputs.items():
+        path = os.path.join(args.build, name)
+        if os.path.exists(path):
+            with open(path) as f:
+                if f.read() == text:
+                    continue   # leave it alone, so make doesn't rebuild it
+        with open(path, "w") as f:
+            f.write(text)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,99 @@
+/*
+Replay - play a recorded trace back through the sketch, as a Mega built with TRACEREPLAY would,
+ and print what the state machines and the LCD did (see transcript.h)
+
+  replay FILE             FILE is an EEPROM dump - all 4K of it, as avrdude reads it with -U eeprom:r:FILE:r
+  replay --serial FILE    FILE is what the USB serial port sent while recording with TRACESERIAL
+
+The sketch must be built with TRACEMODE=TRACEREPLAY (and TRACESERIAL=true for --serial) - make replay
+ does that.  Nothing is connected: the TOTIs, buttons, write enable and RFID come from the trace.
+A trace recorded by yardsim --trace FILE --transcript FILE2 should give exactly FILE2.
+Exits 1 if the trace can't be replayed.
+*/
+
+#include "board.h"
+#include "WillsIO.h"
+#include "transcript.h"
+#include <string>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+//what the sketch has that the replay needs
+void setup();
+void loop();
+extern Trace trace;
+
+const unsigned long MAXLOOPS = 100000000UL;   //a trace can't be this long, so something's wrong
+const unsigned int LOOPMICROS = 10;   //what loop() costs besides the micros() calls and pins it makes
+
+static bool done = false;
+static void (*chained)(const char* line) = NULL;
+
+static void lcdShown(const char* line) {
+	//the end of the replay isn't part of what was recorded
+	if (hostLcd && (line == hostLcd->screen[1]) && (strncmp(line, "Replay done", 11) == 0)) {
+		done = true;
+		return;
+	}
+	if (chained) {
+		chained(line);
+	}
+}
+
+static bool loadEeprom(const char* path) {
+	FILE* f = fopen(path, "rb");
+	if (!f) {
+		perror(path);
+		return(false);
+	}
+	size_t got = fread(EEPROM.cells, 1, sizeof(EEPROM.cells), f);
+	fclose(f);
+	if (got != sizeof(EEPROM.cells)) {
+		fprintf(stderr, "replay: %s is %lu bytes, not a %lu byte EEPROM dump\n", path, (unsigned long)got,
+			(unsigned long)sizeof(EEPROM.cells));
+		return(false);
+	}
+	return(true);
+}
+
+int main(int argc, char** argv) {
+	bool serial = (argc == 3) && (std::string(argv[1]) == "--serial");
+	const char* path = (argc == 2 + serial) ? argv[argc - 1] : NULL;
+	if (!path || (path[0] == '-')) {
+		fprintf(stderr, "replay [--serial] FILE\n");
+		return(2);
+	}
+	if (serial) {
+		int fd = open(path, O_RDONLY);   //read only as fast as the sketch takes it, so nothing overruns
+		if (fd < 0) {
+			perror(path);
+			return(1);
+		}
+		hostAttach(Serial, fd);
+	}
+	else if (!loadEeprom(path)) {
+		return(1);
+	}
+
+	setup();
+	if (!trace.replaying()) {
+		fprintf(stderr, "replay: %s isn't a trace this build can replay (the LCD said No trace! or Old trace!)\n", path);
+		return(1);
+	}
+	transcriptStart(stdout);
+	chained = hostLcd->shown;
+	hostLcd->shown = lcdShown;
+	unsigned long loops = 0;
+	while (!done && (loops++ < MAXLOOPS)) {
+		loop();
+		hostAdvance(LOOPMICROS);
+		transcriptLoop();
+	}
+	transcriptStop();
+	if (!done) {
+		fprintf(stderr, "replay: %s didn't end\n", path);
+		return(1);
+	}
+	return(0);
+}
@@ -0,0 +1,141 @@
+#!/usr/bin/env python3
+"""Run the yard simulator over a grid of settings, in parallel, and tabulate what it measured.
+
+    sweep.py [--build NAME=V1,V2 ...] [--vary SETTING=V1,V2 ...] [--rev REV ...]
+             [--seeds N] [--hours H] [--jobs N] [--csv FILE] [--show NAME,NAME...] [-- yardsim settings]
+
+--build changes a const or #define in the sketch (see prepare.py), so each value is a
+separate build - e.g. --build ALLOCPOLICY=ALLOCNEAREST,ALLOCLRU,ALLOCLENGTH.
+--vary changes a yardsim setting from run to run - e.g. --vary despatch=6,12,24.
+--rev builds the sketch as it was at a git revision instead of as it is in the working tree,
+so that two versions can be compared under the same traffic - e.g. --rev HEAD~3 --rev HEAD.
+
+Every combination is run with seeds 1...N, every run in its own process, and the table shows
+each measurement averaged over the seeds.  Anything after -- is passed to every run.
+"""
+
+import argparse
+import csv
+import hashlib
+import itertools
+import multiprocessing
+import os
+import subprocess
+import sys
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+REPO = os.path.dirname(HERE)
+SOURCES = ("SwinStor2.ino", "WillsIO.h", "WillsIO.cpp")
+SHOW = ("merged", "stored", "through_pct", "exited", "wait_main_mean", "wait_goods_mean", "wait_branch_mean",
+        "wait_enter_mean", "wait_enter_p95", "exception_exit_s_per_h", "eeprom_writes_per_h", "refused",
+        "collisions", "misroutes", "run_throughs")
+
+
+def grid(pairs):
+    """[('NAME', 'V1,V2'), ...] -> every combination, as lists of (NAME, VALUE)."""
+    axes = []
+    for pair in pairs:
+        if "=" not in pair:
+            sys.exit("sweep.py: %s should be NAME=V1,V2..." % pair)
+        name, values = pair.split("=", 1)
+        axes.append([(name, value) for value in values.split(",")])
+    return [list(combination) for combination in itertools.product(*axes)]
+
+
+def source(rev):
+    """A directory holding the sketch at a git revision, or the working tree's if rev is None."""
+    if rev is None:
+        return REPO
+    sha = subprocess.check_output(["git", "-C", REPO, "rev-parse", "--short", rev + "^{commit}"], text=True).strip()
+    directory = os.path.join(HERE, "build", "rev-" + sha)
+    os.makedirs(directory, exist_ok=True)
+    for name in SOURCES:
+        text = subprocess.check_output(["git", "-C", REPO, "show", "%s:%s" % (sha, name)])
+        with open(os.path.join(directory, name), "wb") as f:
+            f.write(text)
+    return directory
+
+
+def build(rev, settings):
+    """Build yardsim for a revision and set of sketch settings - returns the program."""
+    key = "%s %s" % (rev, " ".join("%s=%s" % s for s in settings))
+    directory = os.path.join("build", "sweep-" + hashlib.sha1(key.encode()).hexdigest()[:10])
+    command = ["make", "-s", "-C", HERE, "SRC=" + source(rev), "BUILD=" + directory,
+               "SET=" + " ".join("%s=%s" % s for s in settings), os.path.join(directory, "yardsim")]
+    subprocess.check_call(command)
+    return os.path.join(HERE, directory, "yardsim")
+
+
+def run(job):
+    """One yardsim run - returns its measurements as a dict."""
+    program, arguments = job
+    output = subprocess.run([program] + arguments, check=True, capture_output=True, text=True).stdout
+    measured = {}
+    for line in output.splitlines():
+        if "=" in line:
+            name, value = line.split("=", 1)
+            measured[name] = float(value)
+    return measured
+
+
+def label(rev, built, varied):
+    parts = ([rev] if rev else []) + ["%s=%s" % s for s in built + varied]
+    return " ".join(parts) or "as it is"
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--build", action="append", default=[], metavar="NAME=V1,V2")
+    parser.add_argument("--vary", action="append", default=[], metavar="SETTING=V1,V2")
+    parser.add_argument("--rev", action="append", default=[])
+    parser.add_argument("--seeds", type=int, default=4)
+    parser.add_argument("--hours", default="1")
+    parser.add_argument("--jobs", type=int, default=os.cpu_count())
+    parser.add_argument("--csv", help="also write every run to this file")
+    parser.add_argument("--show", help="the measurements to tabulate, comma separated")
+    parser.add_argument("extra", nargs="*", help="yardsim settings for every run")
+    args = parser.parse_args()
+
+    revs = args.rev or [None]
+    builds = grid(args.build)
+    varies = grid(args.vary)
+    show = args.show.split(",") if args.show else SHOW
+
+    programs = {}
+    for rev in revs:
+        for built in builds:
+            programs[(rev, tuple(built))] = build(rev, built)
+
+    cases = []
+    jobs = []
+    for (rev, built), program in programs.items():
+        for varied in varies:
+            arguments = ["--hours", args.hours] + args.extra
+            for name, value in varied:
+                arguments += ["--" + name, value]
+            cases.append((label(rev, list(built), varied), len(jobs)))
+            for seed in range(1, args.seeds + 1):
+                jobs.append((program, arguments + ["--seed", str(seed)]))
+
+    with multiprocessing.Pool(args.jobs) as pool:
+        results = pool.map(run, jobs, chunksize=1)
+
+    if args.csv:
+        with open(args.csv, "w", newline="") as f:
+            writer = csv.writer(f)
+            names = sorted(results[0])
+            writer.writerow(["case", "seed"] + names)
+            for case, first in cases:
+                for seed in range(args.seeds):
+                    writer.writerow([case, seed + 1] + [results[first + seed].get(n, "") for n in names])
+
+    width = max(len(case) for case, first in cases)
+    print("%-*s  %s" % (width, "", "  ".join("%9s" % n for n in show)))
+    for case, first in cases:
+        runs = results[first:first + args.seeds]
+        means = [sum(r.get(n, 0) for r in runs) / len(runs) for n in show]
+        print("%-*s  %s" % (width, case, "  ".join("%*.1f" % (max(9, len(n)), m) for n, m in zip(show, means))))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,237 @@
+/*
+Test of the serial commands - the whole sketch, with the USB serial port on a pty
+
+The test is the PC at the other end of the pty: it types commands into the master side and reads
+ the answers back, while loop() runs on the simulated clock.  Checks that:
+  - H, S, D, X and P are each answered as documented, and a bad or over-long line gets ERR
+  - a batch of despatches fills the exit queue and holds the rest, and X or Test mode drops those
+  - a press shorter than BOUNCEMS does nothing, even while TOTI changes bring the logic ticks forward
+  - several lines sent at once are each answered, in order
+  - the console never waits for the port - no write() ever found the transmit buffer full,
+    even with a status dump going out while the PC isn't reading
+
+Exits 1 if any check fails.
+*/
+
+#include "board.h"
+#include "WillsIO.h"
+#include <pty.h>
+#include <termios.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string>
+#include <vector>
+
+//what the sketch has that the test needs
+void setup();
+void loop();
+extern IO io;
+extern byte batchCount;
+extern int testMode;
+
+const byte WESTPIN = 7;   //eastPin - LOW for the West box
+const byte DCCTOTI = 24;   //always occupied while DCC is on
+const byte UPPIN = 20;
+const byte DOWNPIN = 21;
+const byte SPARETOTI = 16;   //on a DPR board, but nothing watches it
+const unsigned int LOOPMICROS = 10;   //what loop() costs besides the micros() calls and pins it makes
+
+static int failures = 0;
+static int pc = -1;   //the master side of the pty
+static std::string heard;   //what has come back, not yet made into lines
+static std::vector<std::string> lines;
+
+#define CHECK(condition, ...) do { \
+	if (!(condition)) { \
+		failures++; \
+		printf("FAIL line %d: ", __LINE__); \
+		printf(__VA_ARGS__); \
+		printf("\n"); \
+	} \
+} while (0)
+
+static void listen() {
+	//take whatever the sketch has sent, a line at a time
+	char buffer[256];
+	ssize_t got;
+	while ((got = ::read(pc, buffer, sizeof(buffer))) > 0) {
+		heard.append(buffer, got);
+	}
+	size_t end;
+	while ((end = heard.find("\r\n")) != std::string::npos) {
+		lines.push_back(heard.substr(0, end));
+		heard.erase(0, end + 2);
+	}
+}
+
+static void run(unsigned long milliseconds, bool reading = true) {
+	//let the sketch run, with the PC reading what it sends (or not)
+	unsigned long until = hostNow() + milliseconds * 1000;
+	while (hostNow() < until) {
+		loop();
+		hostAdvance(LOOPMICROS);
+		if (reading) listen();
+	}
+}
+
+static std::vector<std::string> ask(const char* command, unsigned long milliseconds = 500) {
+	//type a command, and return the lines that come back
+	lines.clear();
+	std::string typed = std::string(command) + "\r\n";
+	CHECK(::write(pc, typed.data(), typed.size()) == (ssize_t)typed.size(), "couldn't type %s", command);
+	run(milliseconds);
+	return(lines);
+}
+
+static std::string show(const std::vector<std::string>& answer) {
+	std::string all;
+	for (const std::string& line : answer) all += "[" + line + "]";
+	return(all);
+}
+
+#define ANSWER(command, ...) do { \
+	std::vector<std::string> expected = { __VA_ARGS__ }; \
+	std::vector<std::string> answer = ask(command); \
+	CHECK(answer == expected, "%s answered %s, expected %s", command, show(answer).c_str(), show(expected).c_str()); \
+} while (0)
+
+static bool startsWith(const std::string& text, const char* start) {
+	return(text.compare(0, strlen(start), start) == 0);
+}
+
+static void press(bool up, bool down, unsigned long milliseconds) {
+	hostSetInput(UPPIN, up ? LOW : HIGH);
+	hostSetInput(DOWNPIN, down ? LOW : HIGH);
+	run(milliseconds);
+	hostSetInput(UPPIN, HIGH);
+	hostSetInput(DOWNPIN, HIGH);
+	run(200);
+}
+
+static void testCommands() {
+	ANSWER("H", "S|D s M|G|B ...|X|P n 0|1", "OK");
+	ANSWER("h", "S|D s M|G|B ...|X|P n 0|1", "OK");
+	ANSWER("FOO", "ERR ?");
+	ANSWER("D 1", "ERR D s M|G|B ...");
+	ANSWER("D 9 M", "ERR word 1");
+	ANSWER("D 1 Q", "ERR word 1");
+	ANSWER("D 7 M", "ERR S7");   //nothing in Siding 7
+	ANSWER("P 5 1", "ERR Test mode");
+	ANSWER(std::string(60, 'X').c_str(), "ERR too long");
+	ANSWER("D 1 M 1 M 1 M 1 M 1 M 1 M 1 M 1 M 1 M 1 M", "ERR too long");   //more words than fit
+	ANSWER("", );
+
+	std::vector<std::string> status = ask("S");
+	CHECK(status.size() == 6, "S answered %d lines: %s", (int)status.size(), show(status).c_str());
+	if (status.size() == 6) {
+		const char* starts[6] = { "P ", "T ", "S M", "Q ", "R", "OK" };
+		for (int x = 0; x < 6; x++) {
+			CHECK(startsWith(status[x], starts[x]), "status line %d is %s, expected %s...", x, status[x].c_str(), starts[x]);
+		}
+		CHECK(status[1] == "T 3f 00 80", "status TOTIs %s, expected Sidings 1-6 and DCC", status[1].c_str());
+		CHECK(status[2].find(" Run") != std::string::npos, "status %s isn't in Run mode", status[2].c_str());
+	}
+}
+
+static void testBounce() {
+	//Up and Down together, too short for Test mode - with a TOTI flickering, so the logic ticks come every few mS
+	hostSetInput(UPPIN, LOW);
+	hostSetInput(DOWNPIN, LOW);
+	for (unsigned long ms = 0; ms < BOUNCEMS - 10; ms += 2) {
+		hostToti(SPARETOTI, (ms % 4) == 0);
+		run(2);
+	}
+	hostToti(SPARETOTI, false);
+	hostSetInput(UPPIN, HIGH);
+	hostSetInput(DOWNPIN, HIGH);
+	run(200);
+	CHECK(testMode == 0, "a %dmS press of Up and Down went into Test mode", BOUNCEMS - 10);
+}
+
+static void testBatch() {
+	//six despatches - four fill the exit queue, and the console holds the other two
+	ANSWER("D 1 M, 2 G, 3 B, 4 M, 5 G, 6 B", "OK 6");
+	int queued = 0;
+	for (byte index = 0; index < EXITQUEUELENGTH; index++) {
+		if (io.queueEntry(index) != 0) queued++;
+	}
+	CHECK(queued == EXITQUEUELENGTH, "%d queued, expected the queue full", queued);
+	CHECK((batchCount > 0) && (queued + batchCount <= 6), "%d held by the console", batchCount);   //EXIT may have taken one already
+	ANSWER("D 1 G", "ERR S1");   //already going
+	std::vector<std::string> status = ask("S");
+	CHECK((status.size() == 6) && startsWith(status[3], "Q ") && (status[3].find(" + ") != std::string::npos),
+		"status queue line %s, expected held despatches after +", (status.size() > 3) ? status[3].c_str() : "missing");
+	ANSWER("X", "OK");
+	CHECK(batchCount == 0, "X left %d despatches held", batchCount);
+
+	//and again, but this time Test mode drops them
+	ANSWER("D 6 M", "OK 1");
+	CHECK(batchCount == 1, "D 6 M with the queue full left %d despatches held", batchCount);
+	press(true, true, 300);
+	CHECK(testMode != 0, "Up and Down together didn't go into Test mode");
+	CHECK((batchCount == 0) && !io.queueNotEmpty(), "Test mode left %d despatches held, queue %s", batchCount,
+		io.queueNotEmpty() ? "not empty" : "empty");
+	ANSWER("D 1 M", "ERR not now");
+	ANSWER("P 5 1", "OK P5=1");
+	CHECK(io.testPoint(5), "P 5 1 didn't set point 5");
+	ANSWER("P 5 0", "OK P5=0");
+	ANSWER("P 99 1", "ERR P n 0|1");
+	press(true, true, 300);
+	CHECK(testMode == 0, "Up and Down together didn't go back to Run mode");
+}
+
+static void testTogether() {
+	//three lines typed at once are answered one after another
+	std::vector<std::string> answer = ask("X\r\nH\nFOO");
+	std::vector<std::string> expected = { "OK", "S|D s M|G|B ...|X|P n 0|1", "OK", "ERR ?" };
+	CHECK(answer == expected, "X,H,FOO answered %s", show(answer).c_str());
+}
+
+static void testNotReading() {
+	//status dumps go out while the PC isn't reading, then it catches up - nothing waits for the port
+	unsigned long blocked = Serial.txBlocked;
+	for (int x = 0; x < 5; x++) {
+		std::string typed = "S\r\n";
+		CHECK(::write(pc, typed.data(), typed.size()) == 3, "couldn't type S");
+		run(30, false);
+	}
+	lines.clear();
+	run(1000);
+	int oks = 0;
+	for (const std::string& line : lines) oks += (line == "OK");
+	CHECK(oks == 5, "5 status dumps gave %d OKs", oks);
+	CHECK(Serial.txBlocked == blocked, "write() waited %luuS for the port", Serial.txBlocked - blocked);
+}
+
+int main() {
+	int slave;
+	if (openpty(&pc, &slave, NULL, NULL, NULL) < 0) {
+		perror("openpty");
+		return(2);
+	}
+	termios raw;
+	tcgetattr(slave, &raw);
+	cfmakeraw(&raw);
+	tcsetattr(slave, TCSANOW, &raw);
+	fcntl(pc, F_SETFL, fcntl(pc, F_GETFL) | O_NONBLOCK);
+	hostAttach(Serial, slave);
+
+	//trains standing in Sidings 1...6
+	hostSetInput(WESTPIN, LOW);
+	hostToti(DCCTOTI, true);
+	for (byte siding = 1; siding <= 6; siding++) {
+		hostToti(siding, true);
+	}
+	setup();
+	run(1000);
+
+	testCommands();
+	testBounce();
+	testBatch();
+	testTogether();
+	testNotReading();
+	CHECK(Serial.txBlocked == 0, "write() waited %luuS for the port in all", Serial.txBlocked);
+
+	printf("test_console: %s\n", failures ? "FAILED" : "passed");
+	return(failures ? 1 : 0);
+}
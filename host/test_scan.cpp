@@ -0,0 +1,182 @@
+/*
+Test of the exchange with the DPR boards - IO::scanStep() from the Timer1 interrupt, IO::updater() from loop()
+
+The timer is set up and the interrupt does what they are in SwinStor2.ino, against the simulated
+ shift registers in board.cpp.  Checks that:
+  - every point goes out to its own relay or pin, and only once updater() has handed it over
+  - points set in one tick go out in the same exchange
+  - the relays are refreshed every exchange however long loop() stalls, and no interrupt is late
+  - every TOTI comes in as itself, and updater() always sees one whole exchange's worth
+  - updater() sees a change however many exchanges it missed
+
+Exits 1 if any check fails.
+*/
+
+#include "board.h"
+#include "WillsIO.h"
+#include <random>
+
+IO io(false);
+
+ISR(TIMER1_COMPA_vect)
+{
+	io.scanStep();
+}
+
+static int failures = 0;
+
+#define CHECK(condition, ...) do { \
+	if (!(condition)) { \
+		failures++; \
+		printf("FAIL line %d: ", __LINE__); \
+		printf(__VA_ARGS__); \
+		printf("\n"); \
+	} \
+} while (0)
+
+const unsigned long EXCHANGEMICROS = (4UL * SHIFTLENGTH + 4) * SCANSTEP;   //steps 0...lastStep
+
+static void startTimer() {
+	//as setup() does
+	TCCR1A = 0;
+	TCCR1B = (1 << WGM12) | (1 << CS11);
+	OCR1A = SCANSTEP * 2 - 1;
+	TIMSK1 |= (1 << OCIE1A);
+}
+
+static void tick() {
+	//what loop() does with the I/O each time round, then time for two exchanges
+	io.updater();
+	hostAdvance(2 * EXCHANGEMICROS);
+}
+
+static bool wired(byte point) {
+	//points 30...32 are the spare Arduino pins
+	return((point <= PINSLOT * 8 + PINPOINTS) || (point > (PINSLOT + 1) * 8));
+}
+
+static void testPoints() {
+	//each point on its own, then alternate points
+	for (byte point = 1; point <= MAXPOINTS; point++) {
+		if (!wired(point)) continue;
+		io.setPoint(point, true);
+		tick();
+		for (byte other = 1; other <= MAXPOINTS; other++) {
+			if (!wired(other)) continue;
+			CHECK(hostRelay(other) == (other == point), "point %d set, relay %d is %d", point, other, hostRelay(other));
+		}
+		io.setPoint(point, false);
+	}
+	for (byte point = 1; point <= MAXPOINTS; point++) {
+		if (wired(point)) io.setPoint(point, (point % 2) == 1);
+	}
+	tick();
+	for (byte point = 1; point <= MAXPOINTS; point++) {
+		if (wired(point)) CHECK(hostRelay(point) == ((point % 2) == 1), "odd points set, relay %d is %d", point, hostRelay(point));
+	}
+	for (byte point = 1; point <= MAXPOINTS; point++) {
+		if (wired(point)) io.setPoint(point, false);
+	}
+	tick();
+}
+
+static void testHandover() {
+	//nothing goes out until updater(), then a route goes out in one exchange
+	const unsigned long route = POINTBIT(3) | POINTBIT(17) | POINTBIT(24) | POINTBIT(26);
+	io.setPoints(route, 0);
+	hostAdvance(3 * EXCHANGEMICROS);
+	CHECK(!hostRelay(3) && !hostRelay(17) && !hostRelay(24) && !hostRelay(26), "points went out before updater()");
+
+	io.updater();
+	unsigned long latches = hostLatches();
+	bool out = false;
+	for (unsigned long waited = 0; waited < 2 * EXCHANGEMICROS; waited += SCANSTEP / 5) {
+		hostAdvance(SCANSTEP / 5);
+		int on = hostRelay(3) + hostRelay(17) + hostRelay(24);   //all on the DPR boards
+		if (hostLatches() != latches) {
+			CHECK((on == 0) || (on == 3), "%d of the route's 3 relays out after a latch", on);
+			latches = hostLatches();
+		}
+		out = (on == 3) && hostRelay(26);
+	}
+	CHECK(out, "route not out 2 exchanges after updater()");
+	io.setPoints(0, route);
+	tick();
+}
+
+static void testStall() {
+	//loop() stops calling updater() for a second - the relays carry on being refreshed
+	io.setPoint(5, true);
+	io.setPoint(27, true);
+	tick();
+	unsigned long latches = hostLatches();
+	unsigned long late = hostInterruptsLate;
+	hostAdvance(1000000);
+	unsigned long expected = 2 * 1000000 / EXCHANGEMICROS;   //STROBE latches at the start and the end of each exchange
+	CHECK((hostLatches() - latches >= expected - 1) && (hostLatches() - latches <= expected + 1),
+		"%lu latches in a 1s stall, expected %lu", hostLatches() - latches, expected);
+	CHECK(hostInterruptsLate == late, "%lu interrupts late", hostInterruptsLate - late);
+	CHECK(hostRelay(5) && hostRelay(27), "relays dropped during a stall");
+	io.setPoint(5, false);
+	io.setPoint(27, false);
+	tick();
+}
+
+static void testTotis() {
+	//each TOTI on its own, then a changing pattern sampled at odd moments
+	for (byte toti = 1; toti <= MAXTOTIS; toti++) {
+		hostToti(toti, true);
+		hostAdvance(2 * EXCHANGEMICROS);
+		CHECK(io.updater(), "TOTI %d occupied, updater() saw no change", toti);
+		for (byte other = 1; other <= MAXTOTIS; other++) {
+			CHECK(io.testToti(other) == (other == toti), "TOTI %d occupied, testToti(%d) is %d", toti, other, io.testToti(other));
+		}
+		hostToti(toti, false);
+	}
+	hostAdvance(2 * EXCHANGEMICROS);
+	io.updater();
+	hostAdvance(2 * EXCHANGEMICROS);
+	CHECK(!io.updater(), "updater() saw a change when there wasn't one");
+
+	//a change while loop() stalls for exactly 256 exchanges - the exchange count is back where it was
+	io.updater();
+	hostToti(5, true);
+	hostAdvance(256 * EXCHANGEMICROS);
+	CHECK(io.updater() && io.testToti(5), "TOTI 5 occupied during a 256 exchange stall, updater() missed it");
+	hostToti(5, false);
+	hostAdvance(2 * EXCHANGEMICROS);
+	io.updater();
+
+	//a train is on all of these or none - updater() mustn't ever see some
+	const byte together[] = { 1, 8, 9, 16, 17, MAXTOTIS };
+	std::mt19937 rng(1);
+	bool on = false;
+	for (int x = 0; x < 2000; x++) {
+		hostAdvance(std::uniform_int_distribution<int>(1, EXCHANGEMICROS)(rng));
+		if (std::uniform_int_distribution<int>(0, 1)(rng)) {
+			on = !on;
+			for (byte toti : together) hostToti(toti, on);
+			hostAdvance(std::uniform_int_distribution<int>(1, EXCHANGEMICROS)(rng));
+		}
+		io.updater();
+		int seen = 0;
+		for (byte toti : together) seen += io.testToti(toti);
+		CHECK((seen == 0) || (seen == sizeof(together)), "updater() saw %d of %d TOTIs", seen, (int)sizeof(together));
+	}
+	for (byte toti : together) hostToti(toti, false);
+}
+
+int main() {
+	hostBoards(DPRBOARDS);
+	startTimer();
+	io.init(true);
+	hostAdvance(2 * EXCHANGEMICROS);
+
+	testPoints();
+	testHandover();
+	testStall();
+	testTotis();
+
+	printf("test_scan (%d boards): %s\n", DPRBOARDS, failures ? "FAILED" : "passed");
+	return(failures ? 1 : 0);
+}
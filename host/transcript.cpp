@@ -0,0 +1,56 @@
+/*
+Transcript of a run of the sketch - see transcript.h
+*/
+
+#include "board.h"
+#include "WillsIO.h"
+#include "transcript.h"
+#include <string>
+
+//what the sketch has that the transcript needs
+extern State smMerge, smEnter, smExit;
+extern Stats stats;
+
+static FILE* out = NULL;
+static State* const machine[3] = { &smMerge, &smEnter, &smExit };
+static const char* const machineName[3] = { "MERGE", "ENTER", "EXIT" };
+static byte lastState[3];
+static void (*chained)(const char* line) = NULL;   //whatever was watching the LCD before
+
+static void lcdShown(const char* line) {
+	if (out && hostLcd && (line == hostLcd->screen[1])) {
+		std::string shown = line;
+		shown.erase(shown.find_last_not_of(' ') + 1);
+		fprintf(out, "%lu LCD %s\n", stats.upTime(), shown.c_str());
+	}
+	if (chained) {
+		chained(line);
+	}
+}
+
+void transcriptStart(FILE* f) {
+	out = f;
+	for (int m = 0; m < 3; m++) {
+		lastState[m] = machine[m]->fetch();
+		fprintf(out, "%lu %s %02x\n", stats.upTime(), machineName[m], lastState[m]);
+	}
+	if (hostLcd && (hostLcd->shown != lcdShown)) {
+		chained = hostLcd->shown;
+		hostLcd->shown = lcdShown;
+	}
+}
+
+void transcriptLoop() {
+	if (!out) return;
+	for (int m = 0; m < 3; m++) {
+		byte state = machine[m]->fetch();
+		if (state != lastState[m]) {
+			lastState[m] = state;
+			fprintf(out, "%lu %s %02x\n", stats.upTime(), machineName[m], state);
+		}
+	}
+}
+
+void transcriptStop() {
+	out = NULL;
+}
@@ -0,0 +1,20 @@
+/*
+Transcript of a run of the sketch - what the state machines and the LCD did, for checking that
+ replaying a trace does exactly what the run that recorded it did
+
+One line for each change, stamped with the sketch's own clock (stats.upTime(), which a replay
+ keeps just as the run did):
+  <mS> MERGE|ENTER|EXIT <state, msb and all, in hex>
+  <mS> LCD <the bottom row, as it is printed>
+*/
+
+#ifndef transcript_h
+#define transcript_h
+
+#include <stdio.h>
+
+void transcriptStart(FILE* f);   //from now on - call after setup(), with the states as they are
+void transcriptLoop();   //come here after every loop()
+void transcriptStop();
+
+#endif
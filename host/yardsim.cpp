@@ -0,0 +1,931 @@
+/*
+Yard simulator - the sketch, as it is, working the West box against a model of its tracks and trains
+
+Trains turn up at the Main, Goods and Branch approaches to be merged, and at T13 to be stored.
+The operator despatches stored trains to Main, Goods or Branch, and a THROUGH train soon after it's held.
+Each train is a length moving at its own speed along whichever sections the points send it down:
+ it stops short of the end of a stop section whose relay is off, and every section it covers shows on its TOTI.
+The points and stops are read from the simulated DPR boards and pins, so the sketch drives the model
+ exactly as it would drive the layout.
+
+The model is event driven - arrivals, despatches, and each train's front and tail reaching the end of
+ a section are events at the moment they happen.  Between events the sketch's loop() runs on the
+ simulated clock, Timer1 interrupt and all, and trains held at a stop look at their relay every millisecond.
+
+yardsim --help lists the settings.  It prints what it measured as name=value lines, for sweep.py
+
+Built with TRACEMODE=TRACERECORD, --trace saves what the sketch recorded, for replay.cpp to play back.
+The operator's despatches go straight into the exit queue, which the trace doesn't see, so a run to
+ be replayed needs --despatch 0 - and --rfid-miss 0 and no more than 8 trains, so none goes THROUGH.
+*/
+
+#include "board.h"
+#include "WillsIO.h"
+#include "transcript.h"
+#include <vector>
+#include <deque>
+#include <queue>
+#include <algorithm>
+#include <random>
+#include <string>
+#include <stdarg.h>
+#include <time.h>
+
+//what the sketch has that the model needs
+void setup();
+void loop();
+extern IO io;
+extern State smMerge, smEnter, smExit;
+extern Trace trace;
+extern int STAYINSTATE;
+
+const unsigned int STOREDTRAIN = 0x020;   //EEPROM home of the train that lives in each siding
+const unsigned int EETRACE = 0x800;   //the trace recording, up to EETRACEEND
+const unsigned int EETRACEEND = 0x1000;
+const byte WESTPIN = 7;   //eastPin - LOW for the West box
+const byte DCCTOTI = 24;   //always occupied while DCC is on
+const byte DESTMAIN = 0x10;
+const byte DESTGOODS = 0x20;
+const byte DESTBRANCH = 0x40;
+const byte DESTTHROUGH = 0x80;
+const double STOPCM = 10;   //a train held at a stop stands this far short of the end of the section
+const unsigned long LOOKMICROS = 1000;   //how often held and waiting trains look to see if they can go
+
+
+//================================================================
+//                      Settings
+//================================================================
+
+struct Settings {
+	double hours = 2;   //simulated run, after setup()
+	unsigned long seed = 1;
+	int loopMicros = 10;   //what loop() costs besides the micros() calls and pins it makes
+	int stay = 0;   //STAYINSTATE, if not the sketch's own
+	double mergeRate[3] = { 6, 4, 3 };   //trains an hour arriving to be merged from Main, Goods and Branch
+	int fleet = 10;   //trains that are stored here - the first eight live in Sidings 1...8
+	int parked = 6;   //of those, how many are in their sidings at power-up
+	double despatchRate = 12;   //despatches an hour the operator asks for
+	double destShare[3] = { 2, 1, 1 };   //how often each destination is chosen
+	double layoutMinutes = 20;   //mean time a despatched train spends on the layout before it comes back
+	double throughReact = 10;   //seconds before the operator despatches a train held THROUGH
+	double rfidMiss = 0.05;   //chance a reader misses a tag
+	double rfidRepeat = 0.2;   //chance the Enter reader reads a tag twice
+	double readerCm = 100;   //how far before T13 the Enter reader is
+	double sidingCm = 300;
+	double throughCm = 300;   //T14 and the THROUGH road, up to Stop29
+	double trainCm[2] = { 100, 250 };   //shortest and longest train
+	double speed[2] = { 20, 40 };   //slowest and fastest train, cm/s
+	bool verbose = false;   //show the LCD and every train movement
+	const char* tracePath = NULL;   //save the trace the sketch recorded here
+	const char* transcriptPath = NULL;   //write what the state machines and the LCD did here
+} settings;
+
+static void usage() {
+	printf(
+		"yardsim [settings] - run the sketch against a model of the West box\n"
+		"  --hours H            simulated time after setup() (2)\n"
+		"  --seed N             random seed (1)\n"
+		"  --loop-us N          cost of one loop() besides micros() and pins (10)\n"
+		"  --stay S             STAYINSTATE seconds (the sketch's own)\n"
+		"  --merge M,G,B        merging trains an hour on Main, Goods, Branch (6,4,3)\n"
+		"  --fleet N            trains stored here, the first 8 living in Sidings 1...8 (10)\n"
+		"  --parked N           of those, in their sidings at power-up (6)\n"
+		"  --despatch R         despatches an hour (12)\n"
+		"  --dest M,G,B         share of despatches to Main, Goods, Branch (2,1,1)\n"
+		"  --layout MIN         mean minutes on the layout before a train comes back (20)\n"
+		"  --through-react S    seconds before a THROUGH train is despatched (10)\n"
+		"  --rfid-miss P        chance a tag isn't read (0.05)\n"
+		"  --rfid-repeat P      chance the Enter reader reads a tag twice (0.2)\n"
+		"  --reader-cm CM       Enter reader distance before T13 (100)\n"
+		"  --siding-cm CM       siding length (300)\n"
+		"  --through-cm CM      THROUGH road length (300)\n"
+		"  --train-cm MIN,MAX   train lengths (100,250)\n"
+		"  --speed MIN,MAX      train speeds, cm/s (20,40)\n"
+		"  --verbose            show the LCD and the trains as they go\n"
+		"  --trace FILE         save the trace (EEPROM dump, or what went over serial) - TRACERECORD builds\n"
+		"  --transcript FILE    write the state changes and LCD lines, as replay prints them\n");
+}
+
+static void parseList(const char* text, double* values, int count) {
+	for (int x = 0; x < count; x++) {
+		values[x] = atof(text);
+		text = strchr(text, ',');
+		if (!text) break;
+		text++;
+	}
+}
+
+static void parse(int argc, char** argv) {
+	for (int x = 1; x < argc; x++) {
+		std::string name = argv[x];
+		if (name == "--help" || name == "-h") {
+			usage();
+			exit(0);
+		}
+		if (name == "--verbose") {
+			settings.verbose = true;
+			continue;
+		}
+		if (x + 1 >= argc) {
+			fprintf(stderr, "yardsim: %s needs a value\n", name.c_str());
+			exit(2);
+		}
+		const char* value = argv[++x];
+		if (name == "--hours") settings.hours = atof(value);
+		else if (name == "--seed") settings.seed = strtoul(value, NULL, 0);
+		else if (name == "--loop-us") settings.loopMicros = atoi(value);
+		else if (name == "--stay") settings.stay = atoi(value);
+		else if (name == "--merge") parseList(value, settings.mergeRate, 3);
+		else if (name == "--fleet") settings.fleet = atoi(value);
+		else if (name == "--parked") settings.parked = atoi(value);
+		else if (name == "--despatch") settings.despatchRate = atof(value);
+		else if (name == "--dest") parseList(value, settings.destShare, 3);
+		else if (name == "--layout") settings.layoutMinutes = atof(value);
+		else if (name == "--through-react") settings.throughReact = atof(value);
+		else if (name == "--rfid-miss") settings.rfidMiss = atof(value);
+		else if (name == "--rfid-repeat") settings.rfidRepeat = atof(value);
+		else if (name == "--reader-cm") settings.readerCm = atof(value);
+		else if (name == "--siding-cm") settings.sidingCm = atof(value);
+		else if (name == "--through-cm") settings.throughCm = atof(value);
+		else if (name == "--train-cm") parseList(value, settings.trainCm, 2);
+		else if (name == "--speed") parseList(value, settings.speed, 2);
+		else if (name == "--trace") settings.tracePath = value;
+		else if (name == "--transcript") settings.transcriptPath = value;
+		else {
+			fprintf(stderr, "yardsim: unknown setting %s (--help lists them)\n", name.c_str());
+			exit(2);
+		}
+	}
+	settings.parked = std::min(settings.parked, std::min(settings.fleet, 8));
+}
+
+
+//================================================================
+//                      Track
+//================================================================
+
+//Each leg is a section a train runs along in one direction - T12 and T14 are each used two ways
+enum Leg {
+	APPMAIN, APPGOODS, APPBRANCH, APPENTER,   //approaches, not on a TOTI
+	T21, T22, T23, T20, T11, T12MERGE,   //MERGE
+	T13, T9, T14SCISSORS, T14THROUGH,   //ENTER - T14SCISSORS leads to Siding 2, T14THROUGH to Stop29
+	S1, S2, S3, S4, S5, S6, S7, S8,   //sidings
+	T10, T12EXIT, T17, T18, T19,   //EXIT
+	OUT,   //gone onto the layout
+	LEGS
+};
+
+struct LegInfo {
+	const char* name;
+	byte toti;
+	double length;   //cm
+};
+
+static LegInfo legs[LEGS] = {
+	{ "AppMain", 0, 200 }, { "AppGoods", 0, 200 }, { "AppBranch", 0, 200 }, { "AppEnter", 0, 300 },
+	{ "T21", 21, 150 }, { "T22", 22, 150 }, { "T23", 23, 150 }, { "T20", 20, 60 }, { "T11", 11, 300 }, { "T12", 12, 80 },
+	{ "T13", 13, 150 }, { "T9", 9, 40 }, { "T14", 14, 60 }, { "T14", 14, 300 },
+	{ "S1", 1, 300 }, { "S2", 2, 300 }, { "S3", 3, 300 }, { "S4", 4, 300 },
+	{ "S5", 5, 300 }, { "S6", 6, 300 }, { "S7", 7, 300 }, { "S8", 8, 300 },
+	{ "T10", 10, 60 }, { "T12", 12, 80 }, { "T17", 17, 200 }, { "T18", 18, 200 }, { "T19", 19, 200 },
+	{ "Out", 0, 1e9 }
+};
+
+const Leg approachLeg[4] = { APPMAIN, APPGOODS, APPBRANCH, APPENTER };
+const Leg stopLeg[4] = { T21, T22, T23, T13 };   //where the trains from each approach are held
+const char* const approachName[4] = { "main", "goods", "branch", "enter" };
+
+static bool relay(byte point) {
+	return(hostRelay(point));
+}
+
+static bool sidingReleased(int siding) {
+	if (siding == 1) {
+		return(relay(9) && relay(29));   //over the scissors to Stop29
+	}
+	return(relay(8 + siding) && relay(17));
+}
+
+static bool hasStop(Leg leg) {
+	return((leg == T21) || (leg == T22) || (leg == T23) || (leg == T13) || (leg == T14THROUGH) || ((leg >= S1) && (leg <= S8)));
+}
+
+static bool held(Leg leg) {
+	//whether a train reaching the stop on this leg has to wait there
+	switch (leg) {
+	case T21: return(!relay(26));
+	case T22: return(!relay(25));
+	case T23: return(!relay(27));
+	case T13: return(!relay(28));
+	case T14THROUGH: return(!relay(29));
+	default:
+		if ((leg >= S1) && (leg <= S8)) {
+			return(!sidingReleased(leg - S1 + 1));
+		}
+		return(false);
+	}
+}
+
+
+//================================================================
+//                      Trains and events
+//================================================================
+
+struct Train {
+	byte tag;   //its RFID
+	bool fleet;   //stored here, rather than just passing through the merge
+	double length, speed;
+	std::deque<std::pair<Leg, double> > on;   //the legs it covers, front last, with the distance each starts at
+	double dist;   //how far the front has gone
+	double at;   //when it was there, in seconds
+	bool moving;
+	bool gone;
+	int seq;   //events for the train that are older than this are stale
+	double readerAt;   //distance at which the Enter reader sees its tag, or -1
+	int from;   //the approach it came on
+	int approach;   //which stop it has still to get past, or -1
+	double arrived;   //when it turned up
+	double waited;   //how long it has been waiting to get past that stop, so far
+	double haltedAt;
+	byte dest;   //where it has been despatched to
+	bool requested;   //the operator has asked for it to be despatched
+	bool through;   //it went THROUGH
+	bool stopPassed;   //the front is past the stop on the leg it's on
+};
+
+static std::vector<Train> trains;
+
+enum EventKind { ARRIVE, FRONT, DESPATCH, THROUGHGO };
+
+struct Event {
+	double at;
+	EventKind kind;
+	int train;
+	int seq;
+	int approach;
+	bool operator<(const Event& other) const { return(at > other.at); }   //earliest first
+};
+
+static std::priority_queue<Event> events;
+static std::deque<int> waiting[4];   //trains turned up at each approach, not yet on it
+static int legCount[LEGS];   //trains on each leg
+static int totiCount[32];   //trains on each TOTI
+static std::mt19937_64 rng;
+
+static double uniform(double low, double high) {
+	return(low + (high - low) * std::uniform_real_distribution<double>(0, 1)(rng));
+}
+
+static double exponential(double mean) {
+	return(-mean * log(1.0 - std::uniform_real_distribution<double>(0, 1)(rng)));
+}
+
+static bool chance(double p) {
+	return(uniform(0, 1) < p);
+}
+
+static double seconds() {
+	return(hostNow() / 1e6);
+}
+
+
+//================================================================
+//                      Measurements
+//================================================================
+
+struct Measured {
+	double started;   //seconds, when setup() finished
+	unsigned long eepromAtStart;
+	int merged[3];
+	int stored;   //trains ENTER put in a siding
+	int through;   //...and sent THROUGH
+	int exited[3];   //trains EXIT sent to Main, Goods, Branch
+	int refused;   //despatches the exit queue had no room for
+	int collisions;   //a train ran onto a section another was on
+	int misroutes;   //a train went somewhere other than where it was despatched
+	int runThroughs;   //a train ran through a point set against it
+	std::vector<double> waits[4];   //seconds each train waited at Main, Goods, Branch and T13
+	std::vector<double> releases;   //milliseconds from a train reaching T13 to Stop28 letting it go
+	double t13At;   //when the train now in T13 reached it, or -1 once Stop28 has let it go
+	double exception[3];   //seconds MERGE, ENTER and EXIT spent in their exception state
+	unsigned long loops;
+	bool traceFull;   //the recording stopped before the run did
+	std::string serialTrace;   //what the sketch sent over the USB serial port
+} measured;
+
+static void narrate(const char* format, ...) __attribute__((format(printf, 1, 2)));
+static void narrate(const char* format, ...) {
+	if (!settings.verbose) return;
+	va_list args;
+	va_start(args, format);
+	printf("%9.3f ", seconds());
+	vprintf(format, args);
+	printf("\n");
+	va_end(args);
+}
+
+static void lcdShown(const char* line) {
+	if (hostLcd && (line == hostLcd->screen[1])) {
+		narrate("LCD %s", line);
+	}
+}
+
+static void serialSent(byte port, uint8_t c) {
+	measured.serialTrace += (char)c;
+}
+
+
+//================================================================
+//                      Moving trains
+//================================================================
+
+static void occupy(int t, Leg leg, double start) {
+	Train& train = trains[t];
+	train.on.push_back(std::make_pair(leg, start));
+	legCount[leg]++;
+	byte toti = legs[leg].toti;
+	if (toti) {
+		if (totiCount[toti] > 0) {
+			measured.collisions++;
+			narrate("COLLISION train %02X ran onto T%d", train.tag, toti);
+		}
+		totiCount[toti]++;
+		hostToti(toti, true);
+	}
+	if (leg == T13) {
+		measured.t13At = seconds();
+	}
+}
+
+static void vacate(int t) {
+	Train& train = trains[t];
+	Leg leg = train.on.front().first;
+	train.on.pop_front();
+	legCount[leg]--;
+	byte toti = legs[leg].toti;
+	if (toti && (--totiCount[toti] == 0)) {
+		hostToti(toti, false);
+	}
+}
+
+static void schedule(int t);
+
+static void sendTag(HardwareSerial& port, byte tag) {
+	//an ID-12 frame - STX, ten data and two checksum characters, CR, LF, ETX - with the tag in the last two
+	char frame[17];
+	snprintf(frame, sizeof(frame), "\x02%010X%02X\r\n\x03", 0, tag);
+	hostFeed(port, frame, 16);
+}
+
+static void readTag(HardwareSerial& port, Train& train) {
+	if (chance(settings.rfidMiss)) {
+		narrate("reader %d missed %02X", port.port, train.tag);
+		return;
+	}
+	sendTag(port, train.tag);
+	if ((&port == &Serial1) && chance(settings.rfidRepeat)) {
+		sendTag(port, train.tag);
+	}
+}
+
+static int route(Train& train, Leg from) {
+	//the leg after this one, as the points are set now
+	switch (from) {
+	case APPMAIN: return(T21);
+	case APPGOODS: return(T22);
+	case APPBRANCH: return(T23);
+	case APPENTER: return(T13);
+	case T21:
+	case T22:
+		if (relay(21) != (from == T22)) {   //the Goods/Main point is set for the other road
+			measured.runThroughs++;
+			narrate("RUN THROUGH train %02X at point 21", train.tag);
+		}
+		return(T20);
+	case T23:
+		if (!relay(23)) {
+			measured.runThroughs++;
+			narrate("RUN THROUGH train %02X at point 23", train.tag);
+		}
+		return(T12MERGE);
+	case T12MERGE: return(T20);
+	case T20: return(T11);
+	case T13:
+		if (relay(8)) return(S8);   //Siding 8 doesn't go through T9
+		return(T9);
+	case T9:
+		for (int siding = 1; siding < 8; siding++) {
+			if (relay(siding)) {
+				return((siding == 2) ? T14SCISSORS : (S1 + siding - 1));
+			}
+		}
+		train.through = true;
+		return(T14THROUGH);
+	case T14SCISSORS: return(S2);
+	case T14THROUGH: return(T10);
+	case T10:
+		if (relay(24)) return(T17);
+		return(T12EXIT);
+	case T12EXIT:
+		if (relay(22)) return(T18);
+		return(T19);
+	case T11:
+	case T17:
+	case T18:
+	case T19:
+		return(OUT);
+	default:
+		if ((from >= S1) && (from <= S8)) {
+			return((from == S1) ? T14THROUGH : T10);
+		}
+		return(OUT);
+	}
+}
+
+static void passed(int t, Leg leg, Leg ahead) {
+	//the front of a train has gone past the end of a leg, onto the next
+	Train& train = trains[t];
+	if ((train.approach >= 0) && (leg == stopLeg[train.approach])) {
+		measured.waits[train.approach].push_back(train.waited);
+		train.approach = -1;
+	}
+	if ((leg == T9) && (ahead == T14THROUGH)) {
+		measured.through++;
+	}
+	if (((leg == T9) || (leg == T13) || (leg == T14SCISSORS)) && (ahead >= S1) && (ahead <= S8)) {
+		measured.stored++;
+	}
+	if (ahead == T10) {
+		readTag(Serial2, train);   //the Exit reader
+	}
+	if ((leg == T17) || (leg == T18) || (leg == T19)) {
+		byte went = (leg == T19) ? DESTMAIN : ((leg == T18) ? DESTGOODS : DESTBRANCH);
+		measured.exited[T19 - leg]++;
+		if (train.dest && (train.dest != went)) {
+			measured.misroutes++;
+			narrate("MISROUTE train %02X", train.tag);
+		}
+		train.dest = 0;
+		train.requested = false;
+	}
+	if (leg == T11) {
+		measured.merged[train.from]++;
+	}
+}
+
+static void leave(int t) {
+	//the tail has left the last section - take it off OUT, until it comes back
+	Train& train = trains[t];
+	vacate(t);
+	train.gone = true;
+	train.seq++;
+	narrate("train %02X gone", train.tag);
+	if (train.fleet) {
+		Event back = { train.at + 120 + exponential(std::max(settings.layoutMinutes * 60 - 120, 1.0)), ARRIVE, t, 0, 3 };
+		events.push(back);
+	}
+}
+
+static double stopMark(const Train& train) {
+	//where the front of a train will stop if it's held, or a long way off if it's past it
+	Leg front = train.on.back().first;
+	if (!hasStop(front) || train.stopPassed) return(1e18);
+	return(train.on.back().second + legs[front].length - STOPCM);
+}
+
+static void advance(int t, double now) {
+	//bring a moving train up to now, dealing with everything it passes on the way
+	Train& train = trains[t];
+	double target = train.dist + (now - train.at) * train.speed;
+	train.at = now;
+	while (train.moving && !train.gone) {
+		Leg front = train.on.back().first;
+		double frontEnd = train.on.back().second + legs[front].length;
+		double tailEnd = train.on.front().second + legs[train.on.front().first].length + train.length;
+		double reader = (train.readerAt > train.dist - 1e-9) ? train.readerAt : 1e18;
+		double stop = stopMark(train);
+		double next = std::min(std::min(frontEnd, tailEnd), std::min(reader, stop));
+		if (next > target + 1e-9) {
+			train.dist = target;
+			break;
+		}
+		train.dist = next;
+		if (next == reader) {
+			train.readerAt = -1;
+			readTag(Serial1, train);
+			continue;
+		}
+		if (next == tailEnd) {
+			vacate(t);
+			if (train.on.front().first == OUT) {   //all of it is out on the layout
+				leave(t);
+				break;
+			}
+			continue;
+		}
+		if (next == stop) {
+			train.stopPassed = true;
+			if (!held(front)) continue;
+			train.moving = false;
+			train.haltedAt = train.at;
+			narrate("train %02X held at the end of %s", train.tag, legs[front].name);
+			if ((front == T14THROUGH) && train.through) {   //the operator will despatch it in a moment
+				Event go = { train.at + settings.throughReact, THROUGHGO, t, 0, 0 };
+				events.push(go);
+			}
+			break;
+		}
+		Leg ahead = (Leg)route(train, front);
+		train.stopPassed = false;
+		occupy(t, ahead, frontEnd);
+		passed(t, front, ahead);
+		narrate("train %02X into %s", train.tag, legs[ahead].name);
+	}
+	if (train.moving && !train.gone) {
+		schedule(t);
+	}
+}
+
+static void schedule(int t) {
+	//when the moving train next reaches the end of a leg (front or tail) or the reader
+	Train& train = trains[t];
+	double frontEnd = train.on.back().second + legs[train.on.back().first].length;
+	double tailEnd = train.on.front().second + legs[train.on.front().first].length + train.length;
+	double next = std::min(std::min(frontEnd, tailEnd), stopMark(train));
+	if (train.readerAt > train.dist) {
+		next = std::min(next, train.readerAt);
+	}
+	train.seq++;
+	Event e = { train.at + (next - train.dist) / train.speed, FRONT, t, train.seq, 0 };
+	events.push(e);
+}
+
+static void release(double now) {
+	//trains held at a stop go as soon as their relay lets them
+	for (size_t t = 0; t < trains.size(); t++) {
+		Train& train = trains[t];
+		if (train.gone || train.moving || train.on.empty()) continue;
+		Leg front = train.on.back().first;
+		if (held(front)) continue;
+		if ((train.approach >= 0) && (front == stopLeg[train.approach])) {
+			train.waited += now - train.haltedAt;
+		}
+		train.moving = true;
+		train.at = now;
+		narrate("train %02X starts from %s", train.tag, legs[front].name);
+		schedule(t);
+	}
+}
+
+static int newTrain(byte tag, bool fleet) {
+	Train train;
+	train.tag = tag;
+	train.fleet = fleet;
+	train.length = uniform(settings.trainCm[0], settings.trainCm[1]);
+	train.speed = uniform(settings.speed[0], settings.speed[1]);
+	train.dist = 0;
+	train.at = seconds();
+	train.moving = false;
+	train.gone = true;
+	train.seq = 0;
+	train.readerAt = -1;
+	train.from = -1;
+	train.approach = -1;
+	train.arrived = 0;
+	train.waited = 0;
+	train.haltedAt = 0;
+	train.dest = 0;
+	train.requested = false;
+	train.through = false;
+	train.stopPassed = false;
+	trains.push_back(train);
+	return(trains.size() - 1);
+}
+
+static void launch(int approach) {
+	//the next train waiting to come onto an approach does so, if it's clear
+	if (waiting[approach].empty()) return;
+	if (legCount[approachLeg[approach]] || legCount[stopLeg[approach]]) return;
+	int t = waiting[approach].front();
+	waiting[approach].pop_front();
+	Train& train = trains[t];
+	train.gone = false;
+	train.on.clear();
+	train.dist = 0;
+	train.at = seconds();
+	train.moving = true;
+	train.from = approach;
+	train.approach = approach;
+	train.waited = train.at - train.arrived;   //queued behind the train before
+	train.through = false;
+	train.stopPassed = false;
+	train.readerAt = (approach == 3) ? legs[APPENTER].length - settings.readerCm : -1;
+	occupy(t, approachLeg[approach], 0);
+	narrate("train %02X (%.0fcm at %.0fcm/s) arrives on %s", train.tag, train.length, train.speed, approachName[approach]);
+	schedule(t);
+}
+
+
+//================================================================
+//                      The operator
+//================================================================
+
+static byte destination() {
+	double total = settings.destShare[0] + settings.destShare[1] + settings.destShare[2];
+	double pick = uniform(0, total);
+	if (pick < settings.destShare[0]) return(DESTMAIN);
+	if (pick < settings.destShare[0] + settings.destShare[1]) return(DESTGOODS);
+	return(DESTBRANCH);
+}
+
+static void despatch() {
+	//ask for a train standing in a siding to be despatched
+	std::vector<int> candidates;
+	for (size_t t = 0; t < trains.size(); t++) {
+		Train& train = trains[t];
+		if (train.gone || train.moving || train.requested || (train.on.size() != 1)) continue;
+		Leg leg = train.on.back().first;
+		if ((leg >= S1) && (leg <= S8)) {
+			candidates.push_back(t);
+		}
+	}
+	if (candidates.empty()) return;
+	int t = candidates[std::uniform_int_distribution<size_t>(0, candidates.size() - 1)(rng)];
+	Train& train = trains[t];
+	byte siding = train.on.back().first - S1 + 1;
+	byte dest = destination();
+	if (!io.addToQueue(dest | siding)) {
+		measured.refused++;
+		narrate("queue full - no room for S%d", siding);
+		return;
+	}
+	train.requested = true;
+	train.dest = dest;
+	narrate("despatch S%d (train %02X) to %s", siding, train.tag, (dest == DESTMAIN) ? "Main" : ((dest == DESTGOODS) ? "Goods" : "Branch"));
+}
+
+static void despatchThrough(int t) {
+	Train& train = trains[t];
+	if (train.gone || train.moving || train.requested || (train.on.back().first != T14THROUGH)) return;
+	byte dest = destination();
+	if (!io.addToQueue(DESTTHROUGH | dest)) {
+		measured.refused++;
+		Event again = { seconds() + 5, THROUGHGO, t, 0, 0 };   //try again shortly
+		events.push(again);
+		return;
+	}
+	train.requested = true;
+	train.dest = dest;
+	narrate("despatch THROUGH train %02X", train.tag);
+}
+
+//================================================================
+//                      The run
+//================================================================
+
+static void setUp() {
+	//the yard as it is at power-up - trains in their sidings, and the sidings they live in remembered
+	legs[T14THROUGH].length = settings.throughCm;
+	for (int siding = 0; siding < 8; siding++) {
+		legs[S1 + siding].length = settings.sidingCm;
+	}
+	hostSetInput(WESTPIN, LOW);
+	hostToti(DCCTOTI, true);
+	for (int x = 0; x < settings.fleet; x++) {
+		int t = newTrain(0x10 + x, true);
+		Train& train = trains[t];
+		if (x < 8) {
+			EEPROM.cells[STOREDTRAIN + x] = train.tag;
+		}
+		if (x < settings.parked) {
+			train.gone = false;
+			train.length = std::min(train.length, settings.sidingCm);
+			occupy(t, (Leg)(S1 + x), 0);
+			train.dist = settings.sidingCm - STOPCM;   //standing at the stop
+			train.stopPassed = true;
+		}
+		else {
+			Event back = { uniform(0, settings.layoutMinutes * 60), ARRIVE, t, 0, 3 };
+			events.push(back);
+		}
+	}
+	for (int approach = 0; approach < 3; approach++) {
+		if (settings.mergeRate[approach] > 0) {
+			Event first = { exponential(3600 / settings.mergeRate[approach]), ARRIVE, -1, 0, approach };
+			events.push(first);
+		}
+	}
+	if (settings.despatchRate > 0) {
+		Event first = { exponential(3600 / settings.despatchRate), DESPATCH, -1, 0, 0 };
+		events.push(first);
+	}
+}
+
+static void happen(const Event& e) {
+	switch (e.kind) {
+	case ARRIVE: {
+		int t = e.train;
+		if (t < 0) {   //merging traffic - the tag says which approach, for counting
+			t = newTrain((e.approach << 6) | 0x3F, false);
+			Event next = { e.at + exponential(3600 / settings.mergeRate[e.approach]), ARRIVE, -1, 0, e.approach };
+			events.push(next);
+		}
+		trains[t].arrived = e.at;
+		waiting[e.approach].push_back(t);
+		launch(e.approach);
+		break;
+	}
+	case FRONT:
+		if (e.seq == trains[e.train].seq) {
+			advance(e.train, e.at);
+		}
+		break;
+	case DESPATCH: {
+		despatch();
+		Event next = { e.at + exponential(3600 / settings.despatchRate), DESPATCH, -1, 0, 0 };
+		events.push(next);
+		break;
+	}
+	case THROUGHGO:
+		despatchThrough(e.train);
+		break;
+	}
+}
+
+static size_t traceBytes() {
+	//what the recording took, end mark and all
+	if (!measured.serialTrace.empty()) {
+		return(measured.serialTrace.size());
+	}
+	size_t end = EETRACEEND;
+	while ((end > EETRACE) && (EEPROM.cells[end - 1] == 0xFF)) {   //EEPROM started out erased
+		end--;
+	}
+	return(std::min(end - EETRACE + 1, (size_t)(EETRACEEND - EETRACE)));
+}
+
+static bool saveTrace() {
+	trace.stop();
+	FILE* f = fopen(settings.tracePath, "wb");
+	if (!f) {
+		perror(settings.tracePath);
+		return(false);
+	}
+	if (!measured.serialTrace.empty()) {
+		fwrite(measured.serialTrace.data(), 1, measured.serialTrace.size(), f);
+	}
+	else {
+		fwrite(EEPROM.cells, 1, sizeof(EEPROM.cells), f);
+	}
+	fclose(f);
+	return(true);
+}
+
+static void report(double wall) {
+	double hours = (seconds() - measured.started) / 3600;
+	int merged = measured.merged[0] + measured.merged[1] + measured.merged[2];
+	int exited = measured.exited[0] + measured.exited[1] + measured.exited[2];
+	int entered = measured.stored + measured.through;
+	printf("hours=%.2f\n", hours);
+	printf("merged=%d\n", merged);
+	printf("stored=%d\n", measured.stored);
+	printf("through=%d\n", measured.through);
+	printf("through_pct=%.1f\n", entered ? (100.0 * measured.through / entered) : 0.0);
+	printf("exited=%d\n", exited);
+	printf("trains_per_h=%.1f\n", (merged + entered + exited) / hours);
+	for (int approach = 0; approach < 4; approach++) {
+		std::vector<double>& w = measured.waits[approach];
+		double mean = 0, p95 = 0;
+		if (!w.empty()) {
+			std::sort(w.begin(), w.end());
+			for (double x : w) mean += x;
+			mean /= w.size();
+			p95 = w[std::min(w.size() - 1, (size_t)(0.95 * w.size()))];
+		}
+		printf("wait_%s_mean=%.1f\n", approachName[approach], mean);
+		printf("wait_%s_p95=%.1f\n", approachName[approach], p95);
+	}
+	std::vector<double>& r = measured.releases;
+	double mean = 0, p50 = 0, p95 = 0;   //the mean is mostly the trains held for the scissors or an RFID - p50 is the usual one
+	if (!r.empty()) {
+		std::sort(r.begin(), r.end());
+		for (double x : r) mean += x;
+		mean /= r.size();
+		p50 = r[r.size() / 2];
+		p95 = r[std::min(r.size() - 1, (size_t)(0.95 * r.size()))];
+	}
+	printf("t13_stop28_ms_mean=%.1f\n", mean);
+	printf("t13_stop28_ms_p50=%.1f\n", p50);
+	printf("t13_stop28_ms_p95=%.1f\n", p95);
+	printf("exception_merge_s_per_h=%.1f\n", measured.exception[0] / hours);
+	printf("exception_enter_s_per_h=%.1f\n", measured.exception[1] / hours);
+	printf("exception_exit_s_per_h=%.1f\n", measured.exception[2] / hours);
+	printf("eeprom_writes_per_h=%.0f\n", (EEPROM.writes - measured.eepromAtStart) / hours);
+	printf("refused=%d\n", measured.refused);
+	printf("collisions=%d\n", measured.collisions);
+	printf("misroutes=%d\n", measured.misroutes);
+	printf("run_throughs=%d\n", measured.runThroughs);
+	printf("rfid_overruns=%lu\n", Serial1.rxDropped + Serial2.rxDropped);
+	printf("late_interrupts=%lu\n", hostInterruptsLate);
+	if (settings.tracePath) {
+		printf("trace_full=%d\n", measured.traceFull);
+		printf("trace_bytes=%lu\n", (unsigned long)traceBytes());
+	}
+	printf("wall_s=%.1f\n", wall);
+}
+
+int main(int argc, char** argv) {
+	parse(argc, argv);
+	rng.seed(settings.seed);
+	clock_t wallStart = clock();
+
+	setUp();
+	if (settings.verbose && hostLcd) {
+		hostLcd->shown = lcdShown;
+	}
+	if (settings.tracePath) {
+		Serial.sent = serialSent;
+		if (settings.despatchRate > 0) {
+			fprintf(stderr, "yardsim: the trace won't have the despatches in it (--despatch 0 for a replayable run)\n");
+		}
+	}
+	setup();
+	if (settings.stay) {
+		STAYINSTATE = settings.stay;
+	}
+	bool recording = trace.recording();
+	if (settings.tracePath && !recording) {
+		fprintf(stderr, "yardsim: --trace needs the sketch built with TRACEMODE=TRACERECORD\n");
+		return(2);
+	}
+	FILE* transcript = NULL;
+	if (settings.transcriptPath) {
+		transcript = fopen(settings.transcriptPath, "w");
+		if (!transcript) {
+			perror(settings.transcriptPath);
+			return(2);
+		}
+		transcriptStart(transcript);
+	}
+
+	//events were scheduled from time 0 - start them from the end of setup()
+	measured.started = seconds();
+	measured.eepromAtStart = EEPROM.writes;
+	measured.t13At = -1;
+	std::priority_queue<Event> shifted;
+	while (!events.empty()) {
+		Event e = events.top();
+		events.pop();
+		e.at += measured.started;
+		shifted.push(e);
+	}
+	events = shifted;
+
+	double end = measured.started + settings.hours * 3600;
+	State* machine[3] = { &smMerge, &smEnter, &smExit };
+	double last = seconds();
+	unsigned long looked = hostNow();
+	while (seconds() < end) {
+		loop();
+		hostAdvance(settings.loopMicros);
+		measured.loops++;
+		transcriptLoop();
+		if (recording && !trace.recording()) {   //the trace is full - the replay will stop here too
+			transcriptStop();
+			measured.traceFull = true;
+			recording = false;
+		}
+		double now = seconds();
+		for (int m = 0; m < 3; m++) {
+			if ((machine[m]->fetch() & 0x7F) == 10) {
+				measured.exception[m] += now - last;
+			}
+		}
+		last = now;
+		if ((measured.t13At >= 0) && relay(28)) {
+			measured.releases.push_back((now - measured.t13At) * 1000);
+			measured.t13At = -1;
+		}
+		while (!events.empty() && (events.top().at <= now)) {
+			Event e = events.top();
+			events.pop();
+			happen(e);
+		}
+		if (hostNow() - looked >= LOOKMICROS) {
+			looked = hostNow();
+			release(now);
+			for (int approach = 0; approach < 4; approach++) {
+				launch(approach);
+			}
+		}
+	}
+	transcriptStop();
+	if (transcript) {
+		fclose(transcript);
+	}
+	if (settings.tracePath && !saveTrace()) {
+		return(2);
+	}
+	report((double)(clock() - wallStart) / CLOCKS_PER_SEC);
+	return(0);
+}